@@ -1,3 +1,6 @@
+# GCC/Clang only, the SIMD kernels are picked at runtime without it
+option(ENABLE_NATIVE "Tune for the build machine (-march=native)" OFF)
+
 # MSVC flags. Multi-config generator so we only need one setup
 if(CMCC_IS_MSVC)
   target_compile_options(${PROJECT_NAME}
@@ -45,8 +48,7 @@ if(CMCC_IS_GCC)
                                 -fno-omit-frame-pointer>)
   # Flags that we use no matter what the build type is
   target_compile_options(${PROJECT_NAME}
-                         PUBLIC -march=native
-                                -O3
+                         PUBLIC -O3
                                 -Werror
                                 -Wall
                                 -Wextra
@@ -76,6 +78,12 @@ if(CMCC_IS_GCC)
                                 -Wuseless-cast
                                 -Wdouble-promotion
                                 -Wformat=2)
+  # Tune for the build machine only when asked, the SIMD kernels are picked
+  # at runtime so the default binary runs on any x86-64 CPU
+  if(ENABLE_NATIVE)
+    target_compile_options(${PROJECT_NAME} PUBLIC -march=native)
+    message("   -> Using -march=native.")
+  endif()
   # Minimum size, overwrite O3
   target_compile_options(${PROJECT_NAME} PUBLIC $<$<CONFIG:MinSizeRel>:-Os>)
   # Minimum size with debug info
@@ -113,8 +121,7 @@ if(CMCC_IS_CLANG)
                                 -fno-omit-frame-pointer>)
   # Flags that we use no matter what the build type is
   target_compile_options(${PROJECT_NAME}
-                         PUBLIC -march=native
-                                -O3
+                         PUBLIC -O3
                                 -Werror
                                 -Wall
                                 -Wextra
@@ -139,6 +146,12 @@ if(CMCC_IS_CLANG)
                                 -Wnull-dereference
                                 -Wdouble-promotion
                                 -Wformat=2)
+  # Tune for the build machine only when asked, the SIMD kernels are picked
+  # at runtime so the default binary runs on any x86-64 CPU
+  if(ENABLE_NATIVE)
+    target_compile_options(${PROJECT_NAME} PUBLIC -march=native)
+    message("   -> Using -march=native.")
+  endif()
   # Minimum size, overwrite O3
   target_compile_options(${PROJECT_NAME} PUBLIC $<$<CONFIG:MinSizeRel>:-Os>)
   # Minimum size with debug info
@@ -182,8 +195,7 @@ if(CMCC_IS_MINGW-GCC)
                                 -fno-omit-frame-pointer>)
   # Flags that we use no matter what the build type is
   target_compile_options(${PROJECT_NAME}
-                         PUBLIC -march=native
-                                -O3
+                         PUBLIC -O3
                                 -Werror
                                 -Wall
                                 -Wextra
@@ -213,6 +225,12 @@ if(CMCC_IS_MINGW-GCC)
                                 -Wuseless-cast
                                 -Wdouble-promotion
                                 -Wformat=2)
+  # Tune for the build machine only when asked, the SIMD kernels are picked
+  # at runtime so the default binary runs on any x86-64 CPU
+  if(ENABLE_NATIVE)
+    target_compile_options(${PROJECT_NAME} PUBLIC -march=native)
+    message("   -> Using -march=native.")
+  endif()
   # Minimum size, overwrite O3
   target_compile_options(${PROJECT_NAME} PUBLIC $<$<CONFIG:MinSizeRel>:-Os>)
   # Minimum size with debug info
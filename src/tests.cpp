@@ -1,19 +1,49 @@
 // Include everything
+#include "utils/compare.hpp"
+#include "utils/cpu_dispatch.hpp"
+#include "utils/filter.hpp"
 #include "utils/image.hpp"
+#include "utils/image_hash.hpp"
 #include "utils/natcmp.hpp"
+#include "utils/pixel_kernels.hpp"
+#include "utils/pipeline.hpp"
 #include "utils/pixels.hpp"
+#include "utils/planar_pixels.hpp"
+#include "utils/point_ops.hpp"
 #include "utils/quickrng.hpp"
+#include "utils/resize.hpp"
+#include "utils/stats.hpp"
 #include "utils/system.hpp"
 #include "utils/timer.hpp"
+#include "utils/transform.hpp"
 #ifdef _WIN32
 #include "utils/utf8conv_win32.hpp"
 #endif
 #include <iostream>
-/*
 #include "benchmark/benchmark.h"
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Minor page faults of this process so far, always 0 on Windows
+static double page_faults() {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return static_cast<double>(ru.ru_minflt);
+#endif
+}
 
 static void BM_baseline(benchmark::State &s, const char *fn) {
-    const auto jpeg = utils::jpeg(fn);
+    const auto jpeg = utils::JPEG_Read(fn);
     const auto p = jpeg.get_pixels();
     for (auto _ : s) {
         benchmark::DoNotOptimize(utils::pc_rgb_to_gray_dry(p.buf));
@@ -22,7 +52,7 @@ static void BM_baseline(benchmark::State &s, const char *fn) {
 }
 
 static void BM_baseline2(benchmark::State &s, const char *fn) {
-    const auto jpeg = utils::jpeg(fn);
+    const auto jpeg = utils::JPEG_Read(fn);
     const auto p = jpeg.get_pixels();
     for (auto _ : s) {
         benchmark::DoNotOptimize(utils::pc_rgb_to_gray_dry2(p.buf));
@@ -31,7 +61,7 @@ static void BM_baseline2(benchmark::State &s, const char *fn) {
 }
 
 static void BM_to_gray(benchmark::State &s, const char *fn) {
-    const auto jpeg = utils::jpeg(fn);
+    const auto jpeg = utils::JPEG_Read(fn);
     const auto p = jpeg.get_pixels();
     for (auto _ : s) {
         benchmark::DoNotOptimize(utils::pc_rgb_to_gray(p.buf));
@@ -39,8 +69,17 @@ static void BM_to_gray(benchmark::State &s, const char *fn) {
     }
 }
 
+static void BM_to_gray_par(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels();
+    for (auto _ : s) {
+        benchmark::DoNotOptimize(utils::pc_rgb_to_gray(p.buf, true));
+        benchmark::ClobberMemory();
+    }
+}
+
 static void BM_to_gray2(benchmark::State &s, const char *fn) {
-    const auto jpeg = utils::jpeg(fn);
+    const auto jpeg = utils::JPEG_Read(fn);
     const auto p = jpeg.get_pixels();
     for (auto _ : s) {
         benchmark::DoNotOptimize(utils::pc_rgb_to_gray2(p.buf));
@@ -48,19 +87,1245 @@ static void BM_to_gray2(benchmark::State &s, const char *fn) {
     }
 }
 
-int main(int argc, char **argv) {
-    if (argc <= 1) {
-        std::cout << "Nothing to do!\n";
+// Center crop of half the image converted to GRAY, copying the crop into its
+// own Pixels first vs converting straight out of a view
+static void BM_crop_gray_copy(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto w = p.width() / 2;
+    const auto h = p.height() / 2;
+    const auto v = p.cview().sub(w / 2, h / 2, w, h);
+    for (auto _ : s) {
+        utils::Pixels crop{utils::Pixel_Format::RGB, w, h};
+        auto *dst = crop.buf.data();
+        for (int y = 0; y < h; ++y, dst += v.row_bytes()) {
+            std::memcpy(dst, v.row(y), v.row_bytes());
+        }
+        crop.convert_to(utils::Pixel_Format::GRAY);
+        benchmark::DoNotOptimize(crop.buf.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+static void BM_crop_gray_view(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto w = p.width() / 2;
+    const auto h = p.height() / 2;
+    const auto v = p.cview().sub(w / 2, h / 2, w, h);
+    for (auto _ : s) {
+        const utils::Pixels crop{v, utils::Pixel_Format::GRAY};
+        benchmark::DoNotOptimize(crop.buf.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Allocates a buffer for a decoded RGBA image and fills it once, like a
+// decoder would. bytes_t zeroes everything first, pixel_buf_t does not.
+template <class Buf>
+static void BM_pixel_alloc(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGBA);
+    const auto faults = page_faults();
+    for (auto _ : s) {
+        Buf buf(p.buf.size());
+        std::memcpy(buf.data(), p.buf.data(), buf.size());
+        benchmark::DoNotOptimize(buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.counters["faults"] = benchmark::Counter(
+        page_faults() - faults, benchmark::Counter::kAvgIterations);
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Decodes the same image over and over, as a batch job would, with the
+// pixel buffer pool on or off
+static void BM_decode_pool(benchmark::State &s, const char *fn,
+                           const bool pooled) {
+    auto &pool = utils::Pixel_Pool::instance();
+    const auto old_max = pool.max_bytes();
+    pool.set_max_bytes(pooled ? utils::Pixel_Pool::DEFAULT_MAX_BYTES : 0);
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto before = pool.stats();
+    const auto faults = page_faults();
+    for (auto _ : s) {
+        const auto p = jpeg.get_pixels();
+        benchmark::DoNotOptimize(p.buf.data());
+        benchmark::ClobberMemory();
+    }
+    const auto after = pool.stats();
+    s.counters["faults"] = benchmark::Counter(
+        page_faults() - faults, benchmark::Counter::kAvgIterations);
+    s.counters["hits"] = static_cast<double>(after.hits - before.hits);
+    s.counters["misses"] = static_cast<double>(after.misses - before.misses);
+    pool.set_max_bytes(old_max);
+}
+
+// Splits RGB into planes and merges them back
+static void BM_planar_roundtrip(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    utils::Planar_Pixels pl{p.format(), p.width(), p.height()};
+    utils::Pixels dst{p.format(), p.width(), p.height()};
+    for (auto _ : s) {
+        pl.deinterleave_from(p.cview());
+        pl.interleave_to(dst.view());
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// GRAY from planes, no de-interleaving shuffles needed
+static void BM_planar_gray(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto pl = jpeg.get_planar(utils::Pixel_Format::RGB);
+    for (auto _ : s) {
+        benchmark::DoNotOptimize(pl.to_gray().buf.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Halves RGB with Lanczos3, one 2D filter evaluated in double precision for
+// every output pixel, as a reference for the separable engine below
+static void BM_resize_naive(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto sw = p.width();
+    const auto sh = p.height();
+    utils::Pixels dst{p.format(), sw / 2, sh / 2};
+    const auto lanczos3 = [](const double x) {
+        return utils::detail::resize_kernel(utils::Resize_Filter::Lanczos3, x);
+    };
+    for (auto _ : s) {
+        auto *out = dst.buf.data();
+        for (int oy = 0; oy < dst.height(); ++oy) {
+            const auto cy = (oy + 0.5) * 2.0;
+            for (int ox = 0; ox < dst.width(); ++ox) {
+                const auto cx = (ox + 0.5) * 2.0;
+                double acc[3] = {0.0, 0.0, 0.0};
+                double sum = 0.0;
+                for (auto y = static_cast<int>(cy) - 6; y <= cy + 6; ++y) {
+                    const auto ky = lanczos3((y + 0.5 - cy) / 2.0);
+                    const auto *row = p.buf.data() +
+                                      static_cast<size_t>(std::clamp(
+                                          y, 0, sh - 1)) *
+                                          static_cast<size_t>(sw) * 3;
+                    for (auto x = static_cast<int>(cx) - 6; x <= cx + 6; ++x) {
+                        const auto k = ky * lanczos3((x + 0.5 - cx) / 2.0);
+                        const auto *px =
+                            row + static_cast<size_t>(std::clamp(x, 0, sw - 1)) *
+                                      3;
+                        acc[0] += k * px[0];
+                        acc[1] += k * px[1];
+                        acc[2] += k * px[2];
+                        sum += k;
+                    }
+                }
+                for (const auto a : acc) {
+                    *out++ = static_cast<uint8_t>(
+                        std::clamp(std::lround(a / sum), 0L, 255L));
+                }
+            }
+        }
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Resizes RGB to 1/div of its size with the separable engine
+static void BM_resize(benchmark::State &s, const char *fn,
+                      const utils::Resize_Filter filter, const int div,
+                      const bool parallel) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    utils::Pixels dst{p.format(), p.width() / div, p.height() / div};
+    const utils::Resize_Opts opts{filter, parallel};
+    for (auto _ : s) {
+        utils::resize(p.cview(), dst.view(), opts);
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// QA statistics of RGB the old way, one scalar pass per statistic
+static void BM_stats_naive(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto n = p.buf.size();
+    for (auto _ : s) {
+        uint8_t mn[3] = {255, 255, 255};
+        uint8_t mx[3] = {0, 0, 0};
+        uint64_t sum[3] = {0, 0, 0};
+        uint64_t hist[3][256] = {};
+        for (size_t i = 0; i < n; ++i) {
+            mn[i % 3] = std::min(mn[i % 3], p.buf[i]);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            mx[i % 3] = std::max(mx[i % 3], p.buf[i]);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            sum[i % 3] += p.buf[i];
+        }
+        for (size_t i = 0; i < n; ++i) {
+            ++hist[i % 3][p.buf[i]];
+        }
+        benchmark::DoNotOptimize(mn);
+        benchmark::DoNotOptimize(mx);
+        benchmark::DoNotOptimize(sum);
+        benchmark::DoNotOptimize(hist);
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(n));
+}
+
+static void BM_stats(benchmark::State &s, const char *fn,
+                     const utils::Stats_Opts opts) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    for (auto _ : s) {
+        benchmark::DoNotOptimize(utils::pixel_stats(p.cview(), opts));
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// RGBA with an alpha ramp, like a PNG overlay with soft edges
+static utils::Pixels overlay_pixels(const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    auto p = jpeg.get_pixels(utils::Pixel_Format::RGBA);
+    for (size_t i = 3; i < p.buf.size(); i += 4) {
+        p.buf[i] = static_cast<uint8_t>(i >> 4);
+    }
+    return p;
+}
+
+// Flattens RGBA onto white into an RGB buffer with a single kernel
+static void BM_flatten_kernel(benchmark::State &s, const char *fn,
+                              utils::kernels::over_solid_fn_t kernel) {
+    const auto p = overlay_pixels(fn);
+    const auto n = p.buf.size() / 4;
+    utils::pixel_buf_t dst(n * 3);
+    for (auto _ : s) {
+        kernel(p.buf.data(), dst.data(), n, 255, 255, 255, false, 3);
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Composites the overlay onto an opaque RGB image of the same size
+static void BM_composite(benchmark::State &s, const char *fn,
+                         const bool premultiplied) {
+    auto p = overlay_pixels(fn);
+    if (premultiplied) {
+        p.premultiply();
+    }
+    const utils::Pixels base{p.cview(), utils::Pixel_Format::RGB};
+    auto dst = base;
+    for (auto _ : s) {
+        utils::composite_over(p.cview(), dst.view(), p.alpha_mode());
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Decodes into 512x512 tiles through libjpeg's scanline API and converts
+// them to GRAY, what huge images go through instead of get_pixels()
+static void BM_decode_tiled(benchmark::State &s, const char *fn,
+                            const bool parallel) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    utils::Pixel_Convert_Opts opts{};
+    opts.parallel = parallel;
+    for (auto _ : s) {
+        auto t = jpeg.get_tiled(utils::Pixel_Format::RGB);
+        t.convert_to(utils::Pixel_Format::GRAY, opts);
+        benchmark::DoNotOptimize(t.tile(0, 0).data());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Statistics streamed over the tiles of a decoded image, on the heap or in
+// a scratch file with a small tile cache
+static void BM_stats_tiled(benchmark::State &s, const char *fn,
+                           const bool scratch) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    utils::Tiled_Opts topts{};
+    topts.scratch_dir = scratch ? "/tmp" : "";
+    topts.cache_tiles = 16;
+    const auto t = jpeg.get_tiled(utils::Pixel_Format::RGB, topts);
+    for (auto _ : s) {
+        benchmark::DoNotOptimize(utils::pixel_stats(t).pixels);
+    }
+    s.SetBytesProcessed(s.iterations() *
+                        static_cast<int64_t>(t.size_bytes()));
+}
+
+// Runs a single RGB -> GRAY kernel into a preallocated buffer
+// The result is checked against the double precision reference first
+static void BM_gray_kernel(benchmark::State &s, const char *fn,
+                           utils::kernels::gray_kernel_t kernel) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto n = p.buf.size() / 3;
+    utils::bytes_t ref(n);
+    utils::bytes_t dst(n);
+    utils::kernels::rgb_to_gray_ref(p.buf.data(), ref.data(), n);
+    kernel(p.buf.data(), dst.data(), n);
+    const auto g = utils::Pixel_Format::GRAY;
+    const utils::Const_Pixels_View want{ref.data(), g, p.width(), p.height()};
+    const utils::Const_Pixels_View got{dst.data(), g, p.width(), p.height()};
+    const auto cmp = utils::compare_pixels(want, got, {1, 0, false, false});
+    if (!cmp.is_match()) {
+        s.SkipWithError("Kernel does not match the reference!");
+        return;
+    }
+    for (auto _ : s) {
+        kernel(p.buf.data(), dst.data(), n);
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Levels, gamma and a curve as most editors would run them, pow per byte
+static void BM_point_ops_naive(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    utils::bytes_t dst(p.buf.size());
+    for (auto _ : s) {
+        for (size_t i = 0; i < p.buf.size(); ++i) {
+            auto v = std::clamp((p.buf[i] - 16.0) / (235.0 - 16.0), 0.0, 1.0);
+            v = std::pow(v, 1.0 / 1.8);
+            v = 1.0 - v;
+            dst[i] = static_cast<uint8_t>(std::lround(v * 255.0));
+        }
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// The same chain compiled into one table, applied with a single kernel
+// The result is checked against a plain table lookup first
+static void BM_lut_kernel(benchmark::State &s, const char *fn,
+                          utils::kernels::lut_fn_t kernel) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto lut =
+        utils::Point_Ops{}.levels(16, 235).gamma(1.8).invert().compile();
+    utils::bytes_t dst(p.buf.size());
+    kernel(p.buf.data(), dst.data(), p.buf.size(), lut.lut(), false);
+    for (size_t i = 0; i < p.buf.size(); ++i) {
+        if (dst[i] != lut[p.buf[i]]) {
+            s.SkipWithError("Kernel does not match the table!");
+            return;
+        }
+    }
+    for (auto _ : s) {
+        kernel(p.buf.data(), dst.data(), p.buf.size(), lut.lut(), false);
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// RGB and a slightly gamma adjusted copy of it
+static std::pair<utils::Pixels, utils::Pixels> compare_pair(const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    auto a = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    auto b = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    utils::Point_Ops ops;
+    ops.gamma(1.05);
+    utils::apply_lut(b.view(), ops.compile());
+    return {std::move(a), std::move(b)};
+}
+
+// Error metrics of RGB against a gamma adjusted copy, one scalar pass
+static void BM_compare_naive(benchmark::State &s, const char *fn) {
+    const auto [a, b] = compare_pair(fn);
+    const auto n = a.buf.size();
+    for (auto _ : s) {
+        uint64_t sse = 0;
+        int mx = 0;
+        uint64_t diff = 0;
+        for (size_t i = 0; i < n; i += 3) {
+            bool differs = false;
+            for (size_t c = 0; c < 3; ++c) {
+                const auto d = std::abs(a.buf[i + c] - b.buf[i + c]);
+                sse += static_cast<uint64_t>(d * d);
+                mx = std::max(mx, d);
+                differs |= d > 0;
+            }
+            diff += differs;
+        }
+        benchmark::DoNotOptimize(sse);
+        benchmark::DoNotOptimize(mx);
+        benchmark::DoNotOptimize(diff);
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(n));
+}
+
+static void BM_compare(benchmark::State &s, const char *fn,
+                       const utils::Compare_Opts opts) {
+    const auto [a, b] = compare_pair(fn);
+    for (auto _ : s) {
+        benchmark::DoNotOptimize(
+            utils::compare_pixels(a.cview(), b.cview(), opts));
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(a.buf.size()));
+}
+
+// RGB -> GRAY with the luma weights applied to linear light
+static void BM_gray_linear(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto n = p.buf.size() / 3;
+    utils::bytes_t dst(n);
+    for (auto _ : s) {
+        utils::kernels::rgb_to_gray_linear<3>(p.buf.data(), dst.data(), n);
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Gaussian blur with sigma 2 in double precision, a 2D reference evaluated
+// as two plain separable passes
+static void BM_blur_naive(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    const auto w = p.width();
+    const auto h = p.height();
+    const auto rb = static_cast<size_t>(w) * 3;
+    constexpr int r = 6;
+    double k[2 * r + 1];
+    double sum = 0.0;
+    for (int i = -r; i <= r; ++i) {
+        k[i + r] = std::exp(-(i * i) / 8.0);
+        sum += k[i + r];
+    }
+    std::vector<double> tmp(p.buf.size());
+    utils::bytes_t dst(p.buf.size());
+    for (auto _ : s) {
+        for (int y = 0; y < h; ++y) {
+            const auto *row = p.buf.data() + static_cast<size_t>(y) * rb;
+            for (int x = 0; x < w; ++x) {
+                for (size_t c = 0; c < 3; ++c) {
+                    double acc = 0.0;
+                    for (int i = -r; i <= r; ++i) {
+                        const auto xi =
+                            static_cast<size_t>(std::clamp(x + i, 0, w - 1));
+                        acc += k[i + r] * row[xi * 3 + c];
+                    }
+                    tmp[static_cast<size_t>(y) * rb +
+                        static_cast<size_t>(x) * 3 + c] = acc / sum;
+                }
+            }
+        }
+        for (int y = 0; y < h; ++y) {
+            for (size_t x = 0; x < rb; ++x) {
+                double acc = 0.0;
+                for (int i = -r; i <= r; ++i) {
+                    const auto yi =
+                        static_cast<size_t>(std::clamp(y + i, 0, h - 1));
+                    acc += k[i + r] * tmp[yi * rb + x];
+                }
+                dst[static_cast<size_t>(y) * rb + x] =
+                    static_cast<uint8_t>(std::lround(acc / sum));
+            }
+        }
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+static void BM_gaussian_blur(benchmark::State &s, const char *fn,
+                             const double sigma, const bool parallel) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    utils::Pixels dst{p.format(), p.width(), p.height()};
+    for (auto _ : s) {
+        utils::gaussian_blur(p.cview(), dst.view(), sigma, parallel);
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Same time for any radius
+static void BM_box_blur(benchmark::State &s, const char *fn,
+                        const int radius) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    utils::Pixels dst{p.format(), p.width(), p.height()};
+    for (auto _ : s) {
+        utils::box_blur(p.cview(), dst.view(), radius);
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Pre-OCR clean up on GRAY: unsharp mask and edges
+static void BM_sharpen(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::GRAY);
+    utils::Pixels dst{p.format(), p.width(), p.height()};
+    utils::Sharpen_Opts opts{};
+    opts.amount = 1.5;
+    opts.threshold = 2;
+    for (auto _ : s) {
+        utils::sharpen(p.cview(), dst.view(), opts);
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+static void BM_edge_detect(benchmark::State &s, const char *fn,
+                           const utils::Edge_Filter filter) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::GRAY);
+    utils::Pixels dst{p.format(), p.width(), p.height()};
+    for (auto _ : s) {
+        utils::edge_detect(p.cview(), dst.view(), filter);
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Clockwise rotation one pixel at a time, reading src down the columns
+static void BM_rotate_naive(benchmark::State &s, const char *fn,
+                            const utils::Pixel_Format fmt) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(fmt);
+    const auto w = static_cast<size_t>(p.width());
+    const auto h = static_cast<size_t>(p.height());
+    const auto comps = static_cast<size_t>(utils::pxfmt_components(fmt));
+    utils::bytes_t dst(p.buf.size());
+    for (auto _ : s) {
+        for (size_t y = 0; y < w; ++y) {
+            auto *out = dst.data() + y * h * comps;
+            for (size_t x = 0; x < h; ++x, out += comps) {
+                std::memcpy(out, p.buf.data() + ((h - 1 - x) * w + y) * comps,
+                            comps);
+            }
+        }
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+static void BM_transform(benchmark::State &s, const char *fn,
+                         const utils::Pixel_Format fmt,
+                         const utils::Orientation o, const bool parallel) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(fmt);
+    const auto swap = utils::orientation_swaps_axes(o);
+    utils::Pixels dst{fmt, swap ? p.height() : p.width(),
+                      swap ? p.width() : p.height()};
+    for (auto _ : s) {
+        utils::transform(p.cview(), dst.view(), o, parallel);
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// 8 <-> 16 bits one component at a time with a divide for the way down
+static void BM_depth_naive(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+    std::vector<uint16_t> wide(p.buf.size());
+    utils::bytes_t narrow(p.buf.size());
+    for (auto _ : s) {
+        for (size_t i = 0; i < p.buf.size(); ++i) {
+            wide[i] = static_cast<uint16_t>(p.buf[i] * 257);
+        }
+        for (size_t i = 0; i < wide.size(); ++i) {
+            narrow[i] = static_cast<uint8_t>((wide[i] + 128) / 257);
+        }
+        benchmark::DoNotOptimize(narrow.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// src -> dst -> src through Pixels views
+static void BM_depth_roundtrip(benchmark::State &s, const char *fn,
+                               const utils::Pixel_Format src_fmt,
+                               const utils::Pixel_Format dst_fmt) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels(src_fmt);
+    utils::Pixels wide{dst_fmt, p.width(), p.height()};
+    utils::Pixels back{src_fmt, p.width(), p.height()};
+    for (auto _ : s) {
+        utils::convert_view(p.cview(), wide.view());
+        utils::convert_view(wide.cview(), back.view());
+        benchmark::DoNotOptimize(back.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+static void BM_convert16(benchmark::State &s, const char *fn,
+                         const utils::Pixel_Format src_fmt,
+                         const utils::Pixel_Format dst_fmt) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    auto p = jpeg.get_pixels();
+    p.convert_to(src_fmt);
+    utils::Pixels dst{dst_fmt, p.width(), p.height()};
+    for (auto _ : s) {
+        utils::convert_view(p.cview(), dst.view());
+        benchmark::DoNotOptimize(dst.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() * static_cast<int64_t>(p.buf.size()));
+}
+
+// Crop, convert to gray, a gamma LUT and a 2x downscale, one full pass and
+// buffer per step or all of them fused
+static void BM_pipeline(benchmark::State &s, const char *fn,
+                        const bool fused) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto p = jpeg.get_pixels();
+    const auto cw = p.width() * 3 / 4;
+    const auto ch = p.height() * 3 / 4;
+    const auto crop = p.cview().sub(p.width() / 8, p.height() / 8, cw, ch);
+    utils::Point_Ops ops;
+    ops.gamma(2.2);
+    const auto lut = ops.compile();
+    for (auto _ : s) {
+        if (fused) {
+            auto out = utils::Pixels_Pipeline{crop}
+                           .convert_to(utils::Pixel_Format::GRAY)
+                           .apply_lut(lut)
+                           .downscale_2x()
+                           .run();
+            benchmark::DoNotOptimize(out.buf.data());
+        } else {
+            utils::Pixels cropped{crop.format(), cw, ch};
+            utils::convert_view(crop, cropped.view());
+            cropped.convert_to(utils::Pixel_Format::GRAY);
+            utils::apply_lut(cropped.view(), lut);
+            auto out = utils::resize(cropped.cview(), cw / 2, ch / 2,
+                                     {utils::Resize_Filter::Box, false});
+            benchmark::DoNotOptimize(out.buf.data());
+        }
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() *
+                        static_cast<int64_t>(crop.row_bytes()) * ch);
+}
+
+// 256 px preview from a full decode or from a decode at the smallest IDCT
+// scale that is still larger, both resized down with Lanczos3
+static void BM_decode_preview(benchmark::State &s, const char *fn,
+                              const bool scaled) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto scale = 256.0 / std::max(jpeg.width(), jpeg.height());
+    const auto w = std::max(1, static_cast<int>(jpeg.width() * scale));
+    const auto h = std::max(1, static_cast<int>(jpeg.height() * scale));
+    for (auto _ : s) {
+        const auto p = scaled ? jpeg.get_pixels(utils::Pixel_Format::RGB, w, h)
+                              : jpeg.get_pixels(utils::Pixel_Format::RGB);
+        auto out = utils::resize(p.cview(), w, h);
+        benchmark::DoNotOptimize(out.buf.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Previews decoded from one shared reader on every pool thread at once,
+// each thread with its own TurboJPEG handle
+static void BM_decode_shared(benchmark::State &s, const char *fn) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    auto &pool = utils::shared_thread_pool();
+    const auto n = pool.concurrency() * 4;
+    for (auto _ : s) {
+        pool.parallel_for(n, [&](const size_t) {
+            const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB, 256, 256);
+            benchmark::DoNotOptimize(p.buf.data());
+        });
+    }
+    s.SetItemsProcessed(s.iterations() * static_cast<int64_t>(n));
+}
+
+// Decode, resize and encode of a 256 px preview as a thumbnail service runs
+// it, with one writer (and output buffer) reused or a new one every time
+static void BM_encode_preview(benchmark::State &s, const char *fn,
+                              const bool reuse) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    const auto scale = 256.0 / std::max(jpeg.width(), jpeg.height());
+    const auto w = std::max(1, static_cast<int>(jpeg.width() * scale));
+    const auto h = std::max(1, static_cast<int>(jpeg.height() * scale));
+    utils::JPEG_Write shared{{85, TJSAMP_420, true}};
+    for (auto _ : s) {
+        const auto p = jpeg.get_pixels(utils::Pixel_Format::RGB, w, h);
+        const auto out = utils::resize(p.cview(), w, h);
+        if (reuse) {
+            shared.encode(out.cview());
+            benchmark::DoNotOptimize(shared.data());
+        } else {
+            utils::JPEG_Write writer{{85, TJSAMP_420, true}};
+            writer.encode(out.cview());
+            benchmark::DoNotOptimize(writer.data());
+        }
+    }
+}
+
+// Grayscale for OCR or hashing: RGB converted afterwards, TurboJPEG's GRAY
+// output or the luma plane without any colour conversion
+enum class Gray_Decode { Via_RGB, Gray, Luma };
+static void BM_decode_gray(benchmark::State &s, const char *fn,
+                           const Gray_Decode mode) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    for (auto _ : s) {
+        utils::Pixels p{};
+        switch (mode) {
+        case Gray_Decode::Via_RGB:
+            p = jpeg.get_pixels(utils::Pixel_Format::RGB);
+            p.convert_to(utils::Pixel_Format::GRAY);
+            break;
+        case Gray_Decode::Gray:
+            p = jpeg.get_pixels(utils::Pixel_Format::GRAY);
+            break;
+        case Gray_Decode::Luma:
+        default:
+            p = jpeg.get_luma();
+            break;
+        }
+        benchmark::DoNotOptimize(p.buf.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetItemsProcessed(s.iterations() * jpeg.width() * jpeg.height());
+}
+
+// Width, height and subsampling for an index, from a reader that loads the
+// whole file or from the header probe
+static void BM_probe(benchmark::State &s, const char *fn, const bool probe) {
+    for (auto _ : s) {
+        if (probe) {
+            const auto info = utils::jpeg_probe(fn);
+            benchmark::DoNotOptimize(info.width);
+        } else {
+            const auto jpeg = utils::JPEG_Read(fn);
+            benchmark::DoNotOptimize(jpeg.width());
+        }
+    }
+}
+
+// Perceptual hash from a full decode or from a decode at the IDCT scale
+// that is just large enough
+static void BM_image_hash(benchmark::State &s, const char *fn,
+                          const bool scaled) {
+    const auto jpeg = utils::JPEG_Read(fn);
+    for (auto _ : s) {
+        if (scaled) {
+            benchmark::DoNotOptimize(jpeg.get_hash());
+        } else {
+            const auto p = jpeg.get_pixels(utils::Pixel_Format::GRAY);
+            benchmark::DoNotOptimize(utils::perceptual_hash(p.cview()));
+        }
+    }
+}
+
+// 1M hashes searched for the ones within 10 bits of the image's hash
+static void BM_hash_search(benchmark::State &s, const char *fn,
+                           utils::kernels::hamming_mask_fn_t kernel) {
+    const auto q = utils::JPEG_Read(fn).get_hash();
+    std::mt19937_64 rng{42};
+    std::vector<uint64_t> hashes(1 << 20);
+    for (auto &h : hashes) {
+        h = rng();
+    }
+    std::vector<uint64_t> mask(hashes.size() / 64);
+    for (auto _ : s) {
+        kernel(hashes.data(), hashes.size(), q, 10, mask.data());
+        benchmark::DoNotOptimize(mask.data());
+        benchmark::ClobberMemory();
+    }
+    s.SetBytesProcessed(s.iterations() *
+                        static_cast<int64_t>(hashes.size() * 8));
+}
+
+static int run_benchmarks(int argc, char **argv) {
+    if (argc <= 2) {
+        std::cout << "Usage: " << argv[0] << " --bench <image.jpg>\n";
         return 0;
     }
-    benchmark::RegisterBenchmark("BASELINE I0", &BM_baseline, argv[1]);
-    benchmark::RegisterBenchmark("BASELINE IS", &BM_baseline2, argv[1]);
-    benchmark::RegisterBenchmark("DOUBLE CALC", &BM_to_gray, argv[1]);
-    benchmark::RegisterBenchmark("SIMPLE AVG", &BM_to_gray2, argv[1]);
+    const char *fn = argv[2];
+    benchmark::RegisterBenchmark("BASELINE I0", &BM_baseline, fn);
+    benchmark::RegisterBenchmark("BASELINE IS", &BM_baseline2, fn);
+    benchmark::RegisterBenchmark("PC_RGB_TO_GRAY", &BM_to_gray, fn);
+    benchmark::RegisterBenchmark("PC_RGB_TO_GRAY PARALLEL", &BM_to_gray_par,
+                                 fn)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("SIMPLE AVG", &BM_to_gray2, fn);
+    benchmark::RegisterBenchmark("CROP GRAY COPY", &BM_crop_gray_copy, fn);
+    benchmark::RegisterBenchmark("CROP GRAY VIEW", &BM_crop_gray_view, fn);
+    benchmark::RegisterBenchmark("ALLOC FILL BYTES_T",
+                                 &BM_pixel_alloc<utils::bytes_t>, fn);
+    benchmark::RegisterBenchmark("ALLOC FILL PIXEL_BUF_T",
+                                 &BM_pixel_alloc<utils::pixel_buf_t>, fn);
+    benchmark::RegisterBenchmark("DECODE UNPOOLED", &BM_decode_pool, fn,
+                                 false);
+    benchmark::RegisterBenchmark("DECODE POOLED", &BM_decode_pool, fn, true);
+    benchmark::RegisterBenchmark("PLANAR ROUNDTRIP", &BM_planar_roundtrip, fn);
+    benchmark::RegisterBenchmark("PLANAR GRAY", &BM_planar_gray, fn);
+    benchmark::RegisterBenchmark("RESIZE NAIVE LANCZOS3 1/2",
+                                 &BM_resize_naive, fn);
+    benchmark::RegisterBenchmark("RESIZE LANCZOS3 1/2", &BM_resize, fn,
+                                 utils::Resize_Filter::Lanczos3, 2, false);
+    benchmark::RegisterBenchmark("RESIZE LANCZOS3 1/2 PARALLEL", &BM_resize,
+                                 fn, utils::Resize_Filter::Lanczos3, 2, true)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("RESIZE LANCZOS3 1/8", &BM_resize, fn,
+                                 utils::Resize_Filter::Lanczos3, 8, false);
+    benchmark::RegisterBenchmark("RESIZE BILINEAR 1/2", &BM_resize, fn,
+                                 utils::Resize_Filter::Bilinear, 2, false);
+    benchmark::RegisterBenchmark("RESIZE BOX 1/2 (DOWNSCALE 2X)", &BM_resize,
+                                 fn, utils::Resize_Filter::Box, 2, false);
+    benchmark::RegisterBenchmark("STATS NAIVE", &BM_stats_naive, fn);
+    benchmark::RegisterBenchmark("STATS", &BM_stats, fn,
+                                 utils::Stats_Opts{true, false});
+    benchmark::RegisterBenchmark("STATS PARALLEL", &BM_stats, fn,
+                                 utils::Stats_Opts{true, true})
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("STATS NO HISTOGRAM", &BM_stats, fn,
+                                 utils::Stats_Opts{false, false});
+    benchmark::RegisterBenchmark("FLATTEN SCALAR", &BM_flatten_kernel, fn,
+                                 &utils::kernels::over_solid_scalar);
+    benchmark::RegisterBenchmark("FLATTEN DISPATCHED", &BM_flatten_kernel, fn,
+                                 &utils::kernels::over_solid);
+    benchmark::RegisterBenchmark("COMPOSITE STRAIGHT", &BM_composite, fn,
+                                 false);
+    benchmark::RegisterBenchmark("COMPOSITE PREMULTIPLIED", &BM_composite, fn,
+                                 true);
+    benchmark::RegisterBenchmark("DECODE TILED TO GRAY", &BM_decode_tiled,
+                                 fn, false);
+    benchmark::RegisterBenchmark("DECODE TILED TO GRAY PARALLEL",
+                                 &BM_decode_tiled, fn, true)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("STATS TILED HEAP", &BM_stats_tiled, fn,
+                                 false);
+    benchmark::RegisterBenchmark("STATS TILED SCRATCH FILE", &BM_stats_tiled,
+                                 fn, true);
+    benchmark::RegisterBenchmark("GRAY DOUBLE CALC", &BM_gray_kernel, fn,
+                                 &utils::kernels::rgb_to_gray_ref);
+    benchmark::RegisterBenchmark("GRAY FIXED SCALAR", &BM_gray_kernel, fn,
+                                 &utils::kernels::rgb_to_gray_scalar);
+#if UTILS_ARCH_X86
+    // Only register the kernels this CPU (or UTILS_CPU_TIER) allows
+    const auto tier = utils::cpu_tier();
+    if (tier >= utils::Cpu_Tier::SSE4_1) {
+        benchmark::RegisterBenchmark("GRAY FIXED SSSE3", &BM_gray_kernel, fn,
+                                     &utils::kernels::rgb_to_gray_sse);
+    }
+    if (tier >= utils::Cpu_Tier::AVX2) {
+        benchmark::RegisterBenchmark("GRAY FIXED AVX2", &BM_gray_kernel, fn,
+                                     &utils::kernels::rgb_to_gray_avx2);
+    }
+    if (tier >= utils::Cpu_Tier::AVX512BW) {
+        benchmark::RegisterBenchmark("GRAY FIXED AVX512BW", &BM_gray_kernel,
+                                     fn, &utils::kernels::rgb_to_gray_avx512);
+    }
+#endif
+    benchmark::RegisterBenchmark("GRAY DISPATCHED", &BM_gray_kernel, fn,
+                                 &utils::kernels::rgb_to_gray);
+    benchmark::RegisterBenchmark("GRAY LINEAR LUMA", &BM_gray_linear, fn);
+    benchmark::RegisterBenchmark("COMPARE NAIVE", &BM_compare_naive, fn);
+    benchmark::RegisterBenchmark("COMPARE", &BM_compare, fn,
+                                 utils::Compare_Opts{});
+    benchmark::RegisterBenchmark("COMPARE PARALLEL", &BM_compare, fn,
+                                 utils::Compare_Opts{0, UINT64_MAX, false,
+                                                     true})
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("COMPARE FIRST DIFFERENCE", &BM_compare, fn,
+                                 utils::Compare_Opts{0, 0, false, false});
+    benchmark::RegisterBenchmark("COMPARE SSIM", &BM_compare, fn,
+                                 utils::Compare_Opts{0, UINT64_MAX, true,
+                                                     false});
+    benchmark::RegisterBenchmark("POINT OPS NAIVE POW", &BM_point_ops_naive,
+                                 fn);
+    benchmark::RegisterBenchmark("LUT SCALAR", &BM_lut_kernel, fn,
+                                 &utils::kernels::lut_apply_scalar);
+#if UTILS_ARCH_X86
+    if (tier >= utils::Cpu_Tier::SSE4_1) {
+        benchmark::RegisterBenchmark("LUT SSE4.1", &BM_lut_kernel, fn,
+                                     &utils::kernels::lut_apply_sse);
+    }
+    if (tier >= utils::Cpu_Tier::AVX2) {
+        benchmark::RegisterBenchmark("LUT AVX2", &BM_lut_kernel, fn,
+                                     &utils::kernels::lut_apply_avx2);
+    }
+    if (tier >= utils::Cpu_Tier::AVX512BW) {
+        benchmark::RegisterBenchmark("LUT AVX512BW", &BM_lut_kernel, fn,
+                                     &utils::kernels::lut_apply_avx512);
+    }
+    if (utils::cpu_has_avx512vbmi()) {
+        benchmark::RegisterBenchmark("LUT AVX512VBMI", &BM_lut_kernel, fn,
+                                     &utils::kernels::lut_apply_vbmi);
+    }
+#endif
+    benchmark::RegisterBenchmark("LUT DISPATCHED", &BM_lut_kernel, fn,
+                                 &utils::kernels::lut_apply);
+    benchmark::RegisterBenchmark("BLUR NAIVE GAUSSIAN 2", &BM_blur_naive, fn);
+    benchmark::RegisterBenchmark("BLUR GAUSSIAN 2", &BM_gaussian_blur, fn, 2.0,
+                                 false);
+    benchmark::RegisterBenchmark("BLUR GAUSSIAN 2 PARALLEL",
+                                 &BM_gaussian_blur, fn, 2.0, true)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("BLUR GAUSSIAN 8", &BM_gaussian_blur, fn, 8.0,
+                                 false);
+    benchmark::RegisterBenchmark("BLUR BOX 2", &BM_box_blur, fn, 2);
+    benchmark::RegisterBenchmark("BLUR BOX 50", &BM_box_blur, fn, 50);
+    benchmark::RegisterBenchmark("SHARPEN GRAY", &BM_sharpen, fn);
+    benchmark::RegisterBenchmark("EDGES SOBEL GRAY", &BM_edge_detect, fn,
+                                 utils::Edge_Filter::Sobel);
+    benchmark::RegisterBenchmark("EDGES SCHARR GRAY", &BM_edge_detect, fn,
+                                 utils::Edge_Filter::Scharr);
+    benchmark::RegisterBenchmark("ROTATE 90 NAIVE RGB", &BM_rotate_naive, fn,
+                                 utils::Pixel_Format::RGB);
+    benchmark::RegisterBenchmark("ROTATE 90 RGB", &BM_transform, fn,
+                                 utils::Pixel_Format::RGB,
+                                 utils::Orientation::Rotate_90, false);
+    benchmark::RegisterBenchmark("ROTATE 90 RGB PARALLEL", &BM_transform, fn,
+                                 utils::Pixel_Format::RGB,
+                                 utils::Orientation::Rotate_90, true)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("ROTATE 90 NAIVE GRAY", &BM_rotate_naive,
+                                 fn, utils::Pixel_Format::GRAY);
+    benchmark::RegisterBenchmark("ROTATE 90 GRAY", &BM_transform, fn,
+                                 utils::Pixel_Format::GRAY,
+                                 utils::Orientation::Rotate_90, false);
+    benchmark::RegisterBenchmark("ROTATE 90 NAIVE RGBA", &BM_rotate_naive,
+                                 fn, utils::Pixel_Format::RGBA);
+    benchmark::RegisterBenchmark("ROTATE 90 RGBA", &BM_transform, fn,
+                                 utils::Pixel_Format::RGBA,
+                                 utils::Orientation::Rotate_90, false);
+    benchmark::RegisterBenchmark("ROTATE 180 RGB", &BM_transform, fn,
+                                 utils::Pixel_Format::RGB,
+                                 utils::Orientation::Rotate_180, false);
+    benchmark::RegisterBenchmark("FLIP H RGB", &BM_transform, fn,
+                                 utils::Pixel_Format::RGB,
+                                 utils::Orientation::Flip_H, false);
+    benchmark::RegisterBenchmark("FLIP V RGB", &BM_transform, fn,
+                                 utils::Pixel_Format::RGB,
+                                 utils::Orientation::Flip_V, false);
+    benchmark::RegisterBenchmark("DEPTH NAIVE RGB ROUNDTRIP", &BM_depth_naive,
+                                 fn);
+    benchmark::RegisterBenchmark("DEPTH RGB ROUNDTRIP", &BM_depth_roundtrip,
+                                 fn, utils::Pixel_Format::RGB,
+                                 utils::Pixel_Format::RGB16);
+    benchmark::RegisterBenchmark("CONVERT RGB16 TO GRAY16", &BM_convert16, fn,
+                                 utils::Pixel_Format::RGB16,
+                                 utils::Pixel_Format::GRAY16);
+    benchmark::RegisterBenchmark("CONVERT RGBA16 TO GRAY", &BM_convert16, fn,
+                                 utils::Pixel_Format::RGBA16,
+                                 utils::Pixel_Format::GRAY);
+    benchmark::RegisterBenchmark("PIPELINE SEPARATE PASSES", &BM_pipeline, fn,
+                                 false);
+    benchmark::RegisterBenchmark("PIPELINE FUSED", &BM_pipeline, fn, true);
+    benchmark::RegisterBenchmark("PREVIEW 256 FULL DECODE",
+                                 &BM_decode_preview, fn, false);
+    benchmark::RegisterBenchmark("PREVIEW 256 SCALED DECODE",
+                                 &BM_decode_preview, fn, true);
+    benchmark::RegisterBenchmark("PREVIEW 256 SHARED READER PARALLEL",
+                                 &BM_decode_shared, fn)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("PREVIEW 256 ENCODE NEW WRITER",
+                                 &BM_encode_preview, fn, false);
+    benchmark::RegisterBenchmark("PREVIEW 256 ENCODE REUSED WRITER",
+                                 &BM_encode_preview, fn, true);
+    benchmark::RegisterBenchmark("DECODE GRAY VIA RGB", &BM_decode_gray, fn,
+                                 Gray_Decode::Via_RGB);
+    benchmark::RegisterBenchmark("DECODE GRAY", &BM_decode_gray, fn,
+                                 Gray_Decode::Gray);
+    benchmark::RegisterBenchmark("DECODE LUMA PLANE", &BM_decode_gray, fn,
+                                 Gray_Decode::Luma);
+    benchmark::RegisterBenchmark("HEADER FULL FILE READ", &BM_probe, fn,
+                                 false);
+    benchmark::RegisterBenchmark("HEADER PROBE", &BM_probe, fn, true);
+    benchmark::RegisterBenchmark("HASH FULL DECODE", &BM_image_hash, fn,
+                                 false);
+    benchmark::RegisterBenchmark("HASH SCALED DECODE", &BM_image_hash, fn,
+                                 true);
+    benchmark::RegisterBenchmark("HASH SEARCH SCALAR", &BM_hash_search, fn,
+                                 &utils::kernels::hamming_mask_scalar);
+#if UTILS_ARCH_X86
+    if (tier >= utils::Cpu_Tier::SSE4_1) {
+        benchmark::RegisterBenchmark("HASH SEARCH SSE4.1", &BM_hash_search,
+                                     fn, &utils::kernels::hamming_mask_sse);
+    }
+    if (tier >= utils::Cpu_Tier::AVX2) {
+        benchmark::RegisterBenchmark("HASH SEARCH AVX2", &BM_hash_search, fn,
+                                     &utils::kernels::hamming_mask_avx2);
+    }
+    if (tier >= utils::Cpu_Tier::AVX512BW) {
+        benchmark::RegisterBenchmark("HASH SEARCH AVX512BW", &BM_hash_search,
+                                     fn, &utils::kernels::hamming_mask_avx512);
+    }
+#endif
+    std::ostringstream tier_ss;
+    tier_ss << utils::cpu_tier();
+    benchmark::AddCustomContext("cpu_tier", tier_ss.str());
+    // Skip over --bench <file> so benchmark only sees its own flags
+    argv[2] = argv[0];
+    argc -= 2;
+    argv += 2;
     benchmark::Initialize(&argc, argv);
     benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
+
+// Regression checks run by --test (and ctest), each prints what failed
+static bool check(const bool ok, const char *what) {
+    if (!ok) {
+        std::cerr << "[FAIL] " << what << '\n';
+    }
+    return ok;
+}
+
+// resize() with the scalar kernels only, the same two passes (or the 2x box
+// path) as utils::resize()
+template <size_t C>
+static std::vector<uint8_t> scalar_resize(const utils::Pixels &src,
+                                          const int dw, const int dh,
+                                          const utils::Resize_Filter f) {
+    namespace k = utils::kernels;
+    const auto sw = src.width();
+    const auto sh = src.height();
+    const auto in_bytes = static_cast<size_t>(sw) * C;
+    const auto row_bytes = static_cast<size_t>(dw) * C;
+    std::vector<uint8_t> out(row_bytes * static_cast<size_t>(dh));
+    if (f == utils::Resize_Filter::Box && sw == dw * 2 && sh == dh * 2) {
+        for (size_t y = 0; y < static_cast<size_t>(dh); ++y) {
+            k::downscale_2x_scalar(src.buf.data() + y * 2 * in_bytes,
+                                   src.buf.data() + (y * 2 + 1) * in_bytes,
+                                   out.data() + y * row_bytes,
+                                   static_cast<size_t>(dw), C);
+        }
+        return out;
+    }
+    const auto rw = utils::make_resize_weights(sw, dw, f);
+    const auto rh = utils::make_resize_weights(sh, dh, f);
+    std::vector<uint8_t> tmp(row_bytes * static_cast<size_t>(sh));
+    std::vector<const uint8_t *> rows(static_cast<size_t>(sh));
+    for (size_t y = 0; y < rows.size(); ++y) {
+        k::resample_horizontal_scalar<C>(
+            src.buf.data() + y * in_bytes, tmp.data() + y * row_bytes,
+            rw.start.data(), rw.w.data(), rw.taps, static_cast<size_t>(dw));
+        rows[y] = tmp.data() + y * row_bytes;
+    }
+    for (size_t y = 0; y < static_cast<size_t>(dh); ++y) {
+        k::resample_vertical_scalar(
+            rows.data() + rh.start[y], rh.w.data() + y * rh.taps, rh.taps,
+            out.data() + y * row_bytes, row_bytes);
+    }
+    return out;
+}
+
+// The SIMD resize kernels picked for cpu_tier() match the scalar ones byte
+// for byte. ctest runs this under every UTILS_CPU_TIER.
+static bool test_resize_tiers() {
+    struct Size_Case {
+        int sw, sh, dw, dh;
+    };
+    const Size_Case sizes[] = {{97, 61, 50, 33},
+                               {50, 33, 97, 61},
+                               {301, 9, 173, 20},
+                               {64, 48, 32, 24}};
+    const utils::Resize_Filter filters[] = {utils::Resize_Filter::Box,
+                                            utils::Resize_Filter::Bilinear,
+                                            utils::Resize_Filter::Lanczos3};
+    const utils::Pixel_Format fmts[] = {utils::Pixel_Format::GRAY,
+                                        utils::Pixel_Format::RGB,
+                                        utils::Pixel_Format::RGBA};
+    auto ok = true;
+    for (const auto fmt : fmts) {
+        for (const auto &sz : sizes) {
+            utils::Pixels src{fmt, sz.sw, sz.sh};
+            for (size_t i = 0; i < src.buf.size(); ++i) {
+                src.buf[i] = static_cast<uint8_t>((i * 2654435761U) >> 11);
+            }
+            for (const auto f : filters) {
+                const auto dst = utils::resize(src.cview(), sz.dw, sz.dh, {f});
+                const auto want =
+                    fmt == utils::Pixel_Format::GRAY
+                        ? scalar_resize<1>(src, sz.dw, sz.dh, f)
+                        : (fmt == utils::Pixel_Format::RGB
+                               ? scalar_resize<3>(src, sz.dw, sz.dh, f)
+                               : scalar_resize<4>(src, sz.dw, sz.dh, f));
+                ok = ok && dst.is_valid() && dst.buf.size() == want.size() &&
+                     std::equal(want.begin(), want.end(), dst.buf.begin());
+            }
+        }
+    }
+    return check(ok, "resize at the current CPU tier");
+}
+
+// 16 bit tables from compile16 map whole values, keep_alpha leaves every
+// 4th value (RGBA16 alpha) alone
+static bool test_lut16() {
+    const auto lut = utils::Point_Ops{}.invert().compile16();
+    const uint16_t in[8] = {0, 1000, 40000, 65535, 7, 65535, 12345, 300};
+    uint8_t buf[sizeof(in)];
+    std::memcpy(buf, in, sizeof(in));
+    utils::kernels::lut16_apply(buf, buf, 8, lut.data(), true);
+    uint16_t out[8] = {};
+    std::memcpy(out, buf, sizeof(out));
+    auto ok = lut.size() == 65536;
+    for (size_t i = 0; i < 8; ++i) {
+        const auto want = i % 4 == 3 ? in[i] : 65535 - in[i];
+        ok = ok && out[i] == want;
+    }
+    return check(ok, "16 bit LUT kernel");
+}
+
+// Widening premultiplied RGBA undoes the premultiplication first
+static bool test_premultiplied_to_rgba16() {
+    utils::Pixels p{utils::Pixel_Format::RGBA, 1, 1};
+    const uint8_t px[4] = {200, 100, 50, 51};
+    std::copy(px, px + 4, p.buf.begin());
+    p.premultiply();
+    p.convert_to(utils::Pixel_Format::RGBA16);
+    uint16_t out[4] = {};
+    std::memcpy(out, p.buf.data(), sizeof(out));
+    return check(!p.is_premultiplied() && out[0] == 51400 &&
+                     out[1] == 25700 && out[2] == 12850 && out[3] == 13107,
+                 "premultiplied RGBA -> RGBA16");
+}
+
+// Point ops on 16 bit formats go through the 65536 entry table, RGBA16
+// alpha is left alone
+static bool test_point_ops16() {
+    utils::Pixels p{utils::Pixel_Format::RGBA16, 3, 2};
+    std::vector<uint16_t> in(p.buf.size() / 2);
+    for (size_t i = 0; i < in.size(); ++i) {
+        in[i] = static_cast<uint16_t>(i * 4099);
+    }
+    std::memcpy(p.buf.data(), in.data(), p.buf.size());
+    const auto ops = utils::Point_Ops{}.invert();
+    auto ok = utils::apply_point_ops(p.view(), ops);
+    std::vector<uint16_t> out(in.size());
+    std::memcpy(out.data(), p.buf.data(), p.buf.size());
+    for (size_t i = 0; i < in.size(); ++i) {
+        const auto want = i % 4 == 3 ? in[i] : 65535 - in[i];
+        ok = ok && out[i] == want;
+    }
+    utils::Pixels g{utils::Pixel_Format::GRAY16, 1, 1};
+    const uint16_t v = 1000;
+    std::memcpy(g.buf.data(), &v, 2);
+    ok = ok && utils::apply_lut(g.view(), ops.compile16());
+    uint16_t gv = 0;
+    std::memcpy(&gv, g.buf.data(), 2);
+    ok = ok && gv == 64535;
+    ok = ok && !utils::apply_lut(g.view(), ops.compile());
+    return check(ok, "16 bit point ops");
+}
+
+// Odd sized 4:2:0, TurboJPEG writes the luma plane padded to 34x18
+static bool test_odd_yuv() {
+    utils::Pixels p{utils::Pixel_Format::RGB, 33, 17};
+    for (size_t i = 0; i < p.buf.size(); ++i) {
+        p.buf[i] = static_cast<uint8_t>(i * 7);
+    }
+    const auto path =
+        (std::filesystem::temp_directory_path() / "utils_test_33x17.jpg")
+            .string();
+    utils::JPEG_Write writer{{90, TJSAMP_420, false}};
+    auto ok = writer.save(path.c_str(), p.cview());
+    const utils::JPEG_Read jpeg(path.c_str());
+    std::remove(path.c_str());
+    const auto gray = jpeg.get_pixels(utils::Pixel_Format::GRAY);
+    const auto luma = jpeg.get_luma();
+    const auto yuv = jpeg.get_yuv();
+    ok = ok && gray.is_valid() && yuv.is_valid() &&
+         yuv.cb.width() == 17 && yuv.cb.height() == 9 &&
+         yuv.cr.width() == 17 && yuv.cr.height() == 9;
+    ok = ok && utils::compare_pixels(gray.cview(), luma.cview()).is_match() &&
+         utils::compare_pixels(gray.cview(), yuv.y.cview()).is_match();
+    return check(ok, "33x17 4:2:0 luma and YUV planes");
+}
+
+// get_planar() where TurboJPEG pads luma past the rows of the planes: odd
+// heights, and 4:4:1 (libjpeg-turbo 3) which pads to a multiple of 4 rows
+static bool test_odd_planar() {
+    std::vector<int> samps{TJSAMP_444, TJSAMP_422, TJSAMP_420,
+                           TJSAMP_GRAY, TJSAMP_440, TJSAMP_411};
+#if TJ_NUMSAMP > 6
+    samps.push_back(TJSAMP_441);
+#endif
+    const auto path =
+        (std::filesystem::temp_directory_path() / "utils_test_planar.jpg")
+            .string();
+    auto ok = true;
+    for (const auto h : {17, 18, 19}) {
+        utils::Pixels p{utils::Pixel_Format::RGB, 33, h};
+        for (size_t i = 0; i < p.buf.size(); ++i) {
+            p.buf[i] = static_cast<uint8_t>(i * 7);
+        }
+        for (const auto samp : samps) {
+            utils::JPEG_Write writer{{90, samp, false}};
+            ok = writer.save(path.c_str(), p.cview()) && ok;
+            const utils::JPEG_Read jpeg(path.c_str());
+            const auto luma = jpeg.get_luma();
+            const auto gray = jpeg.get_planar(utils::Pixel_Format::GRAY);
+            const auto rgb = jpeg.get_planar(utils::Pixel_Format::RGB);
+            ok = ok && luma.is_valid() && gray.is_valid() && rgb.is_valid() &&
+                 rgb.width() == 33 && rgb.height() == h &&
+                 utils::compare_pixels(luma.cview(), gray.plane_view(0))
+                     .is_match();
+        }
+    }
+    std::remove(path.c_str());
+    return check(ok, "odd height and 4:4:1 planar decodes");
+}
+
+// trim() on one thread reaches the buffers cached by another one on its
+// next acquire or release
+static bool test_pool_trim() {
+    using utils::Pixel_Pool;
+    auto &pool = Pixel_Pool::instance();
+    const auto big = Pixel_Pool::MIN_BYTES * 4;
+    const auto small = Pixel_Pool::MIN_BYTES;
+    std::promise<void> cached;
+    std::promise<void> trimmed;
+    auto trimmed_f = trimmed.get_future();
+    size_t after = 0;
+    std::thread t([&] {
+        pool.release(pool.acquire(big), big);
+        cached.set_value();
+        trimmed_f.wait();
+        pool.release(pool.acquire(small), small);
+        after = pool.stats().cached_bytes;
+    });
+    cached.get_future().wait();
+    pool.trim();
+    trimmed.set_value();
+    t.join();
+    pool.trim();
+    const auto want = Pixel_Pool::class_bytes(Pixel_Pool::size_class(small));
+    return check(after == want, "pixel pool trim of other threads");
+}
+
+static int run_tests() {
+    std::cout << "CPU tier: " << utils::cpu_tier() << '\n';
+    auto ok = true;
+    ok = test_resize_tiers() && ok;
+    ok = test_lut16() && ok;
+    ok = test_premultiplied_to_rgba16() && ok;
+    ok = test_point_ops16() && ok;
+    ok = test_odd_yuv() && ok;
+    ok = test_odd_planar() && ok;
+    ok = test_pool_trim() && ok;
+    std::cout << (ok ? "All tests passed\n" : "Some tests failed\n");
+    return ok ? 0 : 1;
 }
-*/
 
 int main(int argc, char *argv[]) {
 
@@ -68,6 +1333,12 @@ int main(int argc, char *argv[]) {
         std::cout << "Nothing to do!\n";
         return 0;
     }
+    if (std::string_view(argv[1]) == "--bench") {
+        return run_benchmarks(argc, argv);
+    }
+    if (std::string_view(argv[1]) == "--test") {
+        return run_tests();
+    }
 
     const auto finfo = utils::get_file_info(argv[1]);
 
@@ -0,0 +1,144 @@
+/*
+  alpha.h -- Premultiplied alpha and "over" compositing of pixel views
+*/
+#ifndef ALPHA_HPP
+#define ALPHA_HPP
+
+#include "utils/alpha_kernels.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixels_view.hpp"
+#include <iostream>
+
+namespace utils {
+
+// How the colours of RGBA pixels relate to their alpha
+enum class Alpha_Mode { Straight, Premultiplied };
+inline std::ostream &operator<<(std::ostream &os, const Alpha_Mode m) {
+    switch (m) {
+    default:
+    case Alpha_Mode::Straight:
+        os << "Straight";
+        break;
+    case Alpha_Mode::Premultiplied:
+        os << "Premultiplied";
+        break;
+    }
+    return os;
+}
+
+namespace detail {
+inline bool check_rgba_view(const Const_Pixels_View v, const char *what) {
+    if (!v.is_valid() || v.format() != Pixel_Format::RGBA) {
+        std::cerr << "[ERROR] " << what << " needs a valid RGBA view! ("
+                  << v.format() << ")\n";
+        return false;
+    }
+    return true;
+}
+
+// Runs kernel(row, row, width) over every row of v, in place
+template <class Fn>
+void alpha_rows(const Pixels_View v, const bool parallel, const Fn &kernel) {
+    const auto w = static_cast<size_t>(v.width());
+    for_row_bands(static_cast<size_t>(v.height()), v.row_bytes(), parallel,
+                  [&](const size_t first, const size_t last) {
+                      for (auto y = first; y < last; ++y) {
+                          auto *row = v.row(static_cast<int>(y));
+                          kernel(row, row, w);
+                      }
+                  });
+}
+} // namespace detail
+
+// Multiplies the colours of an RGBA view by alpha in place
+inline bool premultiply(const Pixels_View v, const bool parallel = false) {
+    if (!detail::check_rgba_view(v, "Premultiply")) {
+        return false;
+    }
+    detail::alpha_rows(v, parallel, kernels::premultiply);
+    return true;
+}
+
+// Divides the colours of a premultiplied RGBA view by alpha in place
+inline bool unpremultiply(const Pixels_View v, const bool parallel = false) {
+    if (!detail::check_rgba_view(v, "Unpremultiply")) {
+        return false;
+    }
+    detail::alpha_rows(v, parallel, kernels::unpremultiply);
+    return true;
+}
+
+// Composites the RGBA pixels of src over dst, both of the same size
+// RGB destinations are opaque. RGBA destinations are treated as, and stay,
+// premultiplied (an opaque RGBA image is the same either way). Use
+// dst.sub(x, y, w, h) to place an overlay somewhere in a larger image.
+inline bool composite_over(const Const_Pixels_View src, const Pixels_View dst,
+                           const Alpha_Mode src_mode = Alpha_Mode::Straight,
+                           const bool parallel = false) {
+    if (!detail::check_rgba_view(src, "Composite source") || !dst.is_valid()) {
+        return false;
+    }
+    if (src.width() != dst.width() || src.height() != dst.height()) {
+        std::cerr << "[ERROR] Pixel view sizes do not match! (" << src.width()
+                  << 'x' << src.height() << " -> " << dst.width() << 'x'
+                  << dst.height() << ")\n";
+        return false;
+    }
+    const auto *src_end = src.row(src.height() - 1) + src.row_bytes();
+    const auto *dst_end = dst.row(dst.height() - 1) + dst.row_bytes();
+    if (src.data() < dst_end && dst.data() < src_end) {
+        std::cerr << "[ERROR] Pixel views overlap, cannot composite!\n";
+        return false;
+    }
+    const auto premul = src_mode == Alpha_Mode::Premultiplied;
+    const auto w = static_cast<size_t>(dst.width());
+    kernels::over_fn_t fn = nullptr;
+    switch (dst.format()) {
+    case Pixel_Format::RGB:
+        fn = kernels::over_rgb;
+        break;
+    case Pixel_Format::RGBA:
+        fn = kernels::over_rgba;
+        break;
+    case Pixel_Format::GRAY:
+    case Pixel_Format::RGB16:
+    case Pixel_Format::RGBA16:
+    case Pixel_Format::GRAY16:
+    case Pixel_Format::Unknown:
+    default:
+        std::cerr << "[ERROR] Cannot composite onto " << dst.format()
+                  << " pixels!\n";
+        return false;
+    }
+    detail::for_row_bands(
+        static_cast<size_t>(dst.height()), dst.row_bytes(), parallel,
+        [&](const size_t first, const size_t last) {
+            for (auto y = first; y < last; ++y) {
+                const auto yi = static_cast<int>(y);
+                fn(src.row(yi), dst.row(yi), w, premul);
+            }
+        });
+    return true;
+}
+
+// Composites an RGBA view over a solid colour in place, alpha becomes 255
+// (Pixels::convert_to RGB with Pixel_Convert_Opts::composite does the same
+// while dropping the alpha channel)
+inline bool flatten(const Pixels_View v, const uint8_t r, const uint8_t g,
+                    const uint8_t b,
+                    const Alpha_Mode mode = Alpha_Mode::Straight,
+                    const bool parallel = false) {
+    if (!detail::check_rgba_view(v, "Flatten")) {
+        return false;
+    }
+    const auto premul = mode == Alpha_Mode::Premultiplied;
+    detail::alpha_rows(v, parallel,
+                       [&](const uint8_t *src, uint8_t *dst, const size_t n) {
+                           kernels::over_solid(src, dst, n, r, g, b, premul, 4);
+                       });
+    return true;
+}
+
+} // namespace utils
+
+#endif
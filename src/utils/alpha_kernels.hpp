@@ -0,0 +1,428 @@
+/*
+  alpha_kernels.h -- Raw kernels for premultiplied alpha and compositing
+*/
+#ifndef ALPHA_KERNELS_HPP
+#define ALPHA_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+namespace kernels {
+
+// Exact round(x / 255) for 0 <= x <= 255 * 255
+constexpr unsigned div255_round(const unsigned x) noexcept {
+    const auto t = x + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+//
+// Scalar kernels, also used for the tails of the SIMD kernels
+// "Over" is out = round((s * m + d * (255 - a)) / 255) for every channel,
+// where a is the source alpha and m is a for straight colour channels and
+// 255 for premultiplied ones and for alpha. So a straight source is
+// premultiplied and blended with a single rounding. The result has
+// premultiplied colours, which for an opaque destination is the same thing.
+//
+inline void over_px(const uint8_t *s, const uint8_t *d, uint8_t *out,
+                    const size_t out_comps, const bool premul) noexcept {
+    const unsigned a = s[3];
+    for (size_t c = 0; c < out_comps; ++c) {
+        const unsigned d_c = d[c];
+        unsigned s_c = s[c];
+        unsigned m = 255;
+        if (c < 3) {
+            if (premul) {
+                // Colours above alpha are not valid premultiplied values
+                s_c = s_c < a ? s_c : a;
+            } else {
+                m = a;
+            }
+        }
+        out[c] = static_cast<uint8_t>(div255_round(s_c * m + d_c * (255 - a)));
+    }
+}
+
+// RGBA -> RGBA with premultiplied colours, src and dst may be the same
+inline void premultiply_scalar(const uint8_t *src, uint8_t *dst,
+                               const size_t n) noexcept {
+    const uint8_t zero[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < n; ++i, src += 4, dst += 4) {
+        over_px(src, zero, dst, 4, false);
+    }
+}
+
+// Back to straight colours, round(c * 255 / a), clamped for invalid input
+// Fully transparent pixels become 0, 0, 0, 0
+inline void unpremultiply_px(const uint8_t *s, uint8_t *d) noexcept {
+    const unsigned a = s[3];
+    if (a == 0) {
+        std::memset(d, 0, 4);
+        return;
+    }
+    for (size_t c = 0; c < 3; ++c) {
+        const auto v = (s[c] * 255u + a / 2) / a;
+        d[c] = static_cast<uint8_t>(v < 255 ? v : 255);
+    }
+    d[3] = static_cast<uint8_t>(a);
+}
+inline void unpremultiply_scalar(const uint8_t *src, uint8_t *dst,
+                                 const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 4, dst += 4) {
+        unpremultiply_px(src, dst);
+    }
+}
+
+// n RGBA pixels of src over the RGBA (premultiplied) pixels of dst
+inline void over_rgba_scalar(const uint8_t *src, uint8_t *dst, const size_t n,
+                             const bool premul) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 4, dst += 4) {
+        over_px(src, dst, dst, 4, premul);
+    }
+}
+
+// n RGBA pixels of src over the opaque RGB pixels of dst
+inline void over_rgb_scalar(const uint8_t *src, uint8_t *dst, const size_t n,
+                            const bool premul) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 4, dst += 3) {
+        const uint8_t d[4] = {dst[0], dst[1], dst[2], 255};
+        over_px(src, d, dst, 3, premul);
+    }
+}
+
+// n RGBA pixels of src over a solid colour into dst_comps (3 or 4) channel
+// pixels, dst may be the same memory as src
+inline void over_solid_scalar(const uint8_t *src, uint8_t *dst,
+                              const size_t n, const uint8_t r, const uint8_t g,
+                              const uint8_t b, const bool premul,
+                              const size_t dst_comps) noexcept {
+    const uint8_t d[4] = {r, g, b, 255};
+    // A known bound for the compiler, px only has room for 4
+    const auto comps = dst_comps == 4 ? size_t{4} : size_t{3};
+    for (size_t i = 0; i < n; ++i, src += 4, dst += comps) {
+        uint8_t px[4];
+        over_px(src, d, px, comps, premul);
+        std::memcpy(dst, px, comps);
+    }
+}
+
+#if UTILS_ARCH_X86
+//
+// SSE4.1 kernels, 4 pixels per iteration in 16 bit lanes
+// round(x / 255) is (x + 128) * 257 >> 16, exact for every x <= 255 * 255
+//
+UTILS_TARGET_SSE41 inline __m128i div255_round_sse(const __m128i x) noexcept {
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(128)),
+                           _mm_set1_epi16(257));
+}
+
+// Two pixels of s, d and the source alpha a widened to 16 bits
+UTILS_TARGET_SSE41 inline __m128i over_half_sse(__m128i s, const __m128i d,
+                                                const __m128i a,
+                                                const bool premul) noexcept {
+    const auto c255 = _mm_set1_epi16(255);
+    auto m = c255;
+    if (premul) {
+        s = _mm_min_epi16(s, a);
+    } else {
+        m = _mm_blend_epi16(a, c255, 0x88);
+    }
+    const auto x = _mm_add_epi16(_mm_mullo_epi16(s, m),
+                                 _mm_mullo_epi16(d, _mm_sub_epi16(c255, a)));
+    return div255_round_sse(x);
+}
+
+// 4 RGBA pixels of s over 4 RGBA pixels of d
+UTILS_TARGET_SSE41 inline __m128i over_sse(const __m128i s, const __m128i d,
+                                           const bool premul) noexcept {
+    const auto zero = _mm_setzero_si128();
+    const auto a_lo = _mm_shuffle_epi8(
+        s, _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1));
+    const auto a_hi = _mm_shuffle_epi8(s, _mm_setr_epi8(11, -1, 11, -1, 11, -1,
+                                                        11, -1, 15, -1, 15, -1,
+                                                        15, -1, 15, -1));
+    const auto lo = over_half_sse(_mm_unpacklo_epi8(s, zero),
+                                  _mm_unpacklo_epi8(d, zero), a_lo, premul);
+    const auto hi = over_half_sse(_mm_unpackhi_epi8(s, zero),
+                                  _mm_unpackhi_epi8(d, zero), a_hi, premul);
+    return _mm_packus_epi16(lo, hi);
+}
+
+// 4 RGB pixels to RGBA (alpha 0) and back
+UTILS_TARGET_SSE41 inline __m128i load_rgb4_sse(const uint8_t *p) noexcept {
+    int32_t tail{};
+    std::memcpy(&tail, p + 8, 4);
+    const auto v = _mm_insert_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), tail, 2);
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+                                             -1, 9, 10, 11, -1));
+}
+UTILS_TARGET_SSE41 inline void store_rgb4_sse(uint8_t *p,
+                                              const __m128i v) noexcept {
+    const auto rgb = _mm_shuffle_epi8(
+        v, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(p), rgb);
+    const auto tail = _mm_extract_epi32(rgb, 2);
+    std::memcpy(p + 8, &tail, 4);
+}
+
+UTILS_TARGET_SSE41 inline void premultiply_sse(const uint8_t *src, uint8_t *dst,
+                                               const size_t n) noexcept {
+    const auto zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                         over_sse(s, zero, false));
+    }
+    premultiply_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+// Exact integer division in single precision, the quotient is never closer
+// than 1 / 255 to the next integer so truncating it is exact
+UTILS_TARGET_SSE41 inline __m128i
+unpremultiply_px_sse(const __m128i px) noexcept {
+    const auto a = _mm_shuffle_epi32(px, 0xFF);
+    const auto num =
+        _mm_add_epi32(_mm_mullo_epi32(px, _mm_set1_epi32(255)),
+                      _mm_srli_epi32(a, 1));
+    const auto q = _mm_cvttps_epi32(
+        _mm_div_ps(_mm_cvtepi32_ps(num), _mm_cvtepi32_ps(a)));
+    // Keep alpha, zero everything if alpha is 0
+    const auto out = _mm_blend_epi16(_mm_min_epi32(q, _mm_set1_epi32(255)),
+                                     px, 0xC0);
+    return _mm_andnot_si128(_mm_cmpeq_epi32(a, _mm_setzero_si128()), out);
+}
+UTILS_TARGET_SSE41 inline void
+unpremultiply_sse(const uint8_t *src, uint8_t *dst, const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        const auto p0 = unpremultiply_px_sse(_mm_cvtepu8_epi32(s));
+        const auto p1 =
+            unpremultiply_px_sse(_mm_cvtepu8_epi32(_mm_srli_si128(s, 4)));
+        const auto p2 =
+            unpremultiply_px_sse(_mm_cvtepu8_epi32(_mm_srli_si128(s, 8)));
+        const auto p3 =
+            unpremultiply_px_sse(_mm_cvtepu8_epi32(_mm_srli_si128(s, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                         _mm_packus_epi16(_mm_packus_epi32(p0, p1),
+                                          _mm_packus_epi32(p2, p3)));
+    }
+    unpremultiply_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+UTILS_TARGET_SSE41 inline void over_rgba_sse(const uint8_t *src, uint8_t *dst,
+                                             const size_t n,
+                                             const bool premul) noexcept {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        const auto d =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                         over_sse(s, d, premul));
+    }
+    over_rgba_scalar(src + i * 4, dst + i * 4, n - i, premul);
+}
+
+UTILS_TARGET_SSE41 inline void over_rgb_sse(const uint8_t *src, uint8_t *dst,
+                                            const size_t n,
+                                            const bool premul) noexcept {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        store_rgb4_sse(dst + i * 3,
+                       over_sse(s, load_rgb4_sse(dst + i * 3), premul));
+    }
+    over_rgb_scalar(src + i * 4, dst + i * 3, n - i, premul);
+}
+
+// Every pixel is read before its (smaller or equal) output is written, so
+// running in place is fine
+UTILS_TARGET_SSE41 inline void
+over_solid_sse(const uint8_t *src, uint8_t *dst, const size_t n,
+               const uint8_t r, const uint8_t g, const uint8_t b,
+               const bool premul, const size_t dst_comps) noexcept {
+    const auto d = _mm_set1_epi32(static_cast<int>(
+        0xFF000000u | static_cast<uint32_t>(b) << 16 |
+        static_cast<uint32_t>(g) << 8 | r));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        const auto v = over_sse(s, d, premul);
+        if (dst_comps == 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), v);
+        } else {
+            store_rgb4_sse(dst + i * 3, v);
+        }
+    }
+    over_solid_scalar(src + i * 4, dst + i * dst_comps, n - i, r, g, b, premul,
+                      dst_comps);
+}
+
+//
+// AVX2 kernels, the same math on both 128 bit lanes (8 pixels)
+//
+UTILS_TARGET_AVX2 inline __m256i over_avx2(const __m256i s, const __m256i d,
+                                           const bool premul) noexcept {
+    const auto zero = _mm256_setzero_si256();
+    const auto c255 = _mm256_set1_epi16(255);
+    const auto a_lo = _mm256_shuffle_epi8(
+        s, _mm256_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7,
+                            -1, 3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7,
+                            -1, 7, -1));
+    const auto a_hi = _mm256_shuffle_epi8(
+        s, _mm256_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15,
+                            -1, 15, -1, 11, -1, 11, -1, 11, -1, 11, -1, 15, -1,
+                            15, -1, 15, -1, 15, -1));
+    auto s_lo = _mm256_unpacklo_epi8(s, zero);
+    auto s_hi = _mm256_unpackhi_epi8(s, zero);
+    auto m_lo = c255;
+    auto m_hi = c255;
+    if (premul) {
+        s_lo = _mm256_min_epi16(s_lo, a_lo);
+        s_hi = _mm256_min_epi16(s_hi, a_hi);
+    } else {
+        m_lo = _mm256_blend_epi16(a_lo, c255, 0x88);
+        m_hi = _mm256_blend_epi16(a_hi, c255, 0x88);
+    }
+    const auto x_lo = _mm256_add_epi16(
+        _mm256_mullo_epi16(s_lo, m_lo),
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero),
+                           _mm256_sub_epi16(c255, a_lo)));
+    const auto x_hi = _mm256_add_epi16(
+        _mm256_mullo_epi16(s_hi, m_hi),
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero),
+                           _mm256_sub_epi16(c255, a_hi)));
+    const auto round = _mm256_set1_epi16(128);
+    const auto mul = _mm256_set1_epi16(257);
+    return _mm256_packus_epi16(
+        _mm256_mulhi_epu16(_mm256_add_epi16(x_lo, round), mul),
+        _mm256_mulhi_epu16(_mm256_add_epi16(x_hi, round), mul));
+}
+
+UTILS_TARGET_AVX2 inline void premultiply_avx2(const uint8_t *src,
+                                               uint8_t *dst,
+                                               const size_t n) noexcept {
+    const auto zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto s =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4),
+                            over_avx2(s, zero, false));
+    }
+    premultiply_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+UTILS_TARGET_AVX2 inline void over_rgba_avx2(const uint8_t *src, uint8_t *dst,
+                                             const size_t n,
+                                             const bool premul) noexcept {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto s =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 4));
+        const auto d =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4),
+                            over_avx2(s, d, premul));
+    }
+    over_rgba_scalar(src + i * 4, dst + i * 4, n - i, premul);
+}
+
+UTILS_TARGET_AVX2 inline void
+over_solid_avx2(const uint8_t *src, uint8_t *dst, const size_t n,
+                const uint8_t r, const uint8_t g, const uint8_t b,
+                const bool premul, const size_t dst_comps) noexcept {
+    const auto d = _mm256_set1_epi32(static_cast<int>(
+        0xFF000000u | static_cast<uint32_t>(b) << 16 |
+        static_cast<uint32_t>(g) << 8 | r));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto s =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 4));
+        const auto v = over_avx2(s, d, premul);
+        if (dst_comps == 4) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4), v);
+        } else {
+            store_rgb4_sse(dst + i * 3, _mm256_castsi256_si128(v));
+            store_rgb4_sse(dst + i * 3 + 12, _mm256_extracti128_si256(v, 1));
+        }
+    }
+    over_solid_scalar(src + i * 4, dst + i * dst_comps, n - i, r, g, b, premul,
+                      dst_comps);
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+// There is no AVX2 unpremultiply or RGB over, those use SSE4.1
+//
+using alpha_fn_t = void (*)(const uint8_t *, uint8_t *, size_t) noexcept;
+using over_fn_t = void (*)(const uint8_t *, uint8_t *, size_t, bool) noexcept;
+using over_solid_fn_t = void (*)(const uint8_t *, uint8_t *, size_t, uint8_t,
+                                 uint8_t, uint8_t, bool, size_t) noexcept;
+inline void premultiply(const uint8_t *src, uint8_t *dst,
+                        const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<alpha_fn_t>(
+        premultiply_scalar, premultiply_sse, premultiply_avx2);
+    fn(src, dst, n);
+#else
+    premultiply_scalar(src, dst, n);
+#endif
+}
+inline void unpremultiply(const uint8_t *src, uint8_t *dst,
+                          const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<alpha_fn_t>(unpremultiply_scalar, unpremultiply_sse);
+    fn(src, dst, n);
+#else
+    unpremultiply_scalar(src, dst, n);
+#endif
+}
+inline void over_rgba(const uint8_t *src, uint8_t *dst, const size_t n,
+                      const bool premul) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<over_fn_t>(
+        over_rgba_scalar, over_rgba_sse, over_rgba_avx2);
+    fn(src, dst, n, premul);
+#else
+    over_rgba_scalar(src, dst, n, premul);
+#endif
+}
+inline void over_rgb(const uint8_t *src, uint8_t *dst, const size_t n,
+                     const bool premul) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<over_fn_t>(over_rgb_scalar, over_rgb_sse);
+    fn(src, dst, n, premul);
+#else
+    over_rgb_scalar(src, dst, n, premul);
+#endif
+}
+inline void over_solid(const uint8_t *src, uint8_t *dst, const size_t n,
+                       const uint8_t r, const uint8_t g, const uint8_t b,
+                       const bool premul, const size_t dst_comps) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<over_solid_fn_t>(
+        over_solid_scalar, over_solid_sse, over_solid_avx2);
+    fn(src, dst, n, r, g, b, premul, dst_comps);
+#else
+    over_solid_scalar(src, dst, n, r, g, b, premul, dst_comps);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
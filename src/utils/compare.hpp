@@ -0,0 +1,302 @@
+/*
+  compare.h -- Image comparison metrics (MSE, PSNR, max difference, SSIM)
+*/
+#ifndef COMPARE_HPP
+#define COMPARE_HPP
+
+#include "utils/compare_kernels.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixels_view.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace utils {
+
+struct Compare_Opts {
+    // Components at most this far apart do not make a pixel count as
+    // different (they still add to the squared error)
+    uint8_t tolerance{0};
+    // Stop as soon as more pixels than this differ, the result then only
+    // covers the rows compared so far. 0 stops at the first difference.
+    uint64_t max_diff_pixels{std::numeric_limits<uint64_t>::max()};
+    // Also compute the mean SSIM of 8x8 windows 4 pixels apart, in a second
+    // pass that is skipped when the comparison stopped early
+    bool ssim{false};
+    // Split large images into row bands and run them on the shared pool
+    bool parallel{false};
+};
+
+struct Compare_Result {
+    Pixel_Format format{Pixel_Format::Unknown};
+    // Pixels compared, fewer than in the views if stopped early
+    uint64_t pixels{0};
+    // Mean squared error of all components and the PSNR in dB that follows
+    // from it, infinite for identical images
+    double mse{0.0};
+    double psnr{std::numeric_limits<double>::infinity()};
+    uint8_t max_abs_diff{0};
+    // Pixels with a component more than Compare_Opts::tolerance apart
+    uint64_t diff_pixels{0};
+    // 1 for identical images, only with Compare_Opts::ssim
+    double ssim{1.0};
+    bool stopped_early{false};
+
+    bool is_valid() const noexcept { return format != Pixel_Format::Unknown; }
+    // Every pixel compared and none differ by more than the tolerance
+    bool is_match() const noexcept {
+        return is_valid() && !stopped_early && diff_pixels == 0;
+    }
+};
+inline std::ostream &operator<<(std::ostream &os, const Compare_Result &r) {
+    os << r.format << ' ' << r.pixels << " px mse " << r.mse << " psnr "
+       << r.psnr << " dB max diff " << static_cast<int>(r.max_abs_diff)
+       << " diff px " << r.diff_pixels << " ssim " << r.ssim;
+    if (r.stopped_early) {
+        os << " (stopped early)";
+    }
+    return os;
+}
+
+// SSIM stabilizing constants for 8 bit components, (0.01 * 255)^2 and
+// (0.03 * 255)^2
+constexpr double SSIM_C1 = 6.5025;
+constexpr double SSIM_C2 = 58.5225;
+
+namespace detail {
+// Like the stats, the kernels work on 8 bit components
+inline bool check_compare_format(const Pixel_Format fmt) {
+    if (pxfmt_depth(fmt) != 1) {
+        std::cerr << "[ERROR] Cannot compare " << fmt << " pixels!\n";
+        return false;
+    }
+    return true;
+}
+
+// SSIM of one window from the sums of a, b, a * a, b * b and a * b over its
+// n samples
+inline double ssim_window(const double *s, const double n) noexcept {
+    const auto ma = s[0] / n;
+    const auto mb = s[1] / n;
+    const auto va = s[2] / n - ma * ma;
+    const auto vb = s[3] / n - mb * mb;
+    const auto cov = s[4] / n - ma * mb;
+    return ((2.0 * ma * mb + SSIM_C1) * (2.0 * cov + SSIM_C2)) /
+           ((ma * ma + mb * mb + SSIM_C1) * (va + vb + SSIM_C2));
+}
+
+// Differences of bands of rows, merged as the bands finish
+// Bands stop at the next row once the shared count of differing pixels
+// passes the limit.
+class Compare_Acc {
+  public:
+    Compare_Acc(const Const_Pixels_View a, const Const_Pixels_View b,
+                const Compare_Opts &opts)
+        : a_{a}
+        , b_{b}
+        , comps_{static_cast<size_t>(pxfmt_components(a.format()))}
+        , tol_{opts.tolerance}
+        , limit_{opts.max_diff_pixels} {}
+
+    // Safe to call from many threads
+    void add_rows(const size_t first, const size_t last) {
+        const auto row_bytes = a_.row_bytes();
+        const auto check = limit_ != std::numeric_limits<uint64_t>::max();
+        kernels::Diff_Reduce r{};
+        auto y = first;
+        for (; y < last && !stop_.load(std::memory_order_relaxed); ++y) {
+            const auto before = r.diff_pixels;
+            kernels::diff_reduce(a_.row(static_cast<int>(y)),
+                                 b_.row(static_cast<int>(y)), row_bytes,
+                                 comps_, tol_, r);
+            const auto added = r.diff_pixels - before;
+            if (check && added != 0 &&
+                seen_.fetch_add(added, std::memory_order_relaxed) + added >
+                    limit_) {
+                stop_.store(true, std::memory_order_relaxed);
+                ++y;
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> lk(mtx_);
+        total_.merge(r);
+        pixels_ += static_cast<uint64_t>(a_.width()) * (y - first);
+    }
+
+    Compare_Result result() const {
+        Compare_Result res{};
+        res.format = a_.format();
+        res.pixels = pixels_;
+        res.max_abs_diff = total_.max;
+        res.diff_pixels = total_.diff_pixels;
+        res.stopped_early = stop_.load();
+        if (pixels_ != 0) {
+            res.mse = static_cast<double>(total_.sse) /
+                      static_cast<double>(pixels_ * comps_);
+        }
+        if (res.mse > 0.0) {
+            res.psnr = 10.0 * std::log10(255.0 * 255.0 / res.mse);
+        }
+        return res;
+    }
+
+  private:
+    Const_Pixels_View a_;
+    Const_Pixels_View b_;
+    size_t comps_;
+    uint8_t tol_;
+    uint64_t limit_;
+    uint64_t pixels_{0};
+    kernels::Diff_Reduce total_{};
+    std::atomic<uint64_t> seen_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex mtx_;
+};
+
+// Mean SSIM of views smaller than a window, one window covering everything
+inline double ssim_whole(const Const_Pixels_View a,
+                         const Const_Pixels_View b) {
+    const auto comps = static_cast<size_t>(pxfmt_components(a.format()));
+    const auto w = static_cast<size_t>(a.width());
+    double s[4][5] = {};
+    for (int y = 0; y < a.height(); ++y) {
+        const auto *ra = a.row(y);
+        const auto *rb = b.row(y);
+        for (size_t i = 0; i < w * comps; ++i) {
+            const double va = ra[i];
+            const double vb = rb[i];
+            auto *sc = s[i % comps];
+            sc[0] += va;
+            sc[1] += vb;
+            sc[2] += va * va;
+            sc[3] += vb * vb;
+            sc[4] += va * vb;
+        }
+    }
+    const auto n = static_cast<double>(w) * a.height();
+    double sum = 0.0;
+    for (size_t c = 0; c < comps; ++c) {
+        sum += ssim_window(s[c], n);
+    }
+    return sum / static_cast<double>(comps);
+}
+
+//
+// Mean SSIM of 8x8 windows 4 pixels apart, averaged over the channels
+// Column sums of 4 row blocks are computed once with SIMD and shared by the
+// two window rows overlapping them, the same goes for sums of 4 columns
+// across neighbouring windows. Bands of window rows run in parallel.
+//
+inline double ssim_mean(const Const_Pixels_View a, const Const_Pixels_View b,
+                        const bool parallel) {
+    if (a.width() < 8 || a.height() < 8) {
+        return ssim_whole(a, b);
+    }
+    const auto comps = static_cast<size_t>(pxfmt_components(a.format()));
+    const auto groups = static_cast<size_t>(a.width()) / 4;
+    const auto n = groups * 4 * comps;
+    const auto win_rows = static_cast<size_t>(a.height()) / 4 - 1;
+    const auto win_cols = groups - 1;
+
+    double total = 0.0;
+    std::mutex mtx{};
+    const auto run_band = [&](const size_t first, const size_t last) {
+        // Block column sums of the upper and lower half of a window row
+        std::vector<uint32_t> upper(5 * n);
+        std::vector<uint32_t> lower(5 * n);
+        std::vector<uint32_t> column(5 * n);
+        std::vector<double> group_sums(5 * groups * comps);
+        const auto block = [&](const size_t k, uint32_t *sums) {
+            const auto y = static_cast<int>(k * 4);
+            const uint8_t *ra[4] = {a.row(y), a.row(y + 1), a.row(y + 2),
+                                    a.row(y + 3)};
+            const uint8_t *rb[4] = {b.row(y), b.row(y + 1), b.row(y + 2),
+                                    b.row(y + 3)};
+            kernels::ssim_sums4(ra, rb, n, sums);
+        };
+        double sum = 0.0;
+        block(first, upper.data());
+        for (auto j = first; j < last; ++j) {
+            block(j + 1, lower.data());
+            for (size_t k = 0; k < 5 * n; ++k) {
+                column[k] = upper[k] + lower[k];
+            }
+            for (size_t k = 0; k < 5; ++k) {
+                const auto *col = &column[k * n];
+                for (size_t g = 0; g < groups; ++g) {
+                    const auto *px = col + g * 4 * comps;
+                    for (size_t c = 0; c < comps; ++c) {
+                        group_sums[(g * comps + c) * 5 + k] =
+                            px[c] + px[comps + c] + px[2 * comps + c] +
+                            px[3 * comps + c];
+                    }
+                }
+            }
+            for (size_t i = 0; i < win_cols; ++i) {
+                for (size_t c = 0; c < comps; ++c) {
+                    const auto *g0 = &group_sums[(i * comps + c) * 5];
+                    const auto *g1 = g0 + comps * 5;
+                    const double s[5] = {g0[0] + g1[0], g0[1] + g1[1],
+                                         g0[2] + g1[2], g0[3] + g1[3],
+                                         g0[4] + g1[4]};
+                    sum += ssim_window(s, 64.0);
+                }
+            }
+            std::swap(upper, lower);
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        total += sum;
+    };
+    for_row_bands(win_rows, 8 * a.row_bytes(), parallel, run_band);
+    return total / static_cast<double>(win_rows * win_cols * comps);
+}
+} // namespace detail
+
+//
+// Compares two views of the same size and format in one pass
+// Squared error, largest difference and the count of differing pixels come
+// from SIMD kernels that only look at single pixels in blocks holding a
+// difference above the tolerance, so comparing equal images runs at memory
+// bandwidth. Returns an invalid result (and reports why) on mismatches.
+//
+inline Compare_Result compare_pixels(const Const_Pixels_View a,
+                                     const Const_Pixels_View b,
+                                     const Compare_Opts &opts = {}) {
+    if (!a.is_valid() || !b.is_valid()) {
+        std::cerr << "[ERROR] Cannot compare an invalid pixel view!\n";
+        return Compare_Result{};
+    }
+    if (a.format() != b.format() || a.width() != b.width() ||
+        a.height() != b.height()) {
+        std::cerr << "[ERROR] Cannot compare " << a.format() << ' '
+                  << a.width() << 'x' << a.height() << " pixels to "
+                  << b.format() << ' ' << b.width() << 'x' << b.height()
+                  << "!\n";
+        return Compare_Result{};
+    }
+    if (!detail::check_compare_format(a.format())) {
+        return Compare_Result{};
+    }
+    detail::Compare_Acc acc{a, b, opts};
+    detail::for_row_bands(static_cast<size_t>(a.height()), a.row_bytes(),
+                          opts.parallel,
+                          [&](const size_t first, const size_t last) {
+                              acc.add_rows(first, last);
+                          });
+    auto res = acc.result();
+    if (opts.ssim && !res.stopped_early) {
+        res.ssim = res.max_abs_diff == 0
+                       ? 1.0
+                       : detail::ssim_mean(a, b, opts.parallel);
+    }
+    return res;
+}
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,372 @@
+/*
+  compare_kernels.h -- Raw kernels for comparing two images
+*/
+#ifndef COMPARE_KERNELS_HPP
+#define COMPARE_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include "utils/hash_kernels.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+namespace kernels {
+
+// Running squared error, largest difference and count of differing pixels
+struct Diff_Reduce {
+    uint64_t sse{0};
+    uint64_t diff_pixels{0};
+    uint8_t max{0};
+
+    void merge(const Diff_Reduce &o) noexcept {
+        sse += o.sse;
+        diff_pixels += o.diff_pixels;
+        max = o.max > max ? o.max : max;
+    }
+};
+
+//
+// Differences of n bytes of packed pixels with comps channels in a and b
+// A pixel differs when any of its components is more than tol apart.
+// n is a multiple of comps, first (where the tail starts) as well.
+//
+inline void diff_reduce_tail(const uint8_t *a, const uint8_t *b,
+                             const size_t first, const size_t n,
+                             const size_t comps, const uint8_t tol,
+                             Diff_Reduce &r) noexcept {
+    for (auto i = first; i < n; i += comps) {
+        bool differs = false;
+        for (size_t c = 0; c < comps; ++c) {
+            const auto d = a[i + c] > b[i + c] ? a[i + c] - b[i + c]
+                                               : b[i + c] - a[i + c];
+            r.sse += static_cast<uint64_t>(d * d);
+            r.max = static_cast<uint8_t>(d > r.max ? d : r.max);
+            differs |= d > tol;
+        }
+        r.diff_pixels += differs;
+    }
+}
+inline void diff_reduce_scalar(const uint8_t *a, const uint8_t *b,
+                               const size_t n, const size_t comps,
+                               const uint8_t tol, Diff_Reduce &r) noexcept {
+    diff_reduce_tail(a, b, 0, n, comps, tol, r);
+}
+
+// Pixels with any bit set in a mask of one bit per byte of whole pixels
+constexpr unsigned count_pixel_bits(uint64_t m, const size_t comps) noexcept {
+    switch (comps) {
+    case 2:
+        m = (m | m >> 1) & 0x5555555555555555;
+        break;
+    case 3:
+        m = (m | m >> 1 | m >> 2) & 0x9249249249249249;
+        break;
+    case 4:
+        m |= m >> 1;
+        m = (m | m >> 2) & 0x1111111111111111;
+        break;
+    default:
+        break;
+    }
+    return popcount64(m);
+}
+
+//
+// Column sums of 4 rows for SSIM, sums holds 5 arrays of n counters:
+// sum of a, of b, of a * a, of b * b and of a * b for every byte column
+//
+inline void ssim_sums4_tail(const uint8_t *const *a, const uint8_t *const *b,
+                            const size_t first, const size_t n,
+                            uint32_t *sums) noexcept {
+    for (auto x = first; x < n; ++x) {
+        uint32_t s[5] = {0, 0, 0, 0, 0};
+        for (size_t k = 0; k < 4; ++k) {
+            const uint32_t va = a[k][x];
+            const uint32_t vb = b[k][x];
+            s[0] += va;
+            s[1] += vb;
+            s[2] += va * va;
+            s[3] += vb * vb;
+            s[4] += va * vb;
+        }
+        for (size_t j = 0; j < 5; ++j) {
+            sums[j * n + x] = s[j];
+        }
+    }
+}
+inline void ssim_sums4_scalar(const uint8_t *const *a,
+                              const uint8_t *const *b, const size_t n,
+                              uint32_t *sums) noexcept {
+    ssim_sums4_tail(a, b, 0, n, sums);
+}
+
+#if UTILS_ARCH_X86
+//
+// SSE4.1 kernels
+// Squares of byte differences are summed pairwise with pmaddwd into 32 bit
+// lanes, which are flushed to 64 bits before they can overflow. Pixels are
+// only counted in blocks with a difference above tol.
+//
+constexpr size_t DIFF_FLUSH_VECTORS = 4096;
+
+// Differing pixels of n bytes, a multiple of 16 * comps, one bit per byte
+// from pmovmskb and 16 pixels per mask
+UTILS_TARGET_SSE41 inline uint64_t diff_pixels_sse(const uint8_t *a,
+                                                   const uint8_t *b,
+                                                   const size_t n,
+                                                   const size_t comps,
+                                                   const uint8_t tol) noexcept {
+    const auto zero = _mm_setzero_si128();
+    const auto vtol = _mm_set1_epi8(static_cast<char>(tol));
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; i += 16 * comps) {
+        uint64_t m = 0;
+        for (size_t k = 0; k < comps; ++k) {
+            const auto va = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(a + i + k * 16));
+            const auto vb = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(b + i + k * 16));
+            const auto d =
+                _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            const auto same = _mm_cmpeq_epi8(_mm_subs_epu8(d, vtol), zero);
+            const auto bits =
+                static_cast<unsigned>(_mm_movemask_epi8(same)) ^ 0xFFFFU;
+            m |= static_cast<uint64_t>(bits) << (k * 16);
+        }
+        count += count_pixel_bits(m, comps);
+    }
+    return count;
+}
+
+UTILS_TARGET_SSE41 inline void diff_reduce_sse(const uint8_t *a,
+                                               const uint8_t *b,
+                                               const size_t n,
+                                               const size_t comps,
+                                               const uint8_t tol,
+                                               Diff_Reduce &r) noexcept {
+    const auto zero = _mm_setzero_si128();
+    const auto vtol = _mm_set1_epi8(static_cast<char>(tol));
+    const auto block = 16 * comps;
+    auto vmax = zero;
+    auto acc = zero;
+    size_t vectors = 0;
+    size_t i = 0;
+    for (; i + block <= n; i += block) {
+        auto above = zero;
+        for (size_t k = 0; k < block; k += 16) {
+            const auto va =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i + k));
+            const auto vb =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + k));
+            const auto d =
+                _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            vmax = _mm_max_epu8(vmax, d);
+            above = _mm_or_si128(above, _mm_subs_epu8(d, vtol));
+            const auto lo = _mm_unpacklo_epi8(d, zero);
+            const auto hi = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        if (!_mm_testz_si128(above, above)) {
+            r.diff_pixels += diff_pixels_sse(a + i, b + i, block, comps, tol);
+        }
+        vectors += comps;
+        if (vectors >= DIFF_FLUSH_VECTORS) {
+            alignas(16) uint32_t s[4];
+            _mm_store_si128(reinterpret_cast<__m128i *>(s), acc);
+            r.sse += uint64_t{s[0]} + s[1] + s[2] + s[3];
+            acc = zero;
+            vectors = 0;
+        }
+    }
+    alignas(16) uint32_t s[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(s), acc);
+    r.sse += uint64_t{s[0]} + s[1] + s[2] + s[3];
+    alignas(16) uint8_t m[16];
+    _mm_store_si128(reinterpret_cast<__m128i *>(m), vmax);
+    r.max = std::max(r.max, *std::max_element(m, m + 16));
+    diff_reduce_tail(a, b, i, n, comps, tol, r);
+}
+
+// 8 columns at a time, the products of bytes fit in 16 bits
+UTILS_TARGET_SSE41 inline void ssim_sums4_sse(const uint8_t *const *a,
+                                              const uint8_t *const *b,
+                                              const size_t n,
+                                              uint32_t *sums) noexcept {
+    const auto zero = _mm_setzero_si128();
+    size_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        auto sa = zero;
+        auto sb = zero;
+        __m128i sq[3][2] = {{zero, zero}, {zero, zero}, {zero, zero}};
+        for (size_t k = 0; k < 4; ++k) {
+            const auto va = _mm_cvtepu8_epi16(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a[k] + x)));
+            const auto vb = _mm_cvtepu8_epi16(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(b[k] + x)));
+            sa = _mm_add_epi16(sa, va);
+            sb = _mm_add_epi16(sb, vb);
+            const __m128i p[3] = {_mm_mullo_epi16(va, va),
+                                  _mm_mullo_epi16(vb, vb),
+                                  _mm_mullo_epi16(va, vb)};
+            for (size_t j = 0; j < 3; ++j) {
+                sq[j][0] =
+                    _mm_add_epi32(sq[j][0], _mm_unpacklo_epi16(p[j], zero));
+                sq[j][1] =
+                    _mm_add_epi32(sq[j][1], _mm_unpackhi_epi16(p[j], zero));
+            }
+        }
+        const __m128i out[5][2] = {
+            {_mm_unpacklo_epi16(sa, zero), _mm_unpackhi_epi16(sa, zero)},
+            {_mm_unpacklo_epi16(sb, zero), _mm_unpackhi_epi16(sb, zero)},
+            {sq[0][0], sq[0][1]},
+            {sq[1][0], sq[1][1]},
+            {sq[2][0], sq[2][1]}};
+        for (size_t j = 0; j < 5; ++j) {
+            auto *d = reinterpret_cast<__m128i *>(sums + j * n + x);
+            _mm_storeu_si128(d, out[j][0]);
+            _mm_storeu_si128(d + 1, out[j][1]);
+        }
+    }
+    ssim_sums4_tail(a, b, x, n, sums);
+}
+
+//
+// AVX2 kernels, same as above on 32 bytes
+//
+UTILS_TARGET_AVX2 inline void diff_reduce_avx2(const uint8_t *a,
+                                               const uint8_t *b,
+                                               const size_t n,
+                                               const size_t comps,
+                                               const uint8_t tol,
+                                               Diff_Reduce &r) noexcept {
+    const auto zero = _mm256_setzero_si256();
+    const auto vtol = _mm256_set1_epi8(static_cast<char>(tol));
+    const auto block = 32 * comps;
+    auto vmax = zero;
+    auto acc = zero;
+    size_t vectors = 0;
+    size_t i = 0;
+    for (; i + block <= n; i += block) {
+        auto above = zero;
+        for (size_t k = 0; k < block; k += 32) {
+            const auto va = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(a + i + k));
+            const auto vb = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(b + i + k));
+            const auto d = _mm256_or_si256(_mm256_subs_epu8(va, vb),
+                                           _mm256_subs_epu8(vb, va));
+            vmax = _mm256_max_epu8(vmax, d);
+            above = _mm256_or_si256(above, _mm256_subs_epu8(d, vtol));
+            const auto lo = _mm256_unpacklo_epi8(d, zero);
+            const auto hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+        }
+        if (!_mm256_testz_si256(above, above)) {
+            r.diff_pixels += diff_pixels_sse(a + i, b + i, block, comps, tol);
+        }
+        vectors += comps;
+        if (vectors >= DIFF_FLUSH_VECTORS / 2) {
+            alignas(32) uint32_t s[8];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(s), acc);
+            for (const auto v : s) {
+                r.sse += v;
+            }
+            acc = zero;
+            vectors = 0;
+        }
+    }
+    alignas(32) uint32_t s[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(s), acc);
+    for (const auto v : s) {
+        r.sse += v;
+    }
+    alignas(32) uint8_t m[32];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(m), vmax);
+    r.max = std::max(r.max, *std::max_element(m, m + 32));
+    diff_reduce_sse(a + i, b + i, n - i, comps, tol, r);
+}
+
+UTILS_TARGET_AVX2 inline void ssim_sums4_avx2(const uint8_t *const *a,
+                                              const uint8_t *const *b,
+                                              const size_t n,
+                                              uint32_t *sums) noexcept {
+    const auto zero = _mm256_setzero_si256();
+    size_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        auto sa = zero;
+        auto sb = zero;
+        __m256i sq[3][2] = {{zero, zero}, {zero, zero}, {zero, zero}};
+        for (size_t k = 0; k < 4; ++k) {
+            const auto va = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(a[k] + x)));
+            const auto vb = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(b[k] + x)));
+            sa = _mm256_add_epi16(sa, va);
+            sb = _mm256_add_epi16(sb, vb);
+            const __m256i p[3] = {_mm256_mullo_epi16(va, va),
+                                  _mm256_mullo_epi16(vb, vb),
+                                  _mm256_mullo_epi16(va, vb)};
+            for (size_t j = 0; j < 3; ++j) {
+                sq[j][0] = _mm256_add_epi32(
+                    sq[j][0],
+                    _mm256_cvtepu16_epi32(_mm256_castsi256_si128(p[j])));
+                sq[j][1] = _mm256_add_epi32(
+                    sq[j][1],
+                    _mm256_cvtepu16_epi32(_mm256_extracti128_si256(p[j], 1)));
+            }
+        }
+        const __m256i out[5][2] = {
+            {_mm256_cvtepu16_epi32(_mm256_castsi256_si128(sa)),
+             _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sa, 1))},
+            {_mm256_cvtepu16_epi32(_mm256_castsi256_si128(sb)),
+             _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sb, 1))},
+            {sq[0][0], sq[0][1]},
+            {sq[1][0], sq[1][1]},
+            {sq[2][0], sq[2][1]}};
+        for (size_t j = 0; j < 5; ++j) {
+            auto *d = reinterpret_cast<__m256i *>(sums + j * n + x);
+            _mm256_storeu_si256(d, out[j][0]);
+            _mm256_storeu_si256(d + 1, out[j][1]);
+        }
+    }
+    ssim_sums4_tail(a, b, x, n, sums);
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using diff_reduce_fn_t = void (*)(const uint8_t *, const uint8_t *, size_t,
+                                  size_t, uint8_t, Diff_Reduce &) noexcept;
+using ssim_sums4_fn_t = void (*)(const uint8_t *const *,
+                                 const uint8_t *const *, size_t,
+                                 uint32_t *) noexcept;
+inline void diff_reduce(const uint8_t *a, const uint8_t *b, const size_t n,
+                        const size_t comps, const uint8_t tol,
+                        Diff_Reduce &r) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<diff_reduce_fn_t>(
+        diff_reduce_scalar, diff_reduce_sse, diff_reduce_avx2);
+    fn(a, b, n, comps, tol, r);
+#else
+    diff_reduce_scalar(a, b, n, comps, tol, r);
+#endif
+}
+inline void ssim_sums4(const uint8_t *const *a, const uint8_t *const *b,
+                       const size_t n, uint32_t *sums) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<ssim_sums4_fn_t>(
+        ssim_sums4_scalar, ssim_sums4_sse, ssim_sums4_avx2);
+    fn(a, b, n, sums);
+#else
+    ssim_sums4_scalar(a, b, n, sums);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
@@ -0,0 +1,218 @@
+/*
+  cpu_dispatch.h -- Runtime CPU feature detection and kernel selection
+*/
+#ifndef CPU_DISPATCH_HPP
+#define CPU_DISPATCH_HPP
+
+#include "utils/system.hpp"
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Only x86 has SIMD kernels, everything else gets the scalar versions
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+#define UTILS_ARCH_X86 1
+#else
+#define UTILS_ARCH_X86 0
+#endif
+
+#if UTILS_ARCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// Per function target attributes, these let us build SIMD kernels without
+// raising the baseline -march of the whole binary. MSVC does not need them.
+#if UTILS_ARCH_X86 && (defined(__GNUC__) || defined(__clang__))
+#define UTILS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define UTILS_TARGET_AVX2 __attribute__((target("avx2")))
+#define UTILS_TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#define UTILS_TARGET_AVX512VBMI                                                \
+    __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#else
+#define UTILS_TARGET_SSE41
+#define UTILS_TARGET_AVX2
+#define UTILS_TARGET_AVX512BW
+#define UTILS_TARGET_AVX512VBMI
+#endif
+
+namespace utils {
+
+// Instruction set tiers we have kernels for, each implies the ones before it
+enum class Cpu_Tier { Scalar, SSE4_1, AVX2, AVX512BW };
+inline std::ostream &operator<<(std::ostream &os, const Cpu_Tier tier) {
+    switch (tier) {
+    default:
+    case Cpu_Tier::Scalar:
+        os << "Scalar";
+        break;
+    case Cpu_Tier::SSE4_1:
+        os << "SSE4.1";
+        break;
+    case Cpu_Tier::AVX2:
+        os << "AVX2";
+        break;
+    case Cpu_Tier::AVX512BW:
+        os << "AVX-512BW";
+        break;
+    }
+    return os;
+}
+
+namespace detail {
+#if UTILS_ARCH_X86
+struct cpuid_regs {
+    unsigned eax{};
+    unsigned ebx{};
+    unsigned ecx{};
+    unsigned edx{};
+};
+inline cpuid_regs cpuid(const unsigned leaf, const unsigned subleaf) noexcept {
+    cpuid_regs r{};
+#ifdef _MSC_VER
+    int regs[4]{};
+    __cpuidex(regs, static_cast<int>(leaf), static_cast<int>(subleaf));
+    r.eax = static_cast<unsigned>(regs[0]);
+    r.ebx = static_cast<unsigned>(regs[1]);
+    r.ecx = static_cast<unsigned>(regs[2]);
+    r.edx = static_cast<unsigned>(regs[3]);
+#else
+    __cpuid_count(leaf, subleaf, r.eax, r.ebx, r.ecx, r.edx);
+#endif
+    return r;
+}
+// Which register states the OS saves on context switches
+inline uint64_t xgetbv0() noexcept {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax{};
+    unsigned edx{};
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+// Parses the UTILS_CPU_TIER environment variable
+// Returns the highest tier if it is unset or not recognized
+inline Cpu_Tier cpu_tier_env() {
+    constexpr auto env_name = "UTILS_CPU_TIER";
+    auto val = env_var(env_name);
+    if (val.empty()) {
+        return Cpu_Tier::AVX512BW;
+    }
+    for (auto &ch : val) {
+        ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+    }
+    if (val == "scalar") {
+        return Cpu_Tier::Scalar;
+    }
+    if (val == "sse4.1" || val == "sse41") {
+        return Cpu_Tier::SSE4_1;
+    }
+    if (val == "avx2") {
+        return Cpu_Tier::AVX2;
+    }
+    if (val == "avx512bw" || val == "avx512") {
+        return Cpu_Tier::AVX512BW;
+    }
+    std::cerr << "[ERROR] Unknown " << env_name << " (" << val
+              << ")! Expected scalar, sse4.1, avx2 or avx512bw.\n";
+    return Cpu_Tier::AVX512BW;
+}
+} // namespace detail
+
+// Detects the best tier the CPU (and OS) supports with cpuid
+[[nodiscard]] inline Cpu_Tier cpu_detect_tier() noexcept {
+#if UTILS_ARCH_X86
+    const auto max_leaf = detail::cpuid(0, 0).eax;
+    if (max_leaf < 1) {
+        return Cpu_Tier::Scalar;
+    }
+    const auto l1 = detail::cpuid(1, 0);
+    const bool ssse3 = (l1.ecx & (1U << 9)) != 0;
+    const bool sse41 = (l1.ecx & (1U << 19)) != 0;
+    if (!ssse3 || !sse41) {
+        return Cpu_Tier::Scalar;
+    }
+    // AVX needs OS support for saving the YMM registers
+    const bool osxsave = (l1.ecx & (1U << 27)) != 0;
+    const bool avx = (l1.ecx & (1U << 28)) != 0;
+    if (!osxsave || !avx || max_leaf < 7) {
+        return Cpu_Tier::SSE4_1;
+    }
+    const auto xcr0 = detail::xgetbv0();
+    const auto l7 = detail::cpuid(7, 0);
+    const bool ymm_state = (xcr0 & 0x06) == 0x06;
+    const bool avx2 = (l7.ebx & (1U << 5)) != 0;
+    if (!ymm_state || !avx2) {
+        return Cpu_Tier::SSE4_1;
+    }
+    // AVX-512 also needs the opmask and ZMM register states
+    const bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+    const bool avx512f = (l7.ebx & (1U << 16)) != 0;
+    const bool avx512bw = (l7.ebx & (1U << 30)) != 0;
+    if (!zmm_state || !avx512f || !avx512bw) {
+        return Cpu_Tier::AVX2;
+    }
+    return Cpu_Tier::AVX512BW;
+#else
+    return Cpu_Tier::Scalar;
+#endif
+}
+
+// The tier all dispatched kernels use, detected once per process
+// UTILS_CPU_TIER=scalar|sse4.1|avx2|avx512bw can lower it for benchmarking
+[[nodiscard]] inline Cpu_Tier cpu_tier() {
+    static const auto tier = [] {
+        const auto detected = cpu_detect_tier();
+        const auto forced = detail::cpu_tier_env();
+        return forced < detected ? forced : detected;
+    }();
+    return tier;
+}
+
+// AVX-512 VBMI (byte permutes across the whole register) on top of the
+// AVX-512BW tier. Not a tier of its own, only a few kernels have a version.
+[[nodiscard]] inline bool cpu_has_avx512vbmi() {
+#if UTILS_ARCH_X86
+    static const auto vbmi = [] {
+        if (cpu_tier() < Cpu_Tier::AVX512BW) {
+            return false;
+        }
+        return (detail::cpuid(7, 0).ecx & (1U << 1)) != 0;
+    }();
+    return vbmi;
+#else
+    return false;
+#endif
+}
+
+// Picks the best implementation for cpu_tier(), nullptr means no kernel for
+// that tier and we fall back to the next best one
+template <class Fn>
+[[nodiscard]] Fn cpu_select(Fn scalar, Fn sse41, Fn avx2 = nullptr,
+                            Fn avx512bw = nullptr) {
+    const auto tier = cpu_tier();
+    if (tier >= Cpu_Tier::AVX512BW && avx512bw != nullptr) {
+        return avx512bw;
+    }
+    if (tier >= Cpu_Tier::AVX2 && avx2 != nullptr) {
+        return avx2;
+    }
+    if (tier >= Cpu_Tier::SSE4_1 && sse41 != nullptr) {
+        return sse41;
+    }
+    return scalar;
+}
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,497 @@
+/*
+  depth_kernels.h -- Raw kernels for 16 bit per component pixels
+*/
+#ifndef DEPTH_KERNELS_HPP
+#define DEPTH_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include "utils/lut_kernels.hpp"
+#include "utils/pixel_kernels.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+namespace kernels {
+
+// 16 bit components live in byte buffers, these keep the accesses legal
+// for any alignment. They compile to plain loads and stores.
+inline uint16_t load_u16(const uint8_t *p) noexcept {
+    uint16_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+inline void store_u16(uint8_t *p, const uint16_t v) noexcept {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+// 8 -> 16 bits is exact: v * 257 maps 0-255 onto 0-65535
+constexpr uint16_t depth_up(const unsigned v) noexcept {
+    return static_cast<uint16_t>(v * 257);
+}
+// 16 -> 8 bits rounded to nearest, round(v / 257) without a divide.
+// The SIMD kernels saturate v + 128, which gives 255 as well.
+constexpr uint8_t depth_down(const unsigned v) noexcept {
+    const auto t = v + 128;
+    return static_cast<uint8_t>((t - (t >> 8)) >> 8);
+}
+
+// Exact floor(x / 65535) for 0 <= x <= 65535 * 65535
+constexpr unsigned div65535(const unsigned x) noexcept {
+    return (x + 1 + (x >> 16)) >> 16;
+}
+
+//
+// Scalar kernels, also used for the tails of the SIMD kernels
+// n is the number of components for the depth conversions and the number
+// of pixels otherwise. src and dst may point to the same buffer (in place),
+// 8 -> 16 bits walks backwards.
+//
+inline void depth_8_to_16_scalar(const uint8_t *src, uint8_t *dst,
+                                 const size_t n) noexcept {
+    for (size_t i = n; i-- > 0;) {
+        store_u16(dst + i * 2, depth_up(src[i]));
+    }
+}
+inline void depth_16_to_8_scalar(const uint8_t *src, uint8_t *dst,
+                                 const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = depth_down(load_u16(src + i * 2));
+    }
+}
+
+// BT.709 luma like rgb_to_gray_scalar, the Q15 products of 16 bit values
+// still fit in 32 bits
+inline unsigned luma16(const uint8_t *px) noexcept {
+    const auto y = static_cast<unsigned>(LUMA_R) * load_u16(px) +
+                   static_cast<unsigned>(LUMA_G) * load_u16(px + 2) +
+                   static_cast<unsigned>(LUMA_B) * load_u16(px + 4);
+    return y >> LUMA_SHIFT;
+}
+inline void rgb16_to_gray16_scalar(const uint8_t *src, uint8_t *dst,
+                                   const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 6) {
+        store_u16(dst + i * 2, static_cast<uint16_t>(luma16(src)));
+    }
+}
+// Scaled by alpha, like rgba_to_gray_scalar
+inline void rgba16_to_gray16_scalar(const uint8_t *src, uint8_t *dst,
+                                    const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 8) {
+        const auto lum = luma16(src) * load_u16(src + 6);
+        store_u16(dst + i * 2, static_cast<uint16_t>(div65535(lum)));
+    }
+}
+
+// 16 bit version of unpremultiply_px
+inline void unpremultiply16_px(const uint8_t *s, uint8_t *d) noexcept {
+    const unsigned a = load_u16(s + 6);
+    for (size_t c = 0; c < 3; ++c) {
+        const unsigned v = load_u16(s + c * 2);
+        const auto u =
+            a == 0 ? 0U : std::min(0xFFFFU, (v * 0xFFFFU + a / 2) / a);
+        store_u16(d + c * 2, static_cast<uint16_t>(u));
+    }
+    store_u16(d + 6, static_cast<uint16_t>(a));
+}
+// RGBA16 onto a solid 16 bit background into RGB16, rounded
+inline void over_solid16_scalar(const uint8_t *src, uint8_t *dst,
+                                const size_t n, const uint16_t (&bg)[3],
+                                const bool premultiplied) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 8, dst += 6) {
+        const unsigned a = load_u16(src + 6);
+        const auto inv = 0xFFFFU - a;
+        for (size_t c = 0; c < 3; ++c) {
+            const unsigned v = load_u16(src + c * 2);
+            // 64 bit, c * a + bg * (65535 - a) needs 33 bits
+            const auto sum =
+                (premultiplied ? uint64_t{v} * 0xFFFFU : uint64_t{v} * a) +
+                uint64_t{bg[c]} * inv;
+            store_u16(dst + c * 2,
+                      static_cast<uint16_t>((sum + 0x7FFFU) / 0xFFFFU));
+        }
+    }
+}
+
+// 16 bit sRGB decoded to linear light and encoded again, both 65536 entries
+struct Linear_Luma16_Tables {
+    uint16_t decode[65536];
+    uint16_t encode[65536];
+};
+inline const Linear_Luma16_Tables &linear_luma16_tables() {
+    static const auto *tables = [] {
+        auto *t = new Linear_Luma16_Tables{};
+        for (unsigned i = 0; i < 65536; ++i) {
+            t->decode[i] = static_cast<uint16_t>(
+                std::lround(srgb_to_linear(i / 65535.0) * 65535.0));
+            t->encode[i] = static_cast<uint16_t>(
+                std::lround(linear_to_srgb(i / 65535.0) * 65535.0));
+        }
+        return t;
+    }();
+    return *tables;
+}
+
+// 16 bit version of rgb_to_gray_linear
+template <size_t C>
+void rgb16_to_gray16_linear(const uint8_t *src, uint8_t *dst, const size_t n,
+                            const bool premultiplied = false) noexcept {
+    constexpr unsigned half = 1U << (LUMA_SHIFT - 1);
+    const auto &t = linear_luma16_tables();
+    for (size_t i = 0; i < n; ++i, src += C * 2) {
+        const auto lin =
+            (static_cast<unsigned>(LUMA_R) * t.decode[load_u16(src)] +
+             static_cast<unsigned>(LUMA_G) * t.decode[load_u16(src + 2)] +
+             static_cast<unsigned>(LUMA_B) * t.decode[load_u16(src + 4)] +
+             half) >>
+            LUMA_SHIFT;
+        unsigned y = t.encode[lin];
+        if constexpr (C == 4) {
+            if (!premultiplied) {
+                y = div65535(y * load_u16(src + 6));
+            }
+        }
+        store_u16(dst + i * 2, static_cast<uint16_t>(y));
+    }
+}
+
+#if UTILS_ARCH_X86
+//
+// SSE4.1 kernels
+//
+// 16 -> 8 bits of 16 values in two registers, see depth_down
+UTILS_TARGET_SSE41 inline __m128i depth_down_sse(const __m128i a,
+                                                 const __m128i b) {
+    const auto half = _mm_set1_epi16(128);
+    const auto ta = _mm_adds_epu16(a, half);
+    const auto tb = _mm_adds_epu16(b, half);
+    return _mm_packus_epi16(
+        _mm_srli_epi16(_mm_sub_epi16(ta, _mm_srli_epi16(ta, 8)), 8),
+        _mm_srli_epi16(_mm_sub_epi16(tb, _mm_srli_epi16(tb, 8)), 8));
+}
+
+// 16 values per iteration, from the end so it can run in place
+UTILS_TARGET_SSE41 inline void depth_8_to_16_sse(const uint8_t *src,
+                                                 uint8_t *dst,
+                                                 const size_t n) noexcept {
+    auto i = n;
+    for (; i >= 16; i -= 16) {
+        const auto v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src + i - 16));
+        auto *d = reinterpret_cast<__m128i *>(dst + (i - 16) * 2);
+        // (v << 8) | v == v * 257
+        _mm_storeu_si128(d, _mm_unpacklo_epi8(v, v));
+        _mm_storeu_si128(d + 1, _mm_unpackhi_epi8(v, v));
+    }
+    depth_8_to_16_scalar(src, dst, i);
+}
+UTILS_TARGET_SSE41 inline void depth_16_to_8_sse(const uint8_t *src,
+                                                 uint8_t *dst,
+                                                 const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i * 2);
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(dst + i),
+            depth_down_sse(_mm_loadu_si128(s), _mm_loadu_si128(s + 1)));
+    }
+    depth_16_to_8_scalar(src + i * 2, dst + i, n - i);
+}
+
+// 4 pixels as (R, G, B, A) 16 bit lanes in two registers -> 4 luma values
+// in 32 bit lanes. madd is signed, so the values are biased by -32768 and
+// the coefficients times 32768 (2^30) added back afterwards.
+UTILS_TARGET_SSE41 inline __m128i luma16_sse(const __m128i a,
+                                             const __m128i b) {
+    const auto flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    const auto coef = _mm_setr_epi16(LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R,
+                                     LUMA_G, LUMA_B, 0);
+    const auto y = _mm_hadd_epi32(_mm_madd_epi16(_mm_xor_si128(a, flip), coef),
+                                  _mm_madd_epi16(_mm_xor_si128(b, flip), coef));
+    return _mm_srli_epi32(_mm_add_epi32(y, _mm_set1_epi32(1 << 30)),
+                          LUMA_SHIFT);
+}
+// Alpha of the same 4 pixels in 32 bit lanes, times y divided by 65535
+UTILS_TARGET_SSE41 inline __m128i alpha16_scale_sse(const __m128i y,
+                                                    const __m128i a,
+                                                    const __m128i b) {
+    const auto alpha = _mm_castps_si128(
+        _mm_shuffle_ps(_mm_castsi128_ps(_mm_srli_epi64(a, 48)),
+                       _mm_castsi128_ps(_mm_srli_epi64(b, 48)),
+                       _MM_SHUFFLE(2, 0, 2, 0)));
+    const auto lum = _mm_mullo_epi32(y, alpha);
+    return _mm_srli_epi32(
+        _mm_add_epi32(_mm_add_epi32(lum, _mm_set1_epi32(1)),
+                      _mm_srli_epi32(lum, 16)),
+        16);
+}
+// 2 RGB16 pixels at s, widened to (R, G, B, 0) lanes. The second load
+// starts 8 bytes in so neither reads past the 4 pixels at s.
+UTILS_TARGET_SSE41 inline void load_rgb16x4_sse(const uint8_t *s, __m128i &a,
+                                                __m128i &b) {
+    const auto m0 = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10,
+                                  11, -1, -1);
+    const auto m1 = _mm_setr_epi8(4, 5, 6, 7, 8, 9, -1, -1, 10, 11, 12, 13,
+                                  14, 15, -1, -1);
+    a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s)),
+                         m0);
+    b = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 8)), m1);
+}
+
+// 8 pixels per iteration
+UTILS_TARGET_SSE41 inline void rgb16_to_gray16_sse(const uint8_t *src,
+                                                   uint8_t *dst,
+                                                   const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto *s = src + i * 6;
+        __m128i a0;
+        __m128i b0;
+        __m128i a1;
+        __m128i b1;
+        load_rgb16x4_sse(s, a0, b0);
+        load_rgb16x4_sse(s + 24, a1, b1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 2),
+                         _mm_packus_epi32(luma16_sse(a0, b0),
+                                          luma16_sse(a1, b1)));
+    }
+    rgb16_to_gray16_scalar(src + i * 6, dst + i * 2, n - i);
+}
+UTILS_TARGET_SSE41 inline void rgba16_to_gray16_sse(const uint8_t *src,
+                                                    uint8_t *dst,
+                                                    const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i * 8);
+        const auto a0 = _mm_loadu_si128(s);
+        const auto b0 = _mm_loadu_si128(s + 1);
+        const auto a1 = _mm_loadu_si128(s + 2);
+        const auto b1 = _mm_loadu_si128(s + 3);
+        const auto y0 = alpha16_scale_sse(luma16_sse(a0, b0), a0, b0);
+        const auto y1 = alpha16_scale_sse(luma16_sse(a1, b1), a1, b1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 2),
+                         _mm_packus_epi32(y0, y1));
+    }
+    rgba16_to_gray16_scalar(src + i * 8, dst + i * 2, n - i);
+}
+
+//
+// AVX2 kernels, the same on both 128 bit lanes. hadd works per lane, so
+// the 8 luma values come out in the order 0 1 4 5 2 3 6 7.
+//
+UTILS_TARGET_AVX2 inline void depth_8_to_16_avx2(const uint8_t *src,
+                                                 uint8_t *dst,
+                                                 const size_t n) noexcept {
+    auto i = n;
+    for (; i >= 32; i -= 32) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i - 32);
+        const auto lo = _mm256_cvtepu8_epi16(_mm_loadu_si128(s));
+        const auto hi = _mm256_cvtepu8_epi16(_mm_loadu_si128(s + 1));
+        auto *d = reinterpret_cast<__m256i *>(dst + (i - 32) * 2);
+        _mm256_storeu_si256(d, _mm256_or_si256(lo, _mm256_slli_epi16(lo, 8)));
+        _mm256_storeu_si256(d + 1,
+                            _mm256_or_si256(hi, _mm256_slli_epi16(hi, 8)));
+    }
+    depth_8_to_16_sse(src, dst, i);
+}
+UTILS_TARGET_AVX2 inline void depth_16_to_8_avx2(const uint8_t *src,
+                                                 uint8_t *dst,
+                                                 const size_t n) noexcept {
+    const auto half = _mm256_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto *s = reinterpret_cast<const __m256i *>(src + i * 2);
+        auto a = _mm256_adds_epu16(_mm256_loadu_si256(s), half);
+        auto b = _mm256_adds_epu16(_mm256_loadu_si256(s + 1), half);
+        a = _mm256_srli_epi16(_mm256_sub_epi16(a, _mm256_srli_epi16(a, 8)), 8);
+        b = _mm256_srli_epi16(_mm256_sub_epi16(b, _mm256_srli_epi16(b, 8)), 8);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(dst + i),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+    depth_16_to_8_sse(src + i * 2, dst + i, n - i);
+}
+
+UTILS_TARGET_AVX2 inline __m256i luma16_avx2(const __m256i a,
+                                             const __m256i b) {
+    const auto flip = _mm256_set1_epi16(static_cast<short>(0x8000));
+    const auto coef = _mm256_setr_epi16(LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R,
+                                        LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G,
+                                        LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B, 0);
+    const auto y = _mm256_hadd_epi32(
+        _mm256_madd_epi16(_mm256_xor_si256(a, flip), coef),
+        _mm256_madd_epi16(_mm256_xor_si256(b, flip), coef));
+    return _mm256_srli_epi32(_mm256_add_epi32(y, _mm256_set1_epi32(1 << 30)),
+                             LUMA_SHIFT);
+}
+UTILS_TARGET_AVX2 inline __m256i alpha16_scale_avx2(const __m256i y,
+                                                    const __m256i a,
+                                                    const __m256i b) {
+    const auto alpha = _mm256_castps_si256(
+        _mm256_shuffle_ps(_mm256_castsi256_ps(_mm256_srli_epi64(a, 48)),
+                          _mm256_castsi256_ps(_mm256_srli_epi64(b, 48)),
+                          _MM_SHUFFLE(2, 0, 2, 0)));
+    const auto lum = _mm256_mullo_epi32(y, alpha);
+    return _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_add_epi32(lum, _mm256_set1_epi32(1)),
+                         _mm256_srli_epi32(lum, 16)),
+        16);
+}
+// 16 luma values of two luma16_avx2 results -> 16 bit lanes in order
+UTILS_TARGET_AVX2 inline __m256i pack_luma16_avx2(const __m256i y0,
+                                                  const __m256i y1) {
+    // Per lane packing leaves pairs 01 45 89 CD | 23 67 AB EF
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi32(y0, y1), order);
+}
+
+// 8 RGB16 pixels as 0 1 | 2 3 and 4 5 | 6 7, like the RGBA16 loads
+UTILS_TARGET_AVX2 inline void load_rgb16x8_avx2(const uint8_t *s, __m256i &a,
+                                                __m256i &b) {
+    __m128i p01;
+    __m128i p23;
+    __m128i p45;
+    __m128i p67;
+    load_rgb16x4_sse(s, p01, p23);
+    load_rgb16x4_sse(s + 24, p45, p67);
+    a = _mm256_inserti128_si256(_mm256_castsi128_si256(p01), p23, 1);
+    b = _mm256_inserti128_si256(_mm256_castsi128_si256(p45), p67, 1);
+}
+
+// 16 pixels per iteration
+UTILS_TARGET_AVX2 inline void rgb16_to_gray16_avx2(const uint8_t *src,
+                                                   uint8_t *dst,
+                                                   const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = src + i * 6;
+        __m256i a0;
+        __m256i b0;
+        __m256i a1;
+        __m256i b1;
+        load_rgb16x8_avx2(s, a0, b0);
+        load_rgb16x8_avx2(s + 48, a1, b1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 2),
+                            pack_luma16_avx2(luma16_avx2(a0, b0),
+                                             luma16_avx2(a1, b1)));
+    }
+    rgb16_to_gray16_sse(src + i * 6, dst + i * 2, n - i);
+}
+UTILS_TARGET_AVX2 inline void rgba16_to_gray16_avx2(const uint8_t *src,
+                                                    uint8_t *dst,
+                                                    const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = reinterpret_cast<const __m256i *>(src + i * 8);
+        const auto a0 = _mm256_loadu_si256(s);
+        const auto b0 = _mm256_loadu_si256(s + 1);
+        const auto a1 = _mm256_loadu_si256(s + 2);
+        const auto b1 = _mm256_loadu_si256(s + 3);
+        const auto y0 = alpha16_scale_avx2(luma16_avx2(a0, b0), a0, b0);
+        const auto y1 = alpha16_scale_avx2(luma16_avx2(a1, b1), a1, b1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 2),
+                            pack_luma16_avx2(y0, y1));
+    }
+    rgba16_to_gray16_sse(src + i * 8, dst + i * 2, n - i);
+}
+
+//
+// AVX-512BW depth conversions, 64 values per iteration
+//
+// Same GCC intrinsics warning as in lut_kernels.hpp
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+UTILS_TARGET_AVX512BW inline void
+depth_8_to_16_avx512(const uint8_t *src, uint8_t *dst,
+                     const size_t n) noexcept {
+    auto i = n;
+    for (; i >= 64; i -= 64) {
+        const auto *s = reinterpret_cast<const __m256i *>(src + i - 64);
+        const auto lo = _mm512_cvtepu8_epi16(_mm256_loadu_si256(s));
+        const auto hi = _mm512_cvtepu8_epi16(_mm256_loadu_si256(s + 1));
+        auto *d = dst + (i - 64) * 2;
+        _mm512_storeu_si512(d, _mm512_or_si512(lo, _mm512_slli_epi16(lo, 8)));
+        _mm512_storeu_si512(d + 64,
+                            _mm512_or_si512(hi, _mm512_slli_epi16(hi, 8)));
+    }
+    depth_8_to_16_avx2(src, dst, i);
+}
+UTILS_TARGET_AVX512BW inline void
+depth_16_to_8_avx512(const uint8_t *src, uint8_t *dst,
+                     const size_t n) noexcept {
+    const auto half = _mm512_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto *s = src + i * 2;
+        auto a = _mm512_adds_epu16(_mm512_loadu_si512(s), half);
+        auto b = _mm512_adds_epu16(_mm512_loadu_si512(s + 64), half);
+        a = _mm512_srli_epi16(_mm512_sub_epi16(a, _mm512_srli_epi16(a, 8)), 8);
+        b = _mm512_srli_epi16(_mm512_sub_epi16(b, _mm512_srli_epi16(b, 8)), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                            _mm512_cvtepi16_epi8(a));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 32),
+                            _mm512_cvtepi16_epi8(b));
+    }
+    depth_16_to_8_avx2(src + i * 2, dst + i, n - i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using depth_kernel_t = void (*)(const uint8_t *, uint8_t *, size_t) noexcept;
+inline void depth_8_to_16(const uint8_t *src, uint8_t *dst,
+                          const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<depth_kernel_t>(
+        depth_8_to_16_scalar, depth_8_to_16_sse, depth_8_to_16_avx2,
+        depth_8_to_16_avx512);
+    fn(src, dst, n);
+#else
+    depth_8_to_16_scalar(src, dst, n);
+#endif
+}
+inline void depth_16_to_8(const uint8_t *src, uint8_t *dst,
+                          const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<depth_kernel_t>(
+        depth_16_to_8_scalar, depth_16_to_8_sse, depth_16_to_8_avx2,
+        depth_16_to_8_avx512);
+    fn(src, dst, n);
+#else
+    depth_16_to_8_scalar(src, dst, n);
+#endif
+}
+inline void rgb16_to_gray16(const uint8_t *src, uint8_t *dst,
+                            const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<depth_kernel_t>(
+        rgb16_to_gray16_scalar, rgb16_to_gray16_sse, rgb16_to_gray16_avx2);
+    fn(src, dst, n);
+#else
+    rgb16_to_gray16_scalar(src, dst, n);
+#endif
+}
+inline void rgba16_to_gray16(const uint8_t *src, uint8_t *dst,
+                             const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<depth_kernel_t>(
+        rgba16_to_gray16_scalar, rgba16_to_gray16_sse, rgba16_to_gray16_avx2);
+    fn(src, dst, n);
+#else
+    rgba16_to_gray16_scalar(src, dst, n);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
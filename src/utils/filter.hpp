@@ -0,0 +1,418 @@
+/*
+  filter.h -- Blurs, sharpening and edge detection of pixel views
+*/
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include "utils/filter_kernels.hpp"
+#include "utils/pixel_alloc.hpp"
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/resample_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace utils {
+
+// Gradient operators for edge_detect, Scharr is more rotation invariant
+enum class Edge_Filter { Sobel, Scharr };
+inline std::ostream &operator<<(std::ostream &os, const Edge_Filter f) {
+    switch (f) {
+    default:
+    case Edge_Filter::Sobel:
+        os << "Sobel";
+        break;
+    case Edge_Filter::Scharr:
+        os << "Scharr";
+        break;
+    }
+    return os;
+}
+
+// Unsharp mask: src + amount * (src - gaussian_blur(src, sigma)), only where
+// the difference is larger than threshold (0-255) so flat areas keep their
+// noise level
+struct Sharpen_Opts {
+    double sigma{1.0};
+    double amount{1.0};
+    int threshold{0};
+    // Split large images into row bands and run them on the shared pool
+    bool parallel{false};
+};
+
+// Column tiles are sized so the rows a tile keeps around fit in L2
+constexpr size_t FILTER_TILE_BYTES = 256 * 1024;
+
+namespace detail {
+// Both views valid, same 8 bit format and size, and not the same memory
+// (the row passes read rows of src around each dst row)
+inline bool check_filter_views(const Const_Pixels_View src,
+                               const Pixels_View dst, const char *what) {
+    if (!src.is_valid() || !dst.is_valid()) {
+        std::cerr << "[ERROR] " << what << " needs valid pixel views!\n";
+        return false;
+    }
+    if (pxfmt_depth(src.format()) != 1) {
+        std::cerr << "[ERROR] Cannot " << what << ' ' << src.format()
+                  << " pixels!\n";
+        return false;
+    }
+    if (src.format() != dst.format() || src.width() != dst.width() ||
+        src.height() != dst.height()) {
+        std::cerr << "[ERROR] Pixel views do not match! (" << src.format()
+                  << ' ' << src.width() << 'x' << src.height() << " -> "
+                  << dst.format() << ' ' << dst.width() << 'x'
+                  << dst.height() << ")\n";
+        return false;
+    }
+    const auto *src_end = src.row(src.height() - 1) + src.row_bytes();
+    const auto *dst_end = dst.row(dst.height() - 1) + dst.row_bytes();
+    if (src.data() < dst_end && dst.data() < src_end) {
+        std::cerr << "[ERROR] Pixel views overlap, cannot " << what << "!\n";
+        return false;
+    }
+    return true;
+}
+
+inline size_t clamp_index(const std::ptrdiff_t i,
+                          const size_t count) noexcept {
+    const auto last = static_cast<std::ptrdiff_t>(count) - 1;
+    return static_cast<size_t>(std::clamp<std::ptrdiff_t>(i, 0, last));
+}
+
+// Copies pixels [first, first + count) of a row of w pixels to pad, pixels
+// past either edge repeat the edge pixel
+inline void pad_row(const uint8_t *row, const size_t w, const size_t comps,
+                    const std::ptrdiff_t first, const size_t count,
+                    uint8_t *pad) noexcept {
+    const auto end = first + static_cast<std::ptrdiff_t>(count);
+    const auto in_beg = std::clamp<std::ptrdiff_t>(first, 0, end);
+    const auto in_end =
+        std::clamp<std::ptrdiff_t>(end, in_beg, static_cast<std::ptrdiff_t>(w));
+    auto *out = pad;
+    for (auto x = first; x < in_beg; ++x, out += comps) {
+        std::memcpy(out, row, comps);
+    }
+    const auto n = static_cast<size_t>(in_end - in_beg) * comps;
+    std::memcpy(out, row + static_cast<size_t>(in_beg) * comps, n);
+    out += n;
+    const auto *edge = row + (w - 1) * comps;
+    for (auto x = std::max(in_end, first); x < end; ++x, out += comps) {
+        std::memcpy(out, edge, comps);
+    }
+}
+
+// Q14 weights of a normalized gaussian, 2 * ceil(3 * sigma) + 1 taps
+inline std::vector<int16_t> gaussian_weights(const double sigma) {
+    const auto r = std::max(1, static_cast<int>(std::ceil(3.0 * sigma)));
+    std::vector<double> g(static_cast<size_t>(2 * r + 1));
+    double sum = 0.0;
+    for (int i = -r; i <= r; ++i) {
+        const auto v = std::exp(-(i * i) / (2.0 * sigma * sigma));
+        g[static_cast<size_t>(i + r)] = v;
+        sum += v;
+    }
+    std::vector<int16_t> w(g.size());
+    int total = 0;
+    for (size_t i = 0; i < g.size(); ++i) {
+        w[i] = static_cast<int16_t>(
+            std::lround(g[i] / sum * (1 << kernels::RESAMPLE_SHIFT)));
+        total += w[i];
+    }
+    // Rounding leftovers go to the centre so the weights sum to exactly 1
+    const auto c = static_cast<size_t>(r);
+    w[c] = static_cast<int16_t>(w[c] + (1 << kernels::RESAMPLE_SHIFT) - total);
+    return w;
+}
+
+// Pixels per column tile when every tile keeps rows_kept rows around
+inline size_t filter_tile_width(const size_t w, const size_t comps,
+                                const size_t rows_kept) noexcept {
+    const auto px = FILTER_TILE_BYTES / (rows_kept * comps);
+    return std::min(w, std::max<size_t>(64, px));
+}
+
+// Separable convolution of src into dst with symmetric weights w, in column
+// tiles of every row band. Each tile row of src is padded with its halo and
+// filtered horizontally into a ring of taps rows, the vertical pass then
+// reads the ring through row pointers, clamped at the top and bottom.
+// Both passes are resample_vertical: horizontally the taps are the padded
+// row shifted by one pixel each. post(y, x0, n) runs on every finished
+// stretch of n bytes of dst row y from byte x0 on, while it is in cache.
+template <class Post>
+void convolve_rows(const Const_Pixels_View src, const Pixels_View dst,
+                   const std::vector<int16_t> &w, const bool parallel,
+                   const Post &post) {
+    const auto width = static_cast<size_t>(src.width());
+    const auto height = static_cast<size_t>(src.height());
+    const auto comps = static_cast<size_t>(pxfmt_components(src.format()));
+    const auto taps = w.size();
+    const auto r = static_cast<std::ptrdiff_t>(taps / 2);
+    const auto tile_w = filter_tile_width(width, comps, taps + 1);
+    for_row_bands(height, src.row_bytes(), parallel, [&](const size_t first,
+                                                         const size_t last) {
+        const auto ring_pitch = tile_w * comps;
+        pixel_buf_t ring(ring_pitch * taps);
+        pixel_buf_t pad((tile_w + taps) * comps);
+        std::vector<const uint8_t *> hrows(taps);
+        std::vector<const uint8_t *> vrows(taps);
+        for (size_t x0 = 0; x0 < width; x0 += tile_w) {
+            const auto n = std::min(tile_w, width - x0);
+            const auto bytes = n * comps;
+            for (size_t k = 0; k < taps; ++k) {
+                hrows[k] = pad.data() + k * comps;
+            }
+            const auto slot = [&](const size_t y) {
+                return ring.data() + (y % taps) * ring_pitch;
+            };
+            auto next = clamp_index(static_cast<std::ptrdiff_t>(first) - r,
+                                    height);
+            for (auto y = first; y < last; ++y) {
+                const auto yi = static_cast<std::ptrdiff_t>(y);
+                const auto need = clamp_index(yi + r, height);
+                for (; next <= need; ++next) {
+                    pad_row(src.row(static_cast<int>(next)), width, comps,
+                            static_cast<std::ptrdiff_t>(x0) - r, n + taps - 1,
+                            pad.data());
+                    kernels::resample_vertical(hrows.data(), w.data(), taps,
+                                               slot(next), bytes);
+                }
+                for (size_t k = 0; k < taps; ++k) {
+                    vrows[k] = slot(clamp_index(
+                        yi - r + static_cast<std::ptrdiff_t>(k), height));
+                }
+                auto *out = dst.row(static_cast<int>(y)) + x0 * comps;
+                kernels::resample_vertical(vrows.data(), w.data(), taps, out,
+                                           bytes);
+                post(y, x0 * comps, bytes);
+            }
+        }
+    });
+}
+
+template <size_t C>
+void box_pass_h(const Const_Pixels_View src, uint8_t *tmp, const size_t pitch,
+                const size_t radius, const uint32_t mul, const bool parallel) {
+    const auto w = static_cast<size_t>(src.width());
+    const auto r = static_cast<std::ptrdiff_t>(radius);
+    for_row_bands(static_cast<size_t>(src.height()), pitch, parallel,
+                  [&](const size_t first, const size_t last) {
+                      pixel_buf_t pad((w + 2 * radius + 1) * C);
+                      for (auto y = first; y < last; ++y) {
+                          pad_row(src.row(static_cast<int>(y)), w, C, -r,
+                                  w + 2 * radius + 1, pad.data());
+                          kernels::box_horizontal<C>(pad.data(),
+                                                     tmp + y * pitch, w,
+                                                     radius, mul);
+                      }
+                  });
+}
+} // namespace detail
+
+// Gaussian blur of src into dst, both the same size and format
+// Weights out to 3 sigma, fixed point Q14 like resize(). RGBA channels are
+// all blurred the same way, premultiply first so transparent pixels do not
+// bleed their colour.
+inline bool gaussian_blur(const Const_Pixels_View src, const Pixels_View dst,
+                          const double sigma, const bool parallel = false) {
+    if (!detail::check_filter_views(src, dst, "blur")) {
+        return false;
+    }
+    if (!(sigma > 0.0) || sigma > 1000.0) {
+        std::cerr << "[ERROR] Invalid blur sigma (" << sigma << ")!\n";
+        return false;
+    }
+    detail::convolve_rows(src, dst, detail::gaussian_weights(sigma), parallel,
+                          [](size_t, size_t, size_t) {});
+    return true;
+}
+
+// Mean of the (2 * radius + 1)^2 pixels around every pixel, edges clamped
+// Running sums in both directions, so a large radius costs the same as a
+// small one. Three box blurs in a row come close to a gaussian.
+inline bool box_blur(const Const_Pixels_View src, const Pixels_View dst,
+                     const int radius, const bool parallel = false) {
+    if (!detail::check_filter_views(src, dst, "blur")) {
+        return false;
+    }
+    if (radius < 0 || radius > PIXELS_MAX_DIM) {
+        std::cerr << "[ERROR] Invalid box blur radius (" << radius << ")!\n";
+        return false;
+    }
+    if (radius == 0) {
+        return convert_view(src, dst);
+    }
+    const auto h = static_cast<size_t>(src.height());
+    const auto rb = src.row_bytes();
+    const auto r = static_cast<size_t>(radius);
+    const auto mul = kernels::box_mul(2 * r + 1);
+
+    // Horizontal pass into a temporary image
+    pixel_buf_t tmp(rb * h);
+    switch (src.format()) {
+    case Pixel_Format::RGB:
+        detail::box_pass_h<3>(src, tmp.data(), rb, r, mul, parallel);
+        break;
+    case Pixel_Format::RGBA:
+        detail::box_pass_h<4>(src, tmp.data(), rb, r, mul, parallel);
+        break;
+    case Pixel_Format::GRAY:
+        detail::box_pass_h<1>(src, tmp.data(), rb, r, mul, parallel);
+        break;
+    case Pixel_Format::RGB16:
+    case Pixel_Format::RGBA16:
+    case Pixel_Format::GRAY16:
+    case Pixel_Format::Unknown:
+    default:
+        return false;
+    }
+
+    // Vertical pass, column sums of a tile slide down each band
+    const auto tile = std::min(rb, FILTER_TILE_BYTES / 8);
+    const auto ri = static_cast<std::ptrdiff_t>(r);
+    const auto row = [&](const std::ptrdiff_t y) {
+        return tmp.data() + detail::clamp_index(y, h) * rb;
+    };
+    detail::for_row_bands(h, rb, parallel, [&](const size_t first,
+                                               const size_t last) {
+        std::vector<uint32_t> sums(tile);
+        const auto fi = static_cast<std::ptrdiff_t>(first);
+        for (size_t x0 = 0; x0 < rb; x0 += tile) {
+            const auto n = std::min(tile, rb - x0);
+            std::fill(sums.begin(), sums.end(), 0u);
+            for (auto y = fi - ri - 1; y < fi + ri; ++y) {
+                const auto *s = row(y) + x0;
+                for (size_t x = 0; x < n; ++x) {
+                    sums[x] += s[x];
+                }
+            }
+            for (auto y = fi; y < static_cast<std::ptrdiff_t>(last); ++y) {
+                kernels::box_vertical(row(y + ri) + x0, row(y - ri - 1) + x0,
+                                      sums.data(),
+                                      dst.row(static_cast<int>(y)) + x0, n,
+                                      mul);
+            }
+        }
+    });
+    return true;
+}
+
+// Unsharp mask of src into dst, see Sharpen_Opts. The blur and the mask run
+// tile by tile so the blurred pixels never leave the cache. RGBA alpha is
+// copied as is.
+inline bool sharpen(const Const_Pixels_View src, const Pixels_View dst,
+                    const Sharpen_Opts &opts = {}) {
+    if (!detail::check_filter_views(src, dst, "sharpen")) {
+        return false;
+    }
+    if (!(opts.sigma > 0.0) || opts.sigma > 1000.0 || !(opts.amount >= 0.0) ||
+        opts.amount > 127.0 || opts.threshold < 0 || opts.threshold > 255) {
+        std::cerr << "[ERROR] Invalid sharpen options (sigma " << opts.sigma
+                  << ", amount " << opts.amount << ", threshold "
+                  << opts.threshold << ")!\n";
+        return false;
+    }
+    const auto amount = static_cast<int16_t>(
+        std::min(32767L, std::lround(opts.amount * 256.0)));
+    const auto threshold = static_cast<int16_t>(opts.threshold);
+    const auto keep_alpha = src.format() == Pixel_Format::RGBA;
+    detail::convolve_rows(
+        src, dst, detail::gaussian_weights(opts.sigma), opts.parallel,
+        [&](const size_t y, const size_t x0, const size_t n) {
+            const auto yi = static_cast<int>(y);
+            auto *d = dst.row(yi) + x0;
+            kernels::unsharp(src.row(yi) + x0, d, d, n, amount, threshold,
+                             keep_alpha);
+        });
+    return true;
+}
+
+// Gradient magnitude of every channel of src into dst, edges clamped
+// Scaled so a step from 0 to 255 reads 255. RGBA alpha is copied as is.
+inline bool edge_detect(const Const_Pixels_View src, const Pixels_View dst,
+                        const Edge_Filter filter = Edge_Filter::Sobel,
+                        const bool parallel = false) {
+    if (!detail::check_filter_views(src, dst, "detect edges")) {
+        return false;
+    }
+    const auto scharr = filter == Edge_Filter::Scharr;
+    const auto a = static_cast<int16_t>(scharr ? 3 : 1);
+    const auto b = static_cast<int16_t>(scharr ? 10 : 2);
+    const auto scale = 1.0f / static_cast<float>(2 * a + b);
+    const auto w = static_cast<size_t>(src.width());
+    const auto h = static_cast<size_t>(src.height());
+    const auto comps = static_cast<size_t>(pxfmt_components(src.format()));
+    const auto rb = src.row_bytes();
+    const auto keep_alpha = src.format() == Pixel_Format::RGBA;
+    detail::for_row_bands(h, rb, parallel, [&](const size_t first,
+                                               const size_t last) {
+        // Ring of the 3 rows around y, each padded by a pixel on both sides
+        const auto pitch = rb + 2 * comps;
+        pixel_buf_t ring(pitch * 3);
+        const auto slot = [&](const size_t y) {
+            return ring.data() + (y % 3) * pitch;
+        };
+        auto next =
+            detail::clamp_index(static_cast<std::ptrdiff_t>(first) - 1, h);
+        for (auto y = first; y < last; ++y) {
+            const auto yi = static_cast<std::ptrdiff_t>(y);
+            for (; next <= detail::clamp_index(yi + 1, h); ++next) {
+                detail::pad_row(src.row(static_cast<int>(next)), w, comps, -1,
+                                w + 2, slot(next));
+            }
+            auto *out = dst.row(static_cast<int>(y));
+            kernels::edges(slot(detail::clamp_index(yi - 1, h)) + comps,
+                           slot(y) + comps,
+                           slot(detail::clamp_index(yi + 1, h)) + comps, out,
+                           rb, comps, a, b, scale);
+            if (keep_alpha) {
+                const auto *s = src.row(static_cast<int>(y));
+                for (size_t x = 3; x < rb; x += 4) {
+                    out[x] = s[x];
+                }
+            }
+        }
+    });
+    return true;
+}
+
+// Same as above into new Pixels of the size and format of src
+inline Pixels gaussian_blur(const Const_Pixels_View src, const double sigma,
+                            const bool parallel = false) {
+    Pixels p{src.format(), src.width(), src.height()};
+    if (!p.is_valid() || !gaussian_blur(src, p.view(), sigma, parallel)) {
+        p.clear();
+    }
+    return p;
+}
+inline Pixels box_blur(const Const_Pixels_View src, const int radius,
+                       const bool parallel = false) {
+    Pixels p{src.format(), src.width(), src.height()};
+    if (!p.is_valid() || !box_blur(src, p.view(), radius, parallel)) {
+        p.clear();
+    }
+    return p;
+}
+inline Pixels sharpen(const Const_Pixels_View src, const Sharpen_Opts &opts) {
+    Pixels p{src.format(), src.width(), src.height()};
+    if (!p.is_valid() || !sharpen(src, p.view(), opts)) {
+        p.clear();
+    }
+    return p;
+}
+inline Pixels edge_detect(const Const_Pixels_View src,
+                          const Edge_Filter filter,
+                          const bool parallel = false) {
+    Pixels p{src.format(), src.width(), src.height()};
+    if (!p.is_valid() || !edge_detect(src, p.view(), filter, parallel)) {
+        p.clear();
+    }
+    return p;
+}
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,441 @@
+/*
+  filter_kernels.h -- Raw fixed point kernels for blurs, sharpening and edges
+*/
+#ifndef FILTER_KERNELS_HPP
+#define FILTER_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+namespace kernels {
+
+// Box sums are scaled by a Q23 reciprocal of the window size, the product
+// stays below 2^31 for any window of bytes
+constexpr int BOX_SHIFT = 23;
+constexpr uint32_t BOX_HALF = 1u << (BOX_SHIFT - 1);
+
+inline uint32_t box_mul(const size_t window) noexcept {
+    return static_cast<uint32_t>(((size_t{1} << BOX_SHIFT) + window / 2) /
+                                 window);
+}
+constexpr uint8_t box_scale(const uint32_t sum, const uint32_t mul) noexcept {
+    return static_cast<uint8_t>((sum * mul + BOX_HALF) >> BOX_SHIFT);
+}
+
+//
+// Horizontal box: mean of the 2 * radius + 1 pixels around each of the w
+// pixels of a row. pad holds the row with radius edge pixels before it and
+// radius + 1 after it. A running sum per channel, so the cost does not
+// depend on the radius.
+//
+template <size_t C>
+void box_horizontal(const uint8_t *pad, uint8_t *dst, const size_t w,
+                    const size_t radius, const uint32_t mul) noexcept {
+    uint32_t acc[C] = {};
+    for (size_t k = 0; k < 2 * radius + 1; ++k) {
+        for (size_t c = 0; c < C; ++c) {
+            acc[c] += pad[k * C + c];
+        }
+    }
+    const auto *in = pad + (2 * radius + 1) * C;
+    for (size_t x = 0; x < w; ++x, pad += C, in += C, dst += C) {
+        for (size_t c = 0; c < C; ++c) {
+            dst[c] = box_scale(acc[c], mul);
+            acc[c] = acc[c] + in[c] - pad[c];
+        }
+    }
+}
+
+//
+// Vertical box step over n bytes: sums += add - sub, then dst = sums scaled
+// sums holds the column sums of the window ending at the row before add
+//
+inline void box_vertical_tail(const uint8_t *add, const uint8_t *sub,
+                              uint32_t *sums, uint8_t *dst, const size_t first,
+                              const size_t n, const uint32_t mul) noexcept {
+    for (auto x = first; x < n; ++x) {
+        sums[x] = sums[x] + add[x] - sub[x];
+        dst[x] = box_scale(sums[x], mul);
+    }
+}
+inline void box_vertical_scalar(const uint8_t *add, const uint8_t *sub,
+                                uint32_t *sums, uint8_t *dst, const size_t n,
+                                const uint32_t mul) noexcept {
+    box_vertical_tail(add, sub, sums, dst, 0, n, mul);
+}
+
+//
+// Unsharp mask over n bytes: dst = src + amount * (src - blur) wherever
+// |src - blur| > threshold. amount is Q8, so (d << 7) * amount >> 15 with
+// rounding, what mulhrs does. dst may be blur. With keep_alpha every 4th
+// byte (RGBA alpha) is left as in src.
+//
+inline void unsharp_tail(const uint8_t *src, const uint8_t *blur,
+                         uint8_t *dst, const size_t first, const size_t n,
+                         const int16_t amount, const int16_t threshold,
+                         const bool keep_alpha) noexcept {
+    for (auto x = first; x < n; ++x) {
+        const auto d = src[x] - blur[x];
+        auto v = 0;
+        if (std::abs(d) > threshold && !(keep_alpha && x % 4 == 3)) {
+            v = (d * 128 * amount + (1 << 14)) >> 15;
+        }
+        dst[x] = static_cast<uint8_t>(std::clamp(src[x] + v, 0, 255));
+    }
+}
+inline void unsharp_scalar(const uint8_t *src, const uint8_t *blur,
+                           uint8_t *dst, const size_t n, const int16_t amount,
+                           const int16_t threshold,
+                           const bool keep_alpha) noexcept {
+    unsharp_tail(src, blur, dst, 0, n, amount, threshold, keep_alpha);
+}
+
+//
+// Sobel and Scharr gradients over n bytes of comps channels, from three rows
+// padded with comps bytes on both sides. The smoothing weights are
+// (a, b, a), dst is the gradient magnitude times scale, saturated.
+//
+inline uint8_t edge_magnitude(const int gx, const int gy,
+                              const float scale) noexcept {
+    const auto fx = static_cast<float>(gx);
+    const auto fy = static_cast<float>(gy);
+    const auto m = std::sqrt(fx * fx + fy * fy) * scale + 0.5f;
+    return m >= 255.0f ? uint8_t{255} : static_cast<uint8_t>(m);
+}
+inline void edges_tail(const uint8_t *p0, const uint8_t *p1,
+                       const uint8_t *p2, uint8_t *dst, const size_t first,
+                       const size_t n, const size_t comps, const int16_t a,
+                       const int16_t b, const float scale) noexcept {
+    const auto c = static_cast<std::ptrdiff_t>(comps);
+    for (auto x = first; x < n; ++x) {
+        const auto *q0 = p0 + x;
+        const auto *q1 = p1 + x;
+        const auto *q2 = p2 + x;
+        const auto gx = a * (q0[c] - q0[-c]) + b * (q1[c] - q1[-c]) +
+                        a * (q2[c] - q2[-c]);
+        const auto gy = a * (q2[-c] - q0[-c]) + b * (q2[0] - q0[0]) +
+                        a * (q2[c] - q0[c]);
+        dst[x] = edge_magnitude(gx, gy, scale);
+    }
+}
+inline void edges_scalar(const uint8_t *p0, const uint8_t *p1,
+                         const uint8_t *p2, uint8_t *dst, const size_t n,
+                         const size_t comps, const int16_t a, const int16_t b,
+                         const float scale) noexcept {
+    edges_tail(p0, p1, p2, dst, 0, n, comps, a, b, scale);
+}
+
+#if UTILS_ARCH_X86
+//
+// SSE4.1 kernels, 8 bytes per iteration in 16 or 32 bit lanes
+//
+UTILS_TARGET_SSE41 inline __m128i load8_epu16_sse(const uint8_t *p) noexcept {
+    return _mm_cvtepu8_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+}
+
+UTILS_TARGET_SSE41 inline void
+box_vertical_sse(const uint8_t *add, const uint8_t *sub, uint32_t *sums,
+                 uint8_t *dst, const size_t n, const uint32_t mul) noexcept {
+    const auto m = _mm_set1_epi32(static_cast<int>(mul));
+    const auto half = _mm_set1_epi32(static_cast<int>(BOX_HALF));
+    size_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const auto a =
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(add + x));
+        const auto s =
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(sub + x));
+        auto *p = reinterpret_cast<__m128i *>(sums + x);
+        auto s0 = _mm_loadu_si128(p);
+        auto s1 = _mm_loadu_si128(p + 1);
+        s0 = _mm_sub_epi32(_mm_add_epi32(s0, _mm_cvtepu8_epi32(a)),
+                           _mm_cvtepu8_epi32(s));
+        s1 = _mm_sub_epi32(
+            _mm_add_epi32(s1, _mm_cvtepu8_epi32(_mm_srli_si128(a, 4))),
+            _mm_cvtepu8_epi32(_mm_srli_si128(s, 4)));
+        _mm_storeu_si128(p, s0);
+        _mm_storeu_si128(p + 1, s1);
+        const auto q0 = _mm_srli_epi32(
+            _mm_add_epi32(_mm_mullo_epi32(s0, m), half), BOX_SHIFT);
+        const auto q1 = _mm_srli_epi32(
+            _mm_add_epi32(_mm_mullo_epi32(s1, m), half), BOX_SHIFT);
+        const auto q = _mm_packus_epi32(q0, q1);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x),
+                         _mm_packus_epi16(q, q));
+    }
+    box_vertical_tail(add, sub, sums, dst, x, n, mul);
+}
+
+// Alpha lanes of 16 bit RGBA channels cleared, or all lanes set
+UTILS_TARGET_SSE41 inline __m128i
+unsharp_mask_sse(const bool keep_alpha) noexcept {
+    return keep_alpha ? _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0)
+                      : _mm_set1_epi16(-1);
+}
+
+UTILS_TARGET_SSE41 inline void
+unsharp_sse(const uint8_t *src, const uint8_t *blur, uint8_t *dst,
+            const size_t n, const int16_t amount, const int16_t threshold,
+            const bool keep_alpha) noexcept {
+    const auto amt = _mm_set1_epi16(amount);
+    const auto thr = _mm_set1_epi16(threshold);
+    const auto lanes = unsharp_mask_sse(keep_alpha);
+    size_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const auto s = load8_epu16_sse(src + x);
+        const auto d = _mm_sub_epi16(s, load8_epu16_sse(blur + x));
+        const auto keep =
+            _mm_and_si128(_mm_cmpgt_epi16(_mm_abs_epi16(d), thr), lanes);
+        const auto v = _mm_and_si128(
+            _mm_mulhrs_epi16(_mm_slli_epi16(d, 7), amt), keep);
+        const auto r = _mm_adds_epi16(s, v);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x),
+                         _mm_packus_epi16(r, r));
+    }
+    unsharp_tail(src, blur, dst, x, n, amount, threshold, keep_alpha);
+}
+
+// Gradients of 8 bytes as 16 bit lanes
+UTILS_TARGET_SSE41 inline void
+edges_grad_sse(const uint8_t *p0, const uint8_t *p1, const uint8_t *p2,
+               const size_t x, const size_t comps, const __m128i a,
+               const __m128i b, __m128i &gx, __m128i &gy) noexcept {
+    p0 += x;
+    p1 += x;
+    p2 += x;
+    const auto l0 = load8_epu16_sse(p0 - comps);
+    const auto r0 = load8_epu16_sse(p0 + comps);
+    const auto l2 = load8_epu16_sse(p2 - comps);
+    const auto r2 = load8_epu16_sse(p2 + comps);
+    gx = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_add_epi16(_mm_sub_epi16(r0, l0),
+                                      _mm_sub_epi16(r2, l2)),
+                        a),
+        _mm_mullo_epi16(
+            _mm_sub_epi16(load8_epu16_sse(p1 + comps),
+                          load8_epu16_sse(p1 - comps)),
+            b));
+    gy = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_add_epi16(_mm_sub_epi16(l2, l0),
+                                      _mm_sub_epi16(r2, r0)),
+                        a),
+        _mm_mullo_epi16(
+            _mm_sub_epi16(load8_epu16_sse(p2), load8_epu16_sse(p0)),
+            b));
+}
+
+// Magnitude of 4 gradients in 32 bit lanes, same steps as edge_magnitude
+UTILS_TARGET_SSE41 inline __m128i edges_mag_sse(const __m128i gx,
+                                                const __m128i gy,
+                                                const __m128 scale) noexcept {
+    const auto fx = _mm_cvtepi32_ps(gx);
+    const auto fy = _mm_cvtepi32_ps(gy);
+    const auto m = _mm_sqrt_ps(
+        _mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy)));
+    return _mm_cvttps_epi32(
+        _mm_add_ps(_mm_mul_ps(m, scale), _mm_set1_ps(0.5f)));
+}
+
+UTILS_TARGET_SSE41 inline void
+edges_sse(const uint8_t *p0, const uint8_t *p1, const uint8_t *p2,
+          uint8_t *dst, const size_t n, const size_t comps, const int16_t a,
+          const int16_t b, const float scale) noexcept {
+    const auto va = _mm_set1_epi16(a);
+    const auto vb = _mm_set1_epi16(b);
+    const auto vs = _mm_set1_ps(scale);
+    size_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i gx;
+        __m128i gy;
+        edges_grad_sse(p0, p1, p2, x, comps, va, vb, gx, gy);
+        const auto lo = edges_mag_sse(_mm_cvtepi16_epi32(gx),
+                                      _mm_cvtepi16_epi32(gy), vs);
+        const auto hi = edges_mag_sse(_mm_cvtepi16_epi32(_mm_srli_si128(gx, 8)),
+                                      _mm_cvtepi16_epi32(_mm_srli_si128(gy, 8)),
+                                      vs);
+        const auto q = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x),
+                         _mm_packus_epi16(q, q));
+    }
+    edges_tail(p0, p1, p2, dst, x, n, comps, a, b, scale);
+}
+
+//
+// AVX2 kernels, the same on 16 bytes per iteration
+// Lane crossing packs are put back in order with a 64 bit permute
+//
+UTILS_TARGET_AVX2 inline __m256i load16_epu16_avx2(const uint8_t *p) noexcept {
+    return _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+UTILS_TARGET_AVX2 inline void store16_epi16_avx2(uint8_t *p,
+                                                 const __m256i v) noexcept {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p),
+                     _mm_packus_epi16(_mm256_castsi256_si128(v),
+                                      _mm256_extracti128_si256(v, 1)));
+}
+UTILS_TARGET_AVX2 inline void store16_epi32_avx2(uint8_t *p, const __m256i lo,
+                                                 const __m256i hi) noexcept {
+    store16_epi16_avx2(
+        p, _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8));
+}
+
+UTILS_TARGET_AVX2 inline void
+box_vertical_avx2(const uint8_t *add, const uint8_t *sub, uint32_t *sums,
+                  uint8_t *dst, const size_t n, const uint32_t mul) noexcept {
+    const auto m = _mm256_set1_epi32(static_cast<int>(mul));
+    const auto half = _mm256_set1_epi32(static_cast<int>(BOX_HALF));
+    size_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        const auto a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(add + x));
+        const auto s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(sub + x));
+        auto *p = reinterpret_cast<__m256i *>(sums + x);
+        auto s0 = _mm256_loadu_si256(p);
+        auto s1 = _mm256_loadu_si256(p + 1);
+        s0 = _mm256_sub_epi32(_mm256_add_epi32(s0, _mm256_cvtepu8_epi32(a)),
+                              _mm256_cvtepu8_epi32(s));
+        s1 = _mm256_sub_epi32(
+            _mm256_add_epi32(s1, _mm256_cvtepu8_epi32(_mm_srli_si128(a, 8))),
+            _mm256_cvtepu8_epi32(_mm_srli_si128(s, 8)));
+        _mm256_storeu_si256(p, s0);
+        _mm256_storeu_si256(p + 1, s1);
+        const auto q0 = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(s0, m), half), BOX_SHIFT);
+        const auto q1 = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(s1, m), half), BOX_SHIFT);
+        store16_epi32_avx2(dst + x, q0, q1);
+    }
+    box_vertical_tail(add, sub, sums, dst, x, n, mul);
+}
+
+UTILS_TARGET_AVX2 inline void
+unsharp_avx2(const uint8_t *src, const uint8_t *blur, uint8_t *dst,
+             const size_t n, const int16_t amount, const int16_t threshold,
+             const bool keep_alpha) noexcept {
+    const auto amt = _mm256_set1_epi16(amount);
+    const auto thr = _mm256_set1_epi16(threshold);
+    const auto lanes =
+        _mm256_broadcastsi128_si256(unsharp_mask_sse(keep_alpha));
+    size_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        const auto s = load16_epu16_avx2(src + x);
+        const auto d = _mm256_sub_epi16(s, load16_epu16_avx2(blur + x));
+        const auto keep = _mm256_and_si256(
+            _mm256_cmpgt_epi16(_mm256_abs_epi16(d), thr), lanes);
+        const auto v = _mm256_and_si256(
+            _mm256_mulhrs_epi16(_mm256_slli_epi16(d, 7), amt), keep);
+        store16_epi16_avx2(dst + x, _mm256_adds_epi16(s, v));
+    }
+    unsharp_tail(src, blur, dst, x, n, amount, threshold, keep_alpha);
+}
+
+UTILS_TARGET_AVX2 inline __m256i edges_mag_avx2(const __m256i gx,
+                                                const __m256i gy,
+                                                const __m256 scale) noexcept {
+    const auto fx = _mm256_cvtepi32_ps(gx);
+    const auto fy = _mm256_cvtepi32_ps(gy);
+    const auto m = _mm256_sqrt_ps(
+        _mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)));
+    return _mm256_cvttps_epi32(
+        _mm256_add_ps(_mm256_mul_ps(m, scale), _mm256_set1_ps(0.5f)));
+}
+
+UTILS_TARGET_AVX2 inline void
+edges_avx2(const uint8_t *p0, const uint8_t *p1, const uint8_t *p2,
+           uint8_t *dst, const size_t n, const size_t comps, const int16_t a,
+           const int16_t b, const float scale) noexcept {
+    const auto va = _mm256_set1_epi16(a);
+    const auto vb = _mm256_set1_epi16(b);
+    const auto vs = _mm256_set1_ps(scale);
+    size_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        const auto *q0 = p0 + x;
+        const auto *q1 = p1 + x;
+        const auto *q2 = p2 + x;
+        const auto l0 = load16_epu16_avx2(q0 - comps);
+        const auto r0 = load16_epu16_avx2(q0 + comps);
+        const auto l2 = load16_epu16_avx2(q2 - comps);
+        const auto r2 = load16_epu16_avx2(q2 + comps);
+        const auto gx = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_add_epi16(_mm256_sub_epi16(r0, l0),
+                                                _mm256_sub_epi16(r2, l2)),
+                               va),
+            _mm256_mullo_epi16(_mm256_sub_epi16(load16_epu16_avx2(q1 + comps),
+                                                load16_epu16_avx2(q1 - comps)),
+                               vb));
+        const auto gy = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_add_epi16(_mm256_sub_epi16(l2, l0),
+                                                _mm256_sub_epi16(r2, r0)),
+                               va),
+            _mm256_mullo_epi16(_mm256_sub_epi16(load16_epu16_avx2(q2),
+                                                load16_epu16_avx2(q0)),
+                               vb));
+        const auto lo = edges_mag_avx2(
+            _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gx)),
+            _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gy)), vs);
+        const auto hi = edges_mag_avx2(
+            _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gx, 1)),
+            _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gy, 1)), vs);
+        store16_epi32_avx2(dst + x, lo, hi);
+    }
+    edges_tail(p0, p1, p2, dst, x, n, comps, a, b, scale);
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using box_vertical_fn_t = void (*)(const uint8_t *, const uint8_t *,
+                                   uint32_t *, uint8_t *, size_t,
+                                   uint32_t) noexcept;
+using unsharp_fn_t = void (*)(const uint8_t *, const uint8_t *, uint8_t *,
+                              size_t, int16_t, int16_t, bool) noexcept;
+using edges_fn_t = void (*)(const uint8_t *, const uint8_t *,
+                            const uint8_t *, uint8_t *, size_t, size_t,
+                            int16_t, int16_t, float) noexcept;
+inline void box_vertical(const uint8_t *add, const uint8_t *sub,
+                         uint32_t *sums, uint8_t *dst, const size_t n,
+                         const uint32_t mul) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<box_vertical_fn_t>(
+        box_vertical_scalar, box_vertical_sse, box_vertical_avx2);
+    fn(add, sub, sums, dst, n, mul);
+#else
+    box_vertical_scalar(add, sub, sums, dst, n, mul);
+#endif
+}
+inline void unsharp(const uint8_t *src, const uint8_t *blur, uint8_t *dst,
+                    const size_t n, const int16_t amount,
+                    const int16_t threshold, const bool keep_alpha) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<unsharp_fn_t>(unsharp_scalar, unsharp_sse, unsharp_avx2);
+    fn(src, blur, dst, n, amount, threshold, keep_alpha);
+#else
+    unsharp_scalar(src, blur, dst, n, amount, threshold, keep_alpha);
+#endif
+}
+inline void edges(const uint8_t *p0, const uint8_t *p1, const uint8_t *p2,
+                  uint8_t *dst, const size_t n, const size_t comps,
+                  const int16_t a, const int16_t b,
+                  const float scale) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<edges_fn_t>(edges_scalar, edges_sse, edges_avx2);
+    fn(p0, p1, p2, dst, n, comps, a, b, scale);
+#else
+    edges_scalar(p0, p1, p2, dst, n, comps, a, b, scale);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
@@ -0,0 +1,261 @@
+/*
+  hash_kernels.h -- Raw kernels for Hamming distances of 64 bit hashes
+*/
+#ifndef HASH_KERNELS_HPP
+#define HASH_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+namespace kernels {
+
+// Bits set in v, SWAR so it does not depend on a popcnt instruction
+constexpr unsigned popcount64(uint64_t v) noexcept {
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<unsigned>((v * 0x0101010101010101ULL) >> 56);
+}
+
+//
+// Hamming distances of n hashes to q
+// hamming_distances writes one byte per hash. hamming_mask sets bit i % 64
+// of mask[i / 64] for every hash within max_dist of q and clears the others,
+// mask holds (n + 63) / 64 words.
+//
+inline void hamming_distances_scalar(const uint64_t *hashes, const size_t n,
+                                     const uint64_t q,
+                                     uint8_t *dist) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+        dist[i] = static_cast<uint8_t>(popcount64(hashes[i] ^ q));
+    }
+}
+inline void hamming_mask_tail(const uint64_t *hashes, size_t first,
+                              const size_t n, const uint64_t q,
+                              const unsigned max_dist,
+                              uint64_t *mask) noexcept {
+    for (; first < n; ++first) {
+        auto &word = mask[first / 64];
+        const auto bit = uint64_t{1} << (first % 64);
+        if (first % 64 == 0) {
+            word = 0;
+        }
+        if (popcount64(hashes[first] ^ q) <= max_dist) {
+            word |= bit;
+        }
+    }
+}
+inline void hamming_mask_scalar(const uint64_t *hashes, const size_t n,
+                                const uint64_t q, const unsigned max_dist,
+                                uint64_t *mask) noexcept {
+    hamming_mask_tail(hashes, 0, n, q, max_dist, mask);
+}
+
+#if UTILS_ARCH_X86
+//
+// SSE4.1 kernels, bits are counted a nibble at a time with pshufb and the
+// bytes of each 64 bit lane summed with psadbw
+//
+UTILS_TARGET_SSE41 inline __m128i popcount64_sse(const __m128i v) {
+    const auto lut =
+        _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const auto low = _mm_set1_epi8(0x0F);
+    const auto lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, low));
+    const auto hi =
+        _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+    return _mm_sad_epu8(_mm_add_epi8(lo, hi), _mm_setzero_si128());
+}
+// Counts of hashes i and i + 1 in dwords 0 and 1
+UTILS_TARGET_SSE41 inline __m128i hamming2_sse(const uint64_t *hashes,
+                                               const __m128i q) {
+    const auto h =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(hashes));
+    return _mm_shuffle_epi32(popcount64_sse(_mm_xor_si128(h, q)),
+                             _MM_SHUFFLE(3, 1, 2, 0));
+}
+UTILS_TARGET_SSE41 inline void
+hamming_distances_sse(const uint64_t *hashes, const size_t n,
+                      const uint64_t q, uint8_t *dist) noexcept {
+    const auto vq = _mm_set1_epi64x(static_cast<long long>(q));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto a = _mm_unpacklo_epi64(hamming2_sse(hashes + i, vq),
+                                          hamming2_sse(hashes + i + 2, vq));
+        const auto b = _mm_unpacklo_epi64(hamming2_sse(hashes + i + 4, vq),
+                                          hamming2_sse(hashes + i + 6, vq));
+        const auto d = _mm_packus_epi16(_mm_packus_epi32(a, b),
+                                        _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dist + i), d);
+    }
+    hamming_distances_scalar(hashes + i, n - i, q, dist + i);
+}
+UTILS_TARGET_SSE41 inline void
+hamming_mask_sse(const uint64_t *hashes, const size_t n, const uint64_t q,
+                 const unsigned max_dist, uint64_t *mask) noexcept {
+    const auto vq = _mm_set1_epi64x(static_cast<long long>(q));
+    const auto limit = _mm_set1_epi32(static_cast<int>(max_dist));
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = 0;
+        for (size_t k = 0; k < 64; k += 4) {
+            const auto a = hamming2_sse(hashes + i + k, vq);
+            const auto b = hamming2_sse(hashes + i + k + 2, vq);
+            const auto c = _mm_unpacklo_epi64(a, b);
+            const auto over = _mm_cmpgt_epi32(c, limit);
+            const auto bits = ~_mm_movemask_ps(_mm_castsi128_ps(over));
+            word |= static_cast<uint64_t>(bits & 0xF) << k;
+        }
+        mask[i / 64] = word;
+    }
+    hamming_mask_tail(hashes, i, n, q, max_dist, mask);
+}
+
+//
+// AVX2 kernels, 4 hashes per register
+//
+UTILS_TARGET_AVX2 inline __m256i popcount64_avx2(const __m256i v) {
+    const auto lut =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                         1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const auto low = _mm256_set1_epi8(0x0F);
+    const auto lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+    const auto hi = _mm256_shuffle_epi8(
+        lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+// Counts of hashes i to i + 3 in dwords 0 to 3
+UTILS_TARGET_AVX2 inline __m128i hamming4_avx2(const uint64_t *hashes,
+                                               const __m256i q) {
+    const auto h =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hashes));
+    const auto c = popcount64_avx2(_mm256_xor_si256(h, q));
+    return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+        c, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+}
+UTILS_TARGET_AVX2 inline void
+hamming_distances_avx2(const uint64_t *hashes, const size_t n,
+                       const uint64_t q, uint8_t *dist) noexcept {
+    const auto vq = _mm256_set1_epi64x(static_cast<long long>(q));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto a = _mm_packus_epi32(hamming4_avx2(hashes + i, vq),
+                                        hamming4_avx2(hashes + i + 4, vq));
+        const auto b = _mm_packus_epi32(hamming4_avx2(hashes + i + 8, vq),
+                                        hamming4_avx2(hashes + i + 12, vq));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dist + i),
+                         _mm_packus_epi16(a, b));
+    }
+    hamming_distances_sse(hashes + i, n - i, q, dist + i);
+}
+UTILS_TARGET_AVX2 inline void
+hamming_mask_avx2(const uint64_t *hashes, const size_t n, const uint64_t q,
+                  const unsigned max_dist, uint64_t *mask) noexcept {
+    const auto vq = _mm256_set1_epi64x(static_cast<long long>(q));
+    const auto limit = _mm256_set1_epi64x(static_cast<long long>(max_dist));
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = 0;
+        for (size_t k = 0; k < 64; k += 4) {
+            const auto h = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(hashes + i + k));
+            const auto c = popcount64_avx2(_mm256_xor_si256(h, vq));
+            const auto over = _mm256_cmpgt_epi64(c, limit);
+            const auto bits = ~_mm256_movemask_pd(_mm256_castsi256_pd(over));
+            word |= static_cast<uint64_t>(bits & 0xF) << k;
+        }
+        mask[i / 64] = word;
+    }
+    hamming_mask_tail(hashes, i, n, q, max_dist, mask);
+}
+
+//
+// AVX-512BW kernels, 8 hashes per register
+//
+// Same GCC intrinsics warning as in lut_kernels.hpp
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+UTILS_TARGET_AVX512BW inline __m512i popcount64_avx512(const __m512i v) {
+    const auto lut = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+    const auto low = _mm512_set1_epi8(0x0F);
+    const auto lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(v, low));
+    const auto hi = _mm512_shuffle_epi8(
+        lut, _mm512_and_si512(_mm512_srli_epi16(v, 4), low));
+    return _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512());
+}
+UTILS_TARGET_AVX512BW inline void
+hamming_distances_avx512(const uint64_t *hashes, const size_t n,
+                         const uint64_t q, uint8_t *dist) noexcept {
+    const auto vq = _mm512_set1_epi64(static_cast<long long>(q));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto h = _mm512_loadu_si512(hashes + i);
+        const auto c = popcount64_avx512(_mm512_xor_si512(h, vq));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dist + i),
+                         _mm512_cvtepi64_epi8(c));
+    }
+    hamming_distances_scalar(hashes + i, n - i, q, dist + i);
+}
+UTILS_TARGET_AVX512BW inline void
+hamming_mask_avx512(const uint64_t *hashes, const size_t n, const uint64_t q,
+                    const unsigned max_dist, uint64_t *mask) noexcept {
+    const auto vq = _mm512_set1_epi64(static_cast<long long>(q));
+    const auto limit = _mm512_set1_epi64(static_cast<long long>(max_dist));
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = 0;
+        for (size_t k = 0; k < 64; k += 8) {
+            const auto h = _mm512_loadu_si512(hashes + i + k);
+            const auto c = popcount64_avx512(_mm512_xor_si512(h, vq));
+            const auto hit = _mm512_cmple_epu64_mask(c, limit);
+            word |= static_cast<uint64_t>(hit) << k;
+        }
+        mask[i / 64] = word;
+    }
+    hamming_mask_tail(hashes, i, n, q, max_dist, mask);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using hamming_distances_fn_t = void (*)(const uint64_t *, size_t, uint64_t,
+                                        uint8_t *) noexcept;
+using hamming_mask_fn_t = void (*)(const uint64_t *, size_t, uint64_t,
+                                   unsigned, uint64_t *) noexcept;
+inline void hamming_distances(const uint64_t *hashes, const size_t n,
+                              const uint64_t q, uint8_t *dist) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<hamming_distances_fn_t>(
+        hamming_distances_scalar, hamming_distances_sse,
+        hamming_distances_avx2, hamming_distances_avx512);
+    fn(hashes, n, q, dist);
+#else
+    hamming_distances_scalar(hashes, n, q, dist);
+#endif
+}
+inline void hamming_mask(const uint64_t *hashes, const size_t n,
+                         const uint64_t q, const unsigned max_dist,
+                         uint64_t *mask) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<hamming_mask_fn_t>(
+        hamming_mask_scalar, hamming_mask_sse, hamming_mask_avx2,
+        hamming_mask_avx512);
+    fn(hashes, n, q, max_dist, mask);
+#else
+    hamming_mask_scalar(hashes, n, q, max_dist, mask);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
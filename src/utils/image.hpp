@@ -6,21 +6,48 @@
 
 #include "utils/pixels.hpp"
 #include "utils/system.hpp"
+#include "utils/tiled_pixels.hpp"
 #include "utils/image_wrappers/jpeg.hpp"
 
 namespace utils {
 
 // Generic image loader
+// Images of at least pixels_tiled_min_bytes() are loaded into tiled instead
+// of pixels, is_tiled() tells which one holds the image.
 class Image_Load {
   public:
     // Default constructor, everything empty
     Image_Load() = default;
-    // Construct with a given filename
-    // Public member pixel class
+    // Construct with a given filename, Unknown picks the best format
+    explicit Image_Load(const char *filename,
+                        const Pixel_Format fmt = Pixel_Format::Unknown) {
+        const utils::JPEG_Read jpeg{filename};
+        if (!jpeg.is_jpeg()) {
+            std::cerr << "[ERROR] Could not load image: " << filename << '\n';
+            return;
+        }
+        const auto f = fmt == Pixel_Format::Unknown ? jpeg.get_best_format()
+                                                    : fmt;
+        if (pixels_prefer_tiled(jpeg.width(), jpeg.height(), f)) {
+            tiled = jpeg.get_tiled(f);
+        } else {
+            pixels = jpeg.get_pixels(f);
+        }
+    }
+    // Public member pixel classes, only one of them is ever valid
     utils::Pixels pixels{};
+    utils::Tiled_Pixels tiled{};
     // Simple getter functions
-    int width() const noexcept { return pixels.width(); }
-    int height() const noexcept { return pixels.height(); }
+    bool is_valid() const noexcept {
+        return pixels.is_valid() || tiled.is_valid();
+    }
+    bool is_tiled() const noexcept { return tiled.is_valid(); }
+    int width() const noexcept {
+        return is_tiled() ? tiled.width() : pixels.width();
+    }
+    int height() const noexcept {
+        return is_tiled() ? tiled.height() : pixels.height();
+    }
 
   private:
 }; // Image_Load
@@ -0,0 +1,258 @@
+/*
+  image_hash.h -- Perceptual image hashes and Hamming distance search
+*/
+#ifndef IMAGE_HASH_HPP
+#define IMAGE_HASH_HPP
+
+#include "utils/hash_kernels.hpp"
+#include "utils/pipeline.hpp"
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/stats_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+// 64 bit fingerprints that stay close for images that look the same
+// Resaved, resized or slightly retouched copies usually differ in a handful
+// of bits, unrelated images in about half of them.
+//  Average    - the 8x8 thumbnail against its mean, fastest, least robust
+//  Difference - gradients between neighbours of a 9x8 thumbnail
+//  Perceptual - the lowest 8x8 DCT frequencies of a 32x32 thumbnail against
+//               their median, survives gamma and contrast changes best
+enum class Image_Hash { Average, Difference, Perceptual };
+inline std::ostream &operator<<(std::ostream &os, const Image_Hash h) {
+    switch (h) {
+    default:
+    case Image_Hash::Average:
+        os << "Average";
+        break;
+    case Image_Hash::Difference:
+        os << "Difference";
+        break;
+    case Image_Hash::Perceptual:
+        os << "Perceptual";
+        break;
+    }
+    return os;
+}
+
+// Size of the gray thumbnail a hash is computed from
+[[nodiscard]] constexpr std::pair<int, int>
+image_hash_thumbnail_size(const Image_Hash h) noexcept {
+    switch (h) {
+    case Image_Hash::Average:
+        return {8, 8};
+    case Image_Hash::Difference:
+        return {9, 8};
+    case Image_Hash::Perceptual:
+    default:
+        break;
+    }
+    return {32, 32};
+}
+
+namespace detail {
+// Gray w x h thumbnail, halved exactly while src is at least 4 times larger
+// and box filtered the rest of the way, all in one pass
+inline Pixels hash_thumbnail(const Const_Pixels_View src, const int w,
+                             const int h) {
+    Pixels_Pipeline pl{src};
+    pl.convert_to(Pixel_Format::GRAY);
+    while (pl.is_valid() && pl.width() >= w * 4 && pl.height() >= h * 4) {
+        pl.downscale_2x();
+    }
+    pl.resize(w, h, Resize_Filter::Box);
+    return pl.run();
+}
+
+// cos(pi * (2x + 1) * u / 64) for the 8 lowest frequencies of 32 samples
+struct Phash_Cosines {
+    double c[8][32];
+};
+inline const Phash_Cosines &phash_cosines() {
+    static const auto table = [] {
+        constexpr double pi = 3.14159265358979323846;
+        Phash_Cosines t{};
+        for (size_t u = 0; u < 8; ++u) {
+            for (size_t x = 0; x < 32; ++x) {
+                const auto k = static_cast<double>((2 * x + 1) * u);
+                t.c[u][x] = std::cos(pi * k / 64.0);
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+inline uint64_t average_hash_bits(const uint8_t *px) noexcept {
+    unsigned sum = 0;
+    for (size_t i = 0; i < 64; ++i) {
+        sum += px[i];
+    }
+    uint64_t hash = 0;
+    for (size_t i = 0; i < 64; ++i) {
+        hash |= static_cast<uint64_t>(px[i] * 64U > sum) << i;
+    }
+    return hash;
+}
+inline uint64_t difference_hash_bits(const uint8_t *px) noexcept {
+    uint64_t hash = 0;
+    for (size_t y = 0; y < 8; ++y) {
+        const auto *row = px + y * 9;
+        for (size_t x = 0; x < 8; ++x) {
+            hash |= static_cast<uint64_t>(row[x + 1] > row[x]) << (y * 8 + x);
+        }
+    }
+    return hash;
+}
+// Only the 8x8 corner of the 2D DCT is needed, so the row pass computes 8
+// of 32 frequencies and the column pass 8 of 32 rows of those
+inline uint64_t perceptual_hash_bits(const uint8_t *px) {
+    const auto &t = phash_cosines();
+    double rows[32][8];
+    for (size_t y = 0; y < 32; ++y) {
+        for (size_t u = 0; u < 8; ++u) {
+            double s = 0.0;
+            for (size_t x = 0; x < 32; ++x) {
+                s += t.c[u][x] * px[y * 32 + x];
+            }
+            rows[y][u] = s;
+        }
+    }
+    double coef[64];
+    for (size_t v = 0; v < 8; ++v) {
+        for (size_t u = 0; u < 8; ++u) {
+            double s = 0.0;
+            for (size_t y = 0; y < 32; ++y) {
+                s += t.c[v][y] * rows[y][u];
+            }
+            coef[v * 8 + u] = s;
+        }
+    }
+    double sorted[64];
+    std::copy(coef, coef + 64, sorted);
+    std::nth_element(sorted, sorted + 32, sorted + 64);
+    const auto upper = sorted[32];
+    const auto lower = *std::max_element(sorted, sorted + 32);
+    const auto median = (lower + upper) / 2.0;
+    uint64_t hash = 0;
+    for (size_t i = 0; i < 64; ++i) {
+        hash |= static_cast<uint64_t>(coef[i] > median) << i;
+    }
+    return hash;
+}
+} // namespace detail
+
+// Hash of any view, bit y * 8 + x belongs to thumbnail cell (x, y)
+// Colour is reduced to luma first. Returns 0 (and reports why) for invalid
+// views, which real images practically never hash to.
+[[nodiscard]] inline uint64_t
+image_hash(const Const_Pixels_View src,
+           const Image_Hash type = Image_Hash::Perceptual) {
+    if (!src.is_valid()) {
+        std::cerr << "[ERROR] Cannot hash an invalid pixel view!\n";
+        return 0;
+    }
+    const auto [w, h] = image_hash_thumbnail_size(type);
+    const auto thumb = detail::hash_thumbnail(src, w, h);
+    if (!thumb.is_valid()) {
+        return 0;
+    }
+    const auto *px = thumb.buf.data();
+    switch (type) {
+    case Image_Hash::Average:
+        return detail::average_hash_bits(px);
+    case Image_Hash::Difference:
+        return detail::difference_hash_bits(px);
+    case Image_Hash::Perceptual:
+    default:
+        break;
+    }
+    return detail::perceptual_hash_bits(px);
+}
+[[nodiscard]] inline uint64_t average_hash(const Const_Pixels_View src) {
+    return image_hash(src, Image_Hash::Average);
+}
+[[nodiscard]] inline uint64_t difference_hash(const Const_Pixels_View src) {
+    return image_hash(src, Image_Hash::Difference);
+}
+[[nodiscard]] inline uint64_t perceptual_hash(const Const_Pixels_View src) {
+    return image_hash(src, Image_Hash::Perceptual);
+}
+
+// Number of bits two hashes differ in
+[[nodiscard]] constexpr unsigned hamming_distance(const uint64_t a,
+                                                  const uint64_t b) noexcept {
+    return kernels::popcount64(a ^ b);
+}
+
+// Hashes per kernel call of the searches, the mask or distances of a chunk
+// live on the stack
+constexpr size_t HASH_SEARCH_CHUNK = 4096;
+
+// Indices of the n hashes within max_dist bits of q, in ascending order
+// Runs at memory speed, matches are picked from a bit mask per chunk.
+inline std::vector<size_t> hash_search(const uint64_t *hashes, const size_t n,
+                                       const uint64_t q,
+                                       const unsigned max_dist) {
+    std::vector<size_t> found{};
+    const auto limit = std::min(max_dist, 64U);
+    uint64_t mask[HASH_SEARCH_CHUNK / 64];
+    for (size_t first = 0; first < n; first += HASH_SEARCH_CHUNK) {
+        const auto count = std::min(HASH_SEARCH_CHUNK, n - first);
+        kernels::hamming_mask(hashes + first, count, q, limit, mask);
+        for (size_t k = 0; k < (count + 63) / 64; ++k) {
+            for (auto word = mask[k]; word != 0; word &= word - 1) {
+                // Index of the lowest set bit
+                const auto bit = kernels::popcount64((word & (~word + 1)) - 1);
+                found.push_back(first + k * 64 + bit);
+            }
+        }
+    }
+    return found;
+}
+inline std::vector<size_t> hash_search(const std::vector<uint64_t> &hashes,
+                                       const uint64_t q,
+                                       const unsigned max_dist) {
+    return hash_search(hashes.data(), hashes.size(), q, max_dist);
+}
+
+// Index of the hash closest to q, the first one of equally close hashes
+// Returns n if there are no hashes. dist (if set) receives the distance.
+inline size_t hash_nearest(const uint64_t *hashes, const size_t n,
+                           const uint64_t q, unsigned *dist = nullptr) {
+    size_t best = n;
+    unsigned best_dist = 65;
+    uint8_t d[HASH_SEARCH_CHUNK];
+    for (size_t first = 0; first < n && best_dist != 0;
+         first += HASH_SEARCH_CHUNK) {
+        const auto count = std::min(HASH_SEARCH_CHUNK, n - first);
+        kernels::hamming_distances(hashes + first, count, q, d);
+        // The SIMD minimum first, the index only when it is an improvement
+        kernels::Channel_Reduce r{};
+        kernels::channel_reduce(d, count, 1, r);
+        const auto m = r.min[0];
+        if (m < best_dist) {
+            best_dist = m;
+            best = first + static_cast<size_t>(std::find(d, d + count, m) - d);
+        }
+    }
+    if (dist != nullptr) {
+        *dist = best_dist;
+    }
+    return best;
+}
+inline size_t hash_nearest(const std::vector<uint64_t> &hashes,
+                           const uint64_t q, unsigned *dist = nullptr) {
+    return hash_nearest(hashes.data(), hashes.size(), q, dist);
+}
+
+} // namespace utils
+
+#endif
@@ -4,21 +4,134 @@
 #ifndef JPEG_HPP
 #define JPEG_HPP
 
+#include "utils/image_hash.hpp"
 #include "utils/pixels.hpp"
+#include "utils/planar_pixels.hpp"
 #include "utils/system.hpp"
+#include "utils/tiled_pixels.hpp"
+#include "utils/transform.hpp"
 #include <turbojpeg.h>
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio> // jpeglib.h needs FILE
+#include <cstring>
+#include <jpeglib.h>
 #include <string_view>
+#include <utility>
 
 namespace utils {
+namespace detail {
+// TurboJPEG handles of one thread, created on first use and destroyed when
+// the thread exits. A handle only holds state for the call it is used in,
+// so every reader and writer on the thread can share it.
+struct Tj_Thread_Handles {
+    tjhandle decompressor{nullptr};
+    tjhandle compressor{nullptr};
+
+    Tj_Thread_Handles() = default;
+    Tj_Thread_Handles(const Tj_Thread_Handles &) = delete;
+    Tj_Thread_Handles &operator=(const Tj_Thread_Handles &) = delete;
+    ~Tj_Thread_Handles() {
+        if (decompressor != nullptr) {
+            tjDestroy(decompressor);
+        }
+        if (compressor != nullptr) {
+            tjDestroy(compressor);
+        }
+    }
+};
+inline Tj_Thread_Handles &tj_thread_handles() noexcept {
+    thread_local Tj_Thread_Handles th{};
+    return th;
+}
+
+// Decompressor of the calling thread, nullptr if none could be created
+inline tjhandle tj_decompressor() {
+    auto &th = tj_thread_handles();
+    if (th.decompressor == nullptr) {
+        th.decompressor = tjInitDecompress();
+        if (th.decompressor == nullptr) {
+            std::cerr << "[ERROR] Could not create a JPEG decompressor!\n";
+        }
+    }
+    return th.decompressor;
+}
+// Compressor of the calling thread, nullptr if none could be created
+inline tjhandle tj_compressor() {
+    auto &th = tj_thread_handles();
+    if (th.compressor == nullptr) {
+        th.compressor = tjInitCompress();
+        if (th.compressor == nullptr) {
+            std::cerr << "[ERROR] Could not create a JPEG compressor!\n";
+        }
+    }
+    return th.compressor;
+}
+
+// Converts our pixel format to the correct JPEG pixel format enum, -1 for
+// the formats TurboJPEG has none for (16 bit)
+inline int pfmt_to_jfmt(const utils::Pixel_Format fmt) noexcept {
+    switch (fmt) {
+    default:
+    case utils::Pixel_Format::RGB16:
+    case utils::Pixel_Format::RGBA16:
+    case utils::Pixel_Format::GRAY16:
+    case utils::Pixel_Format::Unknown:
+        break;
+    case utils::Pixel_Format::RGB:
+        return TJPF_RGB;
+    case utils::Pixel_Format::RGBA:
+        return TJPF_RGBA;
+    case utils::Pixel_Format::GRAY:
+        return TJPF_GRAY;
+    }
+    return -1;
+}
+} // namespace detail
+
+// The Y, Cb and Cr planes of a JPEG as stored, each as GRAY pixels
+// Cb and Cr are tjPlaneWidth/Height() sized for the subsampling and empty
+// for grayscale JPEGs.
+struct YUV_Planes {
+    utils::Pixels y{};
+    utils::Pixels cb{};
+    utils::Pixels cr{};
+    int subsamp{-1};
+
+    bool is_valid() const noexcept { return y.is_valid(); }
+    bool is_gray() const noexcept { return subsamp == TJSAMP_GRAY; }
+};
+
 // JPEG Reader class
+// Decoding only reads the file buffer and uses the calling thread's
+// TurboJPEG handle, so one reader can decode on many threads at once.
 class JPEG_Read {
   public:
-    // No default/copy/move constructors and assignments
+    // No default/copy constructors and assignments
     JPEG_Read() = delete;
     JPEG_Read(const JPEG_Read &) = delete;
-    JPEG_Read(JPEG_Read &&) = delete;
     JPEG_Read &operator=(const JPEG_Read &) = delete;
-    JPEG_Read &operator=(JPEG_Read &&) = delete;
+
+    // Moved from readers are left empty, is_jpeg() is false
+    JPEG_Read(JPEG_Read &&o) noexcept
+        : is_jpeg_{std::exchange(o.is_jpeg_, false)}
+        , width_{std::exchange(o.width_, 0)}
+        , height_{std::exchange(o.height_, 0)}
+        , subsamp_{std::exchange(o.subsamp_, -1)}
+        , colorspace_{std::exchange(o.colorspace_, -1)}
+        , file_buf_{std::move(o.file_buf_)} {}
+    JPEG_Read &operator=(JPEG_Read &&o) noexcept {
+        if (this != &o) {
+            is_jpeg_ = std::exchange(o.is_jpeg_, false);
+            width_ = std::exchange(o.width_, 0);
+            height_ = std::exchange(o.height_, 0);
+            subsamp_ = std::exchange(o.subsamp_, -1);
+            colorspace_ = std::exchange(o.colorspace_, -1);
+            file_buf_ = std::move(o.file_buf_);
+        }
+        return *this;
+    }
+    ~JPEG_Read() = default;
 
     // Our only constructor -> filename to open
     explicit JPEG_Read(const char *filename) {
@@ -28,8 +141,9 @@ class JPEG_Read {
             return;
         }
         // Read the JPEG header
-        hand_ = tjInitDecompress();
-        if (tjDecompressHeader3(hand_, file_buf_.data(), file_buf_.size(),
+        auto *hand = detail::tj_decompressor();
+        if (hand == nullptr ||
+            tjDecompressHeader3(hand, file_buf_.data(), file_buf_.size(),
                                 &width_, &height_, &subsamp_,
                                 &colorspace_) == -1) {
             return;
@@ -37,13 +151,6 @@ class JPEG_Read {
         is_jpeg_ = true;
     }
 
-    // We need a custom default destructor to destroy our JPEG handles
-    ~JPEG_Read() {
-        if (hand_ != nullptr) {
-            tjDestroy(hand_);
-        }
-    }
-
     // Simple getters
     bool is_jpeg() const noexcept { return is_jpeg_; }
     int width() const noexcept { return width_; }
@@ -91,6 +198,27 @@ class JPEG_Read {
         return "Unknown";
     }
 
+    // Determines the best pixel format given our JPEG info
+    utils::Pixel_Format get_best_format() const noexcept {
+        switch (colorspace_) {
+        // Decompress to RGB
+        case TJCS_RGB:
+        case TJCS_YCbCr:
+            return utils::Pixel_Format::RGB;
+        // Decompress to GRAYSCALE
+        case TJCS_GRAY:
+            return utils::Pixel_Format::GRAY;
+        // Cuurently not supported
+        case TJCS_CMYK:
+        case TJCS_YCCK:
+        default:
+            break;
+        }
+        std::cerr << "[ERROR] JPEG colorspace (" << colorspace_sv()
+                  << ") is not supported!\n";
+        return utils::Pixel_Format::Unknown;
+    }
+
     // Decompress to pixels
     utils::Pixels get_pixels() const {
         return get_pixels(get_best_format());
@@ -101,69 +229,847 @@ class JPEG_Read {
         if (!p.is_valid()) {
             return p;
         }
-        // Decompress image
-        const auto jpfmt = pfmt_to_jfmt(fmt);
-        const auto pitch = static_cast<int>(pixels_pitch(width_, fmt));
-        const auto err = tjDecompress2(hand_, file_buf_.data(),
-                                       file_buf_.size(), p.buf.data(), width_,
-                                       pitch, height_, jpfmt, TJFLAG_NOREALLOC);
-        if (err != 0) {
-            std::cerr << "[ERROR] Could not decompress JPEG! errcode = " << err
-                      << '\n';
+        if (!decode_to(p.view())) {
             p.clear();
         }
         return p;
     }
 
+    // Decompress straight into any view of the same size as the image, in
+    // the view's format and pitch (e.g. a region of a larger canvas)
+    bool decode_to(const utils::Pixels_View dst) const {
+        if (!is_jpeg_ || !dst.is_valid()) {
+            return false;
+        }
+        if (dst.width() != width_ || dst.height() != height_) {
+            std::cerr << "[ERROR] JPEG size (" << width_ << 'x' << height_
+                      << ") does not match the view (" << dst.width() << 'x'
+                      << dst.height() << ")!\n";
+            return false;
+        }
+        return decompress(dst);
+    }
+
+    // True for the IDCT scales TurboJPEG can decode at (1/8 to 2)
+    static bool is_scaling_factor(const tjscalingfactor f) noexcept {
+        int count = 0;
+        const auto *factors = tjGetScalingFactors(&count);
+        for (int i = 0; i < count && factors != nullptr; ++i) {
+            if (factors[i].num * f.denom == f.num * factors[i].denom) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The smallest IDCT scale (1/8 and up, never above 1/1) that still gives
+    // at least min_w x min_h pixels, 1/1 if none does
+    tjscalingfactor best_scaling_factor(const int min_w,
+                                        const int min_h) const noexcept {
+        tjscalingfactor best{1, 1};
+        int64_t best_area = int64_t{width_} * height_;
+        int count = 0;
+        const auto *factors = tjGetScalingFactors(&count);
+        for (int i = 0; i < count && factors != nullptr; ++i) {
+            const auto f = factors[i];
+            const auto sw = TJSCALED(width_, f);
+            const auto sh = TJSCALED(height_, f);
+            if (f.num <= f.denom && sw >= min_w && sh >= min_h &&
+                int64_t{sw} * sh < best_area) {
+                best = f;
+                best_area = int64_t{sw} * sh;
+            }
+        }
+        return best;
+    }
+
+    // Decompress scaled by factor, to TJSCALED(width(), factor) x
+    // TJSCALED(height(), factor) pixels. Scaled decodes skip most of the IDCT
+    // and upsampling work, at 1/8 a decode costs a fraction of a full one and
+    // needs 1/64 of the memory.
+    utils::Pixels get_pixels(const utils::Pixel_Format fmt,
+                             const tjscalingfactor factor) const {
+        if (!is_scaling_factor(factor)) {
+            std::cerr << "[ERROR] JPEG cannot be scaled by " << factor.num
+                      << '/' << factor.denom << "!\n";
+            return utils::Pixels{};
+        }
+        if (!is_jpeg_) {
+            return utils::Pixels{};
+        }
+        utils::Pixels p{fmt, TJSCALED(width_, factor),
+                        TJSCALED(height_, factor)};
+        if (!p.is_valid() || !decompress(p.view())) {
+            p.clear();
+        }
+        return p;
+    }
+    // Decompress at the best_scaling_factor() for a target size, e.g. the
+    // smallest decode a 256 px preview can be resized down from. The result
+    // is at least min_w x min_h unless the image itself is smaller.
+    utils::Pixels get_pixels(const utils::Pixel_Format fmt, const int min_w,
+                             const int min_h) const {
+        return get_pixels(fmt, best_scaling_factor(min_w, min_h));
+    }
+
+    // Perceptual hash of the image (see image_hash), decoded only as large
+    // as the hash thumbnail needs
+    uint64_t get_hash(
+        const utils::Image_Hash type = utils::Image_Hash::Perceptual) const {
+        const auto [w, h] = utils::image_hash_thumbnail_size(type);
+        const auto p = get_pixels(utils::Pixel_Format::GRAY, w * 2, h * 2);
+        if (!p.is_valid()) {
+            return 0;
+        }
+        return utils::image_hash(p.cview(), type);
+    }
+
+    // Decompress into tiles, for images too large for one buffer (see
+    // pixels_prefer_tiled). Rows are decoded one band of tiles at a time, so
+    // besides the tiles only tile_size rows of the image are ever in memory.
+    utils::Tiled_Pixels get_tiled(const utils::Tiled_Opts &opts = {}) const {
+        return get_tiled(get_best_format(), opts);
+    }
+    utils::Tiled_Pixels get_tiled(const utils::Pixel_Format fmt,
+                                  const utils::Tiled_Opts &opts = {}) const {
+        utils::Tiled_Pixels t{fmt, width_, height_, opts};
+        if (!is_jpeg_ || !t.is_valid()) {
+            t.clear();
+            return t;
+        }
+        // 16 bit tiles are widened from 8 bit bands by write_rows
+        const auto fmt8 = utils::pxfmt_with_depth(fmt, 1);
+        const auto band_rows = std::min(t.tile_size(), height_);
+        utils::pixel_buf_t band(utils::pixels_size(width_, band_rows, fmt8));
+        const auto ok = decode_scanlines(
+            fmt8, band.data(), band_rows,
+            [&](const int y, const utils::Const_Pixels_View rows) {
+                return t.write_rows(y, rows);
+            });
+        if (!ok) {
+            t.clear();
+        }
+        return t;
+    }
+
+    // Decompress only the luma plane as GRAY pixels, straight from the IDCT
+    // without any colour conversion. Chroma still has to be decoded into a
+    // scratch buffer. JPEGs not stored as YCbCr or GRAY go through
+    // get_pixels() instead.
+    utils::Pixels get_luma() const {
+        if (!is_jpeg_) {
+            return utils::Pixels{};
+        }
+        if (colorspace_ != TJCS_YCbCr && colorspace_ != TJCS_GRAY) {
+            return get_pixels(utils::Pixel_Format::GRAY);
+        }
+        unsigned char *planes[3] = {nullptr, nullptr, nullptr};
+        int strides[3] = {0, 0, 0};
+        utils::pixel_buf_t chroma{};
+        if (!scratch_chroma(planes, strides, chroma)) {
+            return utils::Pixels{};
+        }
+        return decode_luma(planes, strides);
+    }
+
+    // Decompress the Y, Cb and Cr planes at the resolution they are stored
+    // in (see subsamp()), e.g. for video encoders or chroma aware filters
+    YUV_Planes get_yuv() const {
+        if (!is_jpeg_) {
+            return YUV_Planes{};
+        }
+        if (colorspace_ != TJCS_YCbCr && colorspace_ != TJCS_GRAY) {
+            std::cerr << "[ERROR] JPEG colorspace (" << colorspace_sv()
+                      << ") has no YUV planes!\n";
+            return YUV_Planes{};
+        }
+        YUV_Planes yuv{};
+        yuv.subsamp = subsamp_;
+        if (!yuv.is_gray()) {
+            const auto cw = tjPlaneWidth(1, width_, subsamp_);
+            const auto ch = tjPlaneHeight(1, height_, subsamp_);
+            yuv.cb = utils::Pixels{utils::Pixel_Format::GRAY, cw, ch};
+            yuv.cr = utils::Pixels{utils::Pixel_Format::GRAY, cw, ch};
+            if (!yuv.cb.is_valid() || !yuv.cr.is_valid()) {
+                return YUV_Planes{};
+            }
+        }
+        unsigned char *planes[3] = {nullptr, yuv.cb.buf.data(),
+                                    yuv.cr.buf.data()};
+        int strides[3] = {0, yuv.cb.width(), yuv.cr.width()};
+        yuv.y = decode_luma(planes, strides);
+        if (!yuv.y.is_valid()) {
+            return YUV_Planes{};
+        }
+        return yuv;
+    }
+
+    // Decompress to planes straight from the YUV planes of the JPEG, without
+    // an interleaved buffer in between. Luma is decoded directly into the
+    // first plane when it fits. Chroma is upsampled by replication, so
+    // subsampled images can differ from get_pixels() by a few levels along
+    // colour edges.
+    // JPEGs not stored as YCbCr or GRAY go through get_pixels() instead.
+    utils::Planar_Pixels get_planar() const {
+        return get_planar(get_best_format());
+    }
+    utils::Planar_Pixels get_planar(const utils::Pixel_Format fmt) const {
+        utils::Planar_Pixels pl{fmt, width_, height_};
+        if (!is_jpeg_ || !pl.is_valid()) {
+            pl.clear();
+            return pl;
+        }
+        if (colorspace_ != TJCS_YCbCr && colorspace_ != TJCS_GRAY) {
+            const auto p = get_pixels(fmt);
+            if (!p.is_valid() || !pl.deinterleave_from(p.cview())) {
+                pl.clear();
+            }
+            return pl;
+        }
+        const bool gray = subsamp_ == TJSAMP_GRAY;
+        unsigned char *planes[3] = {nullptr, nullptr, nullptr};
+        int strides[3] = {0, 0, 0};
+        utils::pixel_buf_t chroma{};
+        if (!scratch_chroma(planes, strides, chroma)) {
+            pl.clear();
+            return pl;
+        }
+        // TurboJPEG writes luma padded to whole chroma samples (see
+        // decode_luma). It is decoded straight into the first plane when the
+        // padding of the plane has room for it, else cropped and copied.
+        const auto pw = tjPlaneWidth(0, width_, subsamp_);
+        const auto ph = tjPlaneHeight(0, height_, subsamp_);
+        if (pw > 0 && ph > 0 && static_cast<size_t>(pw) <= pl.pitch() &&
+            static_cast<size_t>(ph) <= pl.plane_rows()) {
+            planes[0] = pl.plane(0);
+            strides[0] = static_cast<int>(pl.pitch());
+            if (!decode_yuv(planes, strides)) {
+                pl.clear();
+                return pl;
+            }
+        } else {
+            const auto luma = decode_luma(planes, strides);
+            if (!luma.is_valid() ||
+                !utils::convert_view(luma.cview(), pl.plane_view(0))) {
+                pl.clear();
+                return pl;
+            }
+        }
+        const auto cw = strides[1];
+        if (fmt == utils::Pixel_Format::GRAY) {
+            return pl;
+        }
+
+        // Fill the colour planes from the luma plane (and chroma)
+        const auto w = static_cast<size_t>(width_);
+        const auto hshift = subsamp_shift(tjMCUWidth[subsamp_]);
+        const auto vshift = subsamp_shift(tjMCUHeight[subsamp_]);
+        for (int y = 0; y < height_; ++y) {
+            const auto off = static_cast<size_t>(y) * pl.pitch();
+            auto *r = pl.plane(0) + off;
+            auto *g = pl.plane(1) + off;
+            auto *b = pl.plane(2) + off;
+            if (gray) {
+                std::memcpy(g, r, w);
+                std::memcpy(b, r, w);
+                continue;
+            }
+            const auto crow = static_cast<size_t>(y >> vshift) *
+                              static_cast<size_t>(cw);
+            ycc_to_rgb_row(r, g, b, planes[1] + crow, planes[2] + crow, w,
+                           hshift);
+        }
+        if (fmt == utils::Pixel_Format::RGBA) {
+            for (int y = 0; y < height_; ++y) {
+                std::memset(pl.plane(3) + static_cast<size_t>(y) * pl.pitch(),
+                            0xFF, w);
+            }
+        }
+        return pl;
+    }
+
   private:
     bool is_jpeg_{false};
-    tjhandle hand_{nullptr};
     int width_{};
     int height_{};
     int subsamp_{-1};
     int colorspace_{-1};
     utils::bytes_t file_buf_{};
 
-    // Determines the best pixel format given our JPEG info
-    utils::Pixel_Format get_best_format() const noexcept {
-        switch (colorspace_) {
-        // Decompress to RGB
-        case TJCS_RGB:
-        case TJCS_YCbCr:
-            return utils::Pixel_Format::RGB;
-        // Decompress to GRAYSCALE
-        case TJCS_GRAY:
-            return utils::Pixel_Format::GRAY;
-        // Cuurently not supported
-        case TJCS_CMYK:
-        case TJCS_YCCK:
-        default:
-            break;
+    // Decompresses into dst, TurboJPEG picks the IDCT scale from its size
+    // 16 bit views get the 8 bit pixels at the start of every row, widened
+    // in place afterwards
+    bool decompress(const utils::Pixels_View dst) const {
+        const auto fmt8 = utils::pxfmt_with_depth(dst.format(), 1);
+        const auto jpfmt = detail::pfmt_to_jfmt(fmt8);
+        if (jpfmt == -1) {
+            return false;
         }
-        std::cerr << "[ERROR] JPEG colorspace (" << colorspace_sv()
-                  << ") is not supported!\n";
-        return utils::Pixel_Format::Unknown;
+        auto *hand = detail::tj_decompressor();
+        if (hand == nullptr) {
+            return false;
+        }
+        const auto err = tjDecompress2(
+            hand, file_buf_.data(), file_buf_.size(), dst.data(), dst.width(),
+            static_cast<int>(dst.pitch()), dst.height(), jpfmt,
+            TJFLAG_NOREALLOC);
+        if (err != 0) {
+            std::cerr << "[ERROR] Could not decompress JPEG! errcode = " << err
+                      << '\n';
+            return false;
+        }
+        if (fmt8 != dst.format()) {
+            const auto widen = utils::get_converter(fmt8, dst.format());
+            const auto w = static_cast<size_t>(dst.width());
+            for (int y = 0; y < dst.height(); ++y) {
+                widen(dst.row(y), dst.row(y), w, {});
+            }
+        }
+        return true;
     }
 
-    // Converts our pixel format to the correct JPEG pixel format enum
-    int pfmt_to_jfmt(const utils::Pixel_Format fmt) const noexcept {
+    // libjpeg reports fatal errors through error_exit, which must not return
+    struct Scanline_Error {
+        jpeg_error_mgr mgr;
+        std::jmp_buf jmp;
+    };
+    static void scanline_error_exit(j_common_ptr cinfo) {
+        char msg[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, msg);
+        std::cerr << "[ERROR] Could not decompress JPEG! " << msg << '\n';
+        std::longjmp(reinterpret_cast<Scanline_Error *>(cinfo->err)->jmp, 1);
+    }
+
+    // Decompresses the image with libjpeg's scanline API, which TurboJPEG
+    // does not expose, into band (band_rows rows of fmt) and hands each band
+    // to fn(first row, rows). Returns false on error or if fn does.
+    // Nothing with a destructor may live between setjmp and the libjpeg
+    // calls that can jump back to it.
+    template <class Fn>
+    bool decode_scanlines(const utils::Pixel_Format fmt, uint8_t *band,
+                          const int band_rows, const Fn &fn) const {
+        J_COLOR_SPACE cs = JCS_UNKNOWN;
         switch (fmt) {
-        default:
-        case utils::Pixel_Format::Unknown:
-            break;
         case utils::Pixel_Format::RGB:
-            return TJPF_RGB;
+            cs = JCS_RGB;
+            break;
         case utils::Pixel_Format::RGBA:
-            return TJPF_RGBA;
+            cs = JCS_EXT_RGBA;
+            break;
         case utils::Pixel_Format::GRAY:
-            return TJPF_GRAY;
+            cs = JCS_GRAYSCALE;
+            break;
+        case utils::Pixel_Format::RGB16:
+        case utils::Pixel_Format::RGBA16:
+        case utils::Pixel_Format::GRAY16:
+        case utils::Pixel_Format::Unknown:
+        default:
+            return false;
+        }
+        const auto pitch = utils::pixels_pitch(width_, fmt);
+        jpeg_decompress_struct cinfo{};
+        Scanline_Error err{};
+        cinfo.err = jpeg_std_error(&err.mgr);
+        err.mgr.error_exit = scanline_error_exit;
+        if (setjmp(err.jmp) != 0) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, file_buf_.data(), file_buf_.size());
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = cs;
+        jpeg_start_decompress(&cinfo);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            const auto first = static_cast<int>(cinfo.output_scanline);
+            int rows = 0;
+            while (rows < band_rows &&
+                   cinfo.output_scanline < cinfo.output_height) {
+                JSAMPROW row = band + static_cast<size_t>(rows) * pitch;
+                if (jpeg_read_scanlines(&cinfo, &row, 1) != 1) {
+                    break;
+                }
+                ++rows;
+            }
+            if (rows == 0 ||
+                !fn(first, utils::Const_Pixels_View{band, fmt, width_, rows})) {
+                jpeg_destroy_decompress(&cinfo);
+                return false;
+            }
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+
+    // Decompresses the raw Y, Cb and Cr planes, only the Y plane is used for
+    // grayscale JPEGs
+    bool decode_yuv(unsigned char **planes, int *strides) const {
+        auto *hand = detail::tj_decompressor();
+        if (hand == nullptr) {
+            return false;
+        }
+        const auto err =
+            tjDecompressToYUVPlanes(hand, file_buf_.data(), file_buf_.size(),
+                                    planes, width_, strides, height_, 0);
+        if (err != 0) {
+            std::cerr << "[ERROR] Could not decompress JPEG to YUV! errcode = "
+                      << err << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    // Decodes the YUV planes with planes 1 and 2 already set up, returns the
+    // Y plane as GRAY pixels of the image size. TurboJPEG writes luma padded
+    // to whole chroma samples (tjPlaneWidth/Height(0), 34x18 for a 33x17
+    // 4:2:0 image), so it is decoded at that size and cropped in place.
+    utils::Pixels decode_luma(unsigned char **planes, int *strides) const {
+        const auto pw = tjPlaneWidth(0, width_, subsamp_);
+        const auto ph = tjPlaneHeight(0, height_, subsamp_);
+        if (pw < width_ || ph < height_) {
+            return utils::Pixels{};
+        }
+        const auto w = static_cast<size_t>(width_);
+        const auto pitch = static_cast<size_t>(pw);
+        utils::pixel_buf_t buf(pitch * static_cast<size_t>(ph));
+        planes[0] = buf.data();
+        strides[0] = pw;
+        if (!decode_yuv(planes, strides)) {
+            return utils::Pixels{};
+        }
+        if (pitch != w) {
+            for (size_t y = 1; y < static_cast<size_t>(height_); ++y) {
+                std::memmove(buf.data() + y * w, buf.data() + y * pitch, w);
+            }
+        }
+        buf.resize(w * static_cast<size_t>(height_));
+        return utils::Pixels{std::move(buf), utils::Pixel_Format::GRAY, width_,
+                             height_};
+    }
+
+    // Points planes 1 and 2 (and their strides) at chroma, resized to hold
+    // both chroma planes. Grayscale JPEGs have none, nothing is touched.
+    bool scratch_chroma(unsigned char **planes, int *strides,
+                        utils::pixel_buf_t &chroma) const {
+        if (subsamp_ == TJSAMP_GRAY) {
+            return true;
+        }
+        const auto cw = tjPlaneWidth(1, width_, subsamp_);
+        const auto ch = tjPlaneHeight(1, height_, subsamp_);
+        if (cw <= 0 || ch <= 0) {
+            return false;
+        }
+        const auto csz = static_cast<size_t>(cw) * static_cast<size_t>(ch);
+        chroma.resize(csz * 2);
+        planes[1] = chroma.data();
+        planes[2] = chroma.data() + csz;
+        strides[1] = cw;
+        strides[2] = cw;
+        return true;
+    }
+
+    // log2 of the chroma subsampling factor from the MCU size in pixels
+    static int subsamp_shift(const int mcu) noexcept {
+        switch (mcu) {
+        case 32:
+            return 2;
+        case 16:
+            return 1;
+        default:
+            break;
+        }
+        return 0;
+    }
+
+    // JFIF YCbCr -> RGB in 16 bit fixed point with libjpeg's constants, in
+    // place on the luma row which is also the R row
+    static void ycc_to_rgb_row(uint8_t *r, uint8_t *g, uint8_t *b,
+                               const uint8_t *cb, const uint8_t *cr,
+                               const size_t w, const int hshift) noexcept {
+        constexpr int half = 1 << 15;
+        const auto clamp = [](const int v) {
+            return static_cast<uint8_t>(std::clamp(v, 0, 255));
+        };
+        for (size_t x = 0; x < w; ++x) {
+            const int luma = r[x];
+            const int u = cb[x >> hshift] - 128;
+            const int v = cr[x >> hshift] - 128;
+            r[x] = clamp(luma + ((91881 * v + half) >> 16));
+            g[x] = clamp(luma + ((-22554 * u - 46802 * v + half) >> 16));
+            b[x] = clamp(luma + ((116130 * u + half) >> 16));
         }
-        return -1;
     }
 }; // JPEG_Read
 
+struct JPEG_Write_Opts {
+    // 1 (smallest) to 100 (best)
+    int quality{90};
+    // Chroma subsampling (TJSAMP_444, TJSAMP_420, ...), GRAY pixels are
+    // always written as TJSAMP_GRAY
+    int subsamp{TJSAMP_420};
+    // Faster, slightly less accurate forward DCT
+    bool fast_dct{false};
+};
+
 // JPEG Writer class
-class JPEG_Write {}; // JPEG_Write
+// The output buffer is sized with tjBufSize for the largest image encoded so
+// far and reused with TJFLAG_NOREALLOC, so a writer encoding many images of
+// similar size does not allocate after the first one. Encoding uses the
+// calling thread's TurboJPEG handle.
+class JPEG_Write {
+  public:
+    // No copy constructors and assignments, writers can be moved
+    JPEG_Write() = default;
+    JPEG_Write(const JPEG_Write &) = delete;
+    JPEG_Write(JPEG_Write &&) noexcept = default;
+    JPEG_Write &operator=(const JPEG_Write &) = delete;
+    JPEG_Write &operator=(JPEG_Write &&) noexcept = default;
+    ~JPEG_Write() = default;
+
+    explicit JPEG_Write(const JPEG_Write_Opts &opts) : opts_{opts} {}
+
+    // Simple getters/setters
+    const JPEG_Write_Opts &opts() const noexcept { return opts_; }
+    void set_opts(const JPEG_Write_Opts &opts) noexcept { opts_ = opts; }
+
+    // The last encoded JPEG, valid until the next encode
+    const uint8_t *data() const noexcept { return buf_.data(); }
+    size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    utils::bytes_t to_bytes() const {
+        const auto *p = buf_.data();
+        return utils::bytes_t(p, p + size_);
+    }
+
+    // Encodes GRAY, RGB or RGBA pixels (alpha is dropped) into the buffer
+    bool encode(const utils::Const_Pixels_View src) {
+        size_ = 0;
+        if (!src.is_valid()) {
+            std::cerr << "[ERROR] Cannot encode an invalid pixel view!\n";
+            return false;
+        }
+        const auto jpfmt = detail::pfmt_to_jfmt(src.format());
+        if (jpfmt == -1) {
+            std::cerr << "[ERROR] Cannot encode " << src.format()
+                      << " pixels to JPEG!\n";
+            return false;
+        }
+        const auto subsamp =
+            jpfmt == TJPF_GRAY ? static_cast<int>(TJSAMP_GRAY) : opts_.subsamp;
+        if (subsamp < 0 || subsamp >= TJ_NUMSAMP) {
+            std::cerr << "[ERROR] Invalid JPEG subsampling (" << subsamp
+                      << ")!\n";
+            return false;
+        }
+        auto *hand = detail::tj_compressor();
+        if (hand == nullptr) {
+            return false;
+        }
+        // Only grows, smaller images reuse the buffer of larger ones
+        const auto need = tjBufSize(src.width(), src.height(), subsamp);
+        if (need == static_cast<unsigned long>(-1)) {
+            return false;
+        }
+        if (buf_.size() < need) {
+            buf_.clear();
+            buf_.resize(need);
+        }
+        auto *out = buf_.data();
+        unsigned long out_size = buf_.size();
+        const auto flags =
+            TJFLAG_NOREALLOC | (opts_.fast_dct ? TJFLAG_FASTDCT : 0);
+        const auto err = tjCompress2(
+            hand, src.data(), src.width(), static_cast<int>(src.pitch()),
+            src.height(), jpfmt, &out, &out_size, subsamp,
+            std::clamp(opts_.quality, 1, 100), flags);
+        if (err != 0) {
+            std::cerr << "[ERROR] Could not compress JPEG! "
+                      << tjGetErrorStr2(hand) << '\n';
+            return false;
+        }
+        size_ = out_size;
+        return true;
+    }
+
+    // Writes the last encoded JPEG to a file
+    bool write(const char *filename) const {
+        if (size_ == 0) {
+            std::cerr << "[ERROR] No JPEG to write to " << filename << "!\n";
+            return false;
+        }
+        return utils::file_binwrite(filename, buf_.data(), size_);
+    }
+    // Encodes src and writes it to a file
+    bool save(const char *filename, const utils::Const_Pixels_View src) {
+        return encode(src) && write(filename);
+    }
+
+  private:
+    JPEG_Write_Opts opts_{};
+    utils::pixel_buf_t buf_{};
+    size_t size_{0};
+}; // JPEG_Write
+
+// What a JPEG's headers say about it, see jpeg_probe
+struct JPEG_Info {
+    int width{0};
+    int height{0};
+    int components{0};
+    // TJSAMP_* and TJCS_* as TurboJPEG would report them, -1 if unknown
+    int subsamp{-1};
+    int colorspace{-1};
+    bool progressive{false};
+    // From the EXIF orientation tag, Normal if there is none
+    utils::Orientation orientation{utils::Orientation::Normal};
+    // Bytes of the file that had to be read
+    int64_t bytes_read{0};
+
+    bool is_valid() const noexcept { return width > 0 && height > 0; }
+};
+inline std::ostream &operator<<(std::ostream &os, const JPEG_Info &i) {
+    os << i.width << 'x' << i.height << ' ' << i.components
+       << " components subsamp " << i.subsamp << " colorspace "
+       << i.colorspace << (i.progressive ? " progressive " : " baseline ")
+       << i.orientation << " (" << i.bytes_read << " bytes read)";
+    return os;
+}
+
+// Bytes read at a time by jpeg_probe, enough for the frame header of most
+// JPEGs and the start of the EXIF block in one read
+constexpr std::streamoff JPEG_PROBE_BYTES = 4096;
+
+namespace detail {
+// A window into a file, reread with ranged file_binread wherever the bytes
+// asked for are. Offsets are from the start of the file.
+class File_Window {
+  public:
+    File_Window(const char *filename, const std::streamoff size)
+        : filename_{filename}
+        , size_{size} {}
+
+    // Makes [pos, pos + n) readable, false if that is past the end
+    bool fetch(const std::streamoff pos, const std::streamoff n) {
+        if (pos >= base_ && pos + n <= base_ + window_size()) {
+            return true;
+        }
+        if (pos < 0 || n < 0 || pos + n > size_) {
+            return false;
+        }
+        const auto end = std::min(size_, pos + std::max(n, JPEG_PROBE_BYTES));
+        buf_ = utils::file_binread(filename_, pos, end);
+        base_ = pos;
+        bytes_read_ += static_cast<int64_t>(buf_.size());
+        return pos + n <= base_ + window_size();
+    }
+
+    // Only for fetched bytes, multi byte values are big endian unless le
+    uint8_t u8(const std::streamoff pos) const {
+        return buf_[static_cast<size_t>(pos - base_)];
+    }
+    uint16_t u16(const std::streamoff pos, const bool le = false) const {
+        return utils::read_int<uint16_t>(
+            buf_, static_cast<unsigned>(pos - base_), !le);
+    }
+    uint32_t u32(const std::streamoff pos, const bool le = false) const {
+        return utils::read_int<uint32_t>(
+            buf_, static_cast<unsigned>(pos - base_), !le);
+    }
+    int64_t bytes_read() const noexcept { return bytes_read_; }
+
+  private:
+    const char *filename_;
+    std::streamoff size_;
+    std::streamoff base_{0};
+    utils::bytes_t buf_{};
+    int64_t bytes_read_{0};
+
+    std::streamoff window_size() const noexcept {
+        return static_cast<std::streamoff>(buf_.size());
+    }
+};
+
+// The EXIF orientation tag of the APP1 segment [seg, seg + len), 0 if there
+// is none. Only the TIFF header and the first IFD are read.
+inline int exif_orientation(File_Window &f, const std::streamoff seg,
+                            const std::streamoff len) {
+    constexpr uint8_t exif_id[6] = {'E', 'x', 'i', 'f', 0, 0};
+    if (len < 14 || !f.fetch(seg, 14)) {
+        return 0;
+    }
+    for (size_t i = 0; i < 6; ++i) {
+        if (f.u8(seg + static_cast<std::streamoff>(i)) != exif_id[i]) {
+            return 0;
+        }
+    }
+    const auto tiff = seg + 6;
+    const auto order = f.u16(tiff);
+    if (order != 0x4949 && order != 0x4D4D) {
+        return 0;
+    }
+    const bool le = order == 0x4949;
+    if (f.u16(tiff + 2, le) != 42) {
+        return 0;
+    }
+    const auto ifd = tiff + std::streamoff{f.u32(tiff + 4, le)};
+    const auto end = seg + len;
+    if (ifd + 2 > end || !f.fetch(ifd, 2)) {
+        return 0;
+    }
+    const auto count = std::streamoff{f.u16(ifd, le)};
+    const auto entries = ifd + 2;
+    if (entries + count * 12 > end || !f.fetch(entries, count * 12)) {
+        return 0;
+    }
+    constexpr uint16_t TAG_ORIENTATION = 0x0112;
+    constexpr uint16_t TYPE_SHORT = 3;
+    for (std::streamoff i = 0; i < count; ++i) {
+        const auto e = entries + i * 12;
+        if (f.u16(e, le) == TAG_ORIENTATION && f.u16(e + 2, le) == TYPE_SHORT) {
+            return f.u16(e + 8, le);
+        }
+    }
+    return 0;
+}
+
+// TJSAMP_* for the sampling factors of luma, chroma must be 1x1
+inline int jpeg_subsamp(const int h, const int v) noexcept {
+    const auto hv = h * 10 + v;
+    switch (hv) {
+    case 11:
+        return TJSAMP_444;
+    case 21:
+        return TJSAMP_422;
+    case 22:
+        return TJSAMP_420;
+    case 12:
+        return TJSAMP_440;
+    case 41:
+        return TJSAMP_411;
+    default:
+        break;
+    }
+    return -1;
+}
+} // namespace detail
+
+//
+// Reads only the headers of a JPEG, for scans over many large files
+// The file is read JPEG_PROBE_BYTES at a time from the start up to the frame
+// header (SOFn). Segments in between are skipped without reading them, so a
+// large EXIF thumbnail only costs a read behind it. Colorspace and
+// subsampling are derived the way libjpeg does (JFIF, Adobe and component
+// IDs). Returns an invalid info (and reports why) for non JPEGs.
+//
+inline JPEG_Info jpeg_probe(const char *filename) {
+    const auto size = utils::file_size(filename);
+    if (size < 0) {
+        return JPEG_Info{};
+    }
+    detail::File_Window f{filename, size};
+    if (!f.fetch(0, 2) || f.u16(0) != 0xFFD8) {
+        std::cerr << "[ERROR] Not a JPEG file: " << filename << '\n';
+        return JPEG_Info{};
+    }
+    bool jfif = false;
+    int adobe_transform = -1;
+    int orientation = 0;
+    std::streamoff pos = 2;
+    while (f.fetch(pos, 4) && f.u8(pos) == 0xFF) {
+        const auto marker = f.u8(pos + 1);
+        // Fill bytes, then the markers without a length
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+            continue;
+        }
+        // Scan data or the end before any frame header
+        if (marker == 0xDA || marker == 0xD9) {
+            break;
+        }
+        const auto seg = pos + 4;
+        const auto len = std::streamoff{f.u16(pos + 2)} - 2;
+        if (len < 0) {
+            break;
+        }
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        const bool sof = marker >= 0xC0 && marker <= 0xCF &&
+                         marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (sof) {
+            if (len < 6 || !f.fetch(seg, 6)) {
+                break;
+            }
+            JPEG_Info info{};
+            info.height = f.u16(seg + 1);
+            info.width = f.u16(seg + 3);
+            info.components = f.u8(seg + 5);
+            info.progressive = marker == 0xC2 || marker == 0xC6 ||
+                               marker == 0xCA || marker == 0xCE;
+            const auto comps = std::streamoff{info.components};
+            if (len < 6 + comps * 3 || !f.fetch(seg + 6, comps * 3)) {
+                break;
+            }
+            const auto id = [&](const std::streamoff c) {
+                return f.u8(seg + 6 + c * 3);
+            };
+            const auto hv = [&](const std::streamoff c) {
+                return f.u8(seg + 7 + c * 3);
+            };
+            switch (info.components) {
+            case 1:
+                info.colorspace = TJCS_GRAY;
+                info.subsamp = TJSAMP_GRAY;
+                break;
+            case 3:
+            case 4:
+                if (info.components == 4) {
+                    info.colorspace =
+                        adobe_transform == 2 ? TJCS_YCCK : TJCS_CMYK;
+                } else if (jfif || adobe_transform == 1) {
+                    info.colorspace = TJCS_YCbCr;
+                } else if (adobe_transform == 0 ||
+                           (id(0) == 'R' && id(1) == 'G' && id(2) == 'B')) {
+                    info.colorspace = TJCS_RGB;
+                } else {
+                    info.colorspace = TJCS_YCbCr;
+                }
+                if (hv(1) == 0x11 && hv(2) == 0x11) {
+                    info.subsamp = detail::jpeg_subsamp(hv(0) >> 4,
+                                                        hv(0) & 0x0F);
+                }
+                break;
+            default:
+                break;
+            }
+            if (orientation != 0) {
+                info.orientation = utils::orientation_from_exif(orientation);
+            }
+            info.bytes_read = f.bytes_read();
+            if (!info.is_valid()) {
+                break;
+            }
+            return info;
+        }
+        if (marker == 0xE0 && len >= 5 && f.fetch(seg, 5)) {
+            // APP0, JFIF means YCbCr
+            jfif = f.u32(seg) == 0x4A464946 && f.u8(seg + 4) == 0;
+        } else if (marker == 0xE1 && orientation == 0) {
+            orientation = detail::exif_orientation(f, seg, len);
+        } else if (marker == 0xEE && len >= 12 && f.fetch(seg, 12)) {
+            // APP14, Adobe's colour transform byte follows the version and
+            // flags
+            if (f.u32(seg) == 0x41646F62 && f.u8(seg + 4) == 'e') {
+                adobe_transform = f.u8(seg + 11);
+            }
+        }
+        pos = seg + len;
+    }
+    std::cerr << "[ERROR] No JPEG frame header found in " << filename << '\n';
+    return JPEG_Info{};
+}
 
 } // namespace utils
 
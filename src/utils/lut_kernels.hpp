@@ -0,0 +1,302 @@
+/*
+  lut_kernels.h -- Raw kernels applying 256 entry lookup tables to bytes
+*/
+#ifndef LUT_KERNELS_HPP
+#define LUT_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include "utils/pixel_kernels.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+namespace kernels {
+
+// A byte to byte table, plus the same table rearranged for the shuffle
+// kernels. Each half of 128 entries is split into 8 rows of 16, every row
+// xored with the one before it. Shuffling row h with index x - 16 * h gives
+// 0 once x - 16 * h is negative and row h for x - 16 * h < 128, so xoring
+// all rows of a half leaves exactly row x / 16 entry x % 16.
+struct Lut8 {
+    alignas(64) uint8_t table[256];
+    alignas(64) uint8_t folded[256];
+
+    void fold() noexcept {
+        for (size_t i = 0; i < 256; ++i) {
+            const auto prev = i % 128 < 16 ? 0 : table[i - 16];
+            folded[i] = static_cast<uint8_t>(table[i] ^ prev);
+        }
+    }
+};
+
+//
+// dst[i] = lut[src[i]] for n bytes, src and dst may be the same buffer
+// With keep_alpha every 4th byte (RGBA alpha) is copied as is, n is then a
+// multiple of 4.
+//
+inline void lut_apply_tail(const uint8_t *src, uint8_t *dst, size_t first,
+                           const size_t n, const Lut8 &lut,
+                           const bool keep_alpha) noexcept {
+    for (; first < n; ++first) {
+        const auto v = src[first];
+        dst[first] = keep_alpha && first % 4 == 3 ? v : lut.table[v];
+    }
+}
+inline void lut_apply_scalar(const uint8_t *src, uint8_t *dst, const size_t n,
+                             const Lut8 &lut, const bool keep_alpha) noexcept {
+    if (keep_alpha) {
+        lut_apply_tail(src, dst, 0, n, lut, true);
+        return;
+    }
+    // 8 lookups gathered into one store, the loads are the bottleneck
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v = 0;
+        for (size_t k = 0; k < 8; ++k) {
+            v |= static_cast<uint64_t>(lut.table[src[i + k]]) << (8 * k);
+        }
+        std::memcpy(dst + i, &v, 8);
+    }
+    lut_apply_tail(src, dst, i, n, lut, false);
+}
+
+#if UTILS_ARCH_X86
+UTILS_TARGET_SSE41 inline void lut_apply_sse(const uint8_t *src, uint8_t *dst,
+                                             const size_t n, const Lut8 &lut,
+                                             const bool keep_alpha) noexcept {
+    __m128i rows[16];
+    for (size_t h = 0; h < 16; ++h) {
+        rows[h] = _mm_load_si128(
+            reinterpret_cast<const __m128i *>(lut.folded + 16 * h));
+    }
+    const auto ones = _mm_set1_epi8(-1);
+    const auto flip = _mm_set1_epi8(static_cast<char>(0x80));
+    const auto step = _mm_set1_epi8(16);
+    const auto amask = keep_alpha
+                           ? _mm_set1_epi32(static_cast<int>(0xFF000000))
+                           : _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto x =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        // Each half only looks at its own bytes, the others are all ones
+        // and stay negative for all 8 rows
+        const auto high = _mm_cmplt_epi8(x, _mm_setzero_si128());
+        auto lo = _mm_or_si128(x, high);
+        auto hi =
+            _mm_or_si128(_mm_xor_si128(x, flip), _mm_xor_si128(high, ones));
+        auto r = _mm_setzero_si128();
+        for (size_t h = 0; h < 8; ++h) {
+            r = _mm_xor_si128(r, _mm_shuffle_epi8(rows[h], lo));
+            r = _mm_xor_si128(r, _mm_shuffle_epi8(rows[8 + h], hi));
+            lo = _mm_sub_epi8(lo, step);
+            hi = _mm_sub_epi8(hi, step);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_blendv_epi8(r, x, amask));
+    }
+    lut_apply_tail(src, dst, i, n, lut, keep_alpha);
+}
+
+UTILS_TARGET_AVX2 inline void lut_apply_avx2(const uint8_t *src, uint8_t *dst,
+                                             const size_t n, const Lut8 &lut,
+                                             const bool keep_alpha) noexcept {
+    __m256i rows[16];
+    for (size_t h = 0; h < 16; ++h) {
+        rows[h] = _mm256_broadcastsi128_si256(_mm_load_si128(
+            reinterpret_cast<const __m128i *>(lut.folded + 16 * h)));
+    }
+    const auto ones = _mm256_set1_epi8(-1);
+    const auto flip = _mm256_set1_epi8(static_cast<char>(0x80));
+    const auto step = _mm256_set1_epi8(16);
+    const auto amask = keep_alpha
+                           ? _mm256_set1_epi32(static_cast<int>(0xFF000000))
+                           : _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto x =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const auto high = _mm256_cmpgt_epi8(_mm256_setzero_si256(), x);
+        auto lo = _mm256_or_si256(x, high);
+        auto hi = _mm256_or_si256(_mm256_xor_si256(x, flip),
+                                  _mm256_xor_si256(high, ones));
+        auto r = _mm256_setzero_si256();
+        for (size_t h = 0; h < 8; ++h) {
+            r = _mm256_xor_si256(r, _mm256_shuffle_epi8(rows[h], lo));
+            r = _mm256_xor_si256(r, _mm256_shuffle_epi8(rows[8 + h], hi));
+            lo = _mm256_sub_epi8(lo, step);
+            hi = _mm256_sub_epi8(hi, step);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                            _mm256_blendv_epi8(r, x, amask));
+    }
+    lut_apply_tail(src, dst, i, n, lut, keep_alpha);
+}
+
+// GCC 12 warns about _mm512_undefined_epi32() inside its own intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+constexpr uint64_t LUT_ALPHA_MASK = 0x8888888888888888ULL;
+
+UTILS_TARGET_AVX512BW inline void
+lut_apply_avx512(const uint8_t *src, uint8_t *dst, const size_t n,
+                 const Lut8 &lut, const bool keep_alpha) noexcept {
+    __m512i rows[16];
+    for (size_t h = 0; h < 16; ++h) {
+        rows[h] = _mm512_broadcast_i32x4(_mm_load_si128(
+            reinterpret_cast<const __m128i *>(lut.folded + 16 * h)));
+    }
+    const auto ones = _mm512_set1_epi8(-1);
+    const auto flip = _mm512_set1_epi8(static_cast<char>(0x80));
+    const auto step = _mm512_set1_epi8(16);
+    const __mmask64 amask = keep_alpha ? LUT_ALPHA_MASK : 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto x = _mm512_loadu_si512(src + i);
+        const auto high = _mm512_movepi8_mask(x);
+        auto lo = _mm512_mask_mov_epi8(x, high, ones);
+        auto hi = _mm512_mask_mov_epi8(ones, high, _mm512_xor_si512(x, flip));
+        auto r = _mm512_setzero_si512();
+        for (size_t h = 0; h < 8; ++h) {
+            r = _mm512_xor_si512(r, _mm512_shuffle_epi8(rows[h], lo));
+            r = _mm512_xor_si512(r, _mm512_shuffle_epi8(rows[8 + h], hi));
+            lo = _mm512_sub_epi8(lo, step);
+            hi = _mm512_sub_epi8(hi, step);
+        }
+        _mm512_storeu_si512(dst + i, _mm512_mask_mov_epi8(r, amask, x));
+    }
+    lut_apply_tail(src, dst, i, n, lut, keep_alpha);
+}
+
+// VBMI permutes 128 table entries at once, two of them cover the table
+UTILS_TARGET_AVX512VBMI inline void
+lut_apply_vbmi(const uint8_t *src, uint8_t *dst, const size_t n,
+               const Lut8 &lut, const bool keep_alpha) noexcept {
+    const auto t0 = _mm512_load_si512(lut.table);
+    const auto t1 = _mm512_load_si512(lut.table + 64);
+    const auto t2 = _mm512_load_si512(lut.table + 128);
+    const auto t3 = _mm512_load_si512(lut.table + 192);
+    const __mmask64 amask = keep_alpha ? LUT_ALPHA_MASK : 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto x = _mm512_loadu_si512(src + i);
+        const auto lo = _mm512_permutex2var_epi8(t0, x, t1);
+        const auto hi = _mm512_permutex2var_epi8(t2, x, t3);
+        const auto r = _mm512_mask_mov_epi8(lo, _mm512_movepi8_mask(x), hi);
+        _mm512_storeu_si512(dst + i, _mm512_mask_mov_epi8(r, amask, x));
+    }
+    lut_apply_tail(src, dst, i, n, lut, keep_alpha);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using lut_fn_t = void (*)(const uint8_t *, uint8_t *, size_t, const Lut8 &,
+                          bool) noexcept;
+inline void lut_apply(const uint8_t *src, uint8_t *dst, const size_t n,
+                      const Lut8 &lut, const bool keep_alpha) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_has_avx512vbmi()
+            ? &lut_apply_vbmi
+            : cpu_select<lut_fn_t>(lut_apply_scalar, lut_apply_sse,
+                                   lut_apply_avx2, lut_apply_avx512);
+    fn(src, dst, n, lut, keep_alpha);
+#else
+    lut_apply_scalar(src, dst, n, lut, keep_alpha);
+#endif
+}
+
+//
+// dst[i] = lut[src[i]] for n 16 bit values, src and dst may be the same
+// buffer. With keep_alpha every 4th value (RGBA16 alpha) is copied as is.
+// A 65536 entry table is far too large for the shuffle kernels, the plain
+// lookups are as good as it gets.
+//
+inline void lut16_apply(const uint8_t *src, uint8_t *dst, const size_t n,
+                        const uint16_t *lut, const bool keep_alpha) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+        uint16_t v;
+        std::memcpy(&v, src + i * 2, 2);
+        if (!keep_alpha || i % 4 != 3) {
+            v = lut[v];
+        }
+        std::memcpy(dst + i * 2, &v, 2);
+    }
+}
+
+//
+// sRGB transfer functions on values in [0, 1]
+//
+inline double srgb_to_linear(const double v) noexcept {
+    return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+}
+inline double linear_to_srgb(const double v) noexcept {
+    return v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055;
+}
+
+// Tables for luma of linear light: each channel's weighted linear value in
+// Q15 of 16 bit linear, summed into a 16 bit index of the sRGB encoding
+struct Linear_Luma_Tables {
+    uint32_t r[256];
+    uint32_t g[256];
+    uint32_t b[256];
+    uint8_t encode[65536];
+};
+inline const Linear_Luma_Tables &linear_luma_tables() {
+    static const auto *tables = [] {
+        auto *t = new Linear_Luma_Tables{};
+        for (unsigned i = 0; i < 256; ++i) {
+            const auto lin = static_cast<uint32_t>(
+                std::lround(srgb_to_linear(i / 255.0) * 65535.0));
+            t->r[i] = lin * static_cast<uint32_t>(LUMA_R);
+            t->g[i] = lin * static_cast<uint32_t>(LUMA_G);
+            t->b[i] = lin * static_cast<uint32_t>(LUMA_B);
+        }
+        for (unsigned i = 0; i < 65536; ++i) {
+            t->encode[i] = static_cast<uint8_t>(
+                std::lround(linear_to_srgb(i / 65535.0) * 255.0));
+        }
+        return t;
+    }();
+    return *tables;
+}
+
+// RGB(A) -> GRAY with the luma computed on linear light, sRGB decoded and
+// encoded again through the tables above. Three lookups replace the three
+// multiplies of rgb_to_gray_scalar. With C == 4 the result is scaled by
+// alpha like rgba_to_gray, unless premultiplied.
+template <size_t C>
+void rgb_to_gray_linear(const uint8_t *src, uint8_t *dst, const size_t n,
+                        const bool premultiplied = false) noexcept {
+    constexpr uint32_t half = 1U << (LUMA_SHIFT - 1);
+    const auto &t = linear_luma_tables();
+    for (size_t i = 0; i < n; ++i, src += C) {
+        const auto lin = (t.r[src[0]] + t.g[src[1]] + t.b[src[2]] + half) >>
+                         LUMA_SHIFT;
+        const auto y = t.encode[lin];
+        if constexpr (C == 4) {
+            dst[i] = premultiplied
+                         ? y
+                         : static_cast<uint8_t>(div255(unsigned{y} * src[3]));
+        } else {
+            dst[i] = y;
+        }
+    }
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
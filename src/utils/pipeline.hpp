@@ -0,0 +1,497 @@
+/*
+  pipeline.h -- Lazy chains of pixel operations run in a single pass
+*/
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "utils/lut_kernels.hpp"
+#include "utils/pixel_alloc.hpp"
+#include "utils/pixel_convert.hpp"
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/point_ops.hpp"
+#include "utils/resample_kernels.hpp"
+#include "utils/resize.hpp"
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace utils {
+
+namespace detail {
+enum class Pipeline_Op { Convert, Lut, Downscale_2x, Resize };
+
+// One recorded operation and the size and format of its input
+struct Pipeline_Step {
+    Pipeline_Op op{Pipeline_Op::Convert};
+    Pixel_Format fmt{Pixel_Format::Unknown};
+    int in_w{0};
+    int in_h{0};
+    int out_w{0};
+    int out_h{0};
+    // Convert
+    Pixel_Format to{Pixel_Format::Unknown};
+    Pixel_Convert_Opts opts{};
+    // Lut
+    Point_Lut lut{};
+    // Resize, no taps for a side that keeps its size
+    Resize_Weights rw_h{};
+    Resize_Weights rw_v{};
+};
+
+// Keeps the weights of the outputs [first, first + count) and makes them
+// relative to the first input they read. Returns that input, count becomes
+// the number of inputs read. Starts never decrease along the outputs.
+inline int slice_resize_weights(Resize_Weights &rw, const int first,
+                                int &count) {
+    const auto f = static_cast<size_t>(first);
+    const auto n = static_cast<size_t>(count);
+    std::vector<int> start(rw.start.begin() + static_cast<std::ptrdiff_t>(f),
+                           rw.start.begin() +
+                               static_cast<std::ptrdiff_t>(f + n));
+    std::vector<int16_t> w(
+        rw.w.begin() + static_cast<std::ptrdiff_t>(f * rw.taps),
+        rw.w.begin() + static_cast<std::ptrdiff_t>((f + n) * rw.taps));
+    const auto lo = start.front();
+    const auto hi = start.back() + static_cast<int>(rw.taps);
+    for (auto &s : start) {
+        s -= lo;
+    }
+    rw.start = std::move(start);
+    rw.w = std::move(w);
+    count = hi - lo;
+    return lo;
+}
+
+// Steps that map a row to a row are fused into one level and run back to
+// back on every row. Steps that combine rows (downscale_2x and the vertical
+// half of resize) start a new level, fed from a ring of the last rows of
+// the level before.
+struct Pipeline_Level {
+    using row_fn_t = std::function<void(const uint8_t *, uint8_t *)>;
+    using combine_fn_t =
+        std::function<void(const uint8_t *const *, size_t, uint8_t *)>;
+
+    // Row y of this level reads taps rows from start[y] on, unused for the
+    // first level which reads the source
+    std::vector<int> start{};
+    size_t taps{0};
+    combine_fn_t combine{};
+    std::vector<row_fn_t> ops{};
+    // Largest row in between and the size of the rows that come out
+    size_t scratch_bytes{0};
+    size_t row_bytes{0};
+
+    void add_op(row_fn_t fn, const size_t bytes) {
+        ops.push_back(std::move(fn));
+        scratch_bytes = std::max(scratch_bytes, bytes);
+        row_bytes = bytes;
+    }
+};
+
+// Pulls rows through the levels, each level computes a row once and keeps
+// it until the level after has moved past it. One per thread, everything it
+// allocates is a few rows.
+class Pipeline_Rows {
+  public:
+    Pipeline_Rows(const std::vector<Pipeline_Level> &levels,
+                  const Const_Pixels_View src)
+        : levels_{levels}
+        , src_{src}
+        , state_(levels.size()) {
+        for (size_t k = 0; k < levels.size(); ++k) {
+            auto &st = state_[k];
+            st.scratch[0].resize(levels[k].scratch_bytes);
+            st.scratch[1].resize(levels[k].scratch_bytes);
+            st.rows.resize(levels[k].taps);
+            if (k + 1 < levels.size()) {
+                const auto ring = levels[k + 1].taps;
+                st.tags.assign(ring, std::numeric_limits<size_t>::max());
+                st.ring.resize(ring * levels[k].row_bytes);
+            }
+        }
+    }
+
+    // Computes row y of the last level into dst
+    void write(const size_t y, uint8_t *dst) {
+        produce(levels_.size() - 1, y, dst);
+    }
+
+  private:
+    struct Level_State {
+        pixel_buf_t scratch[2]{};
+        pixel_buf_t ring{};
+        std::vector<size_t> tags{};
+        std::vector<const uint8_t *> rows{};
+    };
+    const std::vector<Pipeline_Level> &levels_;
+    Const_Pixels_View src_{};
+    std::vector<Level_State> state_{};
+
+    const uint8_t *fetch(const size_t k, const size_t y) {
+        if (k == 0 && levels_[0].ops.empty()) {
+            return src_.row(static_cast<int>(y));
+        }
+        auto &st = state_[k];
+        const auto slot = y % st.tags.size();
+        auto *row = st.ring.data() + slot * levels_[k].row_bytes;
+        if (st.tags[slot] != y) {
+            produce(k, y, row);
+            st.tags[slot] = y;
+        }
+        return row;
+    }
+
+    void produce(const size_t k, const size_t y, uint8_t *out) {
+        const auto &lv = levels_[k];
+        auto &st = state_[k];
+        const auto n = lv.ops.size();
+        const uint8_t *in = nullptr;
+        if (k == 0) {
+            in = src_.row(static_cast<int>(y));
+        } else {
+            const auto first = static_cast<size_t>(lv.start[y]);
+            for (size_t t = 0; t < lv.taps; ++t) {
+                st.rows[t] = fetch(k - 1, first + t);
+            }
+            auto *c = n == 0 ? out : st.scratch[0].data();
+            lv.combine(st.rows.data(), y, c);
+            in = c;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            auto *o = i + 1 == n ? out : st.scratch[(i + 1) % 2].data();
+            lv.ops[i](in, o);
+            in = o;
+        }
+    }
+}; // Pipeline_Rows
+} // namespace detail
+
+// Records operations on a view of pixels and runs all of them in one pass
+// over the rows, instead of one pass and one full size buffer per operation.
+// Per pixel steps (format conversions, LUTs) and horizontal resampling run
+// back to back on each row while it is in L1, steps that reduce rows read
+// from a small ring of rows. Crops never touch pixels, they are moved to
+// the source and shrink the work of every step before them.
+// Results are the same as running convert_view, apply_lut, sub, downscale_2x
+// and resize one after the other. The source memory has to outlive the
+// pipeline. Any invalid step is reported and makes run() fail.
+class Pixels_Pipeline {
+  public:
+    // Default construct - empty, invalid pipeline
+    Pixels_Pipeline() = default;
+
+    // Constructor -> Source pixels
+    explicit Pixels_Pipeline(const Const_Pixels_View src)
+        : src_{src}
+        , format_{src.format()}
+        , width_{src.width()}
+        , height_{src.height()}
+        , is_valid_{src.is_valid()} {
+        if (!is_valid_) {
+            std::cerr << "[ERROR] Cannot build a pipeline on an invalid "
+                         "pixel view!\n";
+        }
+    }
+
+    // Simple getters, the format and size of the result so far
+    Pixel_Format format() const noexcept { return format_; }
+    int width() const noexcept { return width_; }
+    int height() const noexcept { return height_; }
+    bool is_valid() const noexcept { return is_valid_; }
+    size_t steps() const noexcept { return steps_.size(); }
+
+    Pixels_Pipeline &convert_to(const Pixel_Format fmt,
+                                const Pixel_Convert_Opts &opts = {}) {
+        if (!is_valid_ || fmt == format_) {
+            return *this;
+        }
+        if (get_converter(format_, fmt) == nullptr) {
+            return fail("convert", fmt);
+        }
+        auto &s = add_step(detail::Pipeline_Op::Convert);
+        s.to = fmt;
+        s.opts = opts;
+        s.opts.parallel = false;
+        format_ = fmt;
+        return *this;
+    }
+
+    // Consecutive LUTs are merged into one
+    Pixels_Pipeline &apply_lut(const Point_Lut &lut) {
+        if (!is_valid_) {
+            return *this;
+        }
+        if (pxfmt_depth(format_) != 1) {
+            return fail("apply a LUT to", format_);
+        }
+        if (!steps_.empty() && steps_.back().op == detail::Pipeline_Op::Lut) {
+            steps_.back().lut = steps_.back().lut.then(lut);
+            return *this;
+        }
+        add_step(detail::Pipeline_Op::Lut).lut = lut;
+        return *this;
+    }
+    Pixels_Pipeline &apply_point_ops(const Point_Ops &ops) {
+        return apply_lut(ops.compile());
+    }
+
+    // Keeps the w x h pixels at x, y of the result so far
+    Pixels_Pipeline &crop(int x, int y, int w, int h) {
+        if (!is_valid_) {
+            return *this;
+        }
+        if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > width_ - x ||
+            h > height_ - y) {
+            std::cerr << "[ERROR] Crop (" << x << ',' << y << ' ' << w << 'x'
+                      << h << ") is outside of the image (" << width_ << 'x'
+                      << height_ << ")!\n";
+            is_valid_ = false;
+            return *this;
+        }
+        width_ = w;
+        height_ = h;
+        // Walk back to the source, turning the rectangle into the one each
+        // step reads
+        for (auto it = steps_.rbegin(); it != steps_.rend(); ++it) {
+            auto &s = *it;
+            s.out_w = w;
+            s.out_h = h;
+            switch (s.op) {
+            case detail::Pipeline_Op::Downscale_2x:
+                x *= 2;
+                y *= 2;
+                w *= 2;
+                h *= 2;
+                break;
+            case detail::Pipeline_Op::Resize:
+                if (s.rw_h.taps != 0) {
+                    x = detail::slice_resize_weights(s.rw_h, x, w);
+                }
+                if (s.rw_v.taps != 0) {
+                    y = detail::slice_resize_weights(s.rw_v, y, h);
+                }
+                break;
+            case detail::Pipeline_Op::Convert:
+            case detail::Pipeline_Op::Lut:
+            default:
+                break;
+            }
+            s.in_w = w;
+            s.in_h = h;
+        }
+        src_ = src_.sub(x, y, w, h);
+        is_valid_ = src_.is_valid();
+        return *this;
+    }
+
+    // Exact 2x box reduction, see utils::downscale_2x
+    Pixels_Pipeline &downscale_2x() {
+        if (!is_valid_) {
+            return *this;
+        }
+        if (pxfmt_depth(format_) != 1 || width_ < 2 || height_ < 2) {
+            return fail("downscale", format_);
+        }
+        auto &s = add_step(detail::Pipeline_Op::Downscale_2x);
+        s.out_w = width_ / 2;
+        s.out_h = height_ / 2;
+        width_ = s.out_w;
+        height_ = s.out_h;
+        return *this;
+    }
+
+    // Resamples to w x h, see utils::resize
+    Pixels_Pipeline &resize(const int w, const int h,
+                            const Resize_Filter f = Resize_Filter::Lanczos3) {
+        if (!is_valid_ || (w == width_ && h == height_)) {
+            return *this;
+        }
+        if (pxfmt_depth(format_) != 1 || w <= 0 || h <= 0) {
+            return fail("resize", format_);
+        }
+        if (f == Resize_Filter::Box && width_ == w * 2 && height_ == h * 2) {
+            return downscale_2x();
+        }
+        auto &s = add_step(detail::Pipeline_Op::Resize);
+        if (w != width_) {
+            s.rw_h = make_resize_weights(width_, w, f);
+        }
+        if (h != height_) {
+            s.rw_v = make_resize_weights(height_, h, f);
+        }
+        s.out_w = w;
+        s.out_h = h;
+        width_ = w;
+        height_ = h;
+        return *this;
+    }
+
+    // Runs every step into dst, which must have the format and size of the
+    // result and must not overlap the source. With parallel set large
+    // results are split into bands of rows on the shared pool, each band
+    // recomputes the few rows it shares with the band before.
+    bool run(const Pixels_View dst, const bool parallel = false) const {
+        if (!is_valid_ || !dst.is_valid()) {
+            std::cerr << "[ERROR] Cannot run an invalid pipeline!\n";
+            return false;
+        }
+        if (dst.format() != format_ || dst.width() != width_ ||
+            dst.height() != height_) {
+            std::cerr << "[ERROR] Pipeline result is " << format_ << ' '
+                      << width_ << 'x' << height_ << ", not "
+                      << dst.format() << ' ' << dst.width() << 'x'
+                      << dst.height() << "!\n";
+            return false;
+        }
+        if (steps_.empty()) {
+            return convert_view(src_, dst);
+        }
+        const auto *src_end = src_.row(src_.height() - 1) + src_.row_bytes();
+        const auto *dst_end = dst.row(dst.height() - 1) + dst.row_bytes();
+        if (src_.data() < dst_end && dst.data() < src_end) {
+            std::cerr << "[ERROR] Pipeline source and result overlap!\n";
+            return false;
+        }
+        const auto levels = compile();
+        detail::for_row_bands(
+            static_cast<size_t>(height_), dst.row_bytes(), parallel,
+            [&](const size_t first, const size_t last) {
+                detail::Pipeline_Rows rows{levels, src_};
+                for (auto y = first; y < last; ++y) {
+                    rows.write(y, dst.row(static_cast<int>(y)));
+                }
+            });
+        return true;
+    }
+
+    // Same as above into new Pixels
+    Pixels run(const bool parallel = false) const {
+        Pixels p{format_, width_, height_};
+        if (!p.is_valid() || !run(p.view(), parallel)) {
+            p.clear();
+        }
+        return p;
+    }
+
+  private:
+    Const_Pixels_View src_{};
+    std::vector<detail::Pipeline_Step> steps_{};
+    Pixel_Format format_{Pixel_Format::Unknown};
+    int width_{0};
+    int height_{0};
+    bool is_valid_{false};
+
+    detail::Pipeline_Step &add_step(const detail::Pipeline_Op op) {
+        auto &s = steps_.emplace_back();
+        s.op = op;
+        s.fmt = format_;
+        s.in_w = width_;
+        s.in_h = height_;
+        s.out_w = width_;
+        s.out_h = height_;
+        return s;
+    }
+
+    Pixels_Pipeline &fail(const char *what, const Pixel_Format fmt) {
+        std::cerr << "[ERROR] Pipeline cannot " << what << ' ' << fmt << ' '
+                  << width_ << 'x' << height_ << " pixels!\n";
+        is_valid_ = false;
+        return *this;
+    }
+
+    // Turns the steps into levels of row functions, they refer to the steps
+    // so the pipeline must not change while they are used
+    std::vector<detail::Pipeline_Level> compile() const {
+        std::vector<detail::Pipeline_Level> levels(1);
+        levels[0].row_bytes = src_.row_bytes();
+        for (const auto &s : steps_) {
+            const auto in_w = static_cast<size_t>(s.in_w);
+            const auto out_w = static_cast<size_t>(s.out_w);
+            const auto comps = static_cast<size_t>(pxfmt_components(s.fmt));
+            const auto out_bytes = pixels_pitch(s.out_w, s.fmt);
+            switch (s.op) {
+            case detail::Pipeline_Op::Convert: {
+                const auto fn = get_converter(s.fmt, s.to);
+                const auto *opts = &s.opts;
+                levels.back().add_op(
+                    [fn, in_w, opts](const uint8_t *src, uint8_t *dst) {
+                        fn(src, dst, in_w, *opts);
+                    },
+                    pixels_pitch(s.out_w, s.to));
+                break;
+            }
+            case detail::Pipeline_Op::Lut: {
+                const auto *lut = &s.lut.lut();
+                const auto keep_alpha = s.fmt == Pixel_Format::RGBA;
+                levels.back().add_op(
+                    [lut, out_bytes, keep_alpha](const uint8_t *src,
+                                                 uint8_t *dst) {
+                        kernels::lut_apply(src, dst, out_bytes, *lut,
+                                           keep_alpha);
+                    },
+                    out_bytes);
+                break;
+            }
+            case detail::Pipeline_Op::Downscale_2x: {
+                auto &lv = levels.emplace_back();
+                lv.taps = 2;
+                lv.start.resize(static_cast<size_t>(s.out_h));
+                for (size_t y = 0; y < lv.start.size(); ++y) {
+                    lv.start[y] = static_cast<int>(y * 2);
+                }
+                lv.combine = [out_w, comps](const uint8_t *const *rows,
+                                            size_t, uint8_t *dst) {
+                    kernels::downscale_2x(rows[0], rows[1], dst, out_w, comps);
+                };
+                lv.scratch_bytes = out_bytes;
+                lv.row_bytes = out_bytes;
+                break;
+            }
+            case detail::Pipeline_Op::Resize: {
+                if (s.rw_h.taps != 0) {
+                    kernels::resample_horizontal_fn_t fn = nullptr;
+                    if (comps == 4) {
+                        fn = kernels::resample_horizontal<4>();
+                    } else if (comps == 3) {
+                        fn = kernels::resample_horizontal<3>();
+                    } else {
+                        fn = kernels::resample_horizontal<1>();
+                    }
+                    const auto *rw = &s.rw_h;
+                    levels.back().add_op(
+                        [fn, rw, out_w](const uint8_t *src, uint8_t *dst) {
+                            fn(src, dst, rw->start.data(), rw->w.data(),
+                               rw->taps, out_w);
+                        },
+                        out_bytes);
+                }
+                if (s.rw_v.taps != 0) {
+                    auto &lv = levels.emplace_back();
+                    const auto *rw = &s.rw_v;
+                    lv.taps = rw->taps;
+                    lv.start = rw->start;
+                    lv.combine = [rw, out_bytes](const uint8_t *const *rows,
+                                                 const size_t y, uint8_t *dst) {
+                        kernels::resample_vertical(rows,
+                                                   rw->w.data() + y * rw->taps,
+                                                   rw->taps, dst, out_bytes);
+                    };
+                    lv.scratch_bytes = out_bytes;
+                    lv.row_bytes = out_bytes;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        return levels;
+    }
+}; // Pixels_Pipeline
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,391 @@
+/*
+  pixel_alloc.h -- Aligned, uninitialized, pooled allocator for pixel buffers
+*/
+#ifndef PIXEL_ALLOC_HPP
+#define PIXEL_ALLOC_HPP
+
+#include "utils/system.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace utils {
+
+// Every pixel buffer starts on a cache line, so SIMD kernels never split a
+// load across two lines at the start of a row
+constexpr size_t PIXEL_BUF_ALIGN = 64;
+// Buffers at least this big are mapped directly and marked for transparent
+// huge pages, one fault per 2MB instead of one per 4KB (Linux only)
+constexpr size_t PIXEL_HUGEPAGE_MIN_BYTES = 4 << 20;
+constexpr size_t PIXEL_HUGEPAGE_SIZE = 2 << 20;
+
+namespace detail {
+constexpr size_t round_up(const size_t n, const size_t align) noexcept {
+    return (n + align - 1) / align * align;
+}
+
+// Raw storage for a pixel buffer, throws std::bad_alloc like operator new
+inline void *raw_alloc(const size_t bytes) {
+#ifdef __linux__
+    if (bytes >= PIXEL_HUGEPAGE_MIN_BYTES) {
+        // Over map by a huge page so the buffer can start on a 2MB boundary,
+        // then give the unused head and tail back
+        const auto size = round_up(bytes, PIXEL_HUGEPAGE_SIZE);
+        const auto len = size + PIXEL_HUGEPAGE_SIZE;
+        auto *map = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        const auto beg = reinterpret_cast<uintptr_t>(map);
+        const auto aligned = round_up(beg, PIXEL_HUGEPAGE_SIZE);
+        if (aligned != beg) {
+            munmap(map, aligned - beg);
+        }
+        const auto tail = beg + len - (aligned + size);
+        if (tail != 0) {
+            munmap(reinterpret_cast<void *>(aligned + size), tail);
+        }
+        auto *p = reinterpret_cast<void *>(aligned);
+        madvise(p, size, MADV_HUGEPAGE);
+        return p;
+    }
+#endif
+    return ::operator new(bytes, std::align_val_t{PIXEL_BUF_ALIGN});
+}
+inline void raw_free(void *p, const size_t bytes) noexcept {
+#ifdef __linux__
+    if (bytes >= PIXEL_HUGEPAGE_MIN_BYTES) {
+        munmap(p, round_up(bytes, PIXEL_HUGEPAGE_SIZE));
+        return;
+    }
+#endif
+    ::operator delete(p, bytes, std::align_val_t{PIXEL_BUF_ALIGN});
+}
+} // namespace detail
+
+// Counters of the pixel buffer pool since the start of the process
+struct Pixel_Pool_Stats {
+    // Buffers handed out from the pool
+    uint64_t hits{};
+    // Buffers that had to be freshly allocated
+    uint64_t misses{};
+    // Returned buffers that were freed because the pool was full
+    uint64_t drops{};
+    // Bytes currently held by the pool, across all threads
+    size_t cached_bytes{};
+};
+inline std::ostream &operator<<(std::ostream &os,
+                                const Pixel_Pool_Stats &st) {
+    os << "hits: " << st.hits << ", misses: " << st.misses
+       << ", drops: " << st.drops << ", cached: " << st.cached_bytes;
+    return os;
+}
+
+// Process wide pool of large pixel buffers, batch decoding of same sized
+// images keeps reusing the same few buffers instead of going back to the OS.
+// Sizes are rounded up to one of 4 classes per power of 2 (at most 25% waste).
+// Each thread keeps a couple of buffers per class to itself, everything else
+// goes to a shared list. The total held by the pool never exceeds
+// max_bytes(), UTILS_PIXEL_POOL_MB=N sets it at startup (0 disables it).
+class Pixel_Pool {
+  public:
+    // Smaller buffers go straight to operator new
+    static constexpr size_t MIN_BYTES = 64 * 1024;
+    static constexpr size_t CLASS_COUNT = 64;
+    static constexpr size_t THREAD_SLOTS = 2;
+    static constexpr size_t DEFAULT_MAX_BYTES = size_t{512} << 20;
+
+    // No copy/move constructors and assignments
+    Pixel_Pool(const Pixel_Pool &) = delete;
+    Pixel_Pool(Pixel_Pool &&) = delete;
+    Pixel_Pool &operator=(const Pixel_Pool &) = delete;
+    Pixel_Pool &operator=(Pixel_Pool &&) = delete;
+
+    // Never destroyed, buffers may still be released during static
+    // destruction of other objects (after the thread caches are gone)
+    static Pixel_Pool &instance() {
+        static auto *pool = new Pixel_Pool;
+        return *pool;
+    }
+
+    // Size class of a buffer, CLASS_COUNT if it is not pooled
+    static constexpr size_t size_class(const size_t bytes) noexcept {
+        if (bytes < MIN_BYTES) {
+            return CLASS_COUNT;
+        }
+        // 4 classes between each power of two from the top 3 bits, the
+        // first one is MIN_BYTES itself
+        const auto b = bytes - 1;
+        const auto p = floor_log2(b);
+        const auto q = b >> (p - 2);
+        const auto c = (p - floor_log2(MIN_BYTES - 1)) * 4 + q - 7;
+        return c < CLASS_COUNT ? c : CLASS_COUNT;
+    }
+    // Number of bytes actually allocated for a size class
+    static constexpr size_t class_bytes(const size_t c) noexcept {
+        const auto p = floor_log2(MIN_BYTES - 1) + (c + 3) / 4;
+        return ((c + 3) % 4 + 5) << (p - 2);
+    }
+
+    // Buffer of at least bytes, throws std::bad_alloc like operator new
+    void *acquire(const size_t bytes) {
+        const auto c = size_class(bytes);
+        if (c == CLASS_COUNT) {
+            return detail::raw_alloc(bytes);
+        }
+        const auto sz = class_bytes(c);
+        auto *tc = current_cache();
+        if (tc != nullptr && tc->count[c] > 0) {
+            cached_bytes_ -= sz;
+            ++hits_;
+            return tc->slots[c][--tc->count[c]];
+        }
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            auto &list = free_[c];
+            if (!list.empty()) {
+                auto *p = list.back();
+                list.pop_back();
+                cached_bytes_ -= sz;
+                ++hits_;
+                return p;
+            }
+        }
+        ++misses_;
+        return detail::raw_alloc(sz);
+    }
+
+    // Gives a buffer from acquire back, bytes must be the same
+    void release(void *p, const size_t bytes) noexcept {
+        const auto c = size_class(bytes);
+        if (c == CLASS_COUNT) {
+            detail::raw_free(p, bytes);
+            return;
+        }
+        const auto sz = class_bytes(c);
+        if (cached_bytes_.fetch_add(sz) + sz > max_bytes_.load()) {
+            cached_bytes_ -= sz;
+            ++drops_;
+            detail::raw_free(p, sz);
+            return;
+        }
+        auto *tc = current_cache();
+        if (tc != nullptr && tc->count[c] < THREAD_SLOTS) {
+            tc->slots[c][tc->count[c]++] = p;
+            return;
+        }
+        std::lock_guard<std::mutex> lk(mtx_);
+        // Out of memory for the list itself, just free the buffer
+        try {
+            free_[c].push_back(p);
+        } catch (const std::bad_alloc &) {
+            cached_bytes_ -= sz;
+            ++drops_;
+            detail::raw_free(p, sz);
+        }
+    }
+
+    // Frees every shared buffer and the ones cached by the calling thread.
+    // Other threads free the buffers they cache on their next acquire or
+    // release.
+    void trim() noexcept {
+        ++epoch_;
+        if (auto *tc = thread_cache()) {
+            flush(*tc);
+        }
+        std::lock_guard<std::mutex> lk(mtx_);
+        for (size_t c = 0; c < CLASS_COUNT; ++c) {
+            const auto sz = class_bytes(c);
+            for (auto *p : free_[c]) {
+                cached_bytes_ -= sz;
+                detail::raw_free(p, sz);
+            }
+            free_[c].clear();
+        }
+    }
+
+    // Upper limit of bytes held by the pool, lowering it trims the pool
+    size_t max_bytes() const noexcept { return max_bytes_.load(); }
+    void set_max_bytes(const size_t bytes) noexcept {
+        max_bytes_ = bytes;
+        if (cached_bytes_.load() > bytes) {
+            trim();
+        }
+    }
+
+    Pixel_Pool_Stats stats() const noexcept {
+        Pixel_Pool_Stats st{};
+        st.hits = hits_.load();
+        st.misses = misses_.load();
+        st.drops = drops_.load();
+        st.cached_bytes = cached_bytes_.load();
+        return st;
+    }
+
+  private:
+    struct Thread_Cache {
+        std::array<std::array<void *, THREAD_SLOTS>, CLASS_COUNT> slots{};
+        std::array<size_t, CLASS_COUNT> count{};
+        // epoch_ when the buffers were cached, trim() bumps it
+        uint64_t epoch{0};
+        // Hand everything to the shared lists when the thread exits
+        ~Thread_Cache() {
+            thread_cache_gone() = true;
+            instance().flush(*this);
+        }
+    };
+
+    std::array<std::vector<void *>, CLASS_COUNT> free_{};
+    std::mutex mtx_{};
+    std::atomic<size_t> max_bytes_{DEFAULT_MAX_BYTES};
+    std::atomic<size_t> cached_bytes_{0};
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> drops_{0};
+    std::atomic<uint64_t> epoch_{0};
+
+    Pixel_Pool() {
+        const auto env = env_var("UTILS_PIXEL_POOL_MB");
+        if (!env.empty()) {
+            max_bytes_ = static_cast<size_t>(std::strtoull(env.c_str(),
+                                                           nullptr, 10))
+                         << 20;
+        }
+    }
+    ~Pixel_Pool() = default;
+
+    static constexpr size_t floor_log2(size_t v) noexcept {
+        size_t r = 0;
+        while (v >>= 1) {
+            ++r;
+        }
+        return r;
+    }
+
+    // Set once the calling thread's cache is destroyed, a plain bool has no
+    // destructor and stays readable until the thread is gone
+    static bool &thread_cache_gone() noexcept {
+        thread_local bool gone{false};
+        return gone;
+    }
+    // nullptr after the thread's cache was destroyed, buffers released by
+    // thread_local or static destructors running later go to the shared lists
+    static Thread_Cache *thread_cache() noexcept {
+        if (thread_cache_gone()) {
+            return nullptr;
+        }
+        thread_local Thread_Cache tc{};
+        return &tc;
+    }
+
+    // The calling thread's cache, its buffers are freed first if trim() ran
+    // on any thread since they were cached
+    Thread_Cache *current_cache() noexcept {
+        auto *tc = thread_cache();
+        if (tc == nullptr) {
+            return nullptr;
+        }
+        const auto epoch = epoch_.load();
+        if (tc->epoch != epoch) {
+            tc->epoch = epoch;
+            for (size_t c = 0; c < CLASS_COUNT; ++c) {
+                const auto sz = class_bytes(c);
+                while (tc->count[c] > 0) {
+                    cached_bytes_ -= sz;
+                    detail::raw_free(tc->slots[c][--tc->count[c]], sz);
+                }
+            }
+        }
+        return tc;
+    }
+
+    // Moves a thread's buffers to the shared lists, freeing what does not fit
+    void flush(Thread_Cache &tc) noexcept {
+        std::lock_guard<std::mutex> lk(mtx_);
+        for (size_t c = 0; c < CLASS_COUNT; ++c) {
+            const auto sz = class_bytes(c);
+            while (tc.count[c] > 0) {
+                auto *p = tc.slots[c][--tc.count[c]];
+                try {
+                    free_[c].push_back(p);
+                } catch (const std::bad_alloc &) {
+                    cached_bytes_ -= sz;
+                    ++drops_;
+                    detail::raw_free(p, sz);
+                }
+            }
+        }
+    }
+}; // Pixel_Pool
+static_assert(Pixel_Pool::size_class(Pixel_Pool::MIN_BYTES) == 0);
+static_assert(Pixel_Pool::class_bytes(0) == Pixel_Pool::MIN_BYTES);
+static_assert(Pixel_Pool::class_bytes(Pixel_Pool::size_class(100000)) >=
+              100000);
+
+namespace detail {
+// Pixel buffers, pooled when they are large enough
+inline void *pixel_alloc(const size_t bytes) {
+    return Pixel_Pool::instance().acquire(bytes);
+}
+inline void pixel_free(void *p, const size_t bytes) noexcept {
+    Pixel_Pool::instance().release(p, bytes);
+}
+} // namespace detail
+
+// Standard allocator for pixel storage, large buffers come from Pixel_Pool
+// Elements are default initialized, so resizing a buffer that is about to be
+// overwritten (decoding, conversions) does not memset it first
+template <class T> class Pixel_Allocator {
+  public:
+    using value_type = T;
+
+    Pixel_Allocator() = default;
+    template <class U>
+    constexpr Pixel_Allocator(const Pixel_Allocator<U> &) noexcept {}
+
+    [[nodiscard]] T *allocate(const size_t n) {
+        return static_cast<T *>(detail::pixel_alloc(n * sizeof(T)));
+    }
+    void deallocate(T *p, const size_t n) noexcept {
+        detail::pixel_free(p, n * sizeof(T));
+    }
+
+    // Default initialize instead of value initialize, a no-op for bytes
+    template <class U>
+    void construct(U *p) noexcept(
+        std::is_nothrow_default_constructible_v<U>) {
+        ::new (static_cast<void *>(p)) U;
+    }
+    template <class U, class... Args>
+    void construct(U *p, Args &&...args) {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <class U>
+    bool operator==(const Pixel_Allocator<U> &) const noexcept {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const Pixel_Allocator<U> &) const noexcept {
+        return false;
+    }
+}; // Pixel_Allocator
+
+// Byte buffer for pixel data, aligned and not zeroed on resize
+using pixel_buf_t = std::vector<uint8_t, Pixel_Allocator<uint8_t>>;
+
+} // namespace utils
+
+#endif
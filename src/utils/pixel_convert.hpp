@@ -0,0 +1,361 @@
+/*
+  pixel_convert.h -- Compile time generated pixel format conversions
+*/
+#ifndef PIXEL_CONVERT_HPP
+#define PIXEL_CONVERT_HPP
+
+#include "utils/alpha_kernels.hpp"
+#include "utils/depth_kernels.hpp"
+#include "utils/lut_kernels.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixel_kernels.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+namespace utils {
+
+// Options for conversions that add or remove an alpha channel
+struct Pixel_Convert_Opts {
+    // Alpha value of every pixel when converting to RGBA
+    uint8_t alpha{0xFF};
+    // RGBA -> RGB: composite onto the background instead of dropping alpha
+    bool composite{false};
+    uint8_t bg_r{0xFF};
+    uint8_t bg_g{0xFF};
+    uint8_t bg_b{0xFF};
+    // RGBA sources have premultiplied colours (see Pixels::premultiply)
+    bool premultiplied{false};
+    // -> GRAY: luma of linear light instead of the sRGB encoded values,
+    // darker and truer for saturated colours. Table driven, same speed as
+    // the scalar fixed point kernel.
+    bool linear_luma{false};
+    // Split large images into row bands and run them on the shared pool
+    bool parallel{false};
+};
+
+// Converts n pixels from Src to Dst
+// src and dst may be the same buffer (in place) as long as it is large enough
+// for both, pixels are walked backwards when the destination is larger.
+// RGBA -> GRAY scales the luma by alpha. Between 8 and 16 bits components
+// are scaled by 257 and rounded, the 8 bit opts values are scaled the same.
+template <Pixel_Format Src, Pixel_Format Dst>
+void convert(const uint8_t *src, uint8_t *dst, size_t n,
+             const Pixel_Convert_Opts &opts = {}) noexcept;
+
+namespace detail {
+// Same depth, 8 bits per component
+template <Pixel_Format Src, Pixel_Format Dst>
+void convert8(const uint8_t *src, uint8_t *dst, const size_t n,
+              const Pixel_Convert_Opts &opts) noexcept {
+    using src_t = Pixel_Traits<Src>;
+    using dst_t = Pixel_Traits<Dst>;
+    constexpr auto sc = static_cast<size_t>(src_t::components);
+    constexpr auto dc = static_cast<size_t>(dst_t::components);
+    if constexpr (Src == Dst) {
+        if (src != dst) {
+            memmove(dst, src, n * sc);
+        }
+    } else if constexpr (dst_t::is_gray && !src_t::is_gray) {
+        if (opts.linear_luma) {
+            kernels::rgb_to_gray_linear<sc>(src, dst, n, opts.premultiplied);
+        } else if constexpr (!src_t::has_alpha) {
+            kernels::rgb_to_gray(src, dst, n);
+        } else if (!opts.premultiplied) {
+            kernels::rgba_to_gray(src, dst, n);
+        } else {
+            // Already scaled by alpha, only the luma is left
+            for (size_t i = 0; i < n; ++i, src += sc) {
+                const auto y = kernels::LUMA_R * src[0] +
+                               kernels::LUMA_G * src[1] +
+                               kernels::LUMA_B * src[2];
+                dst[i] = static_cast<uint8_t>(y >> kernels::LUMA_SHIFT);
+            }
+        }
+    } else if constexpr (src_t::is_gray) {
+        // Expand backwards so an in place conversion never reads over itself
+        const auto alpha = opts.alpha;
+        for (size_t i = n; i-- > 0;) {
+            const auto v = src[i];
+            auto *d = dst + i * dc;
+            d[0] = v;
+            d[1] = v;
+            d[2] = v;
+            if constexpr (dst_t::has_alpha) {
+                d[3] = alpha;
+            }
+        }
+    } else if constexpr (dst_t::has_alpha) {
+        // RGB -> RGBA, also backwards
+        const auto alpha = opts.alpha;
+        for (size_t i = n; i-- > 0;) {
+            const auto *s = src + i * sc;
+            const auto r = s[0];
+            const auto g = s[1];
+            const auto b = s[2];
+            auto *d = dst + i * dc;
+            d[0] = r;
+            d[1] = g;
+            d[2] = b;
+            d[3] = alpha;
+        }
+    } else if (!opts.composite) {
+        // RGBA -> RGB, drop alpha (after undoing it if premultiplied)
+        for (size_t i = 0; i < n; ++i) {
+            const auto *s = src + i * sc;
+            auto *d = dst + i * dc;
+            uint8_t px[4] = {s[0], s[1], s[2], s[3]};
+            if (opts.premultiplied) {
+                kernels::unpremultiply_px(px, px);
+            }
+            d[0] = px[0];
+            d[1] = px[1];
+            d[2] = px[2];
+        }
+    } else {
+        // RGBA -> RGB, composite onto the background colour
+        // c * a + bg * (255 - a), divided by 255 with rounding
+        kernels::over_solid(src, dst, n, opts.bg_r, opts.bg_g, opts.bg_b,
+                            opts.premultiplied, dc);
+    }
+}
+
+// Same depth, 16 bits per component
+template <Pixel_Format Src, Pixel_Format Dst>
+void convert16(const uint8_t *src, uint8_t *dst, const size_t n,
+               const Pixel_Convert_Opts &opts) noexcept {
+    using src_t = Pixel_Traits<Src>;
+    using dst_t = Pixel_Traits<Dst>;
+    constexpr auto sb = static_cast<size_t>(src_t::components) * 2;
+    constexpr auto db = static_cast<size_t>(dst_t::components) * 2;
+    if constexpr (Src == Dst) {
+        if (src != dst) {
+            memmove(dst, src, n * sb);
+        }
+    } else if constexpr (dst_t::is_gray && !src_t::is_gray) {
+        constexpr auto sc = static_cast<size_t>(src_t::components);
+        if (opts.linear_luma) {
+            kernels::rgb16_to_gray16_linear<sc>(src, dst, n,
+                                                opts.premultiplied);
+        } else if constexpr (!src_t::has_alpha) {
+            kernels::rgb16_to_gray16(src, dst, n);
+        } else if (!opts.premultiplied) {
+            kernels::rgba16_to_gray16(src, dst, n);
+        } else {
+            for (size_t i = 0; i < n; ++i, src += sb) {
+                kernels::store_u16(dst + i * 2,
+                                   static_cast<uint16_t>(kernels::luma16(src)));
+            }
+        }
+    } else if constexpr (src_t::is_gray || dst_t::has_alpha) {
+        // GRAY16 -> RGB(A)16 and RGB16 -> RGBA16, backwards
+        const auto alpha = kernels::depth_up(opts.alpha);
+        for (size_t i = n; i-- > 0;) {
+            const auto *s = src + i * sb;
+            uint16_t px[4] = {kernels::load_u16(s), 0, 0, alpha};
+            px[1] = src_t::is_gray ? px[0] : kernels::load_u16(s + 2);
+            px[2] = src_t::is_gray ? px[0] : kernels::load_u16(s + 4);
+            std::memcpy(dst + i * db, px, db);
+        }
+    } else if (!opts.composite) {
+        // RGBA16 -> RGB16, drop alpha (after undoing it if premultiplied)
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t px[8];
+            std::memcpy(px, src + i * sb, sizeof(px));
+            if (opts.premultiplied) {
+                kernels::unpremultiply16_px(px, px);
+            }
+            std::memcpy(dst + i * db, px, db);
+        }
+    } else {
+        const uint16_t bg[3] = {kernels::depth_up(opts.bg_r),
+                                kernels::depth_up(opts.bg_g),
+                                kernels::depth_up(opts.bg_b)};
+        kernels::over_solid16_scalar(src, dst, n, bg, opts.premultiplied);
+    }
+}
+
+// Pixels per chunk of a conversion between depths, small enough for L1
+constexpr size_t CONVERT_DEPTH_CHUNK = 256;
+
+// Between depths the components are converted at the depth of Src, so
+// 16 bit sources keep their precision for luma and alpha, and the depth
+// after that. Both steps run one chunk at a time through a buffer on the
+// stack. A chunk is read completely before any of it is written, walking
+// the chunks backwards when Dst is larger keeps in place conversions safe.
+// Premultiplied colours are undone at the depth of Src, like the other
+// conversions out of RGBA(16) do.
+template <Pixel_Format Src, Pixel_Format Dst>
+void convert_depth(const uint8_t *src, uint8_t *dst, const size_t n,
+                   const Pixel_Convert_Opts &opts) noexcept {
+    using src_t = Pixel_Traits<Src>;
+    using dst_t = Pixel_Traits<Dst>;
+    constexpr auto mid = pxfmt_with_depth(Dst, src_t::depth);
+    constexpr auto sb = static_cast<size_t>(pxfmt_pixel_bytes(Src));
+    constexpr auto mb = static_cast<size_t>(pxfmt_pixel_bytes(mid));
+    constexpr auto db = static_cast<size_t>(pxfmt_pixel_bytes(Dst));
+    constexpr auto dc = static_cast<size_t>(dst_t::components);
+    const auto depth = [](const uint8_t *s, uint8_t *d, const size_t count) {
+        if constexpr (src_t::depth == 1) {
+            kernels::depth_8_to_16(s, d, count * dc);
+        } else {
+            kernels::depth_16_to_8(s, d, count * dc);
+        }
+    };
+    if constexpr (mid == Src) {
+        // Only the depth changes, the kernels handle in place themselves
+        if (!src_t::has_alpha || !opts.premultiplied) {
+            depth(src, dst, n);
+            return;
+        }
+    }
+    alignas(64) uint8_t buf[CONVERT_DEPTH_CHUNK * mb];
+    const auto chunk = [&](const size_t first) {
+        const auto count = std::min(CONVERT_DEPTH_CHUNK, n - first);
+        const auto *s = src + first * sb;
+        if constexpr (mid != Src) {
+            convert<Src, mid>(s, buf, count, opts);
+        } else if constexpr (src_t::depth == 1) {
+            kernels::unpremultiply(s, buf, count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                kernels::unpremultiply16_px(s + i * sb, buf + i * sb);
+            }
+        }
+        depth(buf, dst + first * db, count);
+    };
+    const auto chunks = (n + CONVERT_DEPTH_CHUNK - 1) / CONVERT_DEPTH_CHUNK;
+    if constexpr (db > sb) {
+        for (auto c = chunks; c-- > 0;) {
+            chunk(c * CONVERT_DEPTH_CHUNK);
+        }
+    } else {
+        for (size_t c = 0; c < chunks; ++c) {
+            chunk(c * CONVERT_DEPTH_CHUNK);
+        }
+    }
+}
+} // namespace detail
+
+template <Pixel_Format Src, Pixel_Format Dst>
+void convert(const uint8_t *src, uint8_t *dst, const size_t n,
+             const Pixel_Convert_Opts &opts) noexcept {
+    constexpr auto src_depth = Pixel_Traits<Src>::depth;
+    if constexpr (src_depth != Pixel_Traits<Dst>::depth) {
+        detail::convert_depth<Src, Dst>(src, dst, n, opts);
+    } else if constexpr (src_depth == 2) {
+        detail::convert16<Src, Dst>(src, dst, n, opts);
+    } else {
+        detail::convert8<Src, Dst>(src, dst, n, opts);
+    }
+}
+
+// Pointer to any of the convert<Src, Dst> instantiations
+using convert_fn_t = void (*)(const uint8_t *, uint8_t *, size_t,
+                              const Pixel_Convert_Opts &) noexcept;
+
+namespace detail {
+// Builds the table of every Src, Dst pair, indexed by src * count + dst
+template <size_t... I>
+constexpr auto make_convert_table(std::index_sequence<I...>) {
+    constexpr auto count = PIXEL_FORMAT_COUNT;
+    return std::array<convert_fn_t, sizeof...(I)>{
+        &convert<PIXEL_FORMATS[I / count], PIXEL_FORMATS[I % count]>...};
+}
+constexpr auto convert_table = make_convert_table(
+    std::make_index_sequence<PIXEL_FORMAT_COUNT * PIXEL_FORMAT_COUNT>{});
+} // namespace detail
+
+// Runtime lookup of a conversion, returns nullptr for Unknown formats
+[[nodiscard]] constexpr convert_fn_t
+get_converter(const Pixel_Format src, const Pixel_Format dst) noexcept {
+    const auto s = static_cast<int>(src);
+    const auto d = static_cast<int>(dst);
+    constexpr auto count = static_cast<int>(PIXEL_FORMAT_COUNT);
+    if (s < 0 || d < 0 || s >= count || d >= count) {
+        return nullptr;
+    }
+    return detail::convert_table[static_cast<size_t>(s * count + d)];
+}
+
+// Below this many destination bytes a conversion is not worth splitting up
+constexpr size_t CONVERT_PARALLEL_MIN_BYTES = 1 << 20;
+// Target size of a single band, small enough to stay in L2
+constexpr size_t CONVERT_BAND_BYTES = 256 * 1024;
+
+// Converts n pixels with fn, in bands of whole rows (row_px pixels each) on
+// the shared thread pool when opts.parallel is set and the image is large.
+// In place conversions (src == dst) run in waves: a band is only started
+// once every source byte it writes over has been read. Expansions walk the
+// waves from the end of the buffer, shrinking conversions from the start.
+inline void convert_pixels(const convert_fn_t fn, const Pixel_Format src_fmt,
+                           const Pixel_Format dst_fmt, const uint8_t *src,
+                           uint8_t *dst, const size_t n, const size_t row_px,
+                           const Pixel_Convert_Opts &opts) {
+    const auto sc = static_cast<size_t>(pxfmt_pixel_bytes(src_fmt));
+    const auto dc = static_cast<size_t>(pxfmt_pixel_bytes(dst_fmt));
+    auto &pool = shared_thread_pool();
+    if (!opts.parallel || pool.concurrency() <= 1 || row_px == 0 ||
+        n * dc < CONVERT_PARALLEL_MIN_BYTES) {
+        fn(src, dst, n, opts);
+        return;
+    }
+    // Partial overlap has no safe band order, keep it serial
+    const bool overlap = (src < dst + n * dc) && (dst < src + n * sc);
+    if (overlap && src != dst) {
+        fn(src, dst, n, opts);
+        return;
+    }
+
+    // Whole rows per band
+    const auto band_rows =
+        std::max<size_t>(1, CONVERT_BAND_BYTES / (row_px * std::max(sc, dc)));
+    const auto band_px = band_rows * row_px;
+    const auto bands = (n + band_px - 1) / band_px;
+    const auto run = [&](const size_t first, const size_t last) {
+        pool.parallel_for(last - first, [&](const size_t i) {
+            const auto beg = (first + i) * band_px;
+            const auto cnt = std::min(band_px, n - beg);
+            fn(src + beg * sc, dst + beg * dc, cnt, opts);
+        });
+    };
+
+    if (!overlap || sc == dc) {
+        run(0, bands);
+    } else if (dc > sc) {
+        // Bands [0, live) still have unread sources
+        for (auto live = bands; live > 0;) {
+            const auto live_end = std::min(live * band_px, n) * sc;
+            const auto band_bytes = band_px * dc;
+            const auto lo = (live_end + band_bytes - 1) / band_bytes;
+            if (lo >= live) {
+                // Only overlaps itself, the kernel walks backwards
+                run(live - 1, live);
+                --live;
+            } else {
+                run(lo, live);
+                live = lo;
+            }
+        }
+    } else {
+        // Bands [0, dead) are done, their sources can be written over
+        for (size_t dead = 0; dead < bands;) {
+            const auto live_beg = dead * band_px * sc;
+            const auto hi = std::min(bands, live_beg / (band_px * dc));
+            if (hi <= dead) {
+                // Only overlaps itself, the kernel walks forwards
+                run(dead, dead + 1);
+                ++dead;
+            } else {
+                run(dead, hi);
+                dead = hi;
+            }
+        }
+    }
+}
+
+} // namespace utils
+
+#endif
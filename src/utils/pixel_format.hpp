@@ -0,0 +1,249 @@
+/*
+  pixel_format.h -- Pixel formats and image size calculations
+*/
+#ifndef PIXEL_FORMAT_HPP
+#define PIXEL_FORMAT_HPP
+
+#include "utils/system.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+
+namespace utils {
+
+// Supported pixel formats
+// The 16 formats have 16 bits per component in native byte order, 0-65535
+enum class Pixel_Format {
+    Unknown = -1,
+    RGB,
+    RGBA,
+    GRAY,
+    RGB16,
+    RGBA16,
+    GRAY16
+};
+constexpr std::ostream &operator<<(std::ostream &os, const Pixel_Format fmt) {
+    switch (fmt) {
+    default:
+    case Pixel_Format::Unknown:
+        os << "Unknown";
+        break;
+    case Pixel_Format::RGB:
+        os << "RGB";
+        break;
+    case Pixel_Format::RGBA:
+        os << "RGBA";
+        break;
+    case Pixel_Format::GRAY:
+        os << "Grayscale";
+        break;
+    case Pixel_Format::RGB16:
+        os << "RGB16";
+        break;
+    case Pixel_Format::RGBA16:
+        os << "RGBA16";
+        break;
+    case Pixel_Format::GRAY16:
+        os << "Grayscale16";
+        break;
+    }
+    return os;
+}
+
+// Default maximum for the width and height of an image, the largest a JPEG
+// can be. UTILS_PIXELS_MAX_DIM=N at startup or set_pixels_max_dim() change it.
+constexpr int PIXELS_MAX_DIM = 65535;
+
+namespace detail {
+inline std::atomic<int> &pixels_max_dim_ref() noexcept {
+    static std::atomic<int> max_dim{[] {
+        const auto env = env_var("UTILS_PIXELS_MAX_DIM");
+        const auto val = env.empty() ? 0 : std::atoi(env.c_str());
+        return val > 0 ? val : PIXELS_MAX_DIM;
+    }()};
+    return max_dim;
+}
+} // namespace detail
+
+// Current maximum for the width and height of an image
+[[nodiscard]] inline int pixels_max_dim() noexcept {
+    return detail::pixels_max_dim_ref().load(std::memory_order_relaxed);
+}
+// Changes the maximum, values <= 0 restore the default
+inline void set_pixels_max_dim(const int dim) noexcept {
+    detail::pixels_max_dim_ref().store(dim > 0 ? dim : PIXELS_MAX_DIM,
+                                       std::memory_order_relaxed);
+}
+
+// a * b, or 0 if that does not fit in a size_t
+[[nodiscard]] constexpr size_t size_mul(const size_t a,
+                                        const size_t b) noexcept {
+    if (a != 0 && b > SIZE_MAX / a) {
+        return 0;
+    }
+    return a * b;
+}
+
+// Get the number of components (channels) per pixel for each format
+// Returns -1 if invalid format
+[[nodiscard]] constexpr int pxfmt_components(const Pixel_Format fmt) noexcept {
+    switch (fmt) {
+    default:
+    case Pixel_Format::Unknown:
+        break;
+    case Pixel_Format::RGB:
+    case Pixel_Format::RGB16:
+        return 3;
+    case Pixel_Format::RGBA:
+    case Pixel_Format::RGBA16:
+        return 4;
+    case Pixel_Format::GRAY:
+    case Pixel_Format::GRAY16:
+        return 1;
+    }
+    return -1;
+}
+// Get the number of bytes per component, 1 or 2
+// Returns -1 if invalid format
+[[nodiscard]] constexpr int pxfmt_depth(const Pixel_Format fmt) noexcept {
+    switch (fmt) {
+    default:
+    case Pixel_Format::Unknown:
+        break;
+    case Pixel_Format::RGB:
+    case Pixel_Format::RGBA:
+    case Pixel_Format::GRAY:
+        return 1;
+    case Pixel_Format::RGB16:
+    case Pixel_Format::RGBA16:
+    case Pixel_Format::GRAY16:
+        return 2;
+    }
+    return -1;
+}
+// Get the number of bytes per pixel for each format
+// Returns -1 if invalid format
+[[nodiscard]] constexpr int pxfmt_pixel_bytes(const Pixel_Format fmt) noexcept {
+    const auto comp = pxfmt_components(fmt);
+    return comp < 0 ? -1 : comp * pxfmt_depth(fmt);
+}
+// The format with the same components and depth bytes per component
+// Returns Unknown if invalid format or depth
+[[nodiscard]] constexpr Pixel_Format
+pxfmt_with_depth(const Pixel_Format fmt, const int depth) noexcept {
+    if (depth != 1 && depth != 2) {
+        return Pixel_Format::Unknown;
+    }
+    switch (pxfmt_components(fmt)) {
+    case 3:
+        return depth == 1 ? Pixel_Format::RGB : Pixel_Format::RGB16;
+    case 4:
+        return depth == 1 ? Pixel_Format::RGBA : Pixel_Format::RGBA16;
+    case 1:
+        return depth == 1 ? Pixel_Format::GRAY : Pixel_Format::GRAY16;
+    default:
+        break;
+    }
+    return Pixel_Format::Unknown;
+}
+// Calculates the number of bytes in a single row of an image
+// Returns 0 on error
+[[nodiscard]] inline size_t pixels_pitch(const int w,
+                                         const Pixel_Format fmt) noexcept {
+    if (w <= 0 || w > pixels_max_dim()) {
+        return 0;
+    }
+    const auto bytes = pxfmt_pixel_bytes(fmt);
+    if (bytes < 0) {
+        return 0;
+    }
+    return size_mul(static_cast<size_t>(w), static_cast<size_t>(bytes));
+}
+// Calculates the total number of bytes in an image
+// Returns 0 on error, including sizes that do not fit in a size_t
+[[nodiscard]] inline size_t pixels_size(const int w, const int h,
+                                        const Pixel_Format fmt) noexcept {
+    if (h <= 0 || h > pixels_max_dim()) {
+        return 0;
+    }
+    return size_mul(static_cast<size_t>(h), pixels_pitch(w, fmt));
+}
+
+// Compile time description of each pixel format
+// value_t is the type of one component, max its largest value
+template <Pixel_Format Fmt> struct Pixel_Traits {};
+template <> struct Pixel_Traits<Pixel_Format::RGB> {
+    using value_t = uint8_t;
+    static constexpr int components = 3;
+    static constexpr int depth = 1;
+    static constexpr unsigned max = 0xFF;
+    static constexpr bool has_alpha = false;
+    static constexpr bool is_gray = false;
+};
+template <> struct Pixel_Traits<Pixel_Format::RGBA> {
+    using value_t = uint8_t;
+    static constexpr int components = 4;
+    static constexpr int depth = 1;
+    static constexpr unsigned max = 0xFF;
+    static constexpr bool has_alpha = true;
+    static constexpr bool is_gray = false;
+};
+template <> struct Pixel_Traits<Pixel_Format::GRAY> {
+    using value_t = uint8_t;
+    static constexpr int components = 1;
+    static constexpr int depth = 1;
+    static constexpr unsigned max = 0xFF;
+    static constexpr bool has_alpha = false;
+    static constexpr bool is_gray = true;
+};
+template <> struct Pixel_Traits<Pixel_Format::RGB16> {
+    using value_t = uint16_t;
+    static constexpr int components = 3;
+    static constexpr int depth = 2;
+    static constexpr unsigned max = 0xFFFF;
+    static constexpr bool has_alpha = false;
+    static constexpr bool is_gray = false;
+};
+template <> struct Pixel_Traits<Pixel_Format::RGBA16> {
+    using value_t = uint16_t;
+    static constexpr int components = 4;
+    static constexpr int depth = 2;
+    static constexpr unsigned max = 0xFFFF;
+    static constexpr bool has_alpha = true;
+    static constexpr bool is_gray = false;
+};
+template <> struct Pixel_Traits<Pixel_Format::GRAY16> {
+    using value_t = uint16_t;
+    static constexpr int components = 1;
+    static constexpr int depth = 2;
+    static constexpr unsigned max = 0xFFFF;
+    static constexpr bool has_alpha = false;
+    static constexpr bool is_gray = true;
+};
+
+// Every valid format, in enum order so the value can be used as an index
+constexpr Pixel_Format PIXEL_FORMATS[] = {
+    Pixel_Format::RGB,   Pixel_Format::RGBA,   Pixel_Format::GRAY,
+    Pixel_Format::RGB16, Pixel_Format::RGBA16, Pixel_Format::GRAY16};
+constexpr size_t PIXEL_FORMAT_COUNT = std::size(PIXEL_FORMATS);
+namespace detail {
+template <Pixel_Format Fmt> constexpr bool check_pixel_traits() {
+    using traits = Pixel_Traits<Fmt>;
+    return traits::components == pxfmt_components(Fmt) &&
+           traits::depth == pxfmt_depth(Fmt) &&
+           sizeof(typename traits::value_t) == traits::depth;
+}
+} // namespace detail
+static_assert(detail::check_pixel_traits<Pixel_Format::RGB>());
+static_assert(detail::check_pixel_traits<Pixel_Format::RGBA>());
+static_assert(detail::check_pixel_traits<Pixel_Format::GRAY>());
+static_assert(detail::check_pixel_traits<Pixel_Format::RGB16>());
+static_assert(detail::check_pixel_traits<Pixel_Format::RGBA16>());
+static_assert(detail::check_pixel_traits<Pixel_Format::GRAY16>());
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,459 @@
+/*
+  pixel_kernels.h -- Raw pixel kernels working on spans of packed pixels
+*/
+#ifndef PIXEL_KERNELS_HPP
+#define PIXEL_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+namespace kernels {
+
+// BT.709 luma coefficients in Q15 fixed point, they sum to exactly 1.0 so
+// white stays white. Results are within +-1 of the double precision math.
+constexpr int LUMA_SHIFT = 15;
+constexpr int LUMA_R = 6966;  // 0.2126
+constexpr int LUMA_G = 23436; // 0.7152
+constexpr int LUMA_B = 2366;  // 0.0722
+static_assert(LUMA_R + LUMA_G + LUMA_B == 1 << LUMA_SHIFT);
+
+// Exact floor(x / 255) for 0 <= x <= 255 * 255
+constexpr unsigned div255(const unsigned x) noexcept {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+//
+// Reference implementations, the original double precision BT.709 math
+// Kept around as the baseline for benchmarks and to verify the fast kernels
+//
+inline void rgb_to_gray_ref(const uint8_t *src, uint8_t *dst,
+                            const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 3) {
+        const auto r = static_cast<double>(src[0]) * 0.2126;
+        const auto g = static_cast<double>(src[1]) * 0.7152;
+        const auto b = static_cast<double>(src[2]) * 0.0722;
+        dst[i] = static_cast<uint8_t>(r + g + b);
+    }
+}
+inline void rgba_to_gray_ref(const uint8_t *src, uint8_t *dst,
+                             const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 4) {
+        const auto r = static_cast<double>(src[0]) * 0.2126;
+        const auto g = static_cast<double>(src[1]) * 0.7152;
+        const auto b = static_cast<double>(src[2]) * 0.0722;
+        const auto lum = static_cast<double>(src[3]) / 255.0;
+        dst[i] = static_cast<uint8_t>((r + g + b) * lum);
+    }
+}
+
+//
+// Fixed point scalar kernels, also used for the tails of the SIMD kernels
+// src and dst may point to the same buffer (in place), n is the pixel count
+//
+inline void rgb_to_gray_scalar(const uint8_t *src, uint8_t *dst,
+                               const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 3) {
+        const auto y = LUMA_R * src[0] + LUMA_G * src[1] + LUMA_B * src[2];
+        dst[i] = static_cast<uint8_t>(y >> LUMA_SHIFT);
+    }
+}
+inline void rgba_to_gray_scalar(const uint8_t *src, uint8_t *dst,
+                                const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 4) {
+        const auto y = LUMA_R * src[0] + LUMA_G * src[1] + LUMA_B * src[2];
+        const auto lum = static_cast<unsigned>(y >> LUMA_SHIFT) * src[3];
+        dst[i] = static_cast<uint8_t>(div255(lum));
+    }
+}
+
+#if UTILS_ARCH_X86
+// 8 R, G and B values widened to 16 bits -> 8 gray values in 16 bit lanes
+// R is paired with G so one madd does two of the multiplies
+UTILS_TARGET_SSE41 inline __m128i luma_half_sse(const __m128i r16,
+                                                const __m128i g16,
+                                                const __m128i b16) {
+    const auto zero = _mm_setzero_si128();
+    const auto c_rg = _mm_set1_epi32((LUMA_G << 16) | LUMA_R);
+    const auto c_b = _mm_set1_epi32(LUMA_B);
+    const auto y0 =
+        _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), c_rg),
+                      _mm_madd_epi16(_mm_unpacklo_epi16(b16, zero), c_b));
+    const auto y1 =
+        _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), c_rg),
+                      _mm_madd_epi16(_mm_unpackhi_epi16(b16, zero), c_b));
+    return _mm_packs_epi32(_mm_srli_epi32(y0, LUMA_SHIFT),
+                           _mm_srli_epi32(y1, LUMA_SHIFT));
+}
+// 16 R, G and B values -> 16 gray values
+UTILS_TARGET_SSE41 inline __m128i luma_sse(const __m128i r, const __m128i g,
+                                           const __m128i b) {
+    const auto zero = _mm_setzero_si128();
+    const auto lo = luma_half_sse(_mm_unpacklo_epi8(r, zero),
+                                  _mm_unpacklo_epi8(g, zero),
+                                  _mm_unpacklo_epi8(b, zero));
+    const auto hi = luma_half_sse(_mm_unpackhi_epi8(r, zero),
+                                  _mm_unpackhi_epi8(g, zero),
+                                  _mm_unpackhi_epi8(b, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+
+// 4 RGBA pixels -> 4 alpha scaled gray values in 32 bit lanes
+UTILS_TARGET_SSE41 inline __m128i luma_alpha_sse(const __m128i px) {
+    const auto mask = _mm_set1_epi32(0x00FF00FF);
+    const auto c_rb = _mm_set1_epi32((LUMA_B << 16) | LUMA_R);
+    const auto c_g = _mm_set1_epi32(LUMA_G);
+    // 16 bit lanes of (R, B) and (G, A) pairs
+    const auto rb = _mm_and_si128(px, mask);
+    const auto ga = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+    auto y = _mm_add_epi32(_mm_madd_epi16(rb, c_rb), _mm_madd_epi16(ga, c_g));
+    y = _mm_srli_epi32(y, LUMA_SHIFT);
+    // Scale by alpha and divide by 255
+    const auto lum = _mm_madd_epi16(y, _mm_srli_epi32(px, 24));
+    const auto one = _mm_set1_epi32(1);
+    return _mm_srli_epi32(
+        _mm_add_epi32(_mm_add_epi32(lum, one), _mm_srli_epi32(lum, 8)), 8);
+}
+
+// 16 pixels per iteration, RGB24 is de-interleaved with byte shuffles
+UTILS_TARGET_SSE41 inline void rgb_to_gray_sse(const uint8_t *src,
+                                               uint8_t *dst,
+                                               const size_t n) noexcept {
+    // clang-format off
+    const auto r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const auto r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const auto g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const auto g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const auto b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const auto b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    // clang-format on
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = src + i * 3;
+        const auto a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+        const auto a1 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16));
+        const auto a2 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 32));
+        const auto r = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(a0, r0), _mm_shuffle_epi8(a1, r1)),
+            _mm_shuffle_epi8(a2, r2));
+        const auto g = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(a0, g0), _mm_shuffle_epi8(a1, g1)),
+            _mm_shuffle_epi8(a2, g2));
+        const auto b = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(a0, b0), _mm_shuffle_epi8(a1, b1)),
+            _mm_shuffle_epi8(a2, b2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         luma_sse(r, g, b));
+    }
+    rgb_to_gray_scalar(src + i * 3, dst + i, n - i);
+}
+
+// 16 pixels per iteration, 4 pixels per register
+UTILS_TARGET_SSE41 inline void rgba_to_gray_sse(const uint8_t *src,
+                                                uint8_t *dst,
+                                                const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i * 4);
+        const auto y0 = luma_alpha_sse(_mm_loadu_si128(s));
+        const auto y1 = luma_alpha_sse(_mm_loadu_si128(s + 1));
+        const auto y2 = luma_alpha_sse(_mm_loadu_si128(s + 2));
+        const auto y3 = luma_alpha_sse(_mm_loadu_si128(s + 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_packus_epi16(_mm_packs_epi32(y0, y1),
+                                          _mm_packs_epi32(y2, y3)));
+    }
+    rgba_to_gray_scalar(src + i * 4, dst + i, n - i);
+}
+
+// Same as luma_half_sse and luma_sse, but on both 128 bit lanes
+UTILS_TARGET_AVX2 inline __m256i luma_half_avx2(const __m256i r16,
+                                                const __m256i g16,
+                                                const __m256i b16) {
+    const auto zero = _mm256_setzero_si256();
+    const auto c_rg = _mm256_set1_epi32((LUMA_G << 16) | LUMA_R);
+    const auto c_b = _mm256_set1_epi32(LUMA_B);
+    const auto y0 = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(r16, g16), c_rg),
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(b16, zero), c_b));
+    const auto y1 = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(r16, g16), c_rg),
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(b16, zero), c_b));
+    return _mm256_packs_epi32(_mm256_srli_epi32(y0, LUMA_SHIFT),
+                              _mm256_srli_epi32(y1, LUMA_SHIFT));
+}
+UTILS_TARGET_AVX2 inline __m256i luma_avx2(const __m256i r, const __m256i g,
+                                           const __m256i b) {
+    const auto zero = _mm256_setzero_si256();
+    const auto lo = luma_half_avx2(_mm256_unpacklo_epi8(r, zero),
+                                   _mm256_unpacklo_epi8(g, zero),
+                                   _mm256_unpacklo_epi8(b, zero));
+    const auto hi = luma_half_avx2(_mm256_unpackhi_epi8(r, zero),
+                                   _mm256_unpackhi_epi8(g, zero),
+                                   _mm256_unpackhi_epi8(b, zero));
+    return _mm256_packus_epi16(lo, hi);
+}
+
+// Same as luma_alpha_sse, 8 RGBA pixels
+UTILS_TARGET_AVX2 inline __m256i luma_alpha_avx2(const __m256i px) {
+    const auto mask = _mm256_set1_epi32(0x00FF00FF);
+    const auto c_rb = _mm256_set1_epi32((LUMA_B << 16) | LUMA_R);
+    const auto c_g = _mm256_set1_epi32(LUMA_G);
+    const auto rb = _mm256_and_si256(px, mask);
+    const auto ga = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask);
+    auto y = _mm256_add_epi32(_mm256_madd_epi16(rb, c_rb),
+                              _mm256_madd_epi16(ga, c_g));
+    y = _mm256_srli_epi32(y, LUMA_SHIFT);
+    const auto lum = _mm256_madd_epi16(y, _mm256_srli_epi32(px, 24));
+    const auto one = _mm256_set1_epi32(1);
+    return _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_add_epi32(lum, one),
+                         _mm256_srli_epi32(lum, 8)),
+        8);
+}
+
+// Loads 16 bytes from lo into the low lane and 16 bytes from hi into the high
+UTILS_TARGET_AVX2 inline __m256i load2_avx2(const uint8_t *lo,
+                                            const uint8_t *hi) {
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)), 1);
+}
+
+// 32 pixels per iteration, the low lane gets pixels 0-15 and the high lane
+// pixels 16-31 so the in-lane shuffles and packs keep everything in order
+UTILS_TARGET_AVX2 inline void rgb_to_gray_avx2(const uint8_t *src,
+                                               uint8_t *dst,
+                                               const size_t n) noexcept {
+    // clang-format off
+    const auto r0 = _mm256_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                     0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto r1 = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1,
+                                     -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const auto r2 = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13,
+                                     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const auto g0 = _mm256_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                     1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto g1 = _mm256_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1,
+                                     -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const auto g2 = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14,
+                                     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const auto b0 = _mm256_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                     2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto b1 = _mm256_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1,
+                                     -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const auto b2 = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15,
+                                     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    // clang-format on
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto *s = src + i * 3;
+        const auto a0 = load2_avx2(s, s + 48);
+        const auto a1 = load2_avx2(s + 16, s + 64);
+        const auto a2 = load2_avx2(s + 32, s + 80);
+        const auto r = _mm256_or_si256(
+            _mm256_or_si256(_mm256_shuffle_epi8(a0, r0),
+                            _mm256_shuffle_epi8(a1, r1)),
+            _mm256_shuffle_epi8(a2, r2));
+        const auto g = _mm256_or_si256(
+            _mm256_or_si256(_mm256_shuffle_epi8(a0, g0),
+                            _mm256_shuffle_epi8(a1, g1)),
+            _mm256_shuffle_epi8(a2, g2));
+        const auto b = _mm256_or_si256(
+            _mm256_or_si256(_mm256_shuffle_epi8(a0, b0),
+                            _mm256_shuffle_epi8(a1, b1)),
+            _mm256_shuffle_epi8(a2, b2));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                            luma_avx2(r, g, b));
+    }
+    rgb_to_gray_scalar(src + i * 3, dst + i, n - i);
+}
+
+// 32 pixels per iteration, the packs interleave the lanes so fix the order
+// with a single cross lane permute at the end
+UTILS_TARGET_AVX2 inline void rgba_to_gray_avx2(const uint8_t *src,
+                                                uint8_t *dst,
+                                                const size_t n) noexcept {
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto *s = reinterpret_cast<const __m256i *>(src + i * 4);
+        const auto y0 = luma_alpha_avx2(_mm256_loadu_si256(s));
+        const auto y1 = luma_alpha_avx2(_mm256_loadu_si256(s + 1));
+        const auto y2 = luma_alpha_avx2(_mm256_loadu_si256(s + 2));
+        const auto y3 = luma_alpha_avx2(_mm256_loadu_si256(s + 3));
+        const auto y = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1),
+                                           _mm256_packs_epi32(y2, y3));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                            _mm256_permutevar8x32_epi32(y, order));
+    }
+    rgba_to_gray_scalar(src + i * 4, dst + i, n - i);
+}
+// GCC 12 warns about _mm512_undefined_epi32() inside its own intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// Same as luma_half_avx2 and luma_avx2, but on all four 128 bit lanes
+UTILS_TARGET_AVX512BW inline __m512i luma_half_avx512(const __m512i r16,
+                                                      const __m512i g16,
+                                                      const __m512i b16) {
+    const auto zero = _mm512_setzero_si512();
+    const auto c_rg = _mm512_set1_epi32((LUMA_G << 16) | LUMA_R);
+    const auto c_b = _mm512_set1_epi32(LUMA_B);
+    const auto y0 = _mm512_add_epi32(
+        _mm512_madd_epi16(_mm512_unpacklo_epi16(r16, g16), c_rg),
+        _mm512_madd_epi16(_mm512_unpacklo_epi16(b16, zero), c_b));
+    const auto y1 = _mm512_add_epi32(
+        _mm512_madd_epi16(_mm512_unpackhi_epi16(r16, g16), c_rg),
+        _mm512_madd_epi16(_mm512_unpackhi_epi16(b16, zero), c_b));
+    return _mm512_packs_epi32(_mm512_srli_epi32(y0, LUMA_SHIFT),
+                              _mm512_srli_epi32(y1, LUMA_SHIFT));
+}
+UTILS_TARGET_AVX512BW inline __m512i luma_avx512(const __m512i r,
+                                                 const __m512i g,
+                                                 const __m512i b) {
+    const auto zero = _mm512_setzero_si512();
+    const auto lo = luma_half_avx512(_mm512_unpacklo_epi8(r, zero),
+                                     _mm512_unpacklo_epi8(g, zero),
+                                     _mm512_unpacklo_epi8(b, zero));
+    const auto hi = luma_half_avx512(_mm512_unpackhi_epi8(r, zero),
+                                     _mm512_unpackhi_epi8(g, zero),
+                                     _mm512_unpackhi_epi8(b, zero));
+    return _mm512_packus_epi16(lo, hi);
+}
+
+// Same as luma_alpha_avx2, 16 RGBA pixels
+UTILS_TARGET_AVX512BW inline __m512i luma_alpha_avx512(const __m512i px) {
+    const auto mask = _mm512_set1_epi32(0x00FF00FF);
+    const auto c_rb = _mm512_set1_epi32((LUMA_B << 16) | LUMA_R);
+    const auto c_g = _mm512_set1_epi32(LUMA_G);
+    const auto rb = _mm512_and_si512(px, mask);
+    const auto ga = _mm512_and_si512(_mm512_srli_epi32(px, 8), mask);
+    auto y = _mm512_add_epi32(_mm512_madd_epi16(rb, c_rb),
+                              _mm512_madd_epi16(ga, c_g));
+    y = _mm512_srli_epi32(y, LUMA_SHIFT);
+    const auto lum = _mm512_madd_epi16(y, _mm512_srli_epi32(px, 24));
+    const auto one = _mm512_set1_epi32(1);
+    return _mm512_srli_epi32(
+        _mm512_add_epi32(_mm512_add_epi32(lum, one),
+                         _mm512_srli_epi32(lum, 8)),
+        8);
+}
+
+// Loads 16 bytes into each 128 bit lane, p + stride * lane
+UTILS_TARGET_AVX512BW inline __m512i load4_avx512(const uint8_t *p,
+                                                  const size_t stride) {
+    const auto *q = reinterpret_cast<const __m128i *>(p);
+    auto v = _mm512_castsi128_si512(_mm_loadu_si128(q));
+    q = reinterpret_cast<const __m128i *>(p + stride);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(q), 1);
+    q = reinterpret_cast<const __m128i *>(p + stride * 2);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(q), 2);
+    q = reinterpret_cast<const __m128i *>(p + stride * 3);
+    return _mm512_inserti32x4(v, _mm_loadu_si128(q), 3);
+}
+
+// 64 pixels per iteration, lane k gets pixels 16k to 16k + 15
+UTILS_TARGET_AVX512BW inline void rgb_to_gray_avx512(const uint8_t *src,
+                                                     uint8_t *dst,
+                                                     const size_t n) noexcept {
+    // clang-format off
+    const auto r0 = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto r1 = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1));
+    const auto r2 = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13));
+    const auto g0 = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto g1 = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1));
+    const auto g2 = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14));
+    const auto b0 = _mm512_broadcast_i32x4(_mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto b1 = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1));
+    const auto b2 = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15));
+    // clang-format on
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto *s = src + i * 3;
+        const auto a0 = load4_avx512(s, 48);
+        const auto a1 = load4_avx512(s + 16, 48);
+        const auto a2 = load4_avx512(s + 32, 48);
+        const auto r = _mm512_or_si512(
+            _mm512_or_si512(_mm512_shuffle_epi8(a0, r0),
+                            _mm512_shuffle_epi8(a1, r1)),
+            _mm512_shuffle_epi8(a2, r2));
+        const auto g = _mm512_or_si512(
+            _mm512_or_si512(_mm512_shuffle_epi8(a0, g0),
+                            _mm512_shuffle_epi8(a1, g1)),
+            _mm512_shuffle_epi8(a2, g2));
+        const auto b = _mm512_or_si512(
+            _mm512_or_si512(_mm512_shuffle_epi8(a0, b0),
+                            _mm512_shuffle_epi8(a1, b1)),
+            _mm512_shuffle_epi8(a2, b2));
+        _mm512_storeu_si512(dst + i, luma_avx512(r, g, b));
+    }
+    rgb_to_gray_scalar(src + i * 3, dst + i, n - i);
+}
+
+// 64 pixels per iteration, one cross lane permute restores the order
+UTILS_TARGET_AVX512BW inline void rgba_to_gray_avx512(const uint8_t *src,
+                                                      uint8_t *dst,
+                                                      const size_t n) noexcept {
+    const auto order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10,
+                                         14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto *s = src + i * 4;
+        const auto y0 = luma_alpha_avx512(_mm512_loadu_si512(s));
+        const auto y1 = luma_alpha_avx512(_mm512_loadu_si512(s + 64));
+        const auto y2 = luma_alpha_avx512(_mm512_loadu_si512(s + 128));
+        const auto y3 = luma_alpha_avx512(_mm512_loadu_si512(s + 192));
+        const auto y = _mm512_packus_epi16(_mm512_packs_epi32(y0, y1),
+                                           _mm512_packs_epi32(y2, y3));
+        _mm512_storeu_si512(dst + i, _mm512_permutexvar_epi32(order, y));
+    }
+    rgba_to_gray_scalar(src + i * 4, dst + i, n - i);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using gray_kernel_t = void (*)(const uint8_t *, uint8_t *, size_t) noexcept;
+inline void rgb_to_gray(const uint8_t *src, uint8_t *dst,
+                        const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<gray_kernel_t>(rgb_to_gray_scalar, rgb_to_gray_sse,
+                                  rgb_to_gray_avx2, rgb_to_gray_avx512);
+    fn(src, dst, n);
+#else
+    rgb_to_gray_scalar(src, dst, n);
+#endif
+}
+inline void rgba_to_gray(const uint8_t *src, uint8_t *dst,
+                         const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<gray_kernel_t>(rgba_to_gray_scalar, rgba_to_gray_sse,
+                                  rgba_to_gray_avx2, rgba_to_gray_avx512);
+    fn(src, dst, n);
+#else
+    rgba_to_gray_scalar(src, dst, n);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
@@ -1,175 +1,143 @@
 /*
-  pixels.h -- Image constants and generic helper functions
+  pixels.h -- Pixel buffer class and generic helper functions
 */
 #ifndef PIXELS_HPP
 #define PIXELS_HPP
 
+#include "utils/alpha.hpp"
+#include "utils/pixel_alloc.hpp"
+#include "utils/pixel_convert.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixel_kernels.hpp"
+#include "utils/pixels_view.hpp"
 #include "utils/system.hpp"
 #include <cstring>
+#include <numeric>
 
 namespace utils {
 
-// Supported pixel formats
-enum class Pixel_Format { Unknown = -1, RGB, RGBA, GRAY };
-constexpr std::ostream &operator<<(std::ostream &os, const Pixel_Format fmt) {
-    switch (fmt) {
-    default:
-    case Pixel_Format::Unknown:
-        os << "Unknown";
-        break;
-    case Pixel_Format::RGB:
-        os << "RGB";
-        break;
-    case Pixel_Format::RGBA:
-        os << "RGBA";
-        break;
-    case Pixel_Format::GRAY:
-        os << "Grayscale";
-        break;
-    }
-    return os;
-}
-
-// Maximum dimension for width and height of an image
-constexpr int PIXELS_MAX_DIM = 10000;
-// Get the number of bytes per pixel (components) for each format
-// Returns -1 if invalid format
-[[nodiscard]] constexpr int pxfmt_components(const Pixel_Format fmt) noexcept {
-    switch (fmt) {
-    default:
-    case Pixel_Format::Unknown:
-        break;
-    case Pixel_Format::RGB:
-        return 3;
-    case Pixel_Format::RGBA:
-        return 4;
-    case Pixel_Format::GRAY:
-        return 1;
-    }
-    return -1;
-}
-// Calculates the number of bytes in a single row of an image
-// Returns 0 on error
-[[nodiscard]] constexpr unsigned pixels_pitch(const int w,
-                                              const Pixel_Format fmt) noexcept {
-    if (w > PIXELS_MAX_DIM) {
-        return 0;
-    }
-    const auto comp = pxfmt_components(fmt);
-    if (comp < 0) {
-        return 0;
-    }
-    return static_cast<unsigned>(w * comp);
-}
-// Calculates the total number of bytes in an image
-// Returns 0 on error
-[[nodiscard]] constexpr unsigned pixels_size(const int w, const int h,
-                                             const Pixel_Format fmt) noexcept {
-    if (h > PIXELS_MAX_DIM) {
-        return 0;
-    }
-    return static_cast<unsigned>(h) * pixels_pitch(w, fmt);
-}
-
 // Pixels class, holds pixel buffer and conversion functions
 class Pixels {
   public:
     // Default construct - empty buffer and values
     Pixels() = default;
 
-    // Constructor -> Format, width, height - allocates buffer
+    // Constructor -> Format, width, height - allocates an uninitialized buffer
     Pixels(const Pixel_Format fmt, const int w, const int h)
-        : buf(pixels_size(w, h, fmt), 0)
+        : buf(pixels_size(w, h, fmt))
         , format_{fmt}
         , width_{w}
         , height_{h}
         , is_valid_{verify_buf()} {}
 
     // Constructor -> Moves buffer and verifys
-    Pixels(bytes_t &&p, const Pixel_Format fmt, const int w, const int h)
-        : buf{p}
+    Pixels(pixel_buf_t &&p, const Pixel_Format fmt, const int w, const int h)
+        : buf{std::move(p)}
         , format_{fmt}
         , width_{w}
         , height_{h}
         , is_valid_{verify_buf()} {}
 
     // Constructor -> Copys buffer and verifys
-    Pixels(bytes_t p, const Pixel_Format fmt, const int w, const int h)
-        : buf{std::move(p)}
+    Pixels(const bytes_t &p, const Pixel_Format fmt, const int w, const int h)
+        : buf(p.begin(), p.end())
         , format_{fmt}
         , width_{w}
         , height_{h}
         , is_valid_{verify_buf()} {}
 
-    bytes_t buf{};
+    // Constructor -> Copies the pixels of a view (e.g. a crop) into a new
+    // tightly packed buffer, converting them to fmt on the way
+    Pixels(const Const_Pixels_View src, const Pixel_Format fmt,
+           const Pixel_Convert_Opts &opts = {})
+        : Pixels(fmt, src.width(), src.height()) {
+        if (is_valid_ && !convert_view(src, view(), opts)) {
+            clear();
+        }
+    }
+
+    // Aligned and left uninitialized by the allocator, was a bytes_t before.
+    // Copy it into a bytes_t where one is needed.
+    pixel_buf_t buf{};
 
     // Simple getters
     Pixel_Format format() const noexcept { return format_; }
     int width() const noexcept { return width_; }
     int height() const noexcept { return height_; }
     bool is_valid() const noexcept { return is_valid_; }
+    bool is_premultiplied() const noexcept { return premultiplied_; }
+    Alpha_Mode alpha_mode() const noexcept {
+        return premultiplied_ ? Alpha_Mode::Premultiplied
+                              : Alpha_Mode::Straight;
+    }
 
     void set_format(const Pixel_Format fmt) noexcept { format_ = fmt; };
 
+    // Views of the whole buffer, invalid if the buffer is
+    Pixels_View view() noexcept {
+        if (!is_valid_) {
+            return Pixels_View{};
+        }
+        return Pixels_View{buf.data(), format_, width_, height_};
+    }
+    Const_Pixels_View view() const noexcept { return cview(); }
+    Const_Pixels_View cview() const noexcept {
+        if (!is_valid_) {
+            return Const_Pixels_View{};
+        }
+        return Const_Pixels_View{buf.data(), format_, width_, height_};
+    }
+
     // Resets the class back to empty/clean state
     void clear() {
         format_ = Pixel_Format::Unknown;
         width_ = 0;
         height_ = 0;
         is_valid_ = false;
+        premultiplied_ = false;
         buf.clear();
     }
 
-    // Convert pixel formats
-    void convert_to(const Pixel_Format fmt) {
+    // Switches RGBA pixels to premultiplied colours and back, which makes
+    // compositing cheaper. Does nothing if already in that mode, returns
+    // false for other formats.
+    bool premultiply(const bool parallel = false) {
+        if (!premultiplied_ && !utils::premultiply(view(), parallel)) {
+            return false;
+        }
+        premultiplied_ = true;
+        return true;
+    }
+    bool unpremultiply(const bool parallel = false) {
+        if (premultiplied_ && !utils::unpremultiply(view(), parallel)) {
+            return false;
+        }
+        premultiplied_ = false;
+        return true;
+    }
+
+    // Convert pixel formats in place, a single table lookup picks the
+    // convert<Src, Dst> kernel for this pair
+    void convert_to(const Pixel_Format fmt,
+                    const Pixel_Convert_Opts &opts = {}) {
         // No conversion necessary
         if ((fmt == format_) || buf.empty()) {
             return;
         }
-        switch (fmt) {
-        case Pixel_Format::GRAY:
-            switch (format_) {
-            case Pixel_Format::RGB:
-                format_ = rgb_to_gray();
-                break;
-            case Pixel_Format::RGBA:
-                format_ = rgba_to_gray();
-                break;
-            case Pixel_Format::GRAY:
-            case Pixel_Format::Unknown:
-            default:
-                break;
-            }
-            break;
-        case Pixel_Format::RGB:
-            switch (format_) {
-            case Pixel_Format::GRAY:
-                format_ = gray_to_rgb();
-                break;
-            case Pixel_Format::RGBA:
-            case Pixel_Format::RGB:
-            case Pixel_Format::Unknown:
-            default:
-                break;
-            }
-            break;
-        case Pixel_Format::RGBA:
-            switch (format_) {
-            case Pixel_Format::GRAY:
-                format_ = gray_to_rgba();
-                break;
-            case Pixel_Format::RGBA:
-            case Pixel_Format::RGB:
-            case Pixel_Format::Unknown:
-            default:
-                break;
-            }
-            break;
-        case Pixel_Format::Unknown:
-        default:
-            break;
+        const auto fn = get_converter(format_, fmt);
+        if (fn == nullptr) {
+            return;
+        }
+        convert_buf(fn, fmt, opts);
+    }
+    // Same as above when the formats are known at compile time, skips the
+    // table lookup. Does nothing if the current format is not Src.
+    template <Pixel_Format Src, Pixel_Format Dst>
+    void convert_to(const Pixel_Convert_Opts &opts = {}) {
+        if ((Src == Dst) || (format_ != Src) || buf.empty()) {
+            return;
         }
-        verify_buf();
+        convert_buf(&convert<Src, Dst>, Dst, opts);
     }
 
   private:
@@ -177,6 +145,7 @@ class Pixels {
     int width_{0};
     int height_{0};
     bool is_valid_{false};
+    bool premultiplied_{false};
 
     // Verifies the size of the buffer
     bool verify_buf() {
@@ -191,290 +160,159 @@ class Pixels {
         return true;
     }
 
-    // Pixel conversion -> RGB to GRAYSCALE
-    Pixel_Format rgb_to_gray() {
-        // Get number of components of source pixels
-        constexpr auto src_fmt = Pixel_Format::RGB;
-        constexpr auto comps = pxfmt_components(src_fmt);
-
-        std::cout << "beg: ";
-        for (uint64_t i = 0; i < 12; ++i) {
-            std::cout << static_cast<int>(buf[i]) << ',';
-        }
-        std::cout << '\n';
-        std::cout << "end: ";
-        for (uint64_t i = buf.size() - 12; i < buf.size(); ++i) {
-            std::cout << static_cast<int>(buf[i]) << ',';
-        }
-        std::cout << '\n';
-
-        // Loop over all components and flatten to a single GRAY component
-        auto dst_it = std::begin(buf);
-        for (auto it = std::cbegin(buf); it < std::cend(buf); it += comps) {
-            const auto r = static_cast<double>(*it) * 0.2126;
-            const auto g = static_cast<double>(*(it + 1)) * 0.7152;
-            const auto b = static_cast<double>(*(it + 2)) * 0.0722;
-            *dst_it = static_cast<uint8_t>(r + g + b);
-            dst_it++;
-        }
-
-        // Calculate new size and trim
-        constexpr auto dst_fmt = Pixel_Format::GRAY;
-        const auto dst_sz = pixels_size(width_, height_, dst_fmt);
-        buf.resize(dst_sz);
-
-        std::cout << "beg: ";
-        for (uint64_t i = 0; i < 4; ++i) {
-            std::cout << static_cast<int>(buf[i]) << ',';
-        }
-        std::cout << '\n';
-        std::cout << "end: ";
-        for (uint64_t i = buf.size() - 4; i < buf.size(); ++i) {
-            std::cout << static_cast<int>(buf[i]) << ',';
-        }
-        std::cout << '\n';
-
-        return dst_fmt;
-    }
-
-    // Pixel conversion -> RGBA to GRAYSCALE
-    Pixel_Format rgba_to_gray() {
-        // Since this is encapsulated we are trusting the size of the buffer
-        constexpr auto dst_fmt = Pixel_Format::GRAY;
-        const auto dst_sz = pixels_size(width_, height_, dst_fmt);
-        // RGBA to Grayscale algorithm
-        for (unsigned i = 0; i < dst_sz; ++i) {
-            const auto offs = i * 4;
-            const auto r = static_cast<double>(buf[offs]) * 0.2126;
-            const auto g = static_cast<double>(buf[offs + 1]) * 0.7152;
-            const auto b = static_cast<double>(buf[offs + 2]) * 0.0722;
-            const auto lum = static_cast<double>(buf[offs + 3]) / 255.0;
-            buf[i] = static_cast<uint8_t>((r + g + b) * lum);
+    // Runs a conversion over the whole buffer, growing it first or
+    // trimming it after depending on the destination size. Every conversion
+    // out of premultiplied RGBA (RGBA16 included) undoes it, so the result
+    // never is premultiplied.
+    void convert_buf(const convert_fn_t fn, const Pixel_Format fmt,
+                     const Pixel_Convert_Opts &opts) {
+        const auto n = static_cast<size_t>(width_) *
+                       static_cast<size_t>(height_);
+        const auto dst_sz = pixels_size(width_, height_, fmt);
+        if (dst_sz > buf.size()) {
+            buf.resize(dst_sz);
         }
-        // Trim the rest of the vector
+        auto o = opts;
+        o.premultiplied = premultiplied_;
+        convert_pixels(fn, format_, fmt, buf.data(), buf.data(), n,
+                       static_cast<size_t>(width_), o);
         buf.resize(dst_sz);
-        return dst_fmt;
-    }
-
-    // Pixel conversion -> GRAYSCALE to RGB
-    Pixel_Format gray_to_rgb() {
-        // Calculate the new size of the buffer and resize it
-        constexpr auto dst_fmt = Pixel_Format::RGB;
-        const auto dst_sz = pixels_size(width_, height_, dst_fmt);
-        buf.resize(dst_sz);
-
-        // Get an const iterator to the end of the current data
-        constexpr auto src_fmt = Pixel_Format::GRAY;
-        const auto src_sz = pixels_size(width_, height_, src_fmt);
-        auto src_end_it = std::cbegin(buf) + src_sz - 1;
-
-        // Fill in the new back of the buffer
-        constexpr auto comps = pxfmt_components(dst_fmt);
-        for (auto it = std::rbegin(buf); it != std::rend(buf); it += comps) {
-            std::fill(it, it + comps, *src_end_it);
-            --src_end_it;
-        }
-        return dst_fmt;
-    }
-
-    // Pixel conversion -> GRAYSCALE to RGBA
-    Pixel_Format gray_to_rgba() {
-        // Calculate the new size of the buffer and resize it
-        constexpr auto dst_fmt = Pixel_Format::RGBA;
-        const auto dst_sz = pixels_size(width_, height_, dst_fmt);
-        buf.resize(dst_sz);
-
-        // std::cout << "beg: ";
-        // for (uint64_t i = 0; i < 4; ++i) {
-        //     std::cout << static_cast<int>(buf[i]) << ',';
-        // }
-        // std::cout << '\n';
-        // std::cout << "end: ";
-        // for (uint64_t i = buf.size() - 4; i < buf.size(); ++i) {
-        //     std::cout << static_cast<int>(buf[i]) << ',';
-        // }
-        // std::cout << '\n';
-
-        // Get an const iterator to the end of the current data
-        constexpr auto src_fmt = Pixel_Format::GRAY;
-        const auto src_sz = pixels_size(width_, height_, src_fmt);
-        auto src_end_it = std::cbegin(buf) + src_sz - 1;
-
-        // Fill in the back
-        constexpr auto comps = pxfmt_components(dst_fmt);
-        for (auto it = std::rbegin(buf); it < std::rend(buf); it += comps) {
-            *it = 0xFF;
-            std::fill(it + 1, it + comps, *src_end_it);
-            --src_end_it;
-        }
-
-        // std::cout << "beg: ";
-        // for (uint64_t i = 0; i < 16; ++i) {
-        //     std::cout << static_cast<int>(buf[i]) << ',';
-        // }
-        // std::cout << '\n';
-        // std::cout << "end: ";
-        // for (uint64_t i = buf.size() - 16; i < buf.size(); ++i) {
-        //     std::cout << static_cast<int>(buf[i]) << ',';
-        // }
-        // std::cout << '\n';
-
-        return dst_fmt;
+        format_ = fmt;
+        premultiplied_ = false;
+        is_valid_ = verify_buf();
     }
 };
 
-bytes_t pc_rgb_to_gray_dry(const bytes_t &srcbuf) {
+pixel_buf_t pc_rgb_to_gray_dry(const pixel_buf_t &srcbuf) {
     // Get number of components of source pixels
     constexpr auto src_fmt = Pixel_Format::RGB;
     constexpr auto src_comps = pxfmt_components(src_fmt);
 
-    // We can safely cast to a signed integer here
-    const auto src_size = static_cast<int>(srcbuf.size());
+    const auto src_size = srcbuf.size();
 
     // Make sure we have at least 1 pixel
-    if (src_size < src_comps) {
-        return bytes_t{};
+    if (src_size < static_cast<size_t>(src_comps)) {
+        return pixel_buf_t{};
     }
 
     // Get the size of the destination vector and reserve memory
     constexpr auto dst_fmt = Pixel_Format::GRAY;
     constexpr auto dst_comps = pxfmt_components(dst_fmt);
     const auto dst_size = (src_size / src_comps) * dst_comps;
-    bytes_t dstbuf(static_cast<unsigned>(dst_size), 0);
+    pixel_buf_t dstbuf(dst_size, 0);
 
     return dstbuf;
 }
 
-bytes_t pc_rgb_to_gray_dry2(const bytes_t &srcbuf) {
+pixel_buf_t pc_rgb_to_gray_dry2(const pixel_buf_t &srcbuf) {
     // Get number of components of source pixels
     constexpr auto src_fmt = Pixel_Format::RGB;
     constexpr auto src_comps = pxfmt_components(src_fmt);
 
-    // We can safely cast to a signed integer here
-    const auto src_size = static_cast<int>(srcbuf.size());
+    const auto src_size = srcbuf.size();
 
     // Make sure we have at least 1 pixel
-    if (src_size < src_comps) {
-        return bytes_t{};
+    if (src_size < static_cast<size_t>(src_comps)) {
+        return pixel_buf_t{};
     }
 
     // Get the size of the destination vector and reserve memory
     constexpr auto dst_fmt = Pixel_Format::GRAY;
     constexpr auto dst_comps = pxfmt_components(dst_fmt);
     const auto dst_size = (src_size / src_comps) * dst_comps;
-    bytes_t dstbuf(static_cast<unsigned>(dst_size));
+    pixel_buf_t dstbuf(dst_size);
 
     return dstbuf;
 }
 
-bytes_t pc_rgb_to_gray(const bytes_t &srcbuf) {
+pixel_buf_t pc_rgb_to_gray(const pixel_buf_t &srcbuf,
+                           const bool parallel = false) {
     // Get number of components of source pixels
     constexpr auto src_fmt = Pixel_Format::RGB;
     constexpr auto src_comps = pxfmt_components(src_fmt);
 
-    // We can safely cast to a signed integer here
-    const auto src_size = static_cast<int>(srcbuf.size());
+    const auto src_size = srcbuf.size();
 
     // Make sure we have at least 1 pixel
-    if (src_size < src_comps) {
-        return bytes_t{};
+    if (src_size < static_cast<size_t>(src_comps)) {
+        return pixel_buf_t{};
     }
 
-    // Get the size of the destination vector and 0 initialize
+    // Get the size of the destination vector, every byte gets written below
     constexpr auto dst_fmt = Pixel_Format::GRAY;
     constexpr auto dst_comps = pxfmt_components(dst_fmt);
     const auto dst_size = (src_size / src_comps) * dst_comps;
-    bytes_t dstbuf(static_cast<unsigned>(dst_size), 0);
-
-    // std::cout << "beg: ";
-    // for (uint64_t i = 0; i < 12; ++i) {
-    //     std::cout << static_cast<int>(srcbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
-    // std::cout << "end: ";
-    // for (uint64_t i = srcbuf.size() - 12; i < srcbuf.size(); ++i) {
-    //     std::cout << static_cast<int>(srcbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
-
-    // Loop over all components and flatten to a single GRAY component
-    auto dst_it = std::begin(dstbuf);
-    for (auto it = std::cbegin(srcbuf); it < std::cend(srcbuf);
-         it += src_comps) {
-        const auto r = static_cast<double>(*it) * 0.2126;
-        const auto g = static_cast<double>(*(it + 1)) * 0.7152;
-        const auto b = static_cast<double>(*(it + 2)) * 0.0722;
-        *dst_it = static_cast<uint8_t>(r + g + b);
-        dst_it++;
-    }
+    pixel_buf_t dstbuf(dst_size);
 
-    // std::cout << "beg: ";
-    // for (uint64_t i = 0; i < 4; ++i) {
-    //     std::cout << static_cast<int>(dstbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
-    // std::cout << "end: ";
-    // for (uint64_t i = dstbuf.size() - 4; i < dstbuf.size(); ++i) {
-    //     std::cout << static_cast<int>(dstbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
+    // Flatten all pixels to a single GRAY component
+    Pixel_Convert_Opts opts{};
+    opts.parallel = parallel;
+    convert_pixels(&convert<src_fmt, dst_fmt>, src_fmt, dst_fmt, srcbuf.data(),
+                   dstbuf.data(), dst_size, 1, opts);
 
     return dstbuf;
 }
 
-bytes_t pc_rgb_to_gray2(const bytes_t &srcbuf) {
+pixel_buf_t pc_rgb_to_gray2(const pixel_buf_t &srcbuf,
+                            const bool parallel = false) {
     // Get number of components of source pixels
     constexpr auto src_fmt = Pixel_Format::RGB;
     constexpr auto src_comps = pxfmt_components(src_fmt);
 
-    // We can safely cast to a signed integer here
-    const auto src_size = static_cast<int>(srcbuf.size());
+    const auto src_size = srcbuf.size();
 
     // Make sure we have at least 1 pixel
-    if (src_size < src_comps) {
-        return bytes_t{};
+    if (src_size < static_cast<size_t>(src_comps)) {
+        return pixel_buf_t{};
     }
 
-    // Get the size of the destination vector and 0 initialize
+    // Get the size of the destination vector, every byte gets written below
     constexpr auto dst_fmt = Pixel_Format::GRAY;
     constexpr auto dst_comps = pxfmt_components(dst_fmt);
     const auto dst_size = (src_size / src_comps) * dst_comps;
-    bytes_t dstbuf(static_cast<unsigned>(dst_size), 0);
-
-    // std::cout << "beg: ";
-    // for (uint64_t i = 0; i < 12; ++i) {
-    //     std::cout << static_cast<int>(srcbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
-    // std::cout << "end: ";
-    // for (uint64_t i = srcbuf.size() - 12; i < srcbuf.size(); ++i) {
-    //     std::cout << static_cast<int>(srcbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
+    pixel_buf_t dstbuf(dst_size);
 
     // Loop over all components and flatten to a single GRAY component
-    auto dst_it = std::begin(dstbuf);
-    for (auto it = std::cbegin(srcbuf); it < std::cend(srcbuf);
-         it += src_comps) {
-        const auto avg = std::accumulate(it, it + src_comps, 0) / src_comps;
-        *dst_it = static_cast<uint8_t>(avg);
-        dst_it++;
-    }
-
-    // std::cout << "beg: ";
-    // for (uint64_t i = 0; i < 4; ++i) {
-    //     std::cout << static_cast<int>(dstbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
-    // std::cout << "end: ";
-    // for (uint64_t i = dstbuf.size() - 4; i < dstbuf.size(); ++i) {
-    //     std::cout << static_cast<int>(dstbuf[i]) << ',';
-    // }
-    // std::cout << '\n';
+    constexpr auto avg_kernel = [](const uint8_t *src, uint8_t *dst,
+                                   const size_t n,
+                                   const Pixel_Convert_Opts &) noexcept {
+        for (size_t i = 0; i < n; ++i, src += src_comps) {
+            const auto avg = std::accumulate(src, src + src_comps, 0);
+            dst[i] = static_cast<uint8_t>(avg / src_comps);
+        }
+    };
+    Pixel_Convert_Opts opts{};
+    opts.parallel = parallel;
+    convert_pixels(avg_kernel, src_fmt, dst_fmt, srcbuf.data(), dstbuf.data(),
+                   dst_size, 1, opts);
 
     return dstbuf;
 }
 
+// The same for plain byte vectors, copied to and from a pixel_buf_t
+inline bytes_t pc_rgb_to_gray_dry(const bytes_t &srcbuf) {
+    const auto dst =
+        pc_rgb_to_gray_dry(pixel_buf_t(srcbuf.begin(), srcbuf.end()));
+    return bytes_t(dst.begin(), dst.end());
+}
+inline bytes_t pc_rgb_to_gray_dry2(const bytes_t &srcbuf) {
+    const auto dst =
+        pc_rgb_to_gray_dry2(pixel_buf_t(srcbuf.begin(), srcbuf.end()));
+    return bytes_t(dst.begin(), dst.end());
+}
+inline bytes_t pc_rgb_to_gray(const bytes_t &srcbuf,
+                              const bool parallel = false) {
+    const auto dst =
+        pc_rgb_to_gray(pixel_buf_t(srcbuf.begin(), srcbuf.end()), parallel);
+    return bytes_t(dst.begin(), dst.end());
+}
+inline bytes_t pc_rgb_to_gray2(const bytes_t &srcbuf,
+                               const bool parallel = false) {
+    const auto dst =
+        pc_rgb_to_gray2(pixel_buf_t(srcbuf.begin(), srcbuf.end()), parallel);
+    return bytes_t(dst.begin(), dst.end());
+}
+
 } // namespace utils
 
 #endif
@@ -0,0 +1,193 @@
+/*
+  pixels_view.h -- Non-owning strided views of pixel memory
+*/
+#ifndef PIXELS_VIEW_HPP
+#define PIXELS_VIEW_HPP
+
+#include "utils/pixel_convert.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <type_traits>
+
+namespace utils {
+
+// A width x height window of pixels somewhere in memory, rows are pitch bytes
+// apart. Views never own or copy anything, the memory has to outlive them.
+// Byte is uint8_t for a writable view and const uint8_t for a read only one.
+template <class Byte> class Basic_Pixels_View {
+    static_assert(std::is_same_v<std::remove_const_t<Byte>, uint8_t>);
+
+  public:
+    // Default construct - empty, invalid view
+    Basic_Pixels_View() = default;
+
+    // Constructor -> Memory, format, width, height and row pitch in bytes
+    // A pitch of 0 means tightly packed rows
+    Basic_Pixels_View(Byte *data, const Pixel_Format fmt, const int w,
+                      const int h, const size_t pitch = 0) noexcept
+        : data_{data}
+        , format_{fmt}
+        , width_{w}
+        , height_{h}
+        , pitch_{pitch == 0 ? pixels_pitch(w, fmt) : pitch}
+        , is_valid_{verify()} {}
+
+    // A writable view can always be used as a read only one
+    template <class B, std::enable_if_t<std::is_same_v<const B, Byte> &&
+                                            !std::is_same_v<B, Byte>,
+                                        int> = 0>
+    Basic_Pixels_View(const Basic_Pixels_View<B> &v) noexcept
+        : Basic_Pixels_View(v.data(), v.format(), v.width(), v.height(),
+                            v.pitch()) {}
+
+    // Simple getters
+    Byte *data() const noexcept { return data_; }
+    Pixel_Format format() const noexcept { return format_; }
+    int width() const noexcept { return width_; }
+    int height() const noexcept { return height_; }
+    size_t pitch() const noexcept { return pitch_; }
+    bool is_valid() const noexcept { return is_valid_; }
+
+    // Number of bytes of pixel data in each row, without the padding
+    size_t row_bytes() const noexcept {
+        return pixels_pitch(width_, format_);
+    }
+    // True if there is no padding between rows
+    bool is_contiguous() const noexcept { return pitch_ == row_bytes(); }
+
+    // Pointer to the first pixel of row y, no bounds checking
+    Byte *row(const int y) const noexcept {
+        return data_ + static_cast<size_t>(y) * pitch_;
+    }
+
+    // Sub view of w x h pixels at x, y, shares the same memory
+    // Returns an invalid view if the rectangle does not fit
+    Basic_Pixels_View sub(const int x, const int y, const int w,
+                          const int h) const {
+        if (!is_valid_ || x < 0 || y < 0 || w <= 0 || h <= 0 ||
+            w > width_ - x || h > height_ - y) {
+            std::cerr << "[ERROR] Sub view (" << x << ',' << y << ' ' << w
+                      << 'x' << h << ") is outside of the view (" << width_
+                      << 'x' << height_ << ")!\n";
+            return Basic_Pixels_View{};
+        }
+        const auto offset = static_cast<size_t>(x) *
+                            static_cast<size_t>(pxfmt_pixel_bytes(format_));
+        return Basic_Pixels_View{row(y) + offset, format_, w, h, pitch_};
+    }
+
+  private:
+    Byte *data_{nullptr};
+    Pixel_Format format_{Pixel_Format::Unknown};
+    int width_{0};
+    int height_{0};
+    size_t pitch_{0};
+    bool is_valid_{false};
+
+    // Verifies the dimensions and that the rows do not overlap each other
+    bool verify() const noexcept {
+        if (data_ == nullptr || width_ <= 0 || height_ <= 0 ||
+            height_ > pixels_max_dim()) {
+            return false;
+        }
+        const auto rb = row_bytes();
+        return rb != 0 && pitch_ >= rb;
+    }
+}; // Basic_Pixels_View
+
+using Pixels_View = Basic_Pixels_View<uint8_t>;
+using Const_Pixels_View = Basic_Pixels_View<const uint8_t>;
+
+namespace detail {
+// Runs fn(first, last) over [0, count) rows, in bands on the shared pool if
+// asked to and the work (bytes written) is large enough
+template <class Fn>
+void for_row_bands(const size_t count, const size_t row_bytes,
+                   const bool parallel, const Fn &fn) {
+    auto &pool = shared_thread_pool();
+    if (!parallel || pool.concurrency() <= 1 || row_bytes == 0 ||
+        count * row_bytes < CONVERT_PARALLEL_MIN_BYTES) {
+        fn(size_t{0}, count);
+        return;
+    }
+    const auto band = std::max<size_t>(1, CONVERT_BAND_BYTES / row_bytes);
+    const auto bands = (count + band - 1) / band;
+    pool.parallel_for(bands, [&](const size_t i) {
+        fn(i * band, std::min(count, (i + 1) * band));
+    });
+}
+} // namespace detail
+
+// Converts the pixels of src into dst, the views must have the same size
+// The formats can be anything, including the same one for a strided copy.
+// src and dst may be the same memory if the pitch is the same and large
+// enough for both formats, or if both views are tightly packed.
+// Returns false if nothing was converted.
+inline bool convert_view(const Const_Pixels_View src, const Pixels_View dst,
+                         const Pixel_Convert_Opts &opts = {}) {
+    if (!src.is_valid() || !dst.is_valid()) {
+        std::cerr << "[ERROR] Cannot convert an invalid pixel view!\n";
+        return false;
+    }
+    if (src.width() != dst.width() || src.height() != dst.height()) {
+        std::cerr << "[ERROR] Pixel view sizes do not match! (" << src.width()
+                  << 'x' << src.height() << " -> " << dst.width() << 'x'
+                  << dst.height() << ")\n";
+        return false;
+    }
+    const auto fn = get_converter(src.format(), dst.format());
+    if (fn == nullptr) {
+        return false;
+    }
+    const auto w = static_cast<size_t>(src.width());
+    const auto h = static_cast<size_t>(src.height());
+
+    // Packed on both sides, the whole thing is one run of pixels
+    if (src.is_contiguous() && dst.is_contiguous()) {
+        convert_pixels(fn, src.format(), dst.format(), src.data(), dst.data(),
+                       w * h, w, opts);
+        return true;
+    }
+
+    // Otherwise go row by row, which is only safe if a row never writes over
+    // the source of another row
+    const auto *src_beg = src.data();
+    const auto *src_end = src.row(src.height() - 1) + src.row_bytes();
+    const auto *dst_beg = dst.data();
+    const auto *dst_end = dst.row(dst.height() - 1) + dst.row_bytes();
+    const bool overlap = (src_beg < dst_end) && (dst_beg < src_end);
+    const bool same_rows =
+        src_beg == dst_beg && src.pitch() == dst.pitch() &&
+        src.pitch() >= std::max(src.row_bytes(), dst.row_bytes());
+    if (overlap && !same_rows) {
+        std::cerr << "[ERROR] Pixel views overlap, cannot convert!\n";
+        return false;
+    }
+    const auto convert_rows = [&](const size_t first, const size_t last) {
+        for (auto y = first; y < last; ++y) {
+            const auto yi = static_cast<int>(y);
+            fn(src.row(yi), dst.row(yi), w, opts);
+        }
+    };
+    auto &pool = shared_thread_pool();
+    const auto dst_bytes = dst.row_bytes() * h;
+    if (!opts.parallel || pool.concurrency() <= 1 ||
+        dst_bytes < CONVERT_PARALLEL_MIN_BYTES) {
+        convert_rows(0, h);
+        return true;
+    }
+    const auto band_rows = std::max<size_t>(
+        1, CONVERT_BAND_BYTES / std::max(src.row_bytes(), dst.row_bytes()));
+    const auto bands = (h + band_rows - 1) / band_rows;
+    pool.parallel_for(bands, [&](const size_t i) {
+        convert_rows(i * band_rows, std::min(h, (i + 1) * band_rows));
+    });
+    return true;
+}
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,579 @@
+/*
+  planar_kernels.h -- Raw kernels between packed pixels and separate planes
+*/
+#ifndef PLANAR_KERNELS_HPP
+#define PLANAR_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include "utils/pixel_kernels.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+namespace kernels {
+
+//
+// Scalar kernels, also used for the tails of the SIMD kernels
+// n is the pixel count, planes must not overlap the packed pixels
+//
+inline void deinterleave_rgb_scalar(const uint8_t *src, uint8_t *r,
+                                    uint8_t *g, uint8_t *b,
+                                    const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 3) {
+        r[i] = src[0];
+        g[i] = src[1];
+        b[i] = src[2];
+    }
+}
+inline void deinterleave_rgba_scalar(const uint8_t *src, uint8_t *r,
+                                     uint8_t *g, uint8_t *b, uint8_t *a,
+                                     const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, src += 4) {
+        r[i] = src[0];
+        g[i] = src[1];
+        b[i] = src[2];
+        a[i] = src[3];
+    }
+}
+inline void interleave_rgb_scalar(const uint8_t *r, const uint8_t *g,
+                                  const uint8_t *b, uint8_t *dst,
+                                  const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, dst += 3) {
+        dst[0] = r[i];
+        dst[1] = g[i];
+        dst[2] = b[i];
+    }
+}
+inline void interleave_rgba_scalar(const uint8_t *r, const uint8_t *g,
+                                   const uint8_t *b, const uint8_t *a,
+                                   uint8_t *dst, const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i, dst += 4) {
+        dst[0] = r[i];
+        dst[1] = g[i];
+        dst[2] = b[i];
+        dst[3] = a[i];
+    }
+}
+// Same math as rgb_to_gray_scalar and rgba_to_gray_scalar
+inline void planar_rgb_to_gray_scalar(const uint8_t *r, const uint8_t *g,
+                                      const uint8_t *b, uint8_t *dst,
+                                      const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+        const auto y = LUMA_R * r[i] + LUMA_G * g[i] + LUMA_B * b[i];
+        dst[i] = static_cast<uint8_t>(y >> LUMA_SHIFT);
+    }
+}
+inline void planar_rgba_to_gray_scalar(const uint8_t *r, const uint8_t *g,
+                                       const uint8_t *b, const uint8_t *a,
+                                       uint8_t *dst, const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+        const auto y = LUMA_R * r[i] + LUMA_G * g[i] + LUMA_B * b[i];
+        const auto lum = static_cast<unsigned>(y >> LUMA_SHIFT) * a[i];
+        dst[i] = static_cast<uint8_t>(div255(lum));
+    }
+}
+
+#if UTILS_ARCH_X86
+// 48 bytes of RGB24 -> 16 R, G and B values, same shuffles as rgb_to_gray_sse
+UTILS_TARGET_SSE41 inline void split3_sse(const __m128i a0, const __m128i a1,
+                                          const __m128i a2, __m128i &r,
+                                          __m128i &g, __m128i &b) {
+    // clang-format off
+    const auto r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const auto r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const auto g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const auto g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const auto b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const auto b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    // clang-format on
+    r = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a0, r0), _mm_shuffle_epi8(a1, r1)),
+        _mm_shuffle_epi8(a2, r2));
+    g = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a0, g0), _mm_shuffle_epi8(a1, g1)),
+        _mm_shuffle_epi8(a2, g2));
+    b = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a0, b0), _mm_shuffle_epi8(a1, b1)),
+        _mm_shuffle_epi8(a2, b2));
+}
+// 16 R, G and B values -> 48 bytes of RGB24, the inverse of split3_sse
+UTILS_TARGET_SSE41 inline void merge3_sse(const __m128i r, const __m128i g,
+                                          const __m128i b, __m128i &a0,
+                                          __m128i &a1, __m128i &a2) {
+    // clang-format off
+    const auto r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const auto g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const auto b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const auto r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const auto g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const auto b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const auto r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const auto g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const auto b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    // clang-format on
+    a0 = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(r, r0), _mm_shuffle_epi8(g, g0)),
+        _mm_shuffle_epi8(b, b0));
+    a1 = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(r, r1), _mm_shuffle_epi8(g, g1)),
+        _mm_shuffle_epi8(b, b1));
+    a2 = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(r, r2), _mm_shuffle_epi8(g, g2)),
+        _mm_shuffle_epi8(b, b2));
+}
+
+// 16 pixels per iteration
+UTILS_TARGET_SSE41 inline void deinterleave_rgb_sse(const uint8_t *src,
+                                                    uint8_t *r, uint8_t *g,
+                                                    uint8_t *b,
+                                                    const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i * 3);
+        __m128i vr;
+        __m128i vg;
+        __m128i vb;
+        split3_sse(_mm_loadu_si128(s), _mm_loadu_si128(s + 1),
+                   _mm_loadu_si128(s + 2), vr, vg, vb);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i), vr);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(g + i), vg);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i), vb);
+    }
+    deinterleave_rgb_scalar(src + i * 3, r + i, g + i, b + i, n - i);
+}
+UTILS_TARGET_SSE41 inline void interleave_rgb_sse(const uint8_t *r,
+                                                  const uint8_t *g,
+                                                  const uint8_t *b,
+                                                  uint8_t *dst,
+                                                  const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a0;
+        __m128i a1;
+        __m128i a2;
+        merge3_sse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i)),
+                   _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i)),
+                   _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)),
+                   a0, a1, a2);
+        auto *d = reinterpret_cast<__m128i *>(dst + i * 3);
+        _mm_storeu_si128(d, a0);
+        _mm_storeu_si128(d + 1, a1);
+        _mm_storeu_si128(d + 2, a2);
+    }
+    interleave_rgb_scalar(r + i, g + i, b + i, dst + i * 3, n - i);
+}
+
+// 16 pixels per iteration, gather each channel into a 32 bit group per
+// register then transpose the 4x4 groups
+UTILS_TARGET_SSE41 inline void deinterleave_rgba_sse(const uint8_t *src,
+                                                     uint8_t *r, uint8_t *g,
+                                                     uint8_t *b, uint8_t *a,
+                                                     const size_t n) noexcept {
+    const auto group =
+        _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i * 4);
+        const auto t0 = _mm_shuffle_epi8(_mm_loadu_si128(s), group);
+        const auto t1 = _mm_shuffle_epi8(_mm_loadu_si128(s + 1), group);
+        const auto t2 = _mm_shuffle_epi8(_mm_loadu_si128(s + 2), group);
+        const auto t3 = _mm_shuffle_epi8(_mm_loadu_si128(s + 3), group);
+        const auto rg01 = _mm_unpacklo_epi32(t0, t1);
+        const auto ba01 = _mm_unpackhi_epi32(t0, t1);
+        const auto rg23 = _mm_unpacklo_epi32(t2, t3);
+        const auto ba23 = _mm_unpackhi_epi32(t2, t3);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i),
+                         _mm_unpacklo_epi64(rg01, rg23));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(g + i),
+                         _mm_unpackhi_epi64(rg01, rg23));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i),
+                         _mm_unpacklo_epi64(ba01, ba23));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(a + i),
+                         _mm_unpackhi_epi64(ba01, ba23));
+    }
+    deinterleave_rgba_scalar(src + i * 4, r + i, g + i, b + i, a + i, n - i);
+}
+UTILS_TARGET_SSE41 inline void interleave_rgba_sse(const uint8_t *r,
+                                                   const uint8_t *g,
+                                                   const uint8_t *b,
+                                                   const uint8_t *a,
+                                                   uint8_t *dst,
+                                                   const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto vr =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+        const auto vg =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i));
+        const auto vb =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        const auto va =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const auto rg_lo = _mm_unpacklo_epi8(vr, vg);
+        const auto rg_hi = _mm_unpackhi_epi8(vr, vg);
+        const auto ba_lo = _mm_unpacklo_epi8(vb, va);
+        const auto ba_hi = _mm_unpackhi_epi8(vb, va);
+        auto *d = reinterpret_cast<__m128i *>(dst + i * 4);
+        _mm_storeu_si128(d, _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(d + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(d + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128(d + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+    interleave_rgba_scalar(r + i, g + i, b + i, a + i, dst + i * 4, n - i);
+}
+
+// 16 gray values scaled by alpha, y * a / 255 fits in 16 bits
+UTILS_TARGET_SSE41 inline __m128i scale_alpha_sse(const __m128i y,
+                                                  const __m128i a) {
+    const auto zero = _mm_setzero_si128();
+    const auto one = _mm_set1_epi16(1);
+    auto lo = _mm_mullo_epi16(_mm_unpacklo_epi8(y, zero),
+                              _mm_unpacklo_epi8(a, zero));
+    auto hi = _mm_mullo_epi16(_mm_unpackhi_epi8(y, zero),
+                              _mm_unpackhi_epi8(a, zero));
+    lo = _mm_srli_epi16(
+        _mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(
+        _mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+    return _mm_packus_epi16(lo, hi);
+}
+
+// 16 pixels per iteration, no shuffling needed at all
+UTILS_TARGET_SSE41 inline void planar_rgb_to_gray_sse(const uint8_t *r,
+                                                      const uint8_t *g,
+                                                      const uint8_t *b,
+                                                      uint8_t *dst,
+                                                      const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto y = luma_sse(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), y);
+    }
+    planar_rgb_to_gray_scalar(r + i, g + i, b + i, dst + i, n - i);
+}
+UTILS_TARGET_SSE41 inline void
+planar_rgba_to_gray_sse(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                        const uint8_t *a, uint8_t *dst,
+                        const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto y = luma_sse(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+        const auto va =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         scale_alpha_sse(y, va));
+    }
+    planar_rgba_to_gray_scalar(r + i, g + i, b + i, a + i, dst + i, n - i);
+}
+
+// Same as split3_sse on both 128 bit lanes
+UTILS_TARGET_AVX2 inline void split3_avx2(const __m256i a0, const __m256i a1,
+                                          const __m256i a2, __m256i &r,
+                                          __m256i &g, __m256i &b) {
+    // clang-format off
+    const auto r0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto r1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1));
+    const auto r2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13));
+    const auto g0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto g1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1));
+    const auto g2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14));
+    const auto b0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto b1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1));
+    const auto b2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15));
+    // clang-format on
+    r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a0, r0),
+                                        _mm256_shuffle_epi8(a1, r1)),
+                        _mm256_shuffle_epi8(a2, r2));
+    g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a0, g0),
+                                        _mm256_shuffle_epi8(a1, g1)),
+                        _mm256_shuffle_epi8(a2, g2));
+    b = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a0, b0),
+                                        _mm256_shuffle_epi8(a1, b1)),
+                        _mm256_shuffle_epi8(a2, b2));
+}
+// Same as merge3_sse on both 128 bit lanes
+UTILS_TARGET_AVX2 inline void merge3_avx2(const __m256i r, const __m256i g,
+                                          const __m256i b, __m256i &a0,
+                                          __m256i &a1, __m256i &a2) {
+    // clang-format off
+    const auto r0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5));
+    const auto g0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1));
+    const auto b0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1));
+    const auto r1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1));
+    const auto g1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10));
+    const auto b1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1));
+    const auto r2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1));
+    const auto g2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1));
+    const auto b2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15));
+    // clang-format on
+    a0 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(r, r0),
+                                         _mm256_shuffle_epi8(g, g0)),
+                         _mm256_shuffle_epi8(b, b0));
+    a1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(r, r1),
+                                         _mm256_shuffle_epi8(g, g1)),
+                         _mm256_shuffle_epi8(b, b1));
+    a2 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(r, r2),
+                                         _mm256_shuffle_epi8(g, g2)),
+                         _mm256_shuffle_epi8(b, b2));
+}
+
+// 32 pixels per iteration, the low lane gets pixels 0-15 and the high lane
+// pixels 16-31 like rgb_to_gray_avx2, so each plane comes out in order
+UTILS_TARGET_AVX2 inline void deinterleave_rgb_avx2(const uint8_t *src,
+                                                    uint8_t *r, uint8_t *g,
+                                                    uint8_t *b,
+                                                    const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto *s = src + i * 3;
+        __m256i vr;
+        __m256i vg;
+        __m256i vb;
+        split3_avx2(load2_avx2(s, s + 48), load2_avx2(s + 16, s + 64),
+                    load2_avx2(s + 32, s + 80), vr, vg, vb);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i), vr);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(g + i), vg);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(b + i), vb);
+    }
+    deinterleave_rgb_scalar(src + i * 3, r + i, g + i, b + i, n - i);
+}
+// 32 pixels per iteration, the lanes of the three results are swapped back
+// into the 96 bytes of RGB24
+UTILS_TARGET_AVX2 inline void interleave_rgb_avx2(const uint8_t *r,
+                                                  const uint8_t *g,
+                                                  const uint8_t *b,
+                                                  uint8_t *dst,
+                                                  const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a0;
+        __m256i a1;
+        __m256i a2;
+        merge3_avx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(g + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)), a0,
+            a1, a2);
+        auto *d = reinterpret_cast<__m256i *>(dst + i * 3);
+        _mm256_storeu_si256(d, _mm256_permute2x128_si256(a0, a1, 0x20));
+        _mm256_storeu_si256(d + 1, _mm256_permute2x128_si256(a2, a0, 0x30));
+        _mm256_storeu_si256(d + 2, _mm256_permute2x128_si256(a1, a2, 0x31));
+    }
+    interleave_rgb_scalar(r + i, g + i, b + i, dst + i * 3, n - i);
+}
+
+// 32 pixels per iteration, same transpose as deinterleave_rgba_sse in each
+// lane, one cross lane permute puts the 4 pixel groups back in order
+UTILS_TARGET_AVX2 inline void deinterleave_rgba_avx2(const uint8_t *src,
+                                                     uint8_t *r, uint8_t *g,
+                                                     uint8_t *b, uint8_t *a,
+                                                     const size_t n) noexcept {
+    const auto group = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto *s = reinterpret_cast<const __m256i *>(src + i * 4);
+        const auto t0 = _mm256_shuffle_epi8(_mm256_loadu_si256(s), group);
+        const auto t1 = _mm256_shuffle_epi8(_mm256_loadu_si256(s + 1), group);
+        const auto t2 = _mm256_shuffle_epi8(_mm256_loadu_si256(s + 2), group);
+        const auto t3 = _mm256_shuffle_epi8(_mm256_loadu_si256(s + 3), group);
+        const auto rg01 = _mm256_unpacklo_epi32(t0, t1);
+        const auto ba01 = _mm256_unpackhi_epi32(t0, t1);
+        const auto rg23 = _mm256_unpacklo_epi32(t2, t3);
+        const auto ba23 = _mm256_unpackhi_epi32(t2, t3);
+        const auto vr = _mm256_unpacklo_epi64(rg01, rg23);
+        const auto vg = _mm256_unpackhi_epi64(rg01, rg23);
+        const auto vb = _mm256_unpacklo_epi64(ba01, ba23);
+        const auto va = _mm256_unpackhi_epi64(ba01, ba23);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i),
+                            _mm256_permutevar8x32_epi32(vr, order));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(g + i),
+                            _mm256_permutevar8x32_epi32(vg, order));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(b + i),
+                            _mm256_permutevar8x32_epi32(vb, order));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i),
+                            _mm256_permutevar8x32_epi32(va, order));
+    }
+    deinterleave_rgba_scalar(src + i * 4, r + i, g + i, b + i, a + i, n - i);
+}
+// 32 pixels per iteration, the unpacks leave pixels 0-15 in the low lanes
+// and 16-31 in the high lanes
+UTILS_TARGET_AVX2 inline void interleave_rgba_avx2(const uint8_t *r,
+                                                   const uint8_t *g,
+                                                   const uint8_t *b,
+                                                   const uint8_t *a,
+                                                   uint8_t *dst,
+                                                   const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto vr =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r + i));
+        const auto vg =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(g + i));
+        const auto vb =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        const auto va =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const auto rg_lo = _mm256_unpacklo_epi8(vr, vg);
+        const auto rg_hi = _mm256_unpackhi_epi8(vr, vg);
+        const auto ba_lo = _mm256_unpacklo_epi8(vb, va);
+        const auto ba_hi = _mm256_unpackhi_epi8(vb, va);
+        const auto q0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+        const auto q1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+        const auto q2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+        const auto q3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+        auto *d = reinterpret_cast<__m256i *>(dst + i * 4);
+        _mm256_storeu_si256(d, _mm256_permute2x128_si256(q0, q1, 0x20));
+        _mm256_storeu_si256(d + 1, _mm256_permute2x128_si256(q2, q3, 0x20));
+        _mm256_storeu_si256(d + 2, _mm256_permute2x128_si256(q0, q1, 0x31));
+        _mm256_storeu_si256(d + 3, _mm256_permute2x128_si256(q2, q3, 0x31));
+    }
+    interleave_rgba_scalar(r + i, g + i, b + i, a + i, dst + i * 4, n - i);
+}
+
+// Same as scale_alpha_sse, 32 values
+UTILS_TARGET_AVX2 inline __m256i scale_alpha_avx2(const __m256i y,
+                                                  const __m256i a) {
+    const auto zero = _mm256_setzero_si256();
+    const auto one = _mm256_set1_epi16(1);
+    auto lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(y, zero),
+                                 _mm256_unpacklo_epi8(a, zero));
+    auto hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(y, zero),
+                                 _mm256_unpackhi_epi8(a, zero));
+    lo = _mm256_srli_epi16(
+        _mm256_add_epi16(_mm256_add_epi16(lo, one), _mm256_srli_epi16(lo, 8)),
+        8);
+    hi = _mm256_srli_epi16(
+        _mm256_add_epi16(_mm256_add_epi16(hi, one), _mm256_srli_epi16(hi, 8)),
+        8);
+    return _mm256_packus_epi16(lo, hi);
+}
+
+// 32 pixels per iteration, the in lane unpacks and packs cancel out
+UTILS_TARGET_AVX2 inline void
+planar_rgb_to_gray_avx2(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                        uint8_t *dst, const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto y = luma_avx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(g + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), y);
+    }
+    planar_rgb_to_gray_scalar(r + i, g + i, b + i, dst + i, n - i);
+}
+UTILS_TARGET_AVX2 inline void
+planar_rgba_to_gray_avx2(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                         const uint8_t *a, uint8_t *dst,
+                         const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto y = luma_avx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(g + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+        const auto va =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                            scale_alpha_avx2(y, va));
+    }
+    planar_rgba_to_gray_scalar(r + i, g + i, b + i, a + i, dst + i, n - i);
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+// There are no AVX-512 versions, these are limited by memory bandwidth
+//
+using deinterleave3_fn_t = void (*)(const uint8_t *, uint8_t *, uint8_t *,
+                                    uint8_t *, size_t) noexcept;
+using deinterleave4_fn_t = void (*)(const uint8_t *, uint8_t *, uint8_t *,
+                                    uint8_t *, uint8_t *, size_t) noexcept;
+using interleave3_fn_t = void (*)(const uint8_t *, const uint8_t *,
+                                  const uint8_t *, uint8_t *, size_t) noexcept;
+using interleave4_fn_t = void (*)(const uint8_t *, const uint8_t *,
+                                  const uint8_t *, const uint8_t *, uint8_t *,
+                                  size_t) noexcept;
+inline void deinterleave_rgb(const uint8_t *src, uint8_t *r, uint8_t *g,
+                             uint8_t *b, const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<deinterleave3_fn_t>(
+        deinterleave_rgb_scalar, deinterleave_rgb_sse, deinterleave_rgb_avx2);
+    fn(src, r, g, b, n);
+#else
+    deinterleave_rgb_scalar(src, r, g, b, n);
+#endif
+}
+inline void deinterleave_rgba(const uint8_t *src, uint8_t *r, uint8_t *g,
+                              uint8_t *b, uint8_t *a, const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<deinterleave4_fn_t>(
+        deinterleave_rgba_scalar, deinterleave_rgba_sse,
+        deinterleave_rgba_avx2);
+    fn(src, r, g, b, a, n);
+#else
+    deinterleave_rgba_scalar(src, r, g, b, a, n);
+#endif
+}
+inline void interleave_rgb(const uint8_t *r, const uint8_t *g,
+                           const uint8_t *b, uint8_t *dst,
+                           const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<interleave3_fn_t>(
+        interleave_rgb_scalar, interleave_rgb_sse, interleave_rgb_avx2);
+    fn(r, g, b, dst, n);
+#else
+    interleave_rgb_scalar(r, g, b, dst, n);
+#endif
+}
+inline void interleave_rgba(const uint8_t *r, const uint8_t *g,
+                            const uint8_t *b, const uint8_t *a, uint8_t *dst,
+                            const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<interleave4_fn_t>(
+        interleave_rgba_scalar, interleave_rgba_sse, interleave_rgba_avx2);
+    fn(r, g, b, a, dst, n);
+#else
+    interleave_rgba_scalar(r, g, b, a, dst, n);
+#endif
+}
+inline void planar_rgb_to_gray(const uint8_t *r, const uint8_t *g,
+                               const uint8_t *b, uint8_t *dst,
+                               const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<interleave3_fn_t>(
+        planar_rgb_to_gray_scalar, planar_rgb_to_gray_sse,
+        planar_rgb_to_gray_avx2);
+    fn(r, g, b, dst, n);
+#else
+    planar_rgb_to_gray_scalar(r, g, b, dst, n);
+#endif
+}
+inline void planar_rgba_to_gray(const uint8_t *r, const uint8_t *g,
+                                const uint8_t *b, const uint8_t *a,
+                                uint8_t *dst, const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<interleave4_fn_t>(
+        planar_rgba_to_gray_scalar, planar_rgba_to_gray_sse,
+        planar_rgba_to_gray_avx2);
+    fn(r, g, b, a, dst, n);
+#else
+    planar_rgba_to_gray_scalar(r, g, b, a, dst, n);
+#endif
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
@@ -0,0 +1,250 @@
+/*
+  planar_pixels.h -- Pixel buffer with one plane per channel
+*/
+#ifndef PLANAR_PIXELS_HPP
+#define PLANAR_PIXELS_HPP
+
+#include "utils/pixel_alloc.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/planar_kernels.hpp"
+#include <cstring>
+#include <iostream>
+
+namespace utils {
+
+// Planar (structure of arrays) pixels, R, G, B and A each get their own plane
+// of width bytes per row. Every row of every plane starts on a cache line, so
+// channel wise filters and statistics can run on whole SIMD registers. Each
+// plane has an even number of rows, so a 4:2:0 JPEG can usually be decoded
+// straight into them (see JPEG_Read::get_planar).
+class Planar_Pixels {
+  public:
+    // Default construct - empty buffer and values
+    Planar_Pixels() = default;
+
+    // Constructor -> Format, width, height - allocates uninitialized planes
+    Planar_Pixels(const Pixel_Format fmt, const int w, const int h)
+        : format_{fmt}
+        , width_{w}
+        , height_{h} {
+        const auto planes = pxfmt_components(fmt);
+        if (planes <= 0 || pixels_size(w, h, fmt) == 0) {
+            clear();
+            return;
+        }
+        if (pxfmt_depth(fmt) != 1) {
+            std::cerr << "[ERROR] Planes are 8 bit, not " << fmt << "!\n";
+            clear();
+            return;
+        }
+        pitch_ = detail::round_up(static_cast<size_t>(w), PIXEL_BUF_ALIGN);
+        plane_size_ = pitch_ * detail::round_up(static_cast<size_t>(h), 2);
+        buf_.resize(plane_size_ * static_cast<size_t>(planes));
+        is_valid_ = true;
+    }
+
+    // Constructor -> Splits packed pixels into planes of the same format
+    explicit Planar_Pixels(const Const_Pixels_View src)
+        : Planar_Pixels(src.format(), src.width(), src.height()) {
+        if (is_valid_ && !deinterleave_from(src)) {
+            clear();
+        }
+    }
+
+    // Simple getters
+    Pixel_Format format() const noexcept { return format_; }
+    int width() const noexcept { return width_; }
+    int height() const noexcept { return height_; }
+    size_t pitch() const noexcept { return pitch_; }
+    // Rows each plane has room for, the height rounded up to even
+    size_t plane_rows() const noexcept {
+        return pitch_ == 0 ? 0 : plane_size_ / pitch_;
+    }
+    bool is_valid() const noexcept { return is_valid_; }
+    int planes() const noexcept {
+        return is_valid_ ? pxfmt_components(format_) : 0;
+    }
+
+    // Resets the class back to empty/clean state
+    void clear() {
+        format_ = Pixel_Format::Unknown;
+        width_ = 0;
+        height_ = 0;
+        pitch_ = 0;
+        plane_size_ = 0;
+        is_valid_ = false;
+        buf_.clear();
+    }
+
+    // First byte of plane i (0 = R or GRAY, 1 = G, 2 = B, 3 = A), no bounds
+    // checking
+    uint8_t *plane(const int i) noexcept {
+        return buf_.data() + static_cast<size_t>(i) * plane_size_;
+    }
+    const uint8_t *plane(const int i) const noexcept {
+        return buf_.data() + static_cast<size_t>(i) * plane_size_;
+    }
+
+    // A plane as a GRAY view, so any GRAY kernel or filter runs on it as is
+    Pixels_View plane_view(const int i) noexcept {
+        if (!is_valid_ || i < 0 || i >= planes()) {
+            return Pixels_View{};
+        }
+        return Pixels_View{plane(i), Pixel_Format::GRAY, width_, height_,
+                           pitch_};
+    }
+    Const_Pixels_View plane_view(const int i) const noexcept {
+        if (!is_valid_ || i < 0 || i >= planes()) {
+            return Const_Pixels_View{};
+        }
+        return Const_Pixels_View{plane(i), Pixel_Format::GRAY, width_,
+                                 height_, pitch_};
+    }
+
+    // Splits packed pixels of the same size and format into the planes
+    bool deinterleave_from(const Const_Pixels_View src) {
+        if (!check_view(src)) {
+            return false;
+        }
+        const auto n = static_cast<size_t>(width_);
+        for (int y = 0; y < height_; ++y) {
+            const auto off = static_cast<size_t>(y) * pitch_;
+            switch (format_) {
+            case Pixel_Format::RGB:
+                kernels::deinterleave_rgb(src.row(y), plane(0) + off,
+                                          plane(1) + off, plane(2) + off, n);
+                break;
+            case Pixel_Format::RGBA:
+                kernels::deinterleave_rgba(src.row(y), plane(0) + off,
+                                           plane(1) + off, plane(2) + off,
+                                           plane(3) + off, n);
+                break;
+            case Pixel_Format::GRAY:
+                std::memcpy(plane(0) + off, src.row(y), n);
+                break;
+            case Pixel_Format::RGB16:
+            case Pixel_Format::RGBA16:
+            case Pixel_Format::GRAY16:
+            case Pixel_Format::Unknown:
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Merges the planes into packed pixels of the same size and format
+    bool interleave_to(const Pixels_View dst) const {
+        if (!check_view(dst)) {
+            return false;
+        }
+        const auto n = static_cast<size_t>(width_);
+        for (int y = 0; y < height_; ++y) {
+            const auto off = static_cast<size_t>(y) * pitch_;
+            switch (format_) {
+            case Pixel_Format::RGB:
+                kernels::interleave_rgb(plane(0) + off, plane(1) + off,
+                                        plane(2) + off, dst.row(y), n);
+                break;
+            case Pixel_Format::RGBA:
+                kernels::interleave_rgba(plane(0) + off, plane(1) + off,
+                                         plane(2) + off, plane(3) + off,
+                                         dst.row(y), n);
+                break;
+            case Pixel_Format::GRAY:
+                std::memcpy(dst.row(y), plane(0) + off, n);
+                break;
+            case Pixel_Format::RGB16:
+            case Pixel_Format::RGBA16:
+            case Pixel_Format::GRAY16:
+            case Pixel_Format::Unknown:
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Packed pixels in any format, converted after interleaving if needed
+    Pixels to_pixels(const Pixel_Format fmt,
+                     const Pixel_Convert_Opts &opts = {}) const {
+        if (fmt == Pixel_Format::GRAY) {
+            return to_gray();
+        }
+        Pixels p{format_, width_, height_};
+        if (!p.is_valid() || !interleave_to(p.view())) {
+            p.clear();
+            return p;
+        }
+        p.convert_to(fmt, opts);
+        return p;
+    }
+
+    // GRAY pixels straight from the planes, same luma as the packed kernels
+    Pixels to_gray() const {
+        Pixels p{Pixel_Format::GRAY, width_, height_};
+        if (!p.is_valid() || !is_valid_) {
+            p.clear();
+            return p;
+        }
+        const auto n = static_cast<size_t>(width_);
+        for (int y = 0; y < height_; ++y) {
+            const auto off = static_cast<size_t>(y) * pitch_;
+            auto *dst = p.buf.data() + static_cast<size_t>(y) * n;
+            switch (format_) {
+            case Pixel_Format::RGB:
+                kernels::planar_rgb_to_gray(plane(0) + off, plane(1) + off,
+                                            plane(2) + off, dst, n);
+                break;
+            case Pixel_Format::RGBA:
+                kernels::planar_rgba_to_gray(plane(0) + off, plane(1) + off,
+                                             plane(2) + off, plane(3) + off,
+                                             dst, n);
+                break;
+            case Pixel_Format::GRAY:
+                std::memcpy(dst, plane(0) + off, n);
+                break;
+            case Pixel_Format::RGB16:
+            case Pixel_Format::RGBA16:
+            case Pixel_Format::GRAY16:
+            case Pixel_Format::Unknown:
+            default:
+                p.clear();
+                return p;
+            }
+        }
+        return p;
+    }
+
+  private:
+    pixel_buf_t buf_{};
+    Pixel_Format format_{Pixel_Format::Unknown};
+    int width_{0};
+    int height_{0};
+    size_t pitch_{0};
+    size_t plane_size_{0};
+    bool is_valid_{false};
+
+    // Packed views have to match our size and format exactly
+    template <class Byte>
+    bool check_view(const Basic_Pixels_View<Byte> &v) const {
+        if (!is_valid_ || !v.is_valid()) {
+            return false;
+        }
+        if (v.width() != width_ || v.height() != height_ ||
+            v.format() != format_) {
+            std::cerr << "[ERROR] Pixel view (" << v.format() << ' '
+                      << v.width() << 'x' << v.height()
+                      << ") does not match the planes (" << format_ << ' '
+                      << width_ << 'x' << height_ << ")!\n";
+            return false;
+        }
+        return true;
+    }
+}; // Planar_Pixels
+
+} // namespace utils
+
+#endif
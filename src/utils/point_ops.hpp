@@ -0,0 +1,300 @@
+/*
+  point_ops.h -- Per pixel tone operations compiled into lookup tables
+*/
+#ifndef POINT_OPS_HPP
+#define POINT_OPS_HPP
+
+#include "utils/lut_kernels.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixels_view.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+// A compiled 256 entry table, applied to the colour channels of any format
+class Point_Lut {
+  public:
+    // Default construct - the identity
+    Point_Lut() noexcept {
+        for (size_t i = 0; i < 256; ++i) {
+            lut_.table[i] = static_cast<uint8_t>(i);
+        }
+        lut_.fold();
+    }
+    // Constructor -> Any table
+    explicit Point_Lut(const std::array<uint8_t, 256> &table) noexcept {
+        std::copy(table.begin(), table.end(), lut_.table);
+        lut_.fold();
+    }
+
+    uint8_t operator[](const uint8_t v) const noexcept {
+        return lut_.table[v];
+    }
+    const kernels::Lut8 &lut() const noexcept { return lut_; }
+
+    // This table followed by next, as a single table
+    Point_Lut then(const Point_Lut &next) const noexcept {
+        std::array<uint8_t, 256> t{};
+        for (size_t i = 0; i < 256; ++i) {
+            t[i] = next[lut_.table[i]];
+        }
+        return Point_Lut{t};
+    }
+
+  private:
+    kernels::Lut8 lut_{};
+};
+
+// A chain of point operations on values in [0, 1], evaluated in double
+// precision and only rounded once when compiled into a table. Any number of
+// operations costs the same as one when applied.
+// Values between operations are not clamped, the final result is.
+class Point_Ops {
+  public:
+    using op_fn_t = std::function<double(double)>;
+
+    // Any function of the value
+    Point_Ops &apply(op_fn_t fn) {
+        ops_.push_back(std::move(fn));
+        return *this;
+    }
+    // v ^ (1 / g), g > 1 brightens the mid tones like the middle slider of
+    // levels does
+    Point_Ops &gamma(const double g) {
+        if (!(g > 0.0)) {
+            std::cerr << "[ERROR] Invalid gamma (" << g << ")!\n";
+            return *this;
+        }
+        return apply([g](const double v) {
+            return std::pow(std::max(v, 0.0), 1.0 / g);
+        });
+    }
+    // Maps [in_black, in_white] to [out_black, out_white] with a gamma in
+    // between, all in 0-255 like an image editor's levels dialog
+    Point_Ops &levels(const double in_black, const double in_white,
+                      const double g = 1.0, const double out_black = 0.0,
+                      const double out_white = 255.0) {
+        if (!(in_white > in_black) || !(g > 0.0)) {
+            std::cerr << "[ERROR] Invalid levels (" << in_black << '-'
+                      << in_white << ", gamma " << g << ")!\n";
+            return *this;
+        }
+        const auto ib = in_black / 255.0;
+        const auto iw = in_white / 255.0;
+        const auto ob = out_black / 255.0;
+        const auto ow = out_white / 255.0;
+        return apply([=](const double v) {
+            const auto t = std::clamp((v - ib) / (iw - ib), 0.0, 1.0);
+            return ob + std::pow(t, 1.0 / g) * (ow - ob);
+        });
+    }
+    // Smooth curve through control points (x, y) in 0-255, a monotone cubic
+    // so it never overshoots between points. Flat past the first and last.
+    Point_Ops &curve(std::vector<std::pair<double, double>> points) {
+        std::sort(points.begin(), points.end());
+        points.erase(std::unique(points.begin(), points.end(),
+                                 [](const auto &a, const auto &b) {
+                                     return !(b.first > a.first);
+                                 }),
+                     points.end());
+        if (points.size() < 2) {
+            std::cerr << "[ERROR] A curve needs at least 2 points!\n";
+            return *this;
+        }
+        const auto n = points.size();
+        std::vector<double> xs(n);
+        std::vector<double> ys(n);
+        for (size_t i = 0; i < n; ++i) {
+            xs[i] = points[i].first / 255.0;
+            ys[i] = points[i].second / 255.0;
+        }
+        // Fritsch-Carlson tangents
+        std::vector<double> d(n - 1);
+        for (size_t i = 0; i + 1 < n; ++i) {
+            d[i] = (ys[i + 1] - ys[i]) / (xs[i + 1] - xs[i]);
+        }
+        std::vector<double> m(n);
+        m[0] = d[0];
+        m[n - 1] = d[n - 2];
+        for (size_t i = 1; i + 1 < n; ++i) {
+            m[i] = d[i - 1] * d[i] <= 0.0 ? 0.0 : (d[i - 1] + d[i]) / 2.0;
+        }
+        for (size_t i = 0; i + 1 < n; ++i) {
+            if (std::fpclassify(d[i]) == FP_ZERO) {
+                m[i] = 0.0;
+                m[i + 1] = 0.0;
+                continue;
+            }
+            const auto a = m[i] / d[i];
+            const auto b = m[i + 1] / d[i];
+            const auto s = a * a + b * b;
+            if (s > 9.0) {
+                const auto t = 3.0 / std::sqrt(s);
+                m[i] = t * a * d[i];
+                m[i + 1] = t * b * d[i];
+            }
+        }
+        return apply([xs, ys, m](const double v) {
+            if (v <= xs.front()) {
+                return ys.front();
+            }
+            if (v >= xs.back()) {
+                return ys.back();
+            }
+            const auto k = static_cast<size_t>(
+                std::upper_bound(xs.begin(), xs.end(), v) - xs.begin() - 1);
+            const auto h = xs[k + 1] - xs[k];
+            const auto t = (v - xs[k]) / h;
+            const auto t2 = t * t;
+            const auto t3 = t2 * t;
+            return (2 * t3 - 3 * t2 + 1) * ys[k] +
+                   (t3 - 2 * t2 + t) * h * m[k] +
+                   (-2 * t3 + 3 * t2) * ys[k + 1] + (t3 - t2) * h * m[k + 1];
+        });
+    }
+    Point_Ops &invert() {
+        return apply([](const double v) { return 1.0 - v; });
+    }
+    // sRGB encoded <-> linear light
+    Point_Ops &srgb_to_linear() {
+        return apply([](const double v) {
+            return kernels::srgb_to_linear(std::clamp(v, 0.0, 1.0));
+        });
+    }
+    Point_Ops &linear_to_srgb() {
+        return apply([](const double v) {
+            return kernels::linear_to_srgb(std::clamp(v, 0.0, 1.0));
+        });
+    }
+
+    bool empty() const noexcept { return ops_.empty(); }
+
+    // The whole chain on a single value in [0, 1], clamped
+    double operator()(double v) const {
+        for (const auto &op : ops_) {
+            v = op(v);
+        }
+        return std::clamp(v, 0.0, 1.0);
+    }
+
+    // Table for 8 bit channels
+    Point_Lut compile() const {
+        std::array<uint8_t, 256> t{};
+        for (size_t i = 0; i < t.size(); ++i) {
+            t[i] = static_cast<uint8_t>(
+                std::lround((*this)(static_cast<double>(i) / 255.0) * 255.0));
+        }
+        return Point_Lut{t};
+    }
+    // Table for 16 bit channels, 65536 entries (see apply_lut below)
+    std::vector<uint16_t> compile16() const {
+        std::vector<uint16_t> t(65536);
+        for (size_t i = 0; i < t.size(); ++i) {
+            t[i] = static_cast<uint16_t>(std::lround(
+                (*this)(static_cast<double>(i) / 65535.0) * 65535.0));
+        }
+        return t;
+    }
+
+  private:
+    std::vector<op_fn_t> ops_{};
+};
+
+namespace detail {
+// Both views valid, of the same size and format, and of depth bytes
+inline bool check_lut_views(const Const_Pixels_View src,
+                            const Const_Pixels_View dst, const int depth) {
+    if (!src.is_valid() || !dst.is_valid()) {
+        std::cerr << "[ERROR] Cannot apply a LUT to an invalid pixel view!\n";
+        return false;
+    }
+    if (src.format() != dst.format() || src.width() != dst.width() ||
+        src.height() != dst.height()) {
+        std::cerr << "[ERROR] Pixel views do not match! (" << src.format()
+                  << ' ' << src.width() << 'x' << src.height() << " -> "
+                  << dst.format() << ' ' << dst.width() << 'x'
+                  << dst.height() << ")\n";
+        return false;
+    }
+    if (pxfmt_depth(src.format()) != depth) {
+        std::cerr << "[ERROR] " << depth * 8 << " bit LUTs cannot map "
+                  << src.format() << " pixels!\n";
+        return false;
+    }
+    return true;
+}
+} // namespace detail
+
+// Maps every colour channel of src through lut into dst, alpha is copied
+// as is. Same size and format, may be the same view (in place).
+inline bool apply_lut(const Const_Pixels_View src, const Pixels_View dst,
+                      const Point_Lut &lut, const bool parallel = false) {
+    if (!detail::check_lut_views(src, dst, 1)) {
+        return false;
+    }
+    const auto keep_alpha = src.format() == Pixel_Format::RGBA;
+    const auto rb = src.row_bytes();
+    detail::for_row_bands(
+        static_cast<size_t>(src.height()), rb, parallel,
+        [&](const size_t first, const size_t last) {
+            for (auto y = first; y < last; ++y) {
+                const auto yi = static_cast<int>(y);
+                kernels::lut_apply(src.row(yi), dst.row(yi), rb, lut.lut(),
+                                   keep_alpha);
+            }
+        });
+    return true;
+}
+inline bool apply_lut(const Pixels_View v, const Point_Lut &lut,
+                      const bool parallel = false) {
+    return apply_lut(v, v, lut, parallel);
+}
+
+// Same for 16 bit formats with a table from Point_Ops::compile16
+inline bool apply_lut(const Const_Pixels_View src, const Pixels_View dst,
+                      const std::vector<uint16_t> &lut,
+                      const bool parallel = false) {
+    if (lut.size() != 65536) {
+        std::cerr << "[ERROR] 16 bit LUTs need 65536 entries, not "
+                  << lut.size() << "!\n";
+        return false;
+    }
+    if (!detail::check_lut_views(src, dst, 2)) {
+        return false;
+    }
+    const auto keep_alpha = src.format() == Pixel_Format::RGBA16;
+    const auto rb = src.row_bytes();
+    detail::for_row_bands(
+        static_cast<size_t>(src.height()), rb, parallel,
+        [&](const size_t first, const size_t last) {
+            for (auto y = first; y < last; ++y) {
+                const auto yi = static_cast<int>(y);
+                kernels::lut16_apply(src.row(yi), dst.row(yi), rb / 2,
+                                     lut.data(), keep_alpha);
+            }
+        });
+    return true;
+}
+inline bool apply_lut(const Pixels_View v, const std::vector<uint16_t> &lut,
+                      const bool parallel = false) {
+    return apply_lut(v, v, lut, parallel);
+}
+
+// Compiles ops for the depth of v and applies them in place
+inline bool apply_point_ops(const Pixels_View v, const Point_Ops &ops,
+                            const bool parallel = false) {
+    if (v.is_valid() && pxfmt_depth(v.format()) == 2) {
+        return apply_lut(v, ops.compile16(), parallel);
+    }
+    return apply_lut(v, ops.compile(), parallel);
+}
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,574 @@
+/*
+  resample_kernels.h -- Raw fixed point kernels for separable filters
+*/
+#ifndef RESAMPLE_KERNELS_HPP
+#define RESAMPLE_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+namespace kernels {
+
+// Filter weights are Q14, each set of weights sums to exactly 1 << 14
+constexpr int RESAMPLE_SHIFT = 14;
+constexpr int RESAMPLE_HALF = 1 << (RESAMPLE_SHIFT - 1);
+
+// Rounds a Q14 sum back to a byte, negative lobes can over or undershoot
+constexpr uint8_t resample_clamp(const int acc) noexcept {
+    const auto v = acc >> RESAMPLE_SHIFT;
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+//
+// Vertical pass: dst[x] = sum of rows[k][x] * w[k] for k < taps
+// Works on bytes, so it does not care about the pixel format
+//
+inline void resample_vertical_tail(const uint8_t *const *rows,
+                                   const int16_t *w, const size_t taps,
+                                   uint8_t *dst, const size_t first,
+                                   const size_t n) noexcept {
+    for (auto x = first; x < n; ++x) {
+        int acc = RESAMPLE_HALF;
+        for (size_t k = 0; k < taps; ++k) {
+            acc += rows[k][x] * w[k];
+        }
+        dst[x] = resample_clamp(acc);
+    }
+}
+inline void resample_vertical_scalar(const uint8_t *const *rows,
+                                     const int16_t *w, const size_t taps,
+                                     uint8_t *dst, const size_t n) noexcept {
+    resample_vertical_tail(rows, w, taps, dst, 0, n);
+}
+
+//
+// Horizontal pass: each output pixel is the weighted sum of taps input pixels
+// from start[x] on, the weights of pixel x are at w + x * taps
+//
+template <size_t C>
+void resample_horizontal_scalar(const uint8_t *src, uint8_t *dst,
+                                const int *start, const int16_t *w,
+                                const size_t taps, const size_t n) noexcept {
+    for (size_t x = 0; x < n; ++x, w += taps, dst += C) {
+        const auto *s = src + static_cast<size_t>(start[x]) * C;
+        int acc[C];
+        for (size_t c = 0; c < C; ++c) {
+            acc[c] = RESAMPLE_HALF;
+        }
+        for (size_t k = 0; k < taps; ++k, s += C) {
+            for (size_t c = 0; c < C; ++c) {
+                acc[c] += s[c] * w[k];
+            }
+        }
+        for (size_t c = 0; c < C; ++c) {
+            dst[c] = resample_clamp(acc[c]);
+        }
+    }
+}
+
+//
+// 2x box reduction of one output row from two input rows, comps channels
+// Every output channel is the rounded mean of the 2x2 input pixels
+//
+inline void downscale_2x_tail(const uint8_t *s0, const uint8_t *s1,
+                              uint8_t *d, const size_t first, const size_t w,
+                              const size_t comps) noexcept {
+    for (auto x = first; x < w; ++x) {
+        const auto *a = s0 + x * 2 * comps;
+        const auto *b = s1 + x * 2 * comps;
+        for (size_t c = 0; c < comps; ++c) {
+            const auto sum = a[c] + a[c + comps] + b[c] + b[c + comps] + 2;
+            d[x * comps + c] = static_cast<uint8_t>(sum >> 2);
+        }
+    }
+}
+inline void downscale_2x_scalar(const uint8_t *s0, const uint8_t *s1,
+                                uint8_t *d, const size_t w,
+                                const size_t comps) noexcept {
+    downscale_2x_tail(s0, s1, d, 0, w, comps);
+}
+
+#if UTILS_ARCH_X86
+// Shuffles the two pixels of each pair next to each other channel by channel,
+// one maddubs then adds them up. 16 (or 12 for RGB) input bytes per row and
+// iteration, 8 (or 6) output bytes.
+UTILS_TARGET_SSE41 inline void downscale_2x_sse(const uint8_t *s0,
+                                                const uint8_t *s1, uint8_t *d,
+                                                const size_t w,
+                                                const size_t comps) noexcept {
+    __m128i pairs;
+    size_t in_step = 16;
+    size_t out_step = 8;
+    switch (comps) {
+    case 3:
+        pairs = _mm_setr_epi8(0, 3, 1, 4, 2, 5, 6, 9, 7, 10, 8, 11, -1, -1,
+                              -1, -1);
+        in_step = 12;
+        out_step = 6;
+        break;
+    case 4:
+        pairs = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14,
+                              11, 15);
+        break;
+    default:
+        pairs = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                              14, 15);
+        break;
+    }
+    const auto ones = _mm_set1_epi8(1);
+    const auto two = _mm_set1_epi16(2);
+    const auto out_bytes = w * comps;
+    size_t i = 0;
+    size_t o = 0;
+    for (; i + 16 <= out_bytes * 2 && o + 8 <= out_bytes;
+         i += in_step, o += out_step) {
+        const auto a = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s0 + i)), pairs);
+        const auto b = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s1 + i)), pairs);
+        const auto sum = _mm_add_epi16(
+            _mm_add_epi16(_mm_maddubs_epi16(a, ones),
+                          _mm_maddubs_epi16(b, ones)),
+            two);
+        _mm_storel_epi64(
+            reinterpret_cast<__m128i *>(d + o),
+            _mm_packus_epi16(_mm_srli_epi16(sum, 2), _mm_setzero_si128()));
+    }
+    downscale_2x_tail(s0, s1, d, o / comps, w, comps);
+}
+
+// Two Q14 weights as one madd operand
+inline int resample_weight_pair(const int16_t w0, const int16_t w1) noexcept {
+    const auto lo = static_cast<uint32_t>(static_cast<uint16_t>(w0));
+    const auto hi = static_cast<uint32_t>(static_cast<uint16_t>(w1));
+    return static_cast<int>((hi << 16) | lo);
+}
+
+// 16 bytes per iteration, two rows per madd
+UTILS_TARGET_SSE41 inline void
+resample_vertical_sse(const uint8_t *const *rows, const int16_t *w,
+                      const size_t taps, uint8_t *dst,
+                      const size_t n) noexcept {
+    const auto zero = _mm_setzero_si128();
+    const auto half = _mm_set1_epi32(RESAMPLE_HALF);
+    size_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        auto a0 = half;
+        auto a1 = half;
+        auto a2 = half;
+        auto a3 = half;
+        for (size_t k = 0; k < taps; k += 2) {
+            const auto last = k + 1 == taps;
+            const auto wk = _mm_set1_epi32(
+                resample_weight_pair(w[k], last ? int16_t{0} : w[k + 1]));
+            const auto r0 =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + x));
+            const auto r1 =
+                last ? zero
+                     : _mm_loadu_si128(
+                           reinterpret_cast<const __m128i *>(rows[k + 1] + x));
+            const auto lo = _mm_unpacklo_epi8(r0, r1);
+            const auto hi = _mm_unpackhi_epi8(r0, r1);
+            a0 = _mm_add_epi32(a0,
+                               _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wk));
+            a1 = _mm_add_epi32(a1,
+                               _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wk));
+            a2 = _mm_add_epi32(a2,
+                               _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wk));
+            a3 = _mm_add_epi32(a3,
+                               _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wk));
+        }
+        const auto p01 = _mm_packs_epi32(_mm_srai_epi32(a0, RESAMPLE_SHIFT),
+                                         _mm_srai_epi32(a1, RESAMPLE_SHIFT));
+        const auto p23 = _mm_packs_epi32(_mm_srai_epi32(a2, RESAMPLE_SHIFT),
+                                         _mm_srai_epi32(a3, RESAMPLE_SHIFT));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                         _mm_packus_epi16(p01, p23));
+    }
+    resample_vertical_tail(rows, w, taps, dst, x, n);
+}
+
+// Same as resample_vertical_sse on both lanes, the in lane unpacks and packs
+// cancel out so the bytes stay in order
+UTILS_TARGET_AVX2 inline void
+resample_vertical_avx2(const uint8_t *const *rows, const int16_t *w,
+                       const size_t taps, uint8_t *dst,
+                       const size_t n) noexcept {
+    const auto zero = _mm256_setzero_si256();
+    const auto half = _mm256_set1_epi32(RESAMPLE_HALF);
+    size_t x = 0;
+    for (; x + 32 <= n; x += 32) {
+        auto a0 = half;
+        auto a1 = half;
+        auto a2 = half;
+        auto a3 = half;
+        for (size_t k = 0; k < taps; k += 2) {
+            const auto last = k + 1 == taps;
+            const auto wk = _mm256_set1_epi32(
+                resample_weight_pair(w[k], last ? int16_t{0} : w[k + 1]));
+            const auto r0 = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(rows[k] + x));
+            const auto r1 =
+                last ? zero
+                     : _mm256_loadu_si256(
+                           reinterpret_cast<const __m256i *>(rows[k + 1] + x));
+            const auto lo = _mm256_unpacklo_epi8(r0, r1);
+            const auto hi = _mm256_unpackhi_epi8(r0, r1);
+            a0 = _mm256_add_epi32(
+                a0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), wk));
+            a1 = _mm256_add_epi32(
+                a1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), wk));
+            a2 = _mm256_add_epi32(
+                a2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), wk));
+            a3 = _mm256_add_epi32(
+                a3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), wk));
+        }
+        const auto p01 =
+            _mm256_packs_epi32(_mm256_srai_epi32(a0, RESAMPLE_SHIFT),
+                               _mm256_srai_epi32(a1, RESAMPLE_SHIFT));
+        const auto p23 =
+            _mm256_packs_epi32(_mm256_srai_epi32(a2, RESAMPLE_SHIFT),
+                               _mm256_srai_epi32(a3, RESAMPLE_SHIFT));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x),
+                            _mm256_packus_epi16(p01, p23));
+    }
+    resample_vertical_tail(rows, w, taps, dst, x, n);
+}
+
+// RGBA horizontal pass, all 4 channels of a pixel in one register
+// Two neighbouring pixels are shuffled into (R0, R1, G0, G1, ...) pairs so
+// one madd applies two taps to every channel
+UTILS_TARGET_SSE41 inline void
+resample_horizontal_rgba_sse(const uint8_t *src, uint8_t *dst,
+                             const int *start, const int16_t *w,
+                             const size_t taps, const size_t n) noexcept {
+    const auto pairs =
+        _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto half = _mm_set1_epi32(RESAMPLE_HALF);
+    for (size_t x = 0; x < n; ++x, w += taps, dst += 4) {
+        const auto *s = src + static_cast<size_t>(start[x]) * 4;
+        auto acc = half;
+        size_t k = 0;
+        for (; k + 2 <= taps; k += 2, s += 8) {
+            const auto px =
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s));
+            const auto wk =
+                _mm_set1_epi32(resample_weight_pair(w[k], w[k + 1]));
+            acc = _mm_add_epi32(
+                acc, _mm_madd_epi16(
+                         _mm_cvtepu8_epi16(_mm_shuffle_epi8(px, pairs)), wk));
+        }
+        if (k < taps) {
+            int32_t v{};
+            std::memcpy(&v, s, 4);
+            const auto px = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(px, _mm_set1_epi32(w[k])));
+        }
+        acc = _mm_srai_epi32(acc, RESAMPLE_SHIFT);
+        const auto p = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+        const auto out = _mm_cvtsi128_si32(p);
+        std::memcpy(dst, &out, 4);
+    }
+}
+
+// RGB horizontal pass, the RGBA kernel with 3 channels in 4 lanes
+// The loads read a few bytes past the taps of a pixel. start[] is non
+// decreasing as make_resize_weights builds it, so the window of the last
+// pixel ends where the row has to, pixels reading past that go through the
+// scalar kernel.
+inline size_t resample_rgb_end(const int *start, const size_t taps,
+                               const size_t n) noexcept {
+    return (static_cast<size_t>(start[n - 1]) + taps) * 3;
+}
+UTILS_TARGET_SSE41 inline __m128i
+resample_rgb_pairs_sse(const uint8_t *s, const int16_t *w, const size_t taps,
+                       size_t k, __m128i acc) noexcept {
+    const auto pairs =
+        _mm_setr_epi8(0, 3, 1, 4, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (; k + 2 <= taps; k += 2) {
+        const auto px =
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s + k * 3));
+        const auto wk = _mm_set1_epi32(resample_weight_pair(w[k], w[k + 1]));
+        acc = _mm_add_epi32(
+            acc, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_shuffle_epi8(px, pairs)),
+                                wk));
+    }
+    if (k < taps) {
+        int32_t v{};
+        std::memcpy(&v, s + k * 3, 4);
+        const auto px = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+        acc = _mm_add_epi32(acc, _mm_mullo_epi32(px, _mm_set1_epi32(w[k])));
+    }
+    acc = _mm_srai_epi32(acc, RESAMPLE_SHIFT);
+    return _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+}
+UTILS_TARGET_SSE41 inline void
+resample_horizontal_rgb_sse(const uint8_t *src, uint8_t *dst,
+                            const int *start, const int16_t *w,
+                            const size_t taps, const size_t n) noexcept {
+    if (n == 0) {
+        return;
+    }
+    const auto end = resample_rgb_end(start, taps, n);
+    const auto half = _mm_set1_epi32(RESAMPLE_HALF);
+    size_t x = 0;
+    for (; x < n; ++x, w += taps, dst += 3) {
+        const auto off = static_cast<size_t>(start[x]) * 3;
+        if (off + taps * 3 + 2 > end) {
+            break;
+        }
+        const auto px = resample_rgb_pairs_sse(src + off, w, taps, 0, half);
+        const auto out = _mm_cvtsi128_si32(px);
+        std::memcpy(dst, &out, 3);
+    }
+    resample_horizontal_scalar<3>(src, dst, start + x, w, taps, n - x);
+}
+
+// Four taps per madd, taps k, k + 1 in the low lane and k + 2, k + 3 in the
+// high one, the lanes are added up before the last taps. Below 8 taps
+// (upscaling) joining the lanes costs more than it saves.
+UTILS_TARGET_AVX2 inline void
+resample_horizontal_rgb_avx2(const uint8_t *src, uint8_t *dst,
+                             const int *start, const int16_t *w,
+                             const size_t taps, const size_t n) noexcept {
+    if (taps < 8) {
+        resample_horizontal_rgb_sse(src, dst, start, w, taps, n);
+        return;
+    }
+    if (n == 0) {
+        return;
+    }
+    const auto end = resample_rgb_end(start, taps, n);
+    const auto quads =
+        _mm_setr_epi8(0, 3, 1, 4, 2, 5, -1, -1, 6, 9, 7, 10, 8, 11, -1, -1);
+    const auto half = _mm_set1_epi32(RESAMPLE_HALF);
+    size_t x = 0;
+    for (; x < n; ++x, w += taps, dst += 3) {
+        const auto off = static_cast<size_t>(start[x]) * 3;
+        if (off + taps * 3 + 4 > end) {
+            break;
+        }
+        const auto *s = src + off;
+        auto acc = _mm256_setzero_si256();
+        size_t k = 0;
+        for (; k + 4 <= taps; k += 4) {
+            const auto v =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + k * 3));
+            const auto px = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(v, quads));
+            const auto wk = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_set1_epi32(resample_weight_pair(w[k], w[k + 1]))),
+                _mm_set1_epi32(resample_weight_pair(w[k + 2], w[k + 3])), 1);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(px, wk));
+        }
+        const auto sum = _mm_add_epi32(
+            _mm_add_epi32(_mm256_castsi256_si128(acc),
+                          _mm256_extracti128_si256(acc, 1)),
+            half);
+        const auto out =
+            _mm_cvtsi128_si32(resample_rgb_pairs_sse(s, w, taps, k, sum));
+        std::memcpy(dst, &out, 3);
+    }
+    resample_horizontal_scalar<3>(src, dst, start + x, w, taps, n - x);
+}
+
+// GRAY horizontal pass, the taps of a pixel are contiguous bytes so 8 of
+// them go through one madd against 8 weights. The taps past the last full
+// 8 are masked to 0, which lets the loads run past the window (into the
+// next weights and pixels) as long as they stay inside the row, found the
+// same way as for RGB, and the weights.
+struct Resample_Gray_Tail {
+    size_t full;
+    size_t end;
+    size_t w_end;
+
+    Resample_Gray_Tail(const int *start, const size_t taps,
+                       const size_t n) noexcept
+        : full{taps / 8 * 8}
+        , end{static_cast<size_t>(start[n - 1]) + taps}
+        , w_end{n * taps} {}
+
+    // The masked 8 taps of pixel x can be loaded
+    bool fits(const int *start, const size_t taps,
+              const size_t x) const noexcept {
+        return static_cast<size_t>(start[x]) + full + 8 <= end &&
+               x * taps + full + 8 <= w_end;
+    }
+};
+inline int resample_gray_tail(const uint8_t *s, const int16_t *w, size_t k,
+                              const size_t taps) noexcept {
+    int acc = 0;
+    for (; k < taps; ++k) {
+        acc += s[k] * w[k];
+    }
+    return acc;
+}
+
+// 8 taps of one pixel, lanes cleared in mask do not count
+UTILS_TARGET_SSE41 inline __m128i
+resample_gray8_sse(const uint8_t *s, const int16_t *w,
+                   const __m128i mask) noexcept {
+    const auto px = _mm_cvtepu8_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s)));
+    return _mm_madd_epi16(
+        _mm_and_si128(px, mask),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(w)));
+}
+UTILS_TARGET_SSE41 inline void
+resample_horizontal_gray_sse(const uint8_t *src, uint8_t *dst,
+                             const int *start, const int16_t *w,
+                             const size_t taps, const size_t n) noexcept {
+    if (n == 0) {
+        return;
+    }
+    const Resample_Gray_Tail tail{start, taps, n};
+    const auto ones = _mm_set1_epi16(-1);
+    const auto mask =
+        _mm_cmpgt_epi16(_mm_set1_epi16(static_cast<int16_t>(taps - tail.full)),
+                        _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    for (size_t x = 0; x < n; ++x, w += taps) {
+        const auto *s = src + static_cast<size_t>(start[x]);
+        auto acc = _mm_setzero_si128();
+        for (size_t k = 0; k < tail.full; k += 8) {
+            acc = _mm_add_epi32(acc, resample_gray8_sse(s + k, w + k, ones));
+        }
+        int sum = RESAMPLE_HALF;
+        if (tail.full != taps) {
+            if (tail.fits(start, taps, x)) {
+                acc = _mm_add_epi32(acc, resample_gray8_sse(s + tail.full,
+                                                            w + tail.full,
+                                                            mask));
+            } else {
+                sum += resample_gray_tail(s, w, tail.full, taps);
+            }
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+        dst[x] = resample_clamp(sum + _mm_cvtsi128_si32(acc));
+    }
+}
+
+// Two pixels at once, 8 taps of pixel x in the low lane and of x + 1 in the
+// high one. The last pixels that cannot load their masked taps are left to
+// resample_horizontal_gray_sse.
+UTILS_TARGET_AVX2 inline __m256i
+resample_gray8x2_avx2(const uint8_t *s0, const uint8_t *s1, const int16_t *w0,
+                      const int16_t *w1, const __m256i mask) noexcept {
+    const auto px = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s0)),
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s1))));
+    const auto wk = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(w0))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(w1)), 1);
+    return _mm256_madd_epi16(_mm256_and_si256(px, mask), wk);
+}
+UTILS_TARGET_AVX2 inline void
+resample_horizontal_gray_avx2(const uint8_t *src, uint8_t *dst,
+                              const int *start, const int16_t *w,
+                              const size_t taps, const size_t n) noexcept {
+    if (n == 0) {
+        return;
+    }
+    const Resample_Gray_Tail tail{start, taps, n};
+    const auto ones = _mm256_set1_epi16(-1);
+    const auto mask = _mm256_cmpgt_epi16(
+        _mm256_set1_epi16(static_cast<int16_t>(taps - tail.full)),
+        _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7));
+    size_t x = 0;
+    for (; x + 2 <= n; x += 2) {
+        if (tail.full != taps && !tail.fits(start, taps, x + 1)) {
+            break;
+        }
+        const auto *s0 = src + static_cast<size_t>(start[x]);
+        const auto *s1 = src + static_cast<size_t>(start[x + 1]);
+        const auto *w0 = w + x * taps;
+        const auto *w1 = w0 + taps;
+        auto acc = _mm256_setzero_si256();
+        for (size_t k = 0; k < tail.full; k += 8) {
+            acc = _mm256_add_epi32(
+                acc, resample_gray8x2_avx2(s0 + k, s1 + k, w0 + k, w1 + k,
+                                           ones));
+        }
+        if (tail.full != taps) {
+            const auto k = tail.full;
+            acc = _mm256_add_epi32(
+                acc, resample_gray8x2_avx2(s0 + k, s1 + k, w0 + k, w1 + k,
+                                           mask));
+        }
+        acc = _mm256_hadd_epi32(acc, acc);
+        acc = _mm256_hadd_epi32(acc, acc);
+        dst[x] = resample_clamp(RESAMPLE_HALF +
+                                _mm_cvtsi128_si32(_mm256_castsi256_si128(acc)));
+        dst[x + 1] =
+            resample_clamp(RESAMPLE_HALF + _mm256_extract_epi32(acc, 4));
+    }
+    resample_horizontal_gray_sse(src, dst + x, start + x, w + x * taps, taps,
+                                 n - x);
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using resample_vertical_fn_t = void (*)(const uint8_t *const *,
+                                        const int16_t *, size_t, uint8_t *,
+                                        size_t) noexcept;
+using downscale_2x_fn_t = void (*)(const uint8_t *, const uint8_t *,
+                                   uint8_t *, size_t, size_t) noexcept;
+using resample_horizontal_fn_t = void (*)(const uint8_t *, uint8_t *,
+                                          const int *, const int16_t *, size_t,
+                                          size_t) noexcept;
+inline void resample_vertical(const uint8_t *const *rows, const int16_t *w,
+                              const size_t taps, uint8_t *dst,
+                              const size_t n) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<resample_vertical_fn_t>(
+        resample_vertical_scalar, resample_vertical_sse,
+        resample_vertical_avx2);
+    fn(rows, w, taps, dst, n);
+#else
+    resample_vertical_scalar(rows, w, taps, dst, n);
+#endif
+}
+inline void downscale_2x(const uint8_t *s0, const uint8_t *s1, uint8_t *d,
+                         const size_t w, const size_t comps) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn =
+        cpu_select<downscale_2x_fn_t>(downscale_2x_scalar, downscale_2x_sse);
+    fn(s0, s1, d, w, comps);
+#else
+    downscale_2x_scalar(s0, s1, d, w, comps);
+#endif
+}
+
+// Horizontal kernel for C channels
+template <size_t C>
+[[nodiscard]] inline resample_horizontal_fn_t resample_horizontal() {
+#if UTILS_ARCH_X86
+    if constexpr (C == 4) {
+        static const auto fn = cpu_select<resample_horizontal_fn_t>(
+            resample_horizontal_scalar<4>, resample_horizontal_rgba_sse);
+        return fn;
+    } else if constexpr (C == 3) {
+        static const auto fn = cpu_select<resample_horizontal_fn_t>(
+            resample_horizontal_scalar<3>, resample_horizontal_rgb_sse,
+            resample_horizontal_rgb_avx2);
+        return fn;
+    } else if constexpr (C == 1) {
+        static const auto fn = cpu_select<resample_horizontal_fn_t>(
+            resample_horizontal_scalar<1>, resample_horizontal_gray_sse,
+            resample_horizontal_gray_avx2);
+        return fn;
+    }
+#endif
+    return resample_horizontal_scalar<C>;
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
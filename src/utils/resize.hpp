@@ -0,0 +1,300 @@
+/*
+  resize.h -- Separable image resampling (box, bilinear and Lanczos3)
+*/
+#ifndef RESIZE_HPP
+#define RESIZE_HPP
+
+#include "utils/pixel_alloc.hpp"
+#include "utils/pixel_convert.hpp"
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/resample_kernels.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace utils {
+
+// Resampling filters, from fastest to sharpest
+enum class Resize_Filter { Box, Bilinear, Lanczos3 };
+inline std::ostream &operator<<(std::ostream &os, const Resize_Filter f) {
+    switch (f) {
+    default:
+    case Resize_Filter::Box:
+        os << "Box";
+        break;
+    case Resize_Filter::Bilinear:
+        os << "Bilinear";
+        break;
+    case Resize_Filter::Lanczos3:
+        os << "Lanczos3";
+        break;
+    }
+    return os;
+}
+
+struct Resize_Opts {
+    Resize_Filter filter{Resize_Filter::Lanczos3};
+    // Split large images into row bands and run them on the shared pool
+    bool parallel{false};
+};
+
+// Precomputed Q14 weights of one resampling direction
+// Output pixel i reads taps input pixels from start[i] on, with the weights
+// at w[i * taps]. Pixels past the edges are clamped, their weight is folded
+// into the edge pixel so every read stays inside the image.
+struct Resize_Weights {
+    size_t taps{0};
+    std::vector<int> start{};
+    std::vector<int16_t> w{};
+};
+
+namespace detail {
+inline double resize_support(const Resize_Filter f) noexcept {
+    switch (f) {
+    case Resize_Filter::Box:
+        return 0.5;
+    case Resize_Filter::Bilinear:
+        return 1.0;
+    case Resize_Filter::Lanczos3:
+    default:
+        break;
+    }
+    return 3.0;
+}
+inline double resize_kernel(const Resize_Filter f, const double x) noexcept {
+    constexpr double pi = 3.14159265358979323846;
+    const auto ax = std::abs(x);
+    switch (f) {
+    case Resize_Filter::Box:
+        return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+    case Resize_Filter::Bilinear:
+        return ax < 1.0 ? 1.0 - ax : 0.0;
+    case Resize_Filter::Lanczos3:
+    default:
+        break;
+    }
+    if (ax < 1e-8) {
+        return 1.0;
+    }
+    if (ax >= 3.0) {
+        return 0.0;
+    }
+    const auto px = pi * x;
+    return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+}
+} // namespace detail
+
+// Weights for resampling in pixels to out pixels
+// When shrinking, the filter is stretched to cover every input pixel
+inline Resize_Weights make_resize_weights(const int in, const int out,
+                                          const Resize_Filter f) {
+    Resize_Weights rw{};
+    if (in <= 0 || out <= 0) {
+        return rw;
+    }
+    const auto scale = static_cast<double>(in) / static_cast<double>(out);
+    const auto fscale = std::max(1.0, scale);
+    const auto support = detail::resize_support(f) * fscale;
+    const auto taps =
+        std::min(in, static_cast<int>(std::ceil(support * 2.0)) + 1);
+    const auto ntaps = static_cast<size_t>(taps);
+    rw.taps = ntaps;
+    rw.start.resize(static_cast<size_t>(out));
+    rw.w.resize(static_cast<size_t>(out) * ntaps);
+
+    std::vector<double> fw(ntaps);
+    for (int o = 0; o < out; ++o) {
+        // Pixel centers are at i + 0.5
+        const auto center = (o + 0.5) * scale;
+        const auto left = static_cast<int>(std::floor(center - support));
+        const auto right = static_cast<int>(std::ceil(center + support));
+        const auto start = std::clamp(left, 0, in - taps);
+        std::fill(fw.begin(), fw.end(), 0.0);
+        double sum = 0.0;
+        for (auto i = left; i <= right; ++i) {
+            const auto v = detail::resize_kernel(f, (i + 0.5 - center) / fscale);
+            if (std::abs(v) < 1e-12) {
+                continue;
+            }
+            const auto k = std::clamp(i, 0, in - 1) - start;
+            if (k < 0 || k >= taps) {
+                continue;
+            }
+            fw[static_cast<size_t>(k)] += v;
+            sum += v;
+        }
+        if (std::abs(sum) < 1e-12) {
+            // Cannot happen with the filters above, nearest pixel as fallback
+            const auto k =
+                std::clamp(static_cast<int>(center), 0, in - 1) - start;
+            fw[static_cast<size_t>(std::clamp(k, 0, taps - 1))] = 1.0;
+            sum = 1.0;
+        }
+        // Quantize, then give the rounding error to the largest weight so
+        // flat areas stay exactly flat
+        auto *w = rw.w.data() + static_cast<size_t>(o) * ntaps;
+        int total = 0;
+        size_t big = 0;
+        for (size_t k = 0; k < ntaps; ++k) {
+            const auto q = static_cast<int>(
+                std::lround(fw[k] / sum * (1 << kernels::RESAMPLE_SHIFT)));
+            w[k] = static_cast<int16_t>(q);
+            total += q;
+            if (std::abs(q) > std::abs(w[big])) {
+                big = k;
+            }
+        }
+        w[big] = static_cast<int16_t>(w[big] +
+                                      (1 << kernels::RESAMPLE_SHIFT) - total);
+        rw.start[static_cast<size_t>(o)] = start;
+    }
+    return rw;
+}
+
+namespace detail {
+template <size_t C>
+void resize_pass_h(const Const_Pixels_View src, uint8_t *tmp,
+                   const size_t tmp_pitch, const Resize_Weights &rw,
+                   const size_t out_w, const bool parallel) {
+    const auto fn = kernels::resample_horizontal<C>();
+    for_row_bands(static_cast<size_t>(src.height()), tmp_pitch, parallel,
+                  [&](const size_t first, const size_t last) {
+                      for (auto y = first; y < last; ++y) {
+                          fn(src.row(static_cast<int>(y)), tmp + y * tmp_pitch,
+                             rw.start.data(), rw.w.data(), rw.taps, out_w);
+                      }
+                  });
+}
+
+} // namespace detail
+
+// Exact 2x box reduction, dst must be half the size of src (rounded down)
+// and of the same format. Cheaper than resize() with a Box filter.
+inline bool downscale_2x(const Const_Pixels_View src, const Pixels_View dst,
+                         const bool parallel = false) {
+    if (!src.is_valid() || !dst.is_valid() || src.format() != dst.format() ||
+        pxfmt_depth(src.format()) != 1 || dst.width() != src.width() / 2 ||
+        dst.height() != src.height() / 2) {
+        std::cerr << "[ERROR] Invalid views for a 2x downscale!\n";
+        return false;
+    }
+    const auto w = static_cast<size_t>(dst.width());
+    const auto comps = static_cast<size_t>(pxfmt_components(dst.format()));
+    detail::for_row_bands(
+        static_cast<size_t>(dst.height()), dst.row_bytes(), parallel,
+        [&](const size_t first, const size_t last) {
+            for (auto y = first; y < last; ++y) {
+                const auto yi = static_cast<int>(y);
+                kernels::downscale_2x(src.row(yi * 2), src.row(yi * 2 + 1),
+                                      dst.row(yi), w, comps);
+            }
+        });
+    return true;
+}
+
+// Resamples src (any view, e.g. a sub rectangle of a larger image) to the
+// size of dst, both must have the same format. Runs a horizontal pass into a
+// temporary buffer, then a vertical pass into dst. Halving both sides with
+// the Box filter takes the downscale_2x path.
+inline bool resize(const Const_Pixels_View src, const Pixels_View dst,
+                   const Resize_Opts &opts = {}) {
+    if (!src.is_valid() || !dst.is_valid()) {
+        std::cerr << "[ERROR] Cannot resize an invalid pixel view!\n";
+        return false;
+    }
+    if (src.format() != dst.format()) {
+        std::cerr << "[ERROR] Resize needs the same format on both sides! ("
+                  << src.format() << " -> " << dst.format() << ")\n";
+        return false;
+    }
+    if (pxfmt_depth(src.format()) != 1) {
+        std::cerr << "[ERROR] Cannot resize " << src.format() << " pixels!\n";
+        return false;
+    }
+    const auto sw = src.width();
+    const auto sh = src.height();
+    const auto dw = dst.width();
+    const auto dh = dst.height();
+    if (opts.filter == Resize_Filter::Box && sw == dw * 2 && sh == dh * 2) {
+        return downscale_2x(src, dst, opts.parallel);
+    }
+    if (sw == dw && sh == dh) {
+        return convert_view(src, dst);
+    }
+
+    // Horizontal pass, skipped if the width does not change
+    const auto comps = static_cast<size_t>(pxfmt_components(src.format()));
+    const auto row_bytes = static_cast<size_t>(dw) * comps;
+    pixel_buf_t tmp{};
+    std::vector<const uint8_t *> rows(static_cast<size_t>(sh));
+    if (sw != dw) {
+        const auto rw = make_resize_weights(sw, dw, opts.filter);
+        tmp.resize(row_bytes * static_cast<size_t>(sh));
+        const auto out_w = static_cast<size_t>(dw);
+        switch (src.format()) {
+        case Pixel_Format::RGB:
+            detail::resize_pass_h<3>(src, tmp.data(), row_bytes, rw, out_w,
+                                     opts.parallel);
+            break;
+        case Pixel_Format::RGBA:
+            detail::resize_pass_h<4>(src, tmp.data(), row_bytes, rw, out_w,
+                                     opts.parallel);
+            break;
+        case Pixel_Format::GRAY:
+            detail::resize_pass_h<1>(src, tmp.data(), row_bytes, rw, out_w,
+                                     opts.parallel);
+            break;
+        case Pixel_Format::RGB16:
+        case Pixel_Format::RGBA16:
+        case Pixel_Format::GRAY16:
+        case Pixel_Format::Unknown:
+        default:
+            return false;
+        }
+        for (size_t y = 0; y < rows.size(); ++y) {
+            rows[y] = tmp.data() + y * row_bytes;
+        }
+    } else {
+        for (int y = 0; y < sh; ++y) {
+            rows[static_cast<size_t>(y)] = src.row(y);
+        }
+    }
+
+    // Vertical pass, straight from the row pointers into dst
+    if (sh == dh) {
+        for (int y = 0; y < dh; ++y) {
+            std::memcpy(dst.row(y), rows[static_cast<size_t>(y)], row_bytes);
+        }
+        return true;
+    }
+    const auto rh = make_resize_weights(sh, dh, opts.filter);
+    detail::for_row_bands(
+        static_cast<size_t>(dh), row_bytes, opts.parallel,
+        [&](const size_t first, const size_t last) {
+            for (auto y = first; y < last; ++y) {
+                const auto start = static_cast<size_t>(rh.start[y]);
+                kernels::resample_vertical(rows.data() + start,
+                                           rh.w.data() + y * rh.taps, rh.taps,
+                                           dst.row(static_cast<int>(y)),
+                                           row_bytes);
+            }
+        });
+    return true;
+}
+
+// Same as above into a new Pixels of w x h
+inline Pixels resize(const Const_Pixels_View src, const int w, const int h,
+                     const Resize_Opts &opts = {}) {
+    Pixels p{src.format(), w, h};
+    if (!p.is_valid() || !resize(src, p.view(), opts)) {
+        p.clear();
+    }
+    return p;
+}
+
+} // namespace utils
+
+#endif
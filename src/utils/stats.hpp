@@ -0,0 +1,172 @@
+/*
+  stats.h -- Single pass per channel image statistics and histograms
+*/
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include "utils/pixel_format.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/stats_kernels.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace utils {
+
+struct Stats_Opts {
+    // Also build the histograms (and the clipped counts that come from them),
+    // without them only min/max/sum/mean are computed, at memory bandwidth
+    bool histogram{true};
+    // Split large images into row bands and run them on the shared pool
+    bool parallel{false};
+};
+
+struct Channel_Stats {
+    uint8_t min{0};
+    uint8_t max{0};
+    uint64_t sum{0};
+    double mean{0.0};
+    // Values stuck at 0 and 255, only with Stats_Opts::histogram
+    uint64_t clipped_low{0};
+    uint64_t clipped_high{0};
+    std::array<uint64_t, 256> hist{};
+};
+
+// Statistics of every channel of an image, channel order as in the format
+// (R, G, B, A or GRAY)
+struct Pixel_Stats {
+    Pixel_Format format{Pixel_Format::Unknown};
+    uint64_t pixels{0};
+    int channels{0};
+    std::array<Channel_Stats, 4> channel{};
+
+    bool is_valid() const noexcept { return channels > 0; }
+};
+inline std::ostream &operator<<(std::ostream &os, const Pixel_Stats &s) {
+    os << s.format << ' ' << s.pixels << " px";
+    for (int c = 0; c < s.channels; ++c) {
+        const auto &ch = s.channel[static_cast<size_t>(c)];
+        os << " | " << c << ": " << static_cast<int>(ch.min) << '-'
+           << static_cast<int>(ch.max) << " mean " << ch.mean << " clipped "
+           << ch.clipped_low << '/' << ch.clipped_high;
+    }
+    return os;
+}
+
+// Bytes per band, small enough that 32 bit band histograms cannot overflow
+constexpr size_t STATS_BAND_BYTES = 4 << 20;
+
+namespace detail {
+// The histograms and reductions are on 8 bit components
+inline bool check_stats_format(const Pixel_Format fmt) {
+    if (pxfmt_depth(fmt) != 1) {
+        std::cerr << "[ERROR] Cannot compute stats of " << fmt
+                  << " pixels!\n";
+        return false;
+    }
+    return true;
+}
+
+// Running statistics that bands (or tiles) of an image are merged into
+class Stats_Acc {
+  public:
+    Stats_Acc(const Pixel_Format fmt, const Stats_Opts &opts)
+        : format_{fmt}
+        , comps_{static_cast<size_t>(pxfmt_components(fmt))}
+        , histogram_{opts.histogram}
+        , hist_(opts.histogram ? comps_ * 256 : 0) {}
+
+    // Adds rows [first, last) of src, at most STATS_BAND_BYTES of them so the
+    // 32 bit band histograms cannot overflow. Safe to call from many threads.
+    void add_rows(const Const_Pixels_View src, const size_t first,
+                  const size_t last) {
+        const auto w = static_cast<size_t>(src.width());
+        const auto row_bytes = src.row_bytes();
+        kernels::Channel_Reduce r{};
+        std::vector<uint32_t> sub(histogram_ ? 4 * comps_ * 256 : 0);
+        for (auto y = first; y < last; ++y) {
+            const auto *row = src.row(static_cast<int>(y));
+            kernels::channel_reduce(row, row_bytes, comps_, r);
+            if (histogram_) {
+                kernels::histogram(row, w, comps_, sub.data());
+            }
+        }
+        std::lock_guard<std::mutex> lk(mtx_);
+        total_.merge(r);
+        pixels_ += w * (last - first);
+        for (size_t k = 0; k < sub.size(); ++k) {
+            hist_[k % hist_.size()] += sub[k];
+        }
+    }
+
+    Pixel_Stats result() const {
+        Pixel_Stats st{};
+        st.format = format_;
+        st.pixels = pixels_;
+        st.channels = static_cast<int>(comps_);
+        for (size_t c = 0; c < comps_; ++c) {
+            auto &ch = st.channel[c];
+            ch.min = total_.min[c];
+            ch.max = total_.max[c];
+            ch.sum = total_.sum[c];
+            ch.mean =
+                static_cast<double>(ch.sum) / static_cast<double>(st.pixels);
+            if (histogram_) {
+                std::copy_n(hist_.begin() +
+                                static_cast<std::ptrdiff_t>(c * 256),
+                            256, ch.hist.begin());
+                ch.clipped_low = ch.hist[0];
+                ch.clipped_high = ch.hist[255];
+            }
+        }
+        return st;
+    }
+
+  private:
+    Pixel_Format format_;
+    size_t comps_;
+    bool histogram_;
+    uint64_t pixels_{0};
+    kernels::Channel_Reduce total_{};
+    std::vector<uint64_t> hist_;
+    std::mutex mtx_;
+};
+} // namespace detail
+
+// Min, max, sum, mean and histogram of every channel in one pass over src
+// Each band of rows gets its own 4 sub-histograms and SIMD reductions, the
+// bands are merged into the result as they finish.
+inline Pixel_Stats pixel_stats(const Const_Pixels_View src,
+                               const Stats_Opts &opts = {}) {
+    if (!src.is_valid()) {
+        std::cerr << "[ERROR] Cannot compute stats of an invalid pixel view!\n";
+        return Pixel_Stats{};
+    }
+    if (!detail::check_stats_format(src.format())) {
+        return Pixel_Stats{};
+    }
+    const auto h = static_cast<size_t>(src.height());
+    const auto band = std::max<size_t>(1, STATS_BAND_BYTES / src.row_bytes());
+    const auto bands = (h + band - 1) / band;
+
+    detail::Stats_Acc acc{src.format(), opts};
+    const auto run_band = [&](const size_t i) {
+        acc.add_rows(src, i * band, std::min(h, (i + 1) * band));
+    };
+    auto &pool = shared_thread_pool();
+    if (opts.parallel && pool.concurrency() > 1 && bands > 1) {
+        pool.parallel_for(bands, run_band);
+    } else {
+        for (size_t i = 0; i < bands; ++i) {
+            run_band(i);
+        }
+    }
+    return acc.result();
+}
+
+} // namespace utils
+
+#endif
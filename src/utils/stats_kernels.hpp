@@ -0,0 +1,289 @@
+/*
+  stats_kernels.h -- Raw kernels for per channel image statistics
+*/
+#ifndef STATS_KERNELS_HPP
+#define STATS_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+namespace kernels {
+
+// Running per channel minimum, maximum and sum, channels past comps unused
+struct Channel_Reduce {
+    uint8_t min[4]{255, 255, 255, 255};
+    uint8_t max[4]{0, 0, 0, 0};
+    uint64_t sum[4]{0, 0, 0, 0};
+
+    void merge(const Channel_Reduce &o) noexcept {
+        for (size_t c = 0; c < 4; ++c) {
+            min[c] = o.min[c] < min[c] ? o.min[c] : min[c];
+            max[c] = o.max[c] > max[c] ? o.max[c] : max[c];
+            sum[c] += o.sum[c];
+        }
+    }
+};
+
+//
+// Min, max and sum of n bytes of packed pixels with comps channels
+// n is a multiple of comps, first (where the tail starts) as well
+//
+inline void channel_reduce_tail(const uint8_t *src, const size_t first,
+                                const size_t n, const size_t comps,
+                                Channel_Reduce &r) noexcept {
+    for (auto i = first; i < n; i += comps) {
+        for (size_t c = 0; c < comps; ++c) {
+            const auto v = src[i + c];
+            r.min[c] = v < r.min[c] ? v : r.min[c];
+            r.max[c] = v > r.max[c] ? v : r.max[c];
+            r.sum[c] += v;
+        }
+    }
+}
+inline void channel_reduce_scalar(const uint8_t *src, const size_t n,
+                                  const size_t comps,
+                                  Channel_Reduce &r) noexcept {
+    channel_reduce_tail(src, 0, n, comps, r);
+}
+
+//
+// Histogram of n pixels with C channels into 4 sub-histograms
+// hist holds 4 * C * 256 counters, sub-histogram k at hist + k * C * 256.
+// Neighbouring pixels count into different sub-histograms, so runs of equal
+// values do not wait on the store of the previous increment. The caller adds
+// the sub-histograms up.
+//
+template <size_t C>
+void histogram_scalar(const uint8_t *src, const size_t n,
+                      uint32_t *hist) noexcept {
+    constexpr size_t H = C * 256;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, src += 4 * C) {
+        for (size_t c = 0; c < C; ++c) {
+            ++hist[c * 256 + src[c]];
+            ++hist[H + c * 256 + src[C + c]];
+            ++hist[2 * H + c * 256 + src[2 * C + c]];
+            ++hist[3 * H + c * 256 + src[3 * C + c]];
+        }
+    }
+    for (; i < n; ++i, src += C) {
+        for (size_t c = 0; c < C; ++c) {
+            ++hist[c * 256 + src[c]];
+        }
+    }
+}
+
+#if UTILS_ARCH_X86
+//
+// SIMD reductions. The channel of a lane repeats every V vectors (3 for RGB,
+// 1 otherwise), so min/max/sum are kept per lane and folded into channels at
+// the end. Sums are 16 bit per lane, flushed before they can overflow.
+//
+constexpr size_t REDUCE_FLUSH_ITERS = 256; // 256 * 255 still fits 16 bits
+
+// Byte of a vector that 16 bit lane k of unpacklo (+8 for unpackhi) holds,
+// unpacks work on 16 byte halves
+constexpr size_t unpack_byte(const size_t k) noexcept {
+    return k / 8 * 16 + k % 8;
+}
+template <size_t C, size_t V, size_t W>
+void channel_fold_minmax(const uint8_t (&mn)[V][W], const uint8_t (&mx)[V][W],
+                         Channel_Reduce &r) noexcept {
+    for (size_t j = 0; j < V; ++j) {
+        for (size_t b = 0; b < W; ++b) {
+            const auto c = (j * W + b) % C;
+            r.min[c] = mn[j][b] < r.min[c] ? mn[j][b] : r.min[c];
+            r.max[c] = mx[j][b] > r.max[c] ? mx[j][b] : r.max[c];
+        }
+    }
+}
+template <size_t C, size_t V, size_t K>
+void channel_fold_sums(const uint16_t (&lo)[V][K], const uint16_t (&hi)[V][K],
+                       Channel_Reduce &r) noexcept {
+    for (size_t j = 0; j < V; ++j) {
+        for (size_t k = 0; k < K; ++k) {
+            const auto b = j * K * 2 + unpack_byte(k);
+            r.sum[b % C] += lo[j][k];
+            r.sum[(b + 8) % C] += hi[j][k];
+        }
+    }
+}
+
+template <size_t C>
+UTILS_TARGET_SSE41 void channel_reduce_sse(const uint8_t *src, const size_t n,
+                                           Channel_Reduce &r) noexcept {
+    constexpr size_t V = 16 % C == 0 ? 1 : C;
+    constexpr size_t step = 16 * V;
+    const auto zero = _mm_setzero_si128();
+    __m128i mn[V];
+    __m128i mx[V];
+    for (size_t j = 0; j < V; ++j) {
+        mn[j] = _mm_set1_epi8(-1);
+        mx[j] = zero;
+    }
+    alignas(16) uint16_t lsum[V][8];
+    alignas(16) uint16_t hsum[V][8];
+    size_t i = 0;
+    while (i + step <= n) {
+        const auto iters = std::min((n - i) / step, REDUCE_FLUSH_ITERS);
+        __m128i lo[V];
+        __m128i hi[V];
+        for (size_t j = 0; j < V; ++j) {
+            lo[j] = zero;
+            hi[j] = zero;
+        }
+        for (size_t it = 0; it < iters; ++it, i += step) {
+            for (size_t j = 0; j < V; ++j) {
+                const auto v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(src + i + 16 * j));
+                mn[j] = _mm_min_epu8(mn[j], v);
+                mx[j] = _mm_max_epu8(mx[j], v);
+                lo[j] = _mm_add_epi16(lo[j], _mm_unpacklo_epi8(v, zero));
+                hi[j] = _mm_add_epi16(hi[j], _mm_unpackhi_epi8(v, zero));
+            }
+        }
+        for (size_t j = 0; j < V; ++j) {
+            _mm_store_si128(reinterpret_cast<__m128i *>(lsum[j]), lo[j]);
+            _mm_store_si128(reinterpret_cast<__m128i *>(hsum[j]), hi[j]);
+        }
+        channel_fold_sums<C>(lsum, hsum, r);
+    }
+    alignas(16) uint8_t lmn[V][16];
+    alignas(16) uint8_t lmx[V][16];
+    for (size_t j = 0; j < V; ++j) {
+        _mm_store_si128(reinterpret_cast<__m128i *>(lmn[j]), mn[j]);
+        _mm_store_si128(reinterpret_cast<__m128i *>(lmx[j]), mx[j]);
+    }
+    channel_fold_minmax<C>(lmn, lmx, r);
+    channel_reduce_tail(src, i, n, C, r);
+}
+
+template <size_t C>
+UTILS_TARGET_AVX2 void channel_reduce_avx2(const uint8_t *src, const size_t n,
+                                           Channel_Reduce &r) noexcept {
+    constexpr size_t V = 32 % C == 0 ? 1 : C;
+    constexpr size_t step = 32 * V;
+    const auto zero = _mm256_setzero_si256();
+    __m256i mn[V];
+    __m256i mx[V];
+    for (size_t j = 0; j < V; ++j) {
+        mn[j] = _mm256_set1_epi8(-1);
+        mx[j] = zero;
+    }
+    alignas(32) uint16_t lsum[V][16];
+    alignas(32) uint16_t hsum[V][16];
+    size_t i = 0;
+    while (i + step <= n) {
+        const auto iters = std::min((n - i) / step, REDUCE_FLUSH_ITERS);
+        __m256i lo[V];
+        __m256i hi[V];
+        for (size_t j = 0; j < V; ++j) {
+            lo[j] = zero;
+            hi[j] = zero;
+        }
+        for (size_t it = 0; it < iters; ++it, i += step) {
+            for (size_t j = 0; j < V; ++j) {
+                const auto v = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(src + i + 32 * j));
+                mn[j] = _mm256_min_epu8(mn[j], v);
+                mx[j] = _mm256_max_epu8(mx[j], v);
+                lo[j] = _mm256_add_epi16(lo[j], _mm256_unpacklo_epi8(v, zero));
+                hi[j] = _mm256_add_epi16(hi[j], _mm256_unpackhi_epi8(v, zero));
+            }
+        }
+        for (size_t j = 0; j < V; ++j) {
+            _mm256_store_si256(reinterpret_cast<__m256i *>(lsum[j]), lo[j]);
+            _mm256_store_si256(reinterpret_cast<__m256i *>(hsum[j]), hi[j]);
+        }
+        channel_fold_sums<C>(lsum, hsum, r);
+    }
+    alignas(32) uint8_t lmn[V][32];
+    alignas(32) uint8_t lmx[V][32];
+    for (size_t j = 0; j < V; ++j) {
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lmn[j]), mn[j]);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lmx[j]), mx[j]);
+    }
+    channel_fold_minmax<C>(lmn, lmx, r);
+    channel_reduce_tail(src, i, n, C, r);
+}
+
+// Runtime comps to the templated kernels, anything else runs scalar
+UTILS_TARGET_SSE41 inline void
+channel_reduce_sse(const uint8_t *src, const size_t n, const size_t comps,
+                   Channel_Reduce &r) noexcept {
+    switch (comps) {
+    case 1:
+        channel_reduce_sse<1>(src, n, r);
+        break;
+    case 3:
+        channel_reduce_sse<3>(src, n, r);
+        break;
+    case 4:
+        channel_reduce_sse<4>(src, n, r);
+        break;
+    default:
+        channel_reduce_tail(src, 0, n, comps, r);
+        break;
+    }
+}
+UTILS_TARGET_AVX2 inline void
+channel_reduce_avx2(const uint8_t *src, const size_t n, const size_t comps,
+                    Channel_Reduce &r) noexcept {
+    switch (comps) {
+    case 1:
+        channel_reduce_avx2<1>(src, n, r);
+        break;
+    case 3:
+        channel_reduce_avx2<3>(src, n, r);
+        break;
+    case 4:
+        channel_reduce_avx2<4>(src, n, r);
+        break;
+    default:
+        channel_reduce_tail(src, 0, n, comps, r);
+        break;
+    }
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on, selected once on first use
+//
+using channel_reduce_fn_t = void (*)(const uint8_t *, size_t, size_t,
+                                     Channel_Reduce &) noexcept;
+inline void channel_reduce(const uint8_t *src, const size_t n,
+                           const size_t comps, Channel_Reduce &r) noexcept {
+#if UTILS_ARCH_X86
+    static const auto fn = cpu_select<channel_reduce_fn_t>(
+        channel_reduce_scalar, channel_reduce_sse, channel_reduce_avx2);
+    fn(src, n, comps, r);
+#else
+    channel_reduce_scalar(src, n, comps, r);
+#endif
+}
+
+// Histogram of n pixels with comps channels, see histogram_scalar
+inline void histogram(const uint8_t *src, const size_t n, const size_t comps,
+                      uint32_t *hist) noexcept {
+    switch (comps) {
+    case 1:
+        histogram_scalar<1>(src, n, hist);
+        break;
+    case 3:
+        histogram_scalar<3>(src, n, hist);
+        break;
+    case 4:
+        histogram_scalar<4>(src, n, hist);
+        break;
+    default:
+        break;
+    }
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif
@@ -4,6 +4,7 @@
 #include "utils/natcmp.hpp"
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <random>
@@ -299,6 +300,20 @@ constexpr File_Ext get_file_ext(const std::string_view filename) {
     return File_Ext::Unknown;
 }
 
+//
+// Size of a file in bytes, -1 if it cannot be opened
+//
+inline std::streamoff file_size(const char *filename) {
+    constexpr auto omode = std::ios::in | std::ios::binary | std::ios::ate;
+    std::ifstream fst(filename, omode);
+    if (!fst.is_open()) {
+        std::cerr << "[ERROR] Cannot open file for input: " << filename
+                  << "\n -> Error opening file.\n";
+        return -1;
+    }
+    return static_cast<std::streamoff>(fst.tellg());
+}
+
 //
 // Read a file from disk into memory (vector of bytes)
 //
@@ -360,6 +375,48 @@ inline bytes_t file_binread(const char *filename, const std::streamoff beg,
     return buf;
 }
 
+//
+// Write a buffer from memory to a file on disk, replacing the file
+//
+inline bool file_binwrite(const char *filename, const uint8_t *data,
+                          const size_t size) {
+    constexpr auto omode = std::ios::out | std::ios::binary | std::ios::trunc;
+    std::ofstream fst(filename, omode);
+    if (!fst.is_open()) {
+        std::cerr << "[ERROR] Cannot open file for output: " << filename
+                  << "\n -> Error opening file.\n";
+        return false;
+    }
+    fst.write(reinterpret_cast<const char *>(data), // NOLINT
+              static_cast<std::streamsize>(size));
+    fst.close();
+    if (fst.fail()) {
+        std::cerr << "[ERROR] Cannot write file: " << filename
+                  << "\n -> Error writing file.\n";
+        return false;
+    }
+    return true;
+}
+
+//
+// Read an environment variable, empty if it is not set
+//
+inline std::string env_var(const char *name) {
+#ifdef _MSC_VER
+    char *env = nullptr;
+    size_t len = 0;
+    if (_dupenv_s(&env, &len, name) != 0 || env == nullptr) {
+        return std::string{};
+    }
+    std::string val{env};
+    free(env);
+    return val;
+#else
+    const char *env = std::getenv(name);
+    return env == nullptr ? std::string{} : std::string{env};
+#endif
+}
+
 // List operations
 // Shuffles a list using a random seed based on time
 inline void list_shuffle(list_t &list) {
@@ -0,0 +1,156 @@
+/*
+  thread_pool.h -- Simple shared thread pool for data parallel loops
+*/
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include "utils/system.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils {
+
+class Thread_Pool {
+  public:
+    // The calling thread always helps out, so a pool of N threads runs
+    // parallel_for on N + 1 threads
+    explicit Thread_Pool(const unsigned threads) {
+        workers_.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { worker(); });
+        }
+    }
+
+    // No copy/move constructors and assignments
+    Thread_Pool(const Thread_Pool &) = delete;
+    Thread_Pool(Thread_Pool &&) = delete;
+    Thread_Pool &operator=(const Thread_Pool &) = delete;
+    Thread_Pool &operator=(Thread_Pool &&) = delete;
+
+    ~Thread_Pool() {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &t : workers_) {
+            t.join();
+        }
+    }
+
+    // Number of threads that take part in parallel_for, including the caller
+    unsigned concurrency() const noexcept {
+        return static_cast<unsigned>(workers_.size()) + 1;
+    }
+
+    // Calls fn(i) for every i in [0, count) and blocks until all are done
+    // Safe to call from inside fn, the calling thread works on its own job
+    void parallel_for(const size_t count,
+                      const std::function<void(size_t)> &fn) {
+        if (count == 0) {
+            return;
+        }
+        if (count == 1 || workers_.empty()) {
+            for (size_t i = 0; i < count; ++i) {
+                fn(i);
+            }
+            return;
+        }
+        auto job = std::make_shared<Job>(fn, count);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            jobs_.push_back(job);
+        }
+        cv_.notify_all();
+        run_job(*job);
+        // Wait for the workers still busy with our indices
+        {
+            std::unique_lock<std::mutex> lk(job->mtx);
+            job->cv.wait(lk, [&] { return job->done.load() == count; });
+        }
+        // Nobody may have noticed the job is exhausted yet
+        std::lock_guard<std::mutex> lk(mtx_);
+        const auto it = std::find(jobs_.begin(), jobs_.end(), job);
+        if (it != jobs_.end()) {
+            jobs_.erase(it);
+        }
+    }
+
+  private:
+    struct Job {
+        Job(const std::function<void(size_t)> &f, const size_t n)
+            : fn{f}
+            , count{n} {}
+        const std::function<void(size_t)> &fn;
+        const size_t count;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+
+    std::vector<std::thread> workers_{};
+    std::deque<std::shared_ptr<Job>> jobs_{};
+    std::mutex mtx_{};
+    std::condition_variable cv_{};
+    bool stop_{false};
+
+    // Claims and runs indices until there are none left
+    static void run_job(Job &job) {
+        for (auto i = job.next++; i < job.count; i = job.next++) {
+            job.fn(i);
+            if (++job.done == job.count) {
+                std::lock_guard<std::mutex> lk(job.mtx);
+                job.cv.notify_all();
+            }
+        }
+    }
+
+    void worker() {
+        for (;;) {
+            std::shared_ptr<Job> job{};
+            {
+                std::unique_lock<std::mutex> lk(mtx_);
+                cv_.wait(lk, [this] { return stop_ || !jobs_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                job = jobs_.front();
+                // Every index is claimed, it only needs to finish
+                if (job->next.load() >= job->count) {
+                    jobs_.pop_front();
+                    continue;
+                }
+            }
+            run_job(*job);
+        }
+    }
+}; // Thread_Pool
+
+// Process wide pool, one thread per core (the caller counts as one)
+// UTILS_THREADS=N overrides the total number of threads
+inline Thread_Pool &shared_thread_pool() {
+    static Thread_Pool pool{[] {
+        auto n = std::max(1U, std::thread::hardware_concurrency());
+        const auto env = env_var("UTILS_THREADS");
+        if (!env.empty()) {
+            const auto val = std::atoi(env.c_str());
+            if (val > 0) {
+                n = static_cast<unsigned>(val);
+            }
+        }
+        return n - 1;
+    }()};
+    return pool;
+}
+
+} // namespace utils
+
+#endif
@@ -0,0 +1,612 @@
+/*
+  tiled_pixels.h -- Pixel storage split into square tiles for huge images,
+  on the heap or in a memory mapped scratch file
+*/
+#ifndef TILED_PIXELS_HPP
+#define TILED_PIXELS_HPP
+
+#include "utils/pixel_alloc.hpp"
+#include "utils/pixel_format.hpp"
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/stats.hpp"
+#include "utils/system.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace utils {
+
+// Default width and height of a tile, 1MB per RGBA tile
+constexpr int PIXELS_TILE_SIZE = 512;
+// Images at least this big are loaded into tiles instead of one buffer
+constexpr size_t PIXELS_TILED_MIN_BYTES = size_t{1} << 30;
+// Default number of tiles of a scratch file kept resident
+constexpr size_t PIXELS_TILE_CACHE = 64;
+
+namespace detail {
+inline std::atomic<size_t> &pixels_tiled_min_bytes_ref() noexcept {
+    static std::atomic<size_t> min_bytes{[] {
+        const auto env = env_var("UTILS_PIXELS_TILED_MB");
+        if (env.empty()) {
+            return PIXELS_TILED_MIN_BYTES;
+        }
+        return static_cast<size_t>(std::strtoull(env.c_str(), nullptr, 10))
+               << 20;
+    }()};
+    return min_bytes;
+}
+
+inline const std::string &default_scratch_dir() {
+    static const std::string dir = env_var("UTILS_PIXELS_SCRATCH_DIR");
+    return dir;
+}
+
+// Unlinked temporary file mapped shared into memory. Dirty pages go back to
+// the file rather than to swap, so the kernel can always reclaim them.
+class Scratch_Map {
+  public:
+    Scratch_Map() = default;
+    Scratch_Map(const std::string &dir, const size_t bytes) {
+#ifdef __linux__
+        auto path = dir + "/utils_tiles_XXXXXX";
+        const auto fd = mkstemp(path.data());
+        if (fd < 0) {
+            std::cerr << "[ERROR] Could not create a scratch file in " << dir
+                      << "!\n";
+            return;
+        }
+        // Only the mapping keeps the file alive from here on
+        unlink(path.c_str());
+        // Reserve the space up front, a full disk would otherwise only show
+        // up as SIGBUS on the first write to a tile
+        if (posix_fallocate(fd, 0, static_cast<off_t>(bytes)) == 0) {
+            auto *map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                data_ = static_cast<uint8_t *>(map);
+                size_ = bytes;
+            }
+        }
+        close(fd);
+        if (data_ == nullptr) {
+            std::cerr << "[ERROR] Could not map a scratch file of " << bytes
+                      << " bytes in " << dir << "!\n";
+        }
+#else
+        std::cerr << "[ERROR] Scratch files are not supported here! (" << dir
+                  << ", " << bytes << " bytes)\n";
+#endif
+    }
+    ~Scratch_Map() { unmap(); }
+
+    Scratch_Map(const Scratch_Map &) = delete;
+    Scratch_Map &operator=(const Scratch_Map &) = delete;
+    Scratch_Map(Scratch_Map &&o) noexcept
+        : data_{std::exchange(o.data_, nullptr)}
+        , size_{std::exchange(o.size_, 0)} {}
+    Scratch_Map &operator=(Scratch_Map &&o) noexcept {
+        if (this != &o) {
+            unmap();
+            data_ = std::exchange(o.data_, nullptr);
+            size_ = std::exchange(o.size_, 0);
+        }
+        return *this;
+    }
+
+    uint8_t *data() const noexcept { return data_; }
+    bool is_valid() const noexcept { return data_ != nullptr; }
+
+    // Residency hints for len bytes at off, both page aligned
+    void will_need(const size_t off, const size_t len) const noexcept {
+#ifdef __linux__
+        madvise(data_ + off, len, MADV_WILLNEED);
+#else
+        static_cast<void>(off);
+        static_cast<void>(len);
+#endif
+    }
+    void dont_need(const size_t off, const size_t len) const noexcept {
+#ifdef __linux__
+        madvise(data_ + off, len, MADV_DONTNEED);
+#else
+        static_cast<void>(off);
+        static_cast<void>(len);
+#endif
+    }
+
+    static size_t page_size() noexcept {
+#ifdef __linux__
+        static const auto sz = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return sz;
+#else
+        return 4096;
+#endif
+    }
+
+  private:
+    uint8_t *data_{nullptr};
+    size_t size_{0};
+
+    void unmap() noexcept {
+#ifdef __linux__
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+};
+
+// Least recently used order of the tiles that are resident
+class Tile_Lru {
+  public:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    Tile_Lru(const size_t tiles, const size_t capacity)
+        : capacity_{std::max<size_t>(1, capacity)}
+        , pos_(tiles)
+        , hot_(tiles, false) {}
+
+    struct Touch {
+        // The tile was not resident
+        bool miss;
+        // Tile that fell out of the cache, NONE if none did
+        size_t evicted;
+    };
+    // Marks tile i as the most recently used one
+    Touch touch(const size_t i) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (hot_[i]) {
+            order_.splice(order_.begin(), order_, pos_[i]);
+            return Touch{false, NONE};
+        }
+        order_.push_front(i);
+        pos_[i] = order_.begin();
+        hot_[i] = true;
+        if (order_.size() <= capacity_) {
+            return Touch{true, NONE};
+        }
+        const auto victim = order_.back();
+        order_.pop_back();
+        hot_[victim] = false;
+        return Touch{true, victim};
+    }
+
+  private:
+    size_t capacity_;
+    std::list<size_t> order_{};
+    std::vector<std::list<size_t>::iterator> pos_;
+    std::vector<bool> hot_;
+    std::mutex mtx_{};
+};
+} // namespace detail
+
+// Size in bytes from which images are tiled, UTILS_PIXELS_TILED_MB=N sets it
+// at startup (0 tiles everything)
+[[nodiscard]] inline size_t pixels_tiled_min_bytes() noexcept {
+    return detail::pixels_tiled_min_bytes_ref().load(std::memory_order_relaxed);
+}
+inline void set_pixels_tiled_min_bytes(const size_t bytes) noexcept {
+    detail::pixels_tiled_min_bytes_ref().store(bytes,
+                                               std::memory_order_relaxed);
+}
+// True if an image of this size should go into Tiled_Pixels
+[[nodiscard]] inline bool pixels_prefer_tiled(const int w, const int h,
+                                              const Pixel_Format fmt) noexcept {
+    const auto sz = pixels_size(w, h, fmt);
+    return sz != 0 && sz >= pixels_tiled_min_bytes();
+}
+
+struct Tiled_Opts {
+    // Width and height of a tile in pixels
+    int tile_size{PIXELS_TILE_SIZE};
+    // Directory of a memory mapped scratch file holding the tiles, for images
+    // larger than RAM. Empty keeps the tiles on the heap. Defaults to
+    // UTILS_PIXELS_SCRATCH_DIR.
+    std::string scratch_dir{detail::default_scratch_dir()};
+    // Tiles of the scratch file kept resident, the least recently used ones
+    // beyond that are dropped from memory (their data stays in the file)
+    size_t cache_tiles{PIXELS_TILE_CACHE};
+};
+
+// Pixels split into tile_size x tile_size tiles (tiles on the right and
+// bottom edge are cut to the image), either each in its own heap buffer or
+// all in a memory mapped scratch file. No single allocation is larger than a
+// tile, so images far larger than any contiguous buffer we could get, or
+// than RAM with a scratch file, can still be decoded and converted.
+// Tiles are stored row major, tile (tx, ty) covers the pixels from
+// (tx * tile_size, ty * tile_size). Every tile starts on a page (file) or
+// cache line (heap) and its rows are pitch() bytes apart, the same for all
+// tiles. With a scratch file, the tiles handed out last stay resident and
+// older ones are given back to the kernel. Their pointers stay valid, a
+// tile that is used again is simply paged back in.
+class Tiled_Pixels {
+  public:
+    // Default construct - empty tiles and values
+    Tiled_Pixels() = default;
+
+    // Constructor -> Format, width, height - allocates uninitialized tiles
+    Tiled_Pixels(const Pixel_Format fmt, const int w, const int h,
+                 const Tiled_Opts &opts = {})
+        : format_{fmt}
+        , width_{w}
+        , height_{h}
+        , tile_size_{opts.tile_size}
+        , opts_{opts} {
+        if (tile_size_ <= 0 || pixels_size(w, h, fmt) == 0) {
+            std::cerr << "[ERROR] Invalid tiled image (" << fmt << ' ' << w
+                      << 'x' << h << ", tile " << tile_size_ << ")!\n";
+            clear();
+            return;
+        }
+        tiles_x_ = (w + tile_size_ - 1) / tile_size_;
+        tiles_y_ = (h + tile_size_ - 1) / tile_size_;
+        pitch_ = detail::round_up(pixels_pitch(tile_size_, fmt),
+                                  PIXEL_BUF_ALIGN);
+        const auto tile_bytes =
+            size_mul(pitch_, static_cast<size_t>(tile_size_));
+        if (!opts.scratch_dir.empty()) {
+            stride_ =
+                detail::round_up(tile_bytes, detail::Scratch_Map::page_size());
+            map_ = detail::Scratch_Map{opts.scratch_dir,
+                                       size_mul(stride_, tile_count())};
+            if (stride_ == 0 || !map_.is_valid()) {
+                clear();
+                return;
+            }
+            lru_ = std::make_unique<detail::Tile_Lru>(tile_count(),
+                                                      opts.cache_tiles);
+        } else {
+            tiles_.resize(tile_count());
+            for (int ty = 0; ty < tiles_y_; ++ty) {
+                for (int tx = 0; tx < tiles_x_; ++tx) {
+                    tiles_[index(tx, ty)].resize(
+                        pitch_ * static_cast<size_t>(tile_height(ty)));
+                }
+            }
+        }
+        is_valid_ = true;
+    }
+
+    // Move only, the tiles may live in a mapping we own
+    Tiled_Pixels(const Tiled_Pixels &) = delete;
+    Tiled_Pixels &operator=(const Tiled_Pixels &) = delete;
+    Tiled_Pixels(Tiled_Pixels &&o) noexcept { *this = std::move(o); }
+    Tiled_Pixels &operator=(Tiled_Pixels &&o) noexcept {
+        if (this != &o) {
+            format_ = o.format_;
+            width_ = o.width_;
+            height_ = o.height_;
+            tile_size_ = o.tile_size_;
+            tiles_x_ = o.tiles_x_;
+            tiles_y_ = o.tiles_y_;
+            pitch_ = o.pitch_;
+            stride_ = o.stride_;
+            is_valid_ = o.is_valid_;
+            opts_ = std::move(o.opts_);
+            tiles_ = std::move(o.tiles_);
+            map_ = std::move(o.map_);
+            lru_ = std::move(o.lru_);
+            o.clear();
+        }
+        return *this;
+    }
+    ~Tiled_Pixels() = default;
+
+    // Simple getters
+    Pixel_Format format() const noexcept { return format_; }
+    int width() const noexcept { return width_; }
+    int height() const noexcept { return height_; }
+    int tile_size() const noexcept { return tile_size_; }
+    int tiles_x() const noexcept { return tiles_x_; }
+    int tiles_y() const noexcept { return tiles_y_; }
+    size_t tile_count() const noexcept {
+        return static_cast<size_t>(tiles_x_) * static_cast<size_t>(tiles_y_);
+    }
+    // Bytes between the rows of every tile
+    size_t pitch() const noexcept { return pitch_; }
+    bool is_valid() const noexcept { return is_valid_; }
+    bool is_file_backed() const noexcept { return map_.is_valid(); }
+    // Bytes of pixel data over all tiles, without padding
+    size_t size_bytes() const noexcept {
+        return is_valid_ ? pixels_size(width_, height_, format_) : 0;
+    }
+
+    // Size of a tile, smaller than tile_size() on the right and bottom edge
+    int tile_width(const int tx) const noexcept {
+        return std::min(tile_size_, width_ - tx * tile_size_);
+    }
+    int tile_height(const int ty) const noexcept {
+        return std::min(tile_size_, height_ - ty * tile_size_);
+    }
+
+    // Views of a single tile, invalid if out of range. Marks the tile as
+    // recently used.
+    Pixels_View tile(const int tx, const int ty) noexcept {
+        if (!has_tile(tx, ty)) {
+            return Pixels_View{};
+        }
+        return Pixels_View{tile_data(index(tx, ty)), format_, tile_width(tx),
+                           tile_height(ty), pitch_};
+    }
+    Const_Pixels_View tile(const int tx, const int ty) const noexcept {
+        if (!has_tile(tx, ty)) {
+            return Const_Pixels_View{};
+        }
+        return Const_Pixels_View{tile_data(index(tx, ty)), format_,
+                                 tile_width(tx), tile_height(ty), pitch_};
+    }
+
+    // Calls fn(tx, ty, view) for every tile, in parallel on the shared pool
+    // if asked to. The way to stream any view based operation over the image.
+    template <class Fn>
+    void for_each_tile(const Fn &fn, const bool parallel = false) {
+        for_tiles(tile_count(), parallel, [&](const size_t i) {
+            const auto tx = static_cast<int>(i % static_cast<size_t>(tiles_x_));
+            const auto ty = static_cast<int>(i / static_cast<size_t>(tiles_x_));
+            fn(tx, ty, tile(tx, ty));
+        });
+    }
+    template <class Fn>
+    void for_each_tile(const Fn &fn, const bool parallel = false) const {
+        for_tiles(tile_count(), parallel, [&](const size_t i) {
+            const auto tx = static_cast<int>(i % static_cast<size_t>(tiles_x_));
+            const auto ty = static_cast<int>(i / static_cast<size_t>(tiles_x_));
+            fn(tx, ty, tile(tx, ty));
+        });
+    }
+
+    // Resets the class back to empty/clean state
+    void clear() {
+        format_ = Pixel_Format::Unknown;
+        width_ = 0;
+        height_ = 0;
+        tile_size_ = 0;
+        tiles_x_ = 0;
+        tiles_y_ = 0;
+        pitch_ = 0;
+        stride_ = 0;
+        is_valid_ = false;
+        tiles_.clear();
+        map_ = detail::Scratch_Map{};
+        lru_.reset();
+    }
+
+    // Copies the full width rows of src into rows y and down, converting
+    // them to our format. Decoders hand their output over in bands this way.
+    bool write_rows(const int y, const Const_Pixels_View src,
+                    const Pixel_Convert_Opts &opts = {}) {
+        if (!check_rows(y, src.is_valid(), src.width(), src.height())) {
+            return false;
+        }
+        return copy_rows(y, src.height(), opts,
+                         [&](const int tx, const int ty, const int ry,
+                             const int sy, const int rows) {
+                             return convert_view(
+                                 src.sub(tx * tile_size_, sy, tile_width(tx),
+                                         rows),
+                                 tile(tx, ty).sub(0, ry, tile_width(tx), rows),
+                                 serial(opts));
+                         });
+    }
+
+    // Copies rows y and down into the full width rows of dst, converting
+    // them to the format of dst
+    bool read_rows(const int y, const Pixels_View dst,
+                   const Pixel_Convert_Opts &opts = {}) const {
+        if (!check_rows(y, dst.is_valid(), dst.width(), dst.height())) {
+            return false;
+        }
+        return copy_rows(y, dst.height(), opts,
+                         [&](const int tx, const int ty, const int ry,
+                             const int dy, const int rows) {
+                             return convert_view(
+                                 tile(tx, ty).sub(0, ry, tile_width(tx), rows),
+                                 dst.sub(tx * tile_size_, dy, tile_width(tx),
+                                         rows),
+                                 serial(opts));
+                         });
+    }
+
+    // Convert pixel formats tile by tile. Heap tiles are replaced one at a
+    // time (one per thread with Pixel_Convert_Opts::parallel), a scratch
+    // file is converted into a new one.
+    void convert_to(const Pixel_Format fmt,
+                    const Pixel_Convert_Opts &opts = {}) {
+        if (!is_valid_ || fmt == format_ ||
+            get_converter(format_, fmt) == nullptr) {
+            return;
+        }
+        const auto o = serial(opts);
+        if (is_file_backed()) {
+            Tiled_Pixels dst{fmt, width_, height_, opts_};
+            if (!dst.is_valid()) {
+                return;
+            }
+            for_each_tile(
+                [&](const int tx, const int ty, const Const_Pixels_View v) {
+                    convert_view(v, dst.tile(tx, ty), o);
+                },
+                opts.parallel);
+            *this = std::move(dst);
+            return;
+        }
+        const auto pitch = detail::round_up(pixels_pitch(tile_size_, fmt),
+                                            PIXEL_BUF_ALIGN);
+        for_each_tile(
+            [&](const int tx, const int ty, const Const_Pixels_View v) {
+                pixel_buf_t buf(pitch * static_cast<size_t>(tile_height(ty)));
+                convert_view(v,
+                             Pixels_View{buf.data(), fmt, tile_width(tx),
+                                         tile_height(ty), pitch},
+                             o);
+                tiles_[index(tx, ty)].swap(buf);
+            },
+            opts.parallel);
+        format_ = fmt;
+        pitch_ = pitch;
+    }
+
+    // Copies everything into one contiguous Pixels buffer of format fmt
+    // (Unknown keeps ours), only sensible if it fits in memory
+    Pixels to_pixels(const Pixel_Format fmt = Pixel_Format::Unknown,
+                     const Pixel_Convert_Opts &opts = {}) const {
+        if (!is_valid_) {
+            return Pixels{};
+        }
+        Pixels p{fmt == Pixel_Format::Unknown ? format_ : fmt, width_,
+                 height_};
+        if (p.is_valid() && !read_rows(0, p.view(), opts)) {
+            p.clear();
+        }
+        return p;
+    }
+
+  private:
+    Pixel_Format format_{Pixel_Format::Unknown};
+    int width_{0};
+    int height_{0};
+    int tile_size_{0};
+    int tiles_x_{0};
+    int tiles_y_{0};
+    size_t pitch_{0};
+    // Bytes between tiles in the scratch file
+    size_t stride_{0};
+    bool is_valid_{false};
+    Tiled_Opts opts_{};
+    std::vector<pixel_buf_t> tiles_{};
+    detail::Scratch_Map map_{};
+    std::unique_ptr<detail::Tile_Lru> lru_{};
+
+    size_t index(const int tx, const int ty) const noexcept {
+        return static_cast<size_t>(ty) * static_cast<size_t>(tiles_x_) +
+               static_cast<size_t>(tx);
+    }
+    bool has_tile(const int tx, const int ty) const noexcept {
+        return is_valid_ && tx >= 0 && ty >= 0 && tx < tiles_x_ &&
+               ty < tiles_y_;
+    }
+
+    // First byte of tile i
+    uint8_t *tile_data(const size_t i) noexcept {
+        return map_.is_valid() ? map_tile(i) : tiles_[i].data();
+    }
+    const uint8_t *tile_data(const size_t i) const noexcept {
+        return map_.is_valid() ? map_tile(i) : tiles_[i].data();
+    }
+    // Tile i of the scratch file, paged in if it was not resident and the
+    // least recently used tile paged out
+    uint8_t *map_tile(const size_t i) const noexcept {
+        const auto t = lru_->touch(i);
+        if (t.miss) {
+            map_.will_need(i * stride_, stride_);
+        }
+        if (t.evicted != detail::Tile_Lru::NONE) {
+            map_.dont_need(t.evicted * stride_, stride_);
+        }
+        return map_.data() + i * stride_;
+    }
+
+    // Verifies that w x h rows fit at row y
+    bool check_rows(const int y, const bool valid, const int w,
+                    const int h) const {
+        if (!is_valid_ || !valid) {
+            std::cerr << "[ERROR] Cannot copy rows of an invalid pixel view!\n";
+            return false;
+        }
+        if (w != width_ || y < 0 || h > height_ - y) {
+            std::cerr << "[ERROR] Rows " << y << '-' << y + h << " of width "
+                      << w << " do not fit the tiled image (" << width_ << 'x'
+                      << height_ << ")!\n";
+            return false;
+        }
+        return true;
+    }
+
+    // The tiles are what runs in parallel, never the copies inside them
+    static Pixel_Convert_Opts serial(const Pixel_Convert_Opts &opts) noexcept {
+        auto o = opts;
+        o.parallel = false;
+        return o;
+    }
+
+    // Calls fn(i) for every tile index in [0, count), on the shared pool if
+    // asked to
+    template <class Fn>
+    static void for_tiles(const size_t count, const bool parallel,
+                          const Fn &fn) {
+        auto &pool = shared_thread_pool();
+        if (parallel && pool.concurrency() > 1 && count > 1) {
+            pool.parallel_for(count, fn);
+            return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+    }
+
+    // Calls fn(tx, ty, row in tile, row in view, rows) for every piece of a
+    // tile that rows [y, y + h) cover, the tiles of a band in parallel
+    template <class Fn>
+    bool copy_rows(const int y, const int h, const Pixel_Convert_Opts &opts,
+                   const Fn &fn) const {
+        std::atomic<bool> ok{true};
+        for (int vy = 0; vy < h;) {
+            const auto ty = (y + vy) / tile_size_;
+            const auto ry = (y + vy) - ty * tile_size_;
+            const auto rows = std::min(tile_height(ty) - ry, h - vy);
+            for_tiles(static_cast<size_t>(tiles_x_), opts.parallel,
+                      [&](const size_t tx) {
+                          if (!fn(static_cast<int>(tx), ty, ry, vy, rows)) {
+                              ok = false;
+                          }
+                      });
+            vy += rows;
+        }
+        return ok;
+    }
+}; // Tiled_Pixels
+
+// Statistics of a tiled image, streamed tile by tile (see pixel_stats)
+inline Pixel_Stats pixel_stats(const Tiled_Pixels &src,
+                               const Stats_Opts &opts = {}) {
+    if (!src.is_valid()) {
+        std::cerr << "[ERROR] Cannot compute stats of an invalid tiled image!\n";
+        return Pixel_Stats{};
+    }
+    if (!detail::check_stats_format(src.format())) {
+        return Pixel_Stats{};
+    }
+    detail::Stats_Acc acc{src.format(), opts};
+    src.for_each_tile(
+        [&](int, int, const Const_Pixels_View v) {
+            const auto h = static_cast<size_t>(v.height());
+            const auto band =
+                std::max<size_t>(1, STATS_BAND_BYTES / v.row_bytes());
+            for (size_t y = 0; y < h; y += band) {
+                acc.add_rows(v, y, std::min(h, y + band));
+            }
+        },
+        opts.parallel);
+    return acc.result();
+}
+
+} // namespace utils
+
+#endif
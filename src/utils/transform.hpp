@@ -0,0 +1,263 @@
+/*
+  transform.h -- Rotating, mirroring and transposing pixel views
+*/
+#ifndef TRANSFORM_HPP
+#define TRANSFORM_HPP
+
+#include "utils/pixels.hpp"
+#include "utils/pixels_view.hpp"
+#include "utils/transform_kernels.hpp"
+#include <cstring>
+#include <iostream>
+
+namespace utils {
+
+// The 8 ways to lay an image back down, numbered like the EXIF orientation
+// tag, which names the transform that shows the image upright.
+// Rotations are clockwise. Transpose mirrors along the main diagonal,
+// Transverse along the other one.
+enum class Orientation {
+    Normal = 1,
+    Flip_H = 2,
+    Rotate_180 = 3,
+    Flip_V = 4,
+    Transpose = 5,
+    Rotate_90 = 6,
+    Transverse = 7,
+    Rotate_270 = 8
+};
+inline std::ostream &operator<<(std::ostream &os, const Orientation o) {
+    switch (o) {
+    default:
+    case Orientation::Normal:
+        os << "Normal";
+        break;
+    case Orientation::Flip_H:
+        os << "Flip_H";
+        break;
+    case Orientation::Rotate_180:
+        os << "Rotate_180";
+        break;
+    case Orientation::Flip_V:
+        os << "Flip_V";
+        break;
+    case Orientation::Transpose:
+        os << "Transpose";
+        break;
+    case Orientation::Rotate_90:
+        os << "Rotate_90";
+        break;
+    case Orientation::Transverse:
+        os << "Transverse";
+        break;
+    case Orientation::Rotate_270:
+        os << "Rotate_270";
+        break;
+    }
+    return os;
+}
+
+// The orientation for an EXIF orientation tag, Normal if out of range
+[[nodiscard]] inline Orientation orientation_from_exif(const int tag) {
+    if (tag < 1 || tag > 8) {
+        std::cerr << "[ERROR] Invalid EXIF orientation " << tag << "!\n";
+        return Orientation::Normal;
+    }
+    return static_cast<Orientation>(tag);
+}
+
+// True for the orientations that swap width and height
+[[nodiscard]] inline bool orientation_swaps_axes(const Orientation o) noexcept {
+    return static_cast<int>(o) >= static_cast<int>(Orientation::Transpose);
+}
+
+// Blocks of at most this many bytes of pixels a side are transposed 8x8 at
+// a time, the source and destination rows of a block stay in L1 and L2
+constexpr size_t TRANSPOSE_TILE_BYTES = 256;
+
+namespace detail {
+// Transposes the w x h pixels at src into the h x w pixels at dst by
+// halving the longer side until the block is a tile, so every level of
+// the cache hierarchy sees blocks that fit without knowing its size.
+// Splits stay on multiples of 8, only the right and bottom edge of the
+// whole area go through the scalar edge kernel.
+inline void transpose_blocks(const uint8_t *src, const std::ptrdiff_t sp,
+                             uint8_t *dst, const std::ptrdiff_t dp,
+                             const size_t w, const size_t h, const size_t bpp,
+                             const kernels::transpose8x8_fn_t block) noexcept {
+    const auto b = static_cast<std::ptrdiff_t>(bpp);
+    const auto tile = TRANSPOSE_TILE_BYTES / bpp;
+    if (w > tile || h > tile) {
+        if (w >= h) {
+            const auto half = (w / 2 + 7) / 8 * 8;
+            const auto hp = static_cast<std::ptrdiff_t>(half);
+            transpose_blocks(src, sp, dst, dp, half, h, bpp, block);
+            transpose_blocks(src + hp * b, sp, dst + hp * dp, dp, w - half, h,
+                             bpp, block);
+        } else {
+            const auto half = (h / 2 + 7) / 8 * 8;
+            const auto hp = static_cast<std::ptrdiff_t>(half);
+            transpose_blocks(src, sp, dst, dp, w, half, bpp, block);
+            transpose_blocks(src + hp * sp, sp, dst + hp * b, dp, w, h - half,
+                             bpp, block);
+        }
+        return;
+    }
+    const auto w8 = w & ~size_t{7};
+    const auto h8 = h & ~size_t{7};
+    // dst rows are finished one after the other
+    for (size_t j = 0; j < w8; j += 8) {
+        const auto jp = static_cast<std::ptrdiff_t>(j);
+        const auto *s = src + jp * b;
+        auto *d = dst + jp * dp;
+        for (size_t i = 0; i < h8; i += 8) {
+            const auto ip = static_cast<std::ptrdiff_t>(i);
+            block(s + ip * sp, sp, d + ip * b, dp);
+        }
+    }
+    const auto w8p = static_cast<std::ptrdiff_t>(w8);
+    const auto h8p = static_cast<std::ptrdiff_t>(h8);
+    kernels::transpose_scalar(src + w8p * b, sp, dst + w8p * dp, dp, w - w8,
+                              h8, bpp);
+    kernels::transpose_scalar(src + h8p * sp, sp, dst + h8p * b, dp, w,
+                              h - h8, bpp);
+}
+} // namespace detail
+
+// Writes src in orientation o to dst, which must have the format of src
+// and its size, with width and height swapped for Transpose, Rotate_90,
+// Transverse and Rotate_270. The views must not overlap.
+// With parallel set large images are split into bands of dst rows on the
+// shared pool. Returns false if nothing was written.
+inline bool transform(const Const_Pixels_View src, const Pixels_View dst,
+                      const Orientation o, const bool parallel = false) {
+    if (!src.is_valid() || !dst.is_valid()) {
+        std::cerr << "[ERROR] Cannot transform an invalid pixel view!\n";
+        return false;
+    }
+    const auto swap = orientation_swaps_axes(o);
+    const auto w = swap ? src.height() : src.width();
+    const auto h = swap ? src.width() : src.height();
+    if (src.format() != dst.format() || dst.width() != w ||
+        dst.height() != h) {
+        std::cerr << "[ERROR] Pixel views do not match " << o << "! ("
+                  << src.format() << ' ' << src.width() << 'x'
+                  << src.height() << " -> " << dst.format() << ' '
+                  << dst.width() << 'x' << dst.height() << ")\n";
+        return false;
+    }
+    const auto *src_end = src.row(src.height() - 1) + src.row_bytes();
+    const auto *dst_end = dst.row(dst.height() - 1) + dst.row_bytes();
+    if (src.data() < dst_end && dst.data() < src_end) {
+        std::cerr << "[ERROR] Pixel views overlap, cannot transform!\n";
+        return false;
+    }
+    const auto bpp = pixels_pitch(1, src.format());
+    const auto rows = static_cast<size_t>(h);
+    const auto rb = dst.row_bytes();
+    const auto last = src.height() - 1;
+    switch (o) {
+    default:
+    case Orientation::Normal:
+        return convert_view(src, dst);
+    case Orientation::Flip_V:
+        detail::for_row_bands(rows, rb, parallel,
+                              [&](const size_t first, const size_t end) {
+                                  for (auto y = first; y < end; ++y) {
+                                      const auto yi = static_cast<int>(y);
+                                      std::memcpy(dst.row(yi),
+                                                  src.row(last - yi), rb);
+                                  }
+                              });
+        return true;
+    case Orientation::Flip_H:
+    case Orientation::Rotate_180: {
+        const auto reverse = kernels::reverse_pixels(bpp);
+        if (reverse == nullptr) {
+            std::cerr << "[ERROR] Cannot mirror " << src.format() << "!\n";
+            return false;
+        }
+        const auto flip_v = o == Orientation::Rotate_180;
+        const auto n = static_cast<size_t>(w);
+        detail::for_row_bands(
+            rows, rb, parallel, [&](const size_t first, const size_t end) {
+                for (auto y = first; y < end; ++y) {
+                    const auto yi = static_cast<int>(y);
+                    reverse(src.row(flip_v ? last - yi : yi), dst.row(yi), n);
+                }
+            });
+        return true;
+    }
+    case Orientation::Transpose:
+    case Orientation::Rotate_90:
+    case Orientation::Transverse:
+    case Orientation::Rotate_270: {
+        const auto block = kernels::transpose8x8(bpp);
+        if (block == nullptr) {
+            std::cerr << "[ERROR] Cannot transpose " << src.format() << "!\n";
+            return false;
+        }
+        // Everything is a transpose of src into dst, rotating clockwise reads
+        // src bottom up, counter clockwise writes dst bottom up
+        const auto sp = static_cast<std::ptrdiff_t>(src.pitch());
+        const auto dp = static_cast<std::ptrdiff_t>(dst.pitch());
+        const auto src_up =
+            o == Orientation::Rotate_90 || o == Orientation::Transverse;
+        const auto dst_up =
+            o == Orientation::Rotate_270 || o == Orientation::Transverse;
+        const auto *s = src_up ? src.row(last) : src.row(0);
+        auto *d = dst_up ? dst.row(h - 1) : dst.row(0);
+        const auto ssp = src_up ? -sp : sp;
+        const auto sdp = dst_up ? -dp : dp;
+        const auto b = static_cast<std::ptrdiff_t>(bpp);
+        const auto cols = static_cast<size_t>(src.height());
+        detail::for_row_bands(
+            rows, rb, parallel, [&](const size_t first, const size_t end) {
+                const auto f = static_cast<std::ptrdiff_t>(first);
+                detail::transpose_blocks(s + f * b, ssp, d + f * sdp, sdp,
+                                         end - first, cols, bpp, block);
+            });
+        return true;
+    }
+    }
+}
+
+// Same as above into new Pixels of the right size
+inline Pixels transform(const Const_Pixels_View src, const Orientation o,
+                        const bool parallel = false) {
+    const auto swap = orientation_swaps_axes(o);
+    Pixels p{src.format(), swap ? src.height() : src.width(),
+             swap ? src.width() : src.height()};
+    if (!p.is_valid() || !transform(src, p.view(), o, parallel)) {
+        p.clear();
+    }
+    return p;
+}
+inline Pixels rotate_90(const Const_Pixels_View src,
+                        const bool parallel = false) {
+    return transform(src, Orientation::Rotate_90, parallel);
+}
+inline Pixels rotate_180(const Const_Pixels_View src,
+                         const bool parallel = false) {
+    return transform(src, Orientation::Rotate_180, parallel);
+}
+inline Pixels rotate_270(const Const_Pixels_View src,
+                         const bool parallel = false) {
+    return transform(src, Orientation::Rotate_270, parallel);
+}
+inline Pixels flip_horizontal(const Const_Pixels_View src,
+                              const bool parallel = false) {
+    return transform(src, Orientation::Flip_H, parallel);
+}
+inline Pixels flip_vertical(const Const_Pixels_View src,
+                            const bool parallel = false) {
+    return transform(src, Orientation::Flip_V, parallel);
+}
+inline Pixels transpose(const Const_Pixels_View src,
+                        const bool parallel = false) {
+    return transform(src, Orientation::Transpose, parallel);
+}
+
+} // namespace utils
+
+#endif
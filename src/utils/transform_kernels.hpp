@@ -0,0 +1,387 @@
+/*
+  transform_kernels.h -- Raw kernels for transposing and mirroring pixels
+*/
+#ifndef TRANSFORM_KERNELS_HPP
+#define TRANSFORM_KERNELS_HPP
+
+#include "utils/cpu_dispatch.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+namespace kernels {
+
+//
+// Transposes the 8x8 pixels of B bytes at src into dst, dst row j is src
+// column j. Pitches are signed so either side can run bottom up.
+//
+template <size_t B>
+void transpose8x8_scalar(const uint8_t *src, const std::ptrdiff_t sp,
+                         uint8_t *dst, const std::ptrdiff_t dp) noexcept {
+    for (std::ptrdiff_t i = 0; i < 8; ++i) {
+        const auto *s = src + i * sp;
+        for (std::ptrdiff_t j = 0; j < 8; ++j) {
+            std::memcpy(dst + j * dp + i * static_cast<std::ptrdiff_t>(B),
+                        s + j * static_cast<std::ptrdiff_t>(B), B);
+        }
+    }
+}
+
+// Same for any w x h block, used for the edges
+inline void transpose_scalar(const uint8_t *src, const std::ptrdiff_t sp,
+                             uint8_t *dst, const std::ptrdiff_t dp,
+                             const size_t w, const size_t h,
+                             const size_t bpp) noexcept {
+    for (size_t i = 0; i < h; ++i) {
+        const auto *s = src + static_cast<std::ptrdiff_t>(i) * sp;
+        auto *d = dst + i * bpp;
+        for (size_t j = 0; j < w; ++j, s += bpp, d += dp) {
+            std::memcpy(d, s, bpp);
+        }
+    }
+}
+
+//
+// Mirrors a row of n pixels of B bytes, dst must not overlap src
+//
+template <size_t B>
+void reverse_pixels_scalar(const uint8_t *src, uint8_t *dst,
+                           const size_t n) noexcept {
+    const auto *s = src + n * B;
+    for (size_t i = 0; i < n; ++i, dst += B) {
+        s -= B;
+        std::memcpy(dst, s, B);
+    }
+}
+
+#if UTILS_ARCH_X86
+//
+// SSE4.1 kernels, unpack ladders on 8 byte (GRAY) or 4x4 pixel quadrants
+//
+UTILS_TARGET_SSE41 inline void
+transpose8x8_gray_sse(const uint8_t *src, const std::ptrdiff_t sp,
+                      uint8_t *dst, const std::ptrdiff_t dp) noexcept {
+    __m128i r[8];
+    for (std::ptrdiff_t i = 0; i < 8; ++i) {
+        r[i] = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i * sp));
+    }
+    const auto a0 = _mm_unpacklo_epi8(r[0], r[1]);
+    const auto a1 = _mm_unpacklo_epi8(r[2], r[3]);
+    const auto a2 = _mm_unpacklo_epi8(r[4], r[5]);
+    const auto a3 = _mm_unpacklo_epi8(r[6], r[7]);
+    const auto b0 = _mm_unpacklo_epi16(a0, a1);
+    const auto b1 = _mm_unpackhi_epi16(a0, a1);
+    const auto b2 = _mm_unpacklo_epi16(a2, a3);
+    const auto b3 = _mm_unpackhi_epi16(a2, a3);
+    // Two output rows per register
+    const __m128i c[4] = {
+        _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2),
+        _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3)};
+    for (std::ptrdiff_t j = 0; j < 4; ++j) {
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 2 * j * dp), c[j]);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + (2 * j + 1) * dp),
+                         _mm_unpackhi_epi64(c[j], c[j]));
+    }
+}
+
+// 4x4 transpose of 32 bit lanes, in place
+UTILS_TARGET_SSE41 inline void transpose4x4_epi32_sse(__m128i &r0, __m128i &r1,
+                                                      __m128i &r2,
+                                                      __m128i &r3) noexcept {
+    const auto t0 = _mm_unpacklo_epi32(r0, r1);
+    const auto t1 = _mm_unpacklo_epi32(r2, r3);
+    const auto t2 = _mm_unpackhi_epi32(r0, r1);
+    const auto t3 = _mm_unpackhi_epi32(r2, r3);
+    r0 = _mm_unpacklo_epi64(t0, t1);
+    r1 = _mm_unpackhi_epi64(t0, t1);
+    r2 = _mm_unpacklo_epi64(t2, t3);
+    r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+// RGB rows of 8 pixels as 32 bit lanes (lo = pixels 0-3, hi = 4-7) and back
+// Both loads stay inside the 24 bytes of the row
+UTILS_TARGET_SSE41 inline void expand_rgb8_sse(const uint8_t *s, __m128i &lo,
+                                               __m128i &hi) noexcept {
+    const auto e0 = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9,
+                                  10, 11, -1);
+    const auto e1 = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1,
+                                  13, 14, 15, -1);
+    lo = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s)), e0);
+    hi = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 8)), e1);
+}
+UTILS_TARGET_SSE41 inline void compress_rgb8_sse(uint8_t *d, const __m128i lo,
+                                                 const __m128i hi) noexcept {
+    const auto c = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1,
+                                 -1, -1, -1);
+    const auto l = _mm_shuffle_epi8(lo, c);
+    const auto h = _mm_shuffle_epi8(hi, c);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(d),
+                     _mm_or_si128(l, _mm_slli_si128(h, 12)));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(d + 16),
+                     _mm_srli_si128(h, 4));
+}
+
+// 8x8 pixels of 32 bit lanes as 4 quadrants, q[i][0] is the left half of
+// row i. The quadrants swap places on the diagonal.
+UTILS_TARGET_SSE41 inline void
+transpose8x8_epi32_sse(__m128i (&q)[8][2]) noexcept {
+    for (size_t i = 0; i < 8; i += 4) {
+        for (size_t h = 0; h < 2; ++h) {
+            transpose4x4_epi32_sse(q[i][h], q[i + 1][h], q[i + 2][h],
+                                   q[i + 3][h]);
+        }
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        const auto t = q[i][1];
+        q[i][1] = q[i + 4][0];
+        q[i + 4][0] = t;
+    }
+}
+
+UTILS_TARGET_SSE41 inline void
+transpose8x8_rgba_sse(const uint8_t *src, const std::ptrdiff_t sp,
+                      uint8_t *dst, const std::ptrdiff_t dp) noexcept {
+    __m128i q[8][2];
+    for (std::ptrdiff_t i = 0; i < 8; ++i) {
+        const auto *s = reinterpret_cast<const __m128i *>(src + i * sp);
+        q[i][0] = _mm_loadu_si128(s);
+        q[i][1] = _mm_loadu_si128(s + 1);
+    }
+    transpose8x8_epi32_sse(q);
+    for (std::ptrdiff_t j = 0; j < 8; ++j) {
+        auto *d = reinterpret_cast<__m128i *>(dst + j * dp);
+        _mm_storeu_si128(d, q[j][0]);
+        _mm_storeu_si128(d + 1, q[j][1]);
+    }
+}
+
+UTILS_TARGET_SSE41 inline void
+transpose8x8_rgb_sse(const uint8_t *src, const std::ptrdiff_t sp,
+                     uint8_t *dst, const std::ptrdiff_t dp) noexcept {
+    __m128i q[8][2];
+    for (std::ptrdiff_t i = 0; i < 8; ++i) {
+        expand_rgb8_sse(src + i * sp, q[i][0], q[i][1]);
+    }
+    transpose8x8_epi32_sse(q);
+    for (std::ptrdiff_t j = 0; j < 8; ++j) {
+        compress_rgb8_sse(dst + j * dp, q[j][0], q[j][1]);
+    }
+}
+
+// 16 GRAY or 4 RGBA pixels per iteration from the end of src
+UTILS_TARGET_SSE41 inline void reverse_gray_sse(const uint8_t *src,
+                                                uint8_t *dst,
+                                                const size_t n) noexcept {
+    const auto rev = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4,
+                                   3, 2, 1, 0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src + n - i - 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_shuffle_epi8(v, rev));
+    }
+    reverse_pixels_scalar<1>(src, dst + i, n - i);
+}
+UTILS_TARGET_SSE41 inline void reverse_rgba_sse(const uint8_t *src,
+                                                uint8_t *dst,
+                                                const size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src + (n - i - 4) * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                         _mm_shuffle_epi32(v, 0x1B));
+    }
+    reverse_pixels_scalar<4>(src, dst + i * 4, n - i);
+}
+// 4 RGB pixels per iteration, loaded with the 4 bytes in front of them so
+// the load never runs past the row
+UTILS_TARGET_SSE41 inline void reverse_rgb_sse(const uint8_t *src,
+                                               uint8_t *dst,
+                                               const size_t n) noexcept {
+    const auto rev = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6,
+                                   -1, -1, -1, -1);
+    size_t i = 0;
+    // Pixels n - i - 4 on, at least 2 pixels (4 bytes) in front of them
+    for (; i + 6 <= n; i += 4) {
+        const auto v = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                src + (n - i - 4) * 3 - 4)),
+            rev);
+        auto *d = dst + i * 3;
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(d), v);
+        const auto tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        std::memcpy(d + 8, &tail, 4);
+    }
+    reverse_pixels_scalar<3>(src, dst + i * 3, n - i);
+}
+
+//
+// AVX2 kernels, a whole 8x8 block of 32 bit lanes in 8 registers
+//
+UTILS_TARGET_AVX2 inline void
+transpose8x8_epi32_avx2(__m256i (&r)[8]) noexcept {
+    __m256i t[8];
+    for (size_t i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    // u[0..3] columns (0|4), (1|5), (2|6), (3|7) of rows 0-3, u[4..7] of 4-7
+    __m256i u[8];
+    for (size_t i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (size_t j = 0; j < 4; ++j) {
+        r[j] = _mm256_permute2x128_si256(u[j], u[j + 4], 0x20);
+        r[j + 4] = _mm256_permute2x128_si256(u[j], u[j + 4], 0x31);
+    }
+}
+
+UTILS_TARGET_AVX2 inline void
+transpose8x8_rgba_avx2(const uint8_t *src, const std::ptrdiff_t sp,
+                       uint8_t *dst, const std::ptrdiff_t dp) noexcept {
+    __m256i r[8];
+    for (std::ptrdiff_t i = 0; i < 8; ++i) {
+        r[i] = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(src + i * sp));
+    }
+    transpose8x8_epi32_avx2(r);
+    for (std::ptrdiff_t j = 0; j < 8; ++j) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + j * dp), r[j]);
+    }
+}
+
+UTILS_TARGET_AVX2 inline void
+transpose8x8_rgb_avx2(const uint8_t *src, const std::ptrdiff_t sp,
+                      uint8_t *dst, const std::ptrdiff_t dp) noexcept {
+    __m256i r[8];
+    for (std::ptrdiff_t i = 0; i < 8; ++i) {
+        __m128i lo;
+        __m128i hi;
+        expand_rgb8_sse(src + i * sp, lo, hi);
+        r[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+    transpose8x8_epi32_avx2(r);
+    for (std::ptrdiff_t j = 0; j < 8; ++j) {
+        compress_rgb8_sse(dst + j * dp, _mm256_castsi256_si128(r[j]),
+                          _mm256_extracti128_si256(r[j], 1));
+    }
+}
+
+UTILS_TARGET_AVX2 inline void reverse_rgba_avx2(const uint8_t *src,
+                                                uint8_t *dst,
+                                                const size_t n) noexcept {
+    const auto rev = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(src + (n - i - 8) * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4),
+                            _mm256_permutevar8x32_epi32(v, rev));
+    }
+    reverse_rgba_sse(src, dst + i * 4, n - i);
+}
+#endif // UTILS_ARCH_X86
+
+//
+// Best kernel for the CPU we are running on and the pixel size in bytes,
+// selected once on first use. nullptr for pixel sizes without one.
+//
+using transpose8x8_fn_t = void (*)(const uint8_t *, std::ptrdiff_t, uint8_t *,
+                                   std::ptrdiff_t) noexcept;
+using reverse_pixels_fn_t = void (*)(const uint8_t *, uint8_t *,
+                                     size_t) noexcept;
+[[nodiscard]] inline transpose8x8_fn_t transpose8x8(const size_t bpp) {
+    switch (bpp) {
+    case 1: {
+#if UTILS_ARCH_X86
+        static const auto fn = cpu_select<transpose8x8_fn_t>(
+            transpose8x8_scalar<1>, transpose8x8_gray_sse);
+        return fn;
+#else
+        return transpose8x8_scalar<1>;
+#endif
+    }
+    case 3: {
+#if UTILS_ARCH_X86
+        static const auto fn = cpu_select<transpose8x8_fn_t>(
+            transpose8x8_scalar<3>, transpose8x8_rgb_sse,
+            transpose8x8_rgb_avx2);
+        return fn;
+#else
+        return transpose8x8_scalar<3>;
+#endif
+    }
+    case 4: {
+#if UTILS_ARCH_X86
+        static const auto fn = cpu_select<transpose8x8_fn_t>(
+            transpose8x8_scalar<4>, transpose8x8_rgba_sse,
+            transpose8x8_rgba_avx2);
+        return fn;
+#else
+        return transpose8x8_scalar<4>;
+#endif
+    }
+    // 16 bit formats
+    case 2:
+        return transpose8x8_scalar<2>;
+    case 6:
+        return transpose8x8_scalar<6>;
+    case 8:
+        return transpose8x8_scalar<8>;
+    default:
+        return nullptr;
+    }
+}
+[[nodiscard]] inline reverse_pixels_fn_t reverse_pixels(const size_t bpp) {
+    switch (bpp) {
+    case 1: {
+#if UTILS_ARCH_X86
+        static const auto fn = cpu_select<reverse_pixels_fn_t>(
+            reverse_pixels_scalar<1>, reverse_gray_sse);
+        return fn;
+#else
+        return reverse_pixels_scalar<1>;
+#endif
+    }
+    case 3: {
+#if UTILS_ARCH_X86
+        static const auto fn = cpu_select<reverse_pixels_fn_t>(
+            reverse_pixels_scalar<3>, reverse_rgb_sse);
+        return fn;
+#else
+        return reverse_pixels_scalar<3>;
+#endif
+    }
+    case 4: {
+#if UTILS_ARCH_X86
+        static const auto fn = cpu_select<reverse_pixels_fn_t>(
+            reverse_pixels_scalar<4>, reverse_rgba_sse, reverse_rgba_avx2);
+        return fn;
+#else
+        return reverse_pixels_scalar<4>;
+#endif
+    }
+    // 16 bit formats
+    case 2:
+        return reverse_pixels_scalar<2>;
+    case 6:
+        return reverse_pixels_scalar<6>;
+    case 8:
+        return reverse_pixels_scalar<8>;
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace kernels
+} // namespace utils
+
+#endif